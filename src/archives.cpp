@@ -4,10 +4,22 @@
 #include <minizip/unzip.h>
 
 #include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "content_hash.h"
+#include "file_copy.h"
+#include "parallel.h"
+
 namespace ioq3_map {
 
 std::vector<std::filesystem::path> ListArchives(
@@ -31,10 +43,320 @@ std::vector<std::filesystem::path> ListArchives(
   return archives;
 }
 
+namespace {
+
+// Returns the path of `path` relative to the mount point, in the form used by
+// the zip central directory ("maps/q3dm1.bsp").
+std::string ToArchiveKey(const std::filesystem::path& mount_point,
+                         const std::filesystem::path& path) {
+  std::filesystem::path relative = path.lexically_relative(mount_point);
+  if (relative.empty() || *relative.begin() == "..") {
+    // Not rooted at the mount point, treat it as an archive path already.
+    relative = path.lexically_normal();
+  }
+  return relative.generic_string();
+}
+
+// Inflates `entry` of the open archive into `content`, which is resized to
+// the uncompressed size recorded by the central directory.
+bool InflateEntry(unzFile zf, const ArchiveEntry& entry, std::string* content) {
+  unz64_file_pos file_pos;
+  file_pos.pos_in_zip_directory = entry.pos_in_zip_directory;
+  file_pos.num_of_file = entry.num_of_file;
+  if (unzGoToFilePos64(zf, &file_pos) != UNZ_OK ||
+      unzOpenCurrentFile(zf) != UNZ_OK) {
+    LOG(ERROR) << "Could not open entry " << entry.num_of_file;
+    return false;
+  }
+
+  content->resize(entry.uncompressed_size);
+  size_t total = 0;
+  while (total < content->size()) {
+    unsigned chunk = static_cast<unsigned>(
+        std::min<size_t>(content->size() - total, 1u << 30));
+    int read_bytes = unzReadCurrentFile(zf, content->data() + total, chunk);
+    if (read_bytes <= 0) {
+      break;
+    }
+    total += read_bytes;
+  }
+
+  // Closing the entry verifies the CRC once it has been fully read.
+  bool crc_ok = unzCloseCurrentFile(zf) == UNZ_OK;
+  if (total != content->size() || !crc_ok) {
+    LOG(ERROR) << "Failed to inflate entry " << entry.num_of_file;
+    return false;
+  }
+  return true;
+}
+
+// Entries of one archive that are extracted together by a single worker.
+struct ExtractionBatch {
+  size_t archive = 0;
+  std::vector<const ArchiveIndex::value_type*> entries;
+};
+
+constexpr size_t kExtractionBatchSize = 64;
+
+// Inflates the entries on a pool of workers and hands each one to `write`
+// together with its name. Returns the number of entries that failed.
+size_t ExtractEntries(
+    const ArchiveIndex& index,
+    const std::vector<const ArchiveIndex::value_type*>& entries,
+    const std::function<bool(const std::string& name,
+                             const ArchiveEntry& entry,
+                             const std::string& content)>& write,
+    int num_threads) {
+  // Group the entries per archive, in central directory order, so that every
+  // worker reads a single archive front to back.
+  std::vector<std::vector<const ArchiveIndex::value_type*>> per_archive(
+      index.archives.size());
+  for (const auto* entry : entries) {
+    per_archive[entry->second.archive].push_back(entry);
+  }
+
+  std::vector<ExtractionBatch> batches;
+  for (size_t a = 0; a < per_archive.size(); ++a) {
+    auto& archive_entries = per_archive[a];
+    std::sort(archive_entries.begin(), archive_entries.end(),
+              [](const auto* l, const auto* r) {
+                return l->second.num_of_file < r->second.num_of_file;
+              });
+    for (size_t i = 0; i < archive_entries.size(); i += kExtractionBatchSize) {
+      ExtractionBatch batch;
+      batch.archive = a;
+      batch.entries.assign(
+          archive_entries.begin() + i,
+          archive_entries.begin() +
+              std::min(i + kExtractionBatchSize, archive_entries.size()));
+      batches.push_back(std::move(batch));
+    }
+  }
+
+  std::atomic<size_t> num_failed{0};
+  std::atomic<uint64_t> num_bytes{0};
+  ParallelFor(batches.size(), num_threads, [&](size_t b) {
+    const ExtractionBatch& batch = batches[b];
+    const std::filesystem::path& archive = index.archives[batch.archive];
+    unzFile zf = unzOpen64(archive.string().c_str());
+    if (!zf) {
+      LOG(WARNING) << "Failed to open archive: " << archive;
+      num_failed += batch.entries.size();
+      return;
+    }
+
+    // Sized by the central directory, so every entry is inflated in one go.
+    std::string buffer;
+    for (const auto* entry : batch.entries) {
+      const auto& [name, archive_entry] = *entry;
+      if (!InflateEntry(zf, archive_entry, &buffer) ||
+          !write(name, archive_entry, buffer)) {
+        LOG(ERROR) << "Failed to extract " << name << " from " << archive;
+        ++num_failed;
+        continue;
+      }
+      num_bytes += buffer.size();
+    }
+
+    unzClose(zf);
+  });
+
+  LOG(INFO) << "Extracted " << entries.size() - num_failed << " files ("
+            << num_bytes / (1024 * 1024) << " MB) using "
+            << std::min<size_t>(ResolveThreadCount(num_threads),
+                                batches.size())
+            << " threads.";
+  return num_failed;
+}
+
+// --- Extraction cache ---
+
+constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ull;
+constexpr uint64_t kFnvPrime = 0x100000001b3ull;
+
+uint64_t Fnv1a(const void* data, size_t size, uint64_t hash) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+template <typename T>
+uint64_t Fnv1a(const T& value, uint64_t hash) {
+  return Fnv1a(&value, sizeof(value), hash);
+}
+
+std::string ToHex(uint64_t value, int width) {
+  char text[17];
+  snprintf(text, sizeof(text), "%0*llx", width,
+           static_cast<unsigned long long>(value));
+  return text;
+}
+
+// Identifies an archive by its path, size and modification time. Paths and
+// fields are separated by NULs, which paths cannot contain.
+std::optional<std::string> ArchiveIdentity(
+    const std::filesystem::path& archive) {
+  std::error_code ec;
+  const uintmax_t size = std::filesystem::file_size(archive, ec);
+  if (ec) {
+    return std::nullopt;
+  }
+  const auto mtime =
+      std::filesystem::last_write_time(archive, ec).time_since_epoch();
+  if (ec) {
+    return std::nullopt;
+  }
+  std::string identity = std::filesystem::absolute(archive).string();
+  identity += '\0';
+  identity += std::to_string(size);
+  identity += '\0';
+  identity += std::to_string(mtime.count());
+  return identity;
+}
+
+// Cached contents are named by their XXH64 and size, computed from the
+// inflated bytes, so identical files of different archives share an object.
+std::string ObjectName(std::string_view content) {
+  return ContentHashString(HashContent(content)) + "-" +
+         ToHex(content.size(), 1);
+}
+
+// An entry of an archive is known by the identity of the archive and its
+// name, which cannot contain NULs either: unchanged archives find their
+// contents without inflating them. The entry file is a link to the object.
+std::string EntryName(const std::string& archive_identity,
+                      const std::string& name, const ArchiveEntry& entry) {
+  std::string key = archive_identity;
+  key += '\0';
+  key += name;
+  key += '\0';
+  key += ToHex(entry.crc, 8) + "-" + ToHex(entry.uncompressed_size, 1);
+  return ContentHashString(HashContent(key));
+}
+
+// Identifies the mounted tree: the identity of every archive (see
+// ArchiveIdentity) and the CRCs of the files they provide.
+std::string MountKey(const ArchiveIndex& index,
+                     const std::vector<std::string>& archive_identities) {
+  uint64_t hash = kFnvOffsetBasis;
+  for (const std::string& identity : archive_identities) {
+    hash = Fnv1a(identity.data(), identity.size(), hash);
+  }
+
+  std::vector<const ArchiveIndex::value_type*> entries;
+  entries.reserve(index.entries.size());
+  for (const auto& entry : index.entries) {
+    entries.push_back(&entry);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const auto* l, const auto* r) { return l->first < r->first; });
+  for (const auto* entry : entries) {
+    hash = Fnv1a(entry->first.data(), entry->first.size(), hash);
+    hash = Fnv1a(entry->second.archive, hash);
+    hash = Fnv1a(entry->second.crc, hash);
+    hash = Fnv1a(entry->second.uncompressed_size, hash);
+  }
+  return ToHex(hash, 16);
+}
+
+}  // namespace
+
+std::optional<ArchiveIndex> BuildArchiveIndex(
+    const std::vector<std::filesystem::path>& archives) {
+  if (archives.empty()) {
+    return std::nullopt;
+  }
+
+  ArchiveIndex index;
+  index.archives = archives;
+
+  // Archives are visited in load order so that entries of later archives
+  // replace the ones of earlier archives (Q3: pak0 < pak1 < ... < z_pak).
+  for (size_t a = 0; a < archives.size(); ++a) {
+    unzFile zf = unzOpen64(archives[a].string().c_str());
+    if (!zf) {
+      LOG(WARNING) << "Failed to open archive: " << archives[a];
+      continue;
+    }
+
+    if (unzGoToFirstFile(zf) == UNZ_OK) {
+      do {
+        char filename_inzip[256];
+        unz_file_info64 file_info;
+        unz64_file_pos file_pos;
+        if (unzGetCurrentFileInfo64(zf, &file_info, filename_inzip,
+                                    sizeof(filename_inzip), NULL, 0, NULL,
+                                    0) != UNZ_OK ||
+            unzGetFilePos64(zf, &file_pos) != UNZ_OK) {
+          LOG(ERROR) << "Could not get file info in " << archives[a];
+          continue;
+        }
+
+        std::string filename(filename_inzip);
+        if (filename.empty() || filename.back() == '/' ||
+            filename.back() == '\\') {
+          continue;  // Directories are implied by the file paths.
+        }
+
+        ArchiveEntry entry;
+        entry.archive = a;
+        entry.pos_in_zip_directory = file_pos.pos_in_zip_directory;
+        entry.num_of_file = file_pos.num_of_file;
+        entry.compressed_size = file_info.compressed_size;
+        entry.uncompressed_size = file_info.uncompressed_size;
+        entry.compression_method =
+            static_cast<int>(file_info.compression_method);
+        entry.crc = static_cast<uint32_t>(file_info.crc);
+        index.entries.insert_or_assign(std::move(filename), entry);
+      } while (unzGoToNextFile(zf) == UNZ_OK);
+    }
+
+    unzClose(zf);
+  }
+
+  return index;
+}
+
+std::optional<std::string> ReadArchiveEntry(const ArchiveIndex& index,
+                                            const ArchiveEntry& entry) {
+  if (entry.archive >= index.archives.size()) {
+    LOG(ERROR) << "Invalid archive index: " << entry.archive;
+    return std::nullopt;
+  }
+  const std::filesystem::path& archive = index.archives[entry.archive];
+
+  // A handle is opened per read: it only reads the end of central directory
+  // record, and it keeps concurrent reads independent of each other.
+  unzFile zf = unzOpen64(archive.string().c_str());
+  if (!zf) {
+    LOG(ERROR) << "Failed to open archive: " << archive;
+    return std::nullopt;
+  }
+
+  std::string content;
+  bool ok = InflateEntry(zf, entry, &content);
+  unzClose(zf);
+  if (!ok) {
+    LOG(ERROR) << "Failed to read entry from " << archive;
+    return std::nullopt;
+  }
+  return content;
+}
+
 VirtualFilesystem::VirtualFilesystem(std::filesystem::path mount)
     : mount_point(std::move(mount)) {}
 
+VirtualFilesystem::VirtualFilesystem(std::filesystem::path mount,
+                                     ArchiveIndex archive_index)
+    : mount_point(std::move(mount)), index(std::move(archive_index)) {}
+
 VirtualFilesystem::~VirtualFilesystem() {
+  if (in_memory || !owns_mount_point) {
+    // Nothing was extracted, or the content is shared with later runs.
+    return;
+  }
   if (!mount_point.empty() && std::filesystem::exists(mount_point)) {
     if (mount_point.filename() == "vfs_mount_point") {
       LOG(INFO) << "Cleaning up virtual filesystem at: " << mount_point;
@@ -48,112 +370,236 @@ VirtualFilesystem::~VirtualFilesystem() {
   }
 }
 
-// Helper to extract a single file from zip
-bool ExtractCurrentFile(unzFile zf, const std::filesystem::path& dest_path) {
-  char filename_inzip[256];
-  unz_file_info64 file_info;
+bool VirtualFilesystem::Exists(const std::filesystem::path& path) const {
+  if (index) {
+    return index->entries.count(ToArchiveKey(mount_point, path)) > 0;
+  }
+  return std::filesystem::exists(path);
+}
 
-  if (unzGetCurrentFileInfo64(zf, &file_info, filename_inzip,
-                              sizeof(filename_inzip), NULL, 0, NULL,
-                              0) != UNZ_OK) {
-    LOG(ERROR) << "Could not get file info";
-    return false;
+std::optional<std::string> VirtualFilesystem::ReadFile(
+    const std::filesystem::path& path) const {
+  if (in_memory) {
+    auto it = index->entries.find(ToArchiveKey(mount_point, path));
+    if (it == index->entries.end()) {
+      LOG(ERROR) << "File not found in archives: " << path;
+      return std::nullopt;
+    }
+    return ReadArchiveEntry(*index, it->second);
   }
 
-  // Check if it is a directory (ends with /)
-  std::string filename(filename_inzip);
-  bool is_dir = (!filename.empty() &&
-                 (filename.back() == '/' || filename.back() == '\\'));
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    LOG(ERROR) << "Could not open file: " << path;
+    return std::nullopt;
+  }
+  return std::string((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+}
 
-  std::filesystem::path out_file = dest_path / filename;
+std::optional<uint64_t> VirtualFilesystem::FileSize(
+    const std::filesystem::path& path) const {
+  if (in_memory) {
+    auto it = index->entries.find(ToArchiveKey(mount_point, path));
+    if (it == index->entries.end()) {
+      LOG(ERROR) << "File not found in archives: " << path;
+      return std::nullopt;
+    }
+    return it->second.uncompressed_size;
+  }
 
-  if (is_dir) {
-    std::filesystem::create_directories(out_file);
-    return true;
+  std::error_code error;
+  const uint64_t size = std::filesystem::file_size(path, error);
+  if (error) {
+    LOG(ERROR) << "Could not stat file: " << path << ". Cause: "
+               << error.message();
+    return std::nullopt;
   }
+  return size;
+}
 
-  // Ensure parent directory exists
-  std::filesystem::create_directories(out_file.parent_path());
+std::vector<std::filesystem::path> VirtualFilesystem::ListFiles(
+    const std::filesystem::path& directory, std::string_view extension) const {
+  std::vector<std::filesystem::path> result;
+  if (index) {
+    std::string prefix = ToArchiveKey(mount_point, directory) + "/";
+    for (const auto& [key, entry] : index->entries) {
+      if (key.starts_with(prefix) &&
+          std::filesystem::path(key).extension() == extension) {
+        result.push_back(mount_point / key);
+      }
+    }
+  } else {
+    std::filesystem::recursive_directory_iterator dir_it;
+    try {
+      dir_it = std::filesystem::recursive_directory_iterator(directory);
+    } catch (const std::filesystem::filesystem_error& e) {
+      LOG(ERROR) << "Failed to list " << directory << ": " << e.what();
+      return result;
+    }
+    for (const auto& dir_entry : dir_it) {
+      if (dir_entry.is_regular_file() &&
+          dir_entry.path().extension() == extension) {
+        result.push_back(dir_entry.path());
+      }
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
 
-  if (unzOpenCurrentFile(zf) != UNZ_OK) {
-    LOG(ERROR) << "Could not open file in zip: " << filename;
-    return false;
+std::optional<VirtualFilesystem> BuildVirtualFilesystem(
+    const std::vector<std::filesystem::path>& archives, int num_threads) {
+  // Collisions are resolved up front by the merged central directories: every
+  // path is extracted exactly once, from the highest-priority archive that
+  // provides it (Q3: pak0 < pak1 < ... < z_pak).
+  auto index = BuildArchiveIndex(archives);
+  if (!index) {
+    return std::nullopt;
   }
 
-  // If file exists, do not overwrite (as per specs: "When colliding file names,
-  // do not overwrite. Skip the file.") Wait, the specification says: "When
-  // colliding file names, do not overwrite. Skip the file." But usually in Q3,
-  // later PK3s overwrite earlier ones? Let's re-read the specs in GEMINI.md or
-  // USER RULES. "Write a function to unzip all pk3 files into a temporary
-  // directory. When colliding file names, do not overwrite. Skip the file.
-  // Return the set of files." AND "List all the pk3 files in the base path in
-  // alphabetical order." So if pak0.pk3 has "A", and pak1.pk3 has "A", we unzip
-  // pak0 first, write "A". Then unzipping pak1, we find "A" exists, so we SKIP.
-  // This effectively means "First loaded wins"?
-  // Quake 3 logic is usually "Last loaded wins" (overwrite).
-  // Let's check the Phase 1 instructions again in GEMINI.md.
-  // "When colliding file names, do not overwrite. Skip the file."
-  // This implies First Wins if we process in order.
-  // Maybe the user wants "First wins"? Or maybe they implied "Do not overwrite"
-  // means "If I already extracted it from a previous (lower priority) archive,
-  // keep it"? But Q3 loads pak0, then pak1, pak1 overwrites pak0. So if we
-  // iterate ListArchives (pak0, pak1...), and we want pak1 to overwrite pak0,
-  // we SHOULD overwrite. OR, maybe we iterate in REVERSE order and then "Do not
-  // overwrite" makes sense (Last packed wins = First extracted wins). The
-  // instructions say: "List all the pk3 files in the base path in alphabetical
-  // order." (pak0, pak1...) Then "Unzip all pk3 files... When colliding... do
-  // not overwrite". If I do that: pak0 writes "texture.jpg". pak1 has
-  // "texture.jpg" but I skip it. Result: "texture.jpg" is from pak0. Real Q3:
-  // pak1 overwrites pak0. "texture.jpg" is from pak1. So "Do not overwrite" +
-  // "Alphabetical Order" = "Inverse Q3 Priority". This seems wrong for a map
-  // exporter. HOWEVER, I must follow the user's explicit instruction: "When
-  // colliding file names, do not overwrite." Unless... I should reverse the
-  // list? "Implement a function to list all the pk3 files in the base path in
-  // alphabetical order." "Write a function to unzip all pk3 files..." If I
-  // follow literally, I get inverse priority. USE JUDGEMENT. The user likely
-  // wants correct Q3 behavior. Correct Q3 behavior is: later archives override
-  // earlier ones. So if I have pak0...pak8. pak8 is highest priority. If I
-  // iterate 0..8 and "no overwrite", I get pak0 data. If I iterate 8..0 and "no
-  // overwrite", I get pak8 data. The instruction "List... in alphabetical
-  // order" implies the return of ListPk3Files is A->Z. The instruction "Unzip
-  // all pk3 files..." implies using that list. Maybe I should iterate in
-  // reverse? Or maybe the user *wants* "Do not overwrite" means "Overwrite if
-  // newer"? No "Do not overwrite" means don't. I will iterate in REVERSE order
-  // so that high priority files (z_pak) are extracted first, and then lower
-  // priority ones don't overwrite them. This satisfies "Do not overwrite" and
-  // "Correct Q3 Priority".
-
-  if (std::filesystem::exists(out_file)) {
-    unzCloseCurrentFile(zf);
-    return true;  // Skip
-  }
-
-  FILE* fout = fopen(out_file.string().c_str(), "wb");
-  if (!fout) {
-    LOG(ERROR) << "Could not open output file: " << out_file;
-    unzCloseCurrentFile(zf);
-    return false;
+  // Create mount point
+  std::filesystem::path mount_point =
+      std::filesystem::current_path() / "vfs_mount_point";
+  if (std::filesystem::exists(mount_point)) {
+    std::filesystem::remove_all(mount_point);
   }
+  std::filesystem::create_directories(mount_point);
 
-  std::vector<char> buffer(4096);
-  int read_bytes;
-  while ((read_bytes = unzReadCurrentFile(zf, buffer.data(), buffer.size())) >
-         0) {
-    fwrite(buffer.data(), 1, read_bytes, fout);
+  // The directory tree is created before the workers start.
+  std::vector<const ArchiveIndex::value_type*> entries;
+  entries.reserve(index->entries.size());
+  std::set<std::filesystem::path> directories;
+  for (const auto& entry : index->entries) {
+    entries.push_back(&entry);
+    directories.insert((mount_point / entry.first).parent_path());
+  }
+  for (const auto& directory : directories) {
+    std::filesystem::create_directories(directory);
   }
 
-  fclose(fout);
-  unzCloseCurrentFile(zf);
-  return true;
+  ExtractEntries(
+      *index, entries,
+      [&mount_point](const std::string& name, const ArchiveEntry& entry,
+                     const std::string& content) {
+        return WriteFile(mount_point / name, content);
+      },
+      num_threads);
+  return VirtualFilesystem(mount_point);
 }
 
-std::optional<VirtualFilesystem> BuildVirtualFilesystem(
+std::optional<VirtualFilesystem> BuildCachedVirtualFilesystem(
+    const std::vector<std::filesystem::path>& archives,
+    const std::filesystem::path& cache_dir, int num_threads) {
+  auto index = BuildArchiveIndex(archives);
+  if (!index) {
+    return std::nullopt;
+  }
+  std::vector<std::string> archive_identities;
+  archive_identities.reserve(index->archives.size());
+  for (const auto& archive : index->archives) {
+    std::optional<std::string> identity = ArchiveIdentity(archive);
+    if (!identity) {
+      LOG(ERROR) << "Failed to stat the archive " << archive;
+      return std::nullopt;
+    }
+    archive_identities.push_back(std::move(*identity));
+  }
+  const std::string mount_key = MountKey(*index, archive_identities);
+
+  const std::filesystem::path objects_dir = cache_dir / "objects";
+  const std::filesystem::path entries_dir = cache_dir / "entries";
+  const std::filesystem::path mount_point = cache_dir / "mounts" / mount_key;
+  std::error_code ec;
+  if (std::filesystem::is_directory(mount_point, ec)) {
+    // Mount trees only appear once complete, see below.
+    LOG(INFO) << "Reusing cached virtual filesystem at: " << mount_point;
+    VirtualFilesystem vfs(mount_point);
+    vfs.owns_mount_point = false;
+    return vfs;
+  }
+  std::filesystem::create_directories(objects_dir);
+  std::filesystem::create_directories(entries_dir);
+  std::filesystem::create_directories(mount_point.parent_path());
+
+  auto entry_path = [&](const std::string& name, const ArchiveEntry& entry) {
+    return entries_dir /
+           EntryName(archive_identities[entry.archive], name, entry);
+  };
+
+  // Only inflate the entries that are not cached yet: those of changed
+  // archives. Their contents are stored once, whichever archives provide
+  // them.
+  std::vector<const ArchiveIndex::value_type*> missing;
+  for (const auto& entry : index->entries) {
+    if (!std::filesystem::exists(entry_path(entry.first, entry.second))) {
+      missing.push_back(&entry);
+    }
+  }
+  LOG(INFO) << "Extraction cache: " << index->entries.size() - missing.size()
+            << " files cached, " << missing.size() << " to extract.";
+  size_t num_failed = ExtractEntries(
+      *index, missing,
+      [&](const std::string& name, const ArchiveEntry& entry,
+          const std::string& content) {
+        const std::filesystem::path object = objects_dir / ObjectName(content);
+        if (!std::filesystem::exists(object) &&
+            !WriteFileAtomically(object, content)) {
+          return false;
+        }
+        return CopyFileAtomically(object, entry_path(name, entry))
+            .has_value();
+      },
+      num_threads);
+  if (num_failed > 0) {
+    LOG(ERROR) << "Failed to extract " << num_failed << " files.";
+    return std::nullopt;
+  }
+
+  // Assemble the tree under a private name, then publish it with an atomic
+  // rename so that concurrent exporters never see a partial tree.
+  std::filesystem::path staging = mount_point;
+  staging += UniqueTemporarySuffix();
+  for (const auto& [name, entry] : index->entries) {
+    const std::filesystem::path target = staging / name;
+    const std::filesystem::path object = entry_path(name, entry);
+    std::filesystem::create_directories(target.parent_path());
+    std::filesystem::create_hard_link(object, target, ec);
+    if (ec) {
+      // Hard links are not supported everywhere, fall back to a copy.
+      std::filesystem::copy_file(object, target, ec);
+    }
+    if (ec) {
+      LOG(ERROR) << "Failed to link " << object << " to " << target << ": "
+                 << ec.message();
+      std::filesystem::remove_all(staging, ec);
+      return std::nullopt;
+    }
+  }
+
+  std::filesystem::rename(staging, mount_point, ec);
+  if (ec) {
+    // Another exporter published the same tree first.
+    std::filesystem::remove_all(staging, ec);
+    if (!std::filesystem::is_directory(mount_point, ec)) {
+      LOG(ERROR) << "Failed to publish the cached mount point " << mount_point;
+      return std::nullopt;
+    }
+  }
+
+  LOG(INFO) << "Cached virtual filesystem at: " << mount_point;
+  VirtualFilesystem vfs(mount_point);
+  vfs.owns_mount_point = false;
+  return vfs;
+}
+
+std::optional<VirtualFilesystem> BuildSelectiveVirtualFilesystem(
     const std::vector<std::filesystem::path>& archives) {
-  if (archives.empty()) {
+  auto index = BuildArchiveIndex(archives);
+  if (!index) {
     return std::nullopt;
   }
 
-  // Create mount point
   std::filesystem::path mount_point =
       std::filesystem::current_path() / "vfs_mount_point";
   if (std::filesystem::exists(mount_point)) {
@@ -161,28 +607,72 @@ std::optional<VirtualFilesystem> BuildVirtualFilesystem(
   }
   std::filesystem::create_directories(mount_point);
 
-  // Iterate in REVERSE order to respect Q3 priority with "no overwrite" logic
-  // Q3: pak0 < pak1 < ... < z_pak
-  // We want z_pak content to win.
-  // So we extract z_pak first. Then pak[n-1]... if file exists (from z_pak), we
-  // skip. This results in z_pak version being kept.
-  for (auto it = archives.rbegin(); it != archives.rend(); ++it) {
-    unzFile zf = unzOpen64(it->string().c_str());
-    if (!zf) {
-      LOG(WARNING) << "Failed to open archive: " << *it;
+  LOG(INFO) << "Indexed " << index->entries.size() << " files from "
+            << archives.size() << " archives.";
+  return VirtualFilesystem(mount_point, std::move(*index));
+}
+
+bool ExtractFiles(const VirtualFilesystem& vfs,
+                  const std::vector<std::filesystem::path>& paths,
+                  int num_threads) {
+  if (!vfs.index || vfs.in_memory) {
+    LOG(ERROR) << "ExtractFiles requires a selective virtual filesystem.";
+    return false;
+  }
+
+  bool ok = true;
+  std::set<std::string> keys;
+  std::vector<const ArchiveIndex::value_type*> entries;
+  for (const auto& path : paths) {
+    std::string key = ToArchiveKey(vfs.mount_point, path);
+    auto it = vfs.index->entries.find(key);
+    if (it == vfs.index->entries.end()) {
+      LOG(ERROR) << "File not found in archives: " << path;
+      ok = false;
       continue;
     }
-
-    if (unzGoToFirstFile(zf) == UNZ_OK) {
-      do {
-        ExtractCurrentFile(zf, mount_point);
-      } while (unzGoToNextFile(zf) == UNZ_OK);
+    if (!keys.insert(std::move(key)).second ||
+        std::filesystem::exists(vfs.mount_point / it->first)) {
+      continue;
     }
+    entries.push_back(&*it);
+    std::filesystem::create_directories(
+        (vfs.mount_point / it->first).parent_path());
+  }
 
-    unzClose(zf);
+  size_t num_failed = ExtractEntries(
+      *vfs.index, entries,
+      [&vfs](const std::string& name, const ArchiveEntry& entry,
+             const std::string& content) {
+        return WriteFile(vfs.mount_point / name, content);
+      },
+      num_threads);
+
+  uint64_t extracted_bytes = 0;
+  for (const auto* entry : entries) {
+    extracted_bytes += entry->second.uncompressed_size;
+  }
+  uint64_t total_bytes = 0;
+  for (const auto& [name, entry] : vfs.index->entries) {
+    total_bytes += entry.uncompressed_size;
   }
+  LOG(INFO) << "Selective extraction: " << extracted_bytes / 1024 << " KB of "
+            << total_bytes / 1024 << " KB in the archives.";
+  return ok && num_failed == 0;
+}
 
-  return VirtualFilesystem(mount_point);
+std::optional<VirtualFilesystem> BuildInMemoryVirtualFilesystem(
+    const std::vector<std::filesystem::path>& archives) {
+  auto index = BuildArchiveIndex(archives);
+  if (!index) {
+    return std::nullopt;
+  }
+  LOG(INFO) << "Indexed " << index->entries.size() << " files from "
+            << archives.size() << " archives.";
+  VirtualFilesystem vfs(std::filesystem::current_path() / "vfs_mount_point",
+                        std::move(*index));
+  vfs.in_memory = true;
+  return vfs;
 }
 
 }  // namespace ioq3_map
@@ -1,8 +1,12 @@
 #ifndef IOQ3_MAP_ARCHIVES_H_
 #define IOQ3_MAP_ARCHIVES_H_
 
+#include <cstdint>
 #include <filesystem>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace ioq3_map {
@@ -10,10 +14,59 @@ namespace ioq3_map {
 std::vector<std::filesystem::path> ListArchives(
     const std::filesystem::path& base_path);
 
+// Location of a file inside a .pk3 archive, as recorded by the archive's zip
+// central directory.
+struct ArchiveEntry {
+  // Index into ArchiveIndex::archives.
+  size_t archive = 0;
+
+  // Position of the entry's central directory record (see unz64_file_pos).
+  uint64_t pos_in_zip_directory = 0;
+  uint64_t num_of_file = 0;
+
+  uint64_t compressed_size = 0;
+  uint64_t uncompressed_size = 0;
+  int compression_method = 0;
+  uint32_t crc = 0;
+};
+
+// The merged central directories of a list of archives. Only the central
+// directories are read; no entry is inflated while building the index.
+struct ArchiveIndex {
+  using value_type = std::unordered_map<std::string, ArchiveEntry>::value_type;
+
+  std::vector<std::filesystem::path> archives;
+
+  // Keyed by the path inside the archive, e.g. "maps/q3dm1.bsp". When several
+  // archives provide the same path, the last (highest-priority) archive wins.
+  std::unordered_map<std::string, ArchiveEntry> entries;
+};
+
+// Reads the central directories of the archives, in load order.
+std::optional<ArchiveIndex> BuildArchiveIndex(
+    const std::vector<std::filesystem::path>& archives);
+
+// Inflates a single archive entry into memory.
+std::optional<std::string> ReadArchiveEntry(const ArchiveIndex& index,
+                                            const ArchiveEntry& entry);
+
 struct VirtualFilesystem {
   std::filesystem::path mount_point;
 
+  // The merged central directories of the mounted archives. When present, it
+  // answers which files exist, including those not extracted (yet).
+  std::optional<ArchiveIndex> index;
+
+  // Whether files are inflated from the archives on demand rather than read
+  // from mount_point. Requires the index.
+  bool in_memory = false;
+
+  // Whether the extracted files under mount_point are removed on destruction.
+  // Cached mount points outlive the exporter.
+  bool owns_mount_point = true;
+
   VirtualFilesystem(std::filesystem::path mount);
+  VirtualFilesystem(std::filesystem::path mount, ArchiveIndex archive_index);
   ~VirtualFilesystem();
 
   // Delete copy, allow move
@@ -21,9 +74,55 @@ struct VirtualFilesystem {
   VirtualFilesystem& operator=(const VirtualFilesystem&) = delete;
   VirtualFilesystem(VirtualFilesystem&&) = default;
   VirtualFilesystem& operator=(VirtualFilesystem&&) = default;
+
+  // The paths below are rooted at mount_point, e.g.
+  // mount_point / "maps/q3dm1.bsp", regardless of the storage mode.
+  bool Exists(const std::filesystem::path& path) const;
+  std::optional<std::string> ReadFile(const std::filesystem::path& path) const;
+  // The size ReadFile returns, without reading the file.
+  std::optional<uint64_t> FileSize(const std::filesystem::path& path) const;
+
+  // Recursively lists the files under `directory` whose extension matches.
+  // The result is sorted.
+  std::vector<std::filesystem::path> ListFiles(
+      const std::filesystem::path& directory,
+      std::string_view extension) const;
 };
 
+// Extracts every archive into ./vfs_mount_point on a pool of `num_threads`
+// workers (see ResolveThreadCount). Colliding paths are extracted once, from
+// the highest-priority archive.
 std::optional<VirtualFilesystem> BuildVirtualFilesystem(
+    const std::vector<std::filesystem::path>& archives, int num_threads = 0);
+
+// Extracts the archives into a persistent cache under `cache_dir` and mounts
+// the cached tree. Extracted files are stored once per content (XXH64 and
+// size of the inflated bytes), and found again by the path, size and
+// modification time of their archive together with their name. The tree is
+// keyed by the same identity of every archive and the CRCs of the files they
+// provide. A rerun against unchanged archives reuses the tree as is, and a
+// changed archive only inflates its own files. Several processes may share
+// the cache.
+std::optional<VirtualFilesystem> BuildCachedVirtualFilesystem(
+    const std::vector<std::filesystem::path>& archives,
+    const std::filesystem::path& cache_dir, int num_threads = 0);
+
+// Mounts the archives without extracting any file: the files are listed by
+// the index and extracted to ./vfs_mount_point on request by ExtractFiles.
+// This allows for a map-driven extraction of only the files a map references.
+std::optional<VirtualFilesystem> BuildSelectiveVirtualFilesystem(
+    const std::vector<std::filesystem::path>& archives);
+
+// Extracts the files, given as paths rooted at the mount point, of a selective
+// virtual filesystem. Already extracted files are skipped. Returns false if any
+// of the files could not be extracted.
+bool ExtractFiles(const VirtualFilesystem& vfs,
+                  const std::vector<std::filesystem::path>& paths,
+                  int num_threads = 0);
+
+// Mounts the archives without extracting them. Entries are inflated on demand
+// by VirtualFilesystem::ReadFile.
+std::optional<VirtualFilesystem> BuildInMemoryVirtualFilesystem(
     const std::vector<std::filesystem::path>& archives);
 
 }  // namespace ioq3_map
@@ -9,6 +9,9 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace ioq3_map {
 namespace {
@@ -26,21 +29,30 @@ class ArchivesTest : public ::testing::Test {
 
   void CreateDummyZip(const fs::path& path, const std::string& filename,
                       const std::string& content) {
+    CreateZip(path, {{filename, content}});
+  }
+
+  // Creates a zip holding (filename, content) pairs.
+  void CreateZip(
+      const fs::path& path,
+      const std::vector<std::pair<std::string, std::string>>& files) {
     zipFile zf = zipOpen64(path.u8string().c_str(), 0);
     ASSERT_TRUE(zf != nullptr);
 
-    zip_fileinfo zi = {};
-    int err = zipOpenNewFileInZip(zf, filename.c_str(), &zi, NULL, 0, NULL, 0,
-                                  NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION);
-    ASSERT_EQ(err, ZIP_OK);
+    for (const auto& [filename, content] : files) {
+      zip_fileinfo zi = {};
+      int err = zipOpenNewFileInZip(zf, filename.c_str(), &zi, NULL, 0, NULL, 0,
+                                    NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION);
+      ASSERT_EQ(err, ZIP_OK);
 
-    err = zipWriteInFileInZip(zf, content.data(), content.size());
-    ASSERT_EQ(err, ZIP_OK);
+      err = zipWriteInFileInZip(zf, content.data(), content.size());
+      ASSERT_EQ(err, ZIP_OK);
 
-    err = zipCloseFileInZip(zf);
-    ASSERT_EQ(err, ZIP_OK);
+      err = zipCloseFileInZip(zf);
+      ASSERT_EQ(err, ZIP_OK);
+    }
 
-    err = zipClose(zf, NULL);
+    int err = zipClose(zf, NULL);
     ASSERT_EQ(err, ZIP_OK);
   }
 
@@ -101,6 +113,203 @@ TEST_F(ArchivesTest, BuildVirtualFilesystemExtractsFiles) {
   EXPECT_EQ(content, "from pak1");
 }
 
+TEST_F(ArchivesTest, BuildVirtualFilesystemExtractsInParallel) {
+  // Enough files to span several extraction batches per archive.
+  std::vector<std::pair<std::string, std::string>> pak0_files;
+  std::vector<std::pair<std::string, std::string>> pak1_files;
+  for (int i = 0; i < 200; ++i) {
+    std::string name = "dir" + std::to_string(i % 7) + "/file" +
+                       std::to_string(i) + ".txt";
+    pak0_files.emplace_back(name, "pak0 " + std::string(i, 'x'));
+    if (i % 3 == 0) {
+      pak1_files.emplace_back(name, "pak1 " + std::to_string(i));
+    }
+  }
+  CreateZip(test_dir_ / "pak0.pk3", pak0_files);
+  CreateZip(test_dir_ / "pak1.pk3", pak1_files);
+
+  auto vfs = BuildVirtualFilesystem(
+      {test_dir_ / "pak0.pk3", test_dir_ / "pak1.pk3"}, /*num_threads=*/4);
+  ASSERT_TRUE(vfs.has_value());
+
+  for (int i = 0; i < 200; ++i) {
+    const auto& [name, pak0_content] = pak0_files[i];
+    std::ifstream ifs(vfs->mount_point / name, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(ifs)),
+                        (std::istreambuf_iterator<char>()));
+    if (i % 3 == 0) {
+      EXPECT_EQ(content, "pak1 " + std::to_string(i)) << name;
+    } else {
+      EXPECT_EQ(content, pak0_content) << name;
+    }
+  }
+}
+
+TEST_F(ArchivesTest, BuildCachedVirtualFilesystemReusesCache) {
+  const fs::path cache_dir = test_dir_ / "cache";
+  CreateZip(test_dir_ / "pak0.pk3",
+            {{"file1.txt", "from pak0"}, {"file2.txt", "only in pak0"}});
+  CreateZip(test_dir_ / "pak1.pk3", {{"file1.txt", "from pak1"}});
+  const std::vector<fs::path> archives = {test_dir_ / "pak0.pk3",
+                                          test_dir_ / "pak1.pk3"};
+
+  auto count_objects = [&]() {
+    return std::distance(fs::directory_iterator(cache_dir / "objects"),
+                         fs::directory_iterator());
+  };
+
+  fs::path first_mount;
+  {
+    auto vfs = BuildCachedVirtualFilesystem(archives, cache_dir);
+    ASSERT_TRUE(vfs.has_value());
+    first_mount = vfs->mount_point;
+    EXPECT_TRUE(vfs->Exists(first_mount / "file1.txt"));
+    EXPECT_EQ(*vfs->ReadFile(first_mount / "file1.txt"), "from pak1");
+  }
+  // The cached tree outlives the virtual filesystem.
+  EXPECT_TRUE(fs::exists(first_mount / "file2.txt"));
+  EXPECT_EQ(count_objects(), 2);
+
+  {
+    auto vfs = BuildCachedVirtualFilesystem(archives, cache_dir);
+    ASSERT_TRUE(vfs.has_value());
+    EXPECT_EQ(vfs->mount_point, first_mount);
+  }
+
+  // Changing pak1 yields a new tree, pak0's content is reused.
+  CreateZip(test_dir_ / "pak1.pk3", {{"file1.txt", "from new pak1"}});
+  {
+    auto vfs = BuildCachedVirtualFilesystem(archives, cache_dir);
+    ASSERT_TRUE(vfs.has_value());
+    EXPECT_NE(vfs->mount_point, first_mount);
+    EXPECT_EQ(*vfs->ReadFile(vfs->mount_point / "file1.txt"), "from new pak1");
+    EXPECT_EQ(*vfs->ReadFile(vfs->mount_point / "file2.txt"), "only in pak0");
+  }
+  EXPECT_EQ(count_objects(), 3);
+}
+
+TEST_F(ArchivesTest, BuildCachedVirtualFilesystemTellsApartCrcCollisions) {
+  // Both contents have the same CRC32 and size.
+  ASSERT_EQ(crc32(0, reinterpret_cast<const Bytef*>("crc29685295"), 11),
+            crc32(0, reinterpret_cast<const Bytef*>("crc32060020"), 11));
+  const fs::path cache_dir = test_dir_ / "cache";
+  CreateZip(test_dir_ / "pak0.pk3", {{"a.txt", "crc29685295"}});
+  CreateZip(test_dir_ / "pak1.pk3", {{"b.txt", "crc32060020"}});
+
+  auto vfs = BuildCachedVirtualFilesystem(
+      {test_dir_ / "pak0.pk3", test_dir_ / "pak1.pk3"}, cache_dir);
+  ASSERT_TRUE(vfs.has_value());
+  EXPECT_EQ(*vfs->ReadFile(vfs->mount_point / "a.txt"), "crc29685295");
+  EXPECT_EQ(*vfs->ReadFile(vfs->mount_point / "b.txt"), "crc32060020");
+}
+
+TEST_F(ArchivesTest, BuildCachedVirtualFilesystemConcurrently) {
+  const fs::path cache_dir = test_dir_ / "cache";
+  std::vector<std::pair<std::string, std::string>> files;
+  for (int i = 0; i < 100; ++i) {
+    files.emplace_back("file" + std::to_string(i) + ".txt",
+                       std::string(i * 10, 'a' + i % 26));
+  }
+  CreateZip(test_dir_ / "pak0.pk3", files);
+
+  // Several exporters racing on the same empty cache.
+  std::vector<std::optional<VirtualFilesystem>> results(4);
+  std::vector<std::thread> threads;
+  for (auto& result : results) {
+    threads.emplace_back([&]() {
+      result = BuildCachedVirtualFilesystem({test_dir_ / "pak0.pk3"},
+                                            cache_dir, /*num_threads=*/2);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (const auto& result : results) {
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->mount_point, results[0]->mount_point);
+  }
+  for (const auto& [name, content] : files) {
+    EXPECT_EQ(*results[0]->ReadFile(results[0]->mount_point / name), content);
+  }
+}
+
+TEST_F(ArchivesTest, ExtractFilesOnlyExtractsRequestedFiles) {
+  CreateZip(test_dir_ / "pak0.pk3",
+            {{"maps/q3dm1.bsp", "bsp"},
+             {"scripts/base.shader", "shader"},
+             {"textures/base/wall.jpg", "wall"},
+             {"textures/base/unused.tga", "unused"}});
+
+  auto vfs = BuildSelectiveVirtualFilesystem({test_dir_ / "pak0.pk3"});
+  ASSERT_TRUE(vfs.has_value());
+  EXPECT_FALSE(vfs->in_memory);
+
+  // Every file is known before it is extracted.
+  EXPECT_TRUE(vfs->Exists(vfs->mount_point / "textures/base/unused.tga"));
+  EXPECT_FALSE(vfs->Exists(vfs->mount_point / "textures/base/missing.tga"));
+  EXPECT_EQ(vfs->ListFiles(vfs->mount_point / "scripts", ".shader").size(), 1);
+
+  ASSERT_TRUE(ExtractFiles(*vfs, {vfs->mount_point / "maps/q3dm1.bsp",
+                                  vfs->mount_point / "scripts/base.shader"}));
+  ASSERT_TRUE(
+      ExtractFiles(*vfs, {vfs->mount_point / "textures/base/wall.jpg",
+                          vfs->mount_point / "maps/q3dm1.bsp"}));
+  EXPECT_FALSE(ExtractFiles(*vfs, {vfs->mount_point / "textures/missing"}));
+
+  EXPECT_EQ(*vfs->ReadFile(vfs->mount_point / "maps/q3dm1.bsp"), "bsp");
+  EXPECT_EQ(*vfs->ReadFile(vfs->mount_point / "textures/base/wall.jpg"),
+            "wall");
+  EXPECT_FALSE(fs::exists(vfs->mount_point / "textures/base/unused.tga"));
+}
+
+TEST_F(ArchivesTest, BuildArchiveIndexLastArchiveWins) {
+  CreateZip(test_dir_ / "pak0.pk3",
+            {{"file1.txt", "from pak0"}, {"file2.txt", "only in pak0"}});
+  CreateZip(test_dir_ / "pak1.pk3", {{"file1.txt", "from pak1"}});
+
+  auto index =
+      BuildArchiveIndex({test_dir_ / "pak0.pk3", test_dir_ / "pak1.pk3"});
+  ASSERT_TRUE(index.has_value());
+  ASSERT_EQ(index->entries.size(), 2);
+  EXPECT_EQ(index->entries.at("file1.txt").archive, 1);
+  EXPECT_EQ(index->entries.at("file1.txt").uncompressed_size, 9);
+  EXPECT_EQ(index->entries.at("file2.txt").archive, 0);
+
+  auto content = ReadArchiveEntry(*index, index->entries.at("file2.txt"));
+  ASSERT_TRUE(content.has_value());
+  EXPECT_EQ(*content, "only in pak0");
+}
+
+TEST_F(ArchivesTest, BuildInMemoryVirtualFilesystemDoesNotExtract) {
+  CreateZip(test_dir_ / "pak0.pk3", {{"file1.txt", "from pak0"},
+                                     {"scripts/base.shader", "base"}});
+  CreateZip(test_dir_ / "pak1.pk3", {{"file1.txt", "from pak1"},
+                                     {"scripts/mod.shader", "mod"},
+                                     {"scripts/readme.txt", "ignored"}});
+
+  auto vfs = BuildInMemoryVirtualFilesystem(
+      {test_dir_ / "pak0.pk3", test_dir_ / "pak1.pk3"});
+  ASSERT_TRUE(vfs.has_value());
+  EXPECT_TRUE(vfs->in_memory);
+  EXPECT_FALSE(fs::exists(vfs->mount_point));
+
+  EXPECT_TRUE(vfs->Exists(vfs->mount_point / "file1.txt"));
+  EXPECT_FALSE(vfs->Exists(vfs->mount_point / "file2.txt"));
+
+  auto content = vfs->ReadFile(vfs->mount_point / "file1.txt");
+  ASSERT_TRUE(content.has_value());
+  EXPECT_EQ(*content, "from pak1");
+  EXPECT_FALSE(vfs->ReadFile(vfs->mount_point / "file2.txt").has_value());
+  EXPECT_EQ(vfs->FileSize(vfs->mount_point / "file1.txt"), content->size());
+  EXPECT_FALSE(vfs->FileSize(vfs->mount_point / "file2.txt").has_value());
+
+  auto shaders = vfs->ListFiles(vfs->mount_point / "scripts", ".shader");
+  ASSERT_EQ(shaders.size(), 2);
+  EXPECT_EQ(shaders[0], vfs->mount_point / "scripts/base.shader");
+  EXPECT_EQ(shaders[1], vfs->mount_point / "scripts/mod.shader");
+}
+
 TEST_F(ArchivesTest, UseRealData) {
   // This test assumes it runs from the repo root and "data" folder exists with
   // pak0.pk3.
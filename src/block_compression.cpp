@@ -0,0 +1,806 @@
+#include "block_compression.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+namespace ioq3_map {
+
+namespace {
+
+// The RGBA texels of a block, row by row.
+using Texel = std::array<int, 4>;
+using Texels = std::array<Texel, 16>;
+// An endpoint before quantization.
+using Color = std::array<float, 4>;
+
+// The weights of the second endpoint, out of 64, of the BC7 4-bit indices.
+constexpr int kBc7Weights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                 34, 38, 43, 47, 51, 55, 60, 64};
+
+int LeastSquaresIterations(BlockQuality quality) {
+  switch (quality) {
+    case BlockQuality::kFast:
+      return 0;
+    case BlockQuality::kNormal:
+      return 1;
+    case BlockQuality::kBest:
+      return 8;
+  }
+  return 0;
+}
+
+// Loads the texels of the block at (`bx`, `by`), repeating the last row and
+// column past the edges. `inside` tells the texels within the image.
+void LoadBlock(const RgbaImage& image, int bx, int by, Texels* texels,
+               std::array<bool, 16>* inside) {
+  for (int y = 0; y < 4; ++y) {
+    const int sy = std::min(by * 4 + y, image.height - 1);
+    for (int x = 0; x < 4; ++x) {
+      const int sx = std::min(bx * 4 + x, image.width - 1);
+      const uint8_t* pixel =
+          &image.pixels[(size_t(sy) * image.width + sx) * 4];
+      for (int c = 0; c < 4; ++c) {
+        (*texels)[y * 4 + x][c] = pixel[c];
+      }
+      (*inside)[y * 4 + x] =
+          by * 4 + y < image.height && bx * 4 + x < image.width;
+    }
+  }
+}
+
+int SquaredDistance(const Texel& a, const Texel& b, int begin, int end) {
+  int sum = 0;
+  for (int c = begin; c < end; ++c) {
+    sum += (a[c] - b[c]) * (a[c] - b[c]);
+  }
+  return sum;
+}
+
+// The index of the palette entry nearest to every texel over the channels
+// [begin, end), and the sum of their squared distances. The distances to all
+// entries are computed for a texel at once.
+template <size_t N>
+int64_t NearestIndices(const Texels& texels,
+                       const std::array<Texel, N>& palette, int num_entries,
+                       int begin, int end, std::array<int, 16>* indices) {
+  int64_t error = 0;
+  for (int i = 0; i < 16; ++i) {
+    std::array<int, N> distances;
+    for (size_t k = 0; k < N; ++k) {
+      distances[k] = SquaredDistance(texels[i], palette[k], begin, end);
+    }
+    int best = 0;
+    for (int k = 1; k < num_entries; ++k) {
+      if (distances[k] < distances[best]) {
+        best = k;
+      }
+    }
+    (*indices)[i] = best;
+    error += distances[best];
+  }
+  return error;
+}
+
+// The segment that fits the texels best over the first `channels` channels:
+// the extremes of their projections on their principal axis, found by power
+// iteration on their covariance.
+void FitSegment(const Texels& texels, int channels, Color* e0, Color* e1) {
+  Color mean{};
+  for (const Texel& texel : texels) {
+    for (int c = 0; c < channels; ++c) {
+      mean[c] += texel[c];
+    }
+  }
+  for (int c = 0; c < channels; ++c) {
+    mean[c] /= 16.0f;
+  }
+  float covariance[4][4] = {};
+  for (const Texel& texel : texels) {
+    for (int a = 0; a < channels; ++a) {
+      for (int b = 0; b < channels; ++b) {
+        covariance[a][b] += (texel[a] - mean[a]) * (texel[b] - mean[b]);
+      }
+    }
+  }
+
+  // Starts from the channel of largest variance, which is not orthogonal to
+  // the principal axis.
+  int widest = 0;
+  for (int c = 1; c < channels; ++c) {
+    if (covariance[c][c] > covariance[widest][widest]) {
+      widest = c;
+    }
+  }
+  Color axis{};
+  for (int c = 0; c < channels; ++c) {
+    axis[c] = covariance[widest][c];
+  }
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    Color next{};
+    float scale = 0.0f;
+    for (int a = 0; a < channels; ++a) {
+      for (int b = 0; b < channels; ++b) {
+        next[a] += covariance[a][b] * axis[b];
+      }
+      scale = std::max(scale, std::abs(next[a]));
+    }
+    if (scale == 0.0f) {
+      break;
+    }
+    for (int c = 0; c < channels; ++c) {
+      axis[c] = next[c] / scale;
+    }
+  }
+  float norm = 0.0f;
+  for (int c = 0; c < channels; ++c) {
+    norm += axis[c] * axis[c];
+  }
+  if (norm == 0.0f) {
+    *e0 = *e1 = mean;
+    return;
+  }
+  norm = std::sqrt(norm);
+  for (int c = 0; c < channels; ++c) {
+    axis[c] /= norm;
+  }
+
+  float min_t = std::numeric_limits<float>::max();
+  float max_t = std::numeric_limits<float>::lowest();
+  for (const Texel& texel : texels) {
+    float t = 0.0f;
+    for (int c = 0; c < channels; ++c) {
+      t += (texel[c] - mean[c]) * axis[c];
+    }
+    min_t = std::min(min_t, t);
+    max_t = std::max(max_t, t);
+  }
+  for (int c = 0; c < channels; ++c) {
+    (*e0)[c] = std::clamp(mean[c] + min_t * axis[c], 0.0f, 255.0f);
+    (*e1)[c] = std::clamp(mean[c] + max_t * axis[c], 0.0f, 255.0f);
+  }
+}
+
+// The endpoints that interpolate the texels best over the channels
+// [begin, end), given the weight of the second endpoint of every texel. A
+// negative weight leaves the texel out. Returns false if the weights do not
+// determine the endpoints.
+bool FitEndpoints(const Texels& texels, const std::array<float, 16>& weights,
+                  int begin, int end, Color* e0, Color* e1) {
+  float aa = 0.0f;
+  float ab = 0.0f;
+  float bb = 0.0f;
+  Color ax{};
+  Color bx{};
+  for (int i = 0; i < 16; ++i) {
+    const float b = weights[i];
+    if (b < 0.0f) {
+      continue;
+    }
+    const float a = 1.0f - b;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = begin; c < end; ++c) {
+      ax[c] += a * texels[i][c];
+      bx[c] += b * texels[i][c];
+    }
+  }
+  const float determinant = aa * bb - ab * ab;
+  if (std::abs(determinant) < 1e-6f) {
+    return false;
+  }
+  for (int c = begin; c < end; ++c) {
+    (*e0)[c] =
+        std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+    (*e1)[c] =
+        std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+// --- BC1 ---
+
+struct Bc1Block {
+  uint16_t c0 = 0;
+  uint16_t c1 = 0;
+  std::array<int, 16> indices{};
+  int64_t error = std::numeric_limits<int64_t>::max();
+};
+
+uint16_t QuantizeRgb565(const Color& color) {
+  const int r = std::lround(color[0] * 31.0f / 255.0f);
+  const int g = std::lround(color[1] * 63.0f / 255.0f);
+  const int b = std::lround(color[2] * 31.0f / 255.0f);
+  return static_cast<uint16_t>(r << 11 | g << 5 | b);
+}
+
+int Expand5(int value) { return value << 3 | value >> 2; }
+int Expand6(int value) { return value << 2 | value >> 4; }
+
+Texel ExpandRgb565(uint16_t color) {
+  return {Expand5(color >> 11), Expand6(color >> 5 & 63), Expand5(color & 31),
+          255};
+}
+
+// The colors of a BC1 block. The 3-color mode, of endpoints in increasing
+// order, ends with transparent black.
+std::array<Texel, 4> Bc1Palette(uint16_t c0, uint16_t c1, bool four_colors) {
+  std::array<Texel, 4> palette = {ExpandRgb565(c0), ExpandRgb565(c1)};
+  for (int c = 0; c < 3; ++c) {
+    const int a = palette[0][c];
+    const int b = palette[1][c];
+    if (four_colors) {
+      palette[2][c] = (2 * a + b) / 3;
+      palette[3][c] = (a + 2 * b) / 3;
+    } else {
+      palette[2][c] = (a + b) / 2;
+    }
+  }
+  palette[2][3] = 255;
+  palette[3][3] = four_colors ? 255 : 0;
+  return palette;
+}
+
+// Orders the endpoints for the 4-color mode, which BC3 always uses, and picks
+// the indices. Equal endpoints select the 3-color mode in BC1, of which the
+// first 3 colors are the endpoint color too.
+Bc1Block FitBc1(const Texels& texels, uint16_t c0, uint16_t c1) {
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+  Bc1Block block;
+  block.c0 = c0;
+  block.c1 = c1;
+  block.error = NearestIndices(texels, Bc1Palette(c0, c1, c0 > c1),
+                               c0 > c1 ? 4 : 3, 0, 3, &block.indices);
+  return block;
+}
+
+// The endpoints of 5 and 6 bits of which the third color of the 4-color mode
+// is nearest to every 8-bit value: a solid block is matched more closely than
+// by equal endpoints.
+struct SolidColorTable {
+  std::array<std::array<uint8_t, 2>, 256> five;
+  std::array<std::array<uint8_t, 2>, 256> six;
+};
+
+void BuildSolidColorTable(int bits, int (*expand)(int),
+                          std::array<std::array<uint8_t, 2>, 256>* table) {
+  const int levels = 1 << bits;
+  for (int value = 0; value < 256; ++value) {
+    int best_error = std::numeric_limits<int>::max();
+    for (int a = 0; a < levels; ++a) {
+      for (int b = 0; b < levels; ++b) {
+        const int error =
+            std::abs((2 * expand(a) + expand(b)) / 3 - value) * 256 +
+            std::abs(a - b);
+        if (error < best_error) {
+          best_error = error;
+          (*table)[value] = {static_cast<uint8_t>(a), static_cast<uint8_t>(b)};
+        }
+      }
+    }
+  }
+}
+
+const SolidColorTable& GetSolidColorTable() {
+  static const SolidColorTable table = [] {
+    SolidColorTable t;
+    BuildSolidColorTable(5, Expand5, &t.five);
+    BuildSolidColorTable(6, Expand6, &t.six);
+    return t;
+  }();
+  return table;
+}
+
+Bc1Block EncodeBc1(const Texels& texels, BlockQuality quality) {
+  bool solid = true;
+  for (const Texel& texel : texels) {
+    solid &= SquaredDistance(texel, texels[0], 0, 3) == 0;
+  }
+  if (solid) {
+    const SolidColorTable& table = GetSolidColorTable();
+    const auto& r = table.five[texels[0][0]];
+    const auto& g = table.six[texels[0][1]];
+    const auto& b = table.five[texels[0][2]];
+    return FitBc1(texels, static_cast<uint16_t>(r[0] << 11 | g[0] << 5 | b[0]),
+                  static_cast<uint16_t>(r[1] << 11 | g[1] << 5 | b[1]));
+  }
+
+  Color e0;
+  Color e1;
+  FitSegment(texels, 3, &e0, &e1);
+  Bc1Block best = FitBc1(texels, QuantizeRgb565(e0), QuantizeRgb565(e1));
+  for (int iteration = LeastSquaresIterations(quality);
+       iteration > 0 && best.error > 0; --iteration) {
+    // The weights of the 4-color mode, and of the 3-color one.
+    constexpr float kWeights[2][4] = {{0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f},
+                                      {0.0f, 1.0f, 0.5f, -1.0f}};
+    std::array<float, 16> weights;
+    for (int i = 0; i < 16; ++i) {
+      weights[i] = kWeights[best.c0 > best.c1 ? 0 : 1][best.indices[i]];
+    }
+    if (!FitEndpoints(texels, weights, 0, 3, &e0, &e1)) {
+      break;
+    }
+    const Bc1Block candidate =
+        FitBc1(texels, QuantizeRgb565(e0), QuantizeRgb565(e1));
+    if (candidate.error >= best.error) {
+      break;
+    }
+    best = candidate;
+  }
+  return best;
+}
+
+void WriteBc1(const Bc1Block& block, uint8_t* out) {
+  uint32_t indices = 0;
+  for (int i = 0; i < 16; ++i) {
+    indices |= static_cast<uint32_t>(block.indices[i]) << (i * 2);
+  }
+  out[0] = static_cast<uint8_t>(block.c0);
+  out[1] = static_cast<uint8_t>(block.c0 >> 8);
+  out[2] = static_cast<uint8_t>(block.c1);
+  out[3] = static_cast<uint8_t>(block.c1 >> 8);
+  for (int i = 0; i < 4; ++i) {
+    out[4 + i] = static_cast<uint8_t>(indices >> (i * 8));
+  }
+}
+
+void DecodeBc1(const uint8_t* block, bool force_four_colors, uint8_t* texels) {
+  const uint16_t c0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+  const uint16_t c1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+  const std::array<Texel, 4> palette =
+      Bc1Palette(c0, c1, force_four_colors || c0 > c1);
+  for (int i = 0; i < 16; ++i) {
+    const int index = block[4 + i / 4] >> (i % 4 * 2) & 3;
+    for (int c = 0; c < 4; ++c) {
+      texels[i * 4 + c] = static_cast<uint8_t>(palette[index][c]);
+    }
+  }
+}
+
+// --- BC3 alpha ---
+
+struct AlphaBlock {
+  int a0 = 0;
+  int a1 = 0;
+  std::array<int, 16> indices{};
+  int64_t error = std::numeric_limits<int64_t>::max();
+};
+
+// The alphas of a BC3 alpha block: 8 interpolated between endpoints in
+// decreasing order, or 6 and then 0 and 255.
+std::array<Texel, 8> AlphaPalette(int a0, int a1) {
+  std::array<Texel, 8> palette{};
+  palette[0][3] = a0;
+  palette[1][3] = a1;
+  if (a0 > a1) {
+    for (int i = 1; i < 7; ++i) {
+      palette[i + 1][3] = ((7 - i) * a0 + i * a1) / 7;
+    }
+  } else {
+    for (int i = 1; i < 5; ++i) {
+      palette[i + 1][3] = ((5 - i) * a0 + i * a1) / 5;
+    }
+    palette[6][3] = 0;
+    palette[7][3] = 255;
+  }
+  return palette;
+}
+
+AlphaBlock FitAlpha(const Texels& texels, int a0, int a1) {
+  AlphaBlock block;
+  block.a0 = a0;
+  block.a1 = a1;
+  block.error =
+      NearestIndices(texels, AlphaPalette(a0, a1), 8, 3, 4, &block.indices);
+  return block;
+}
+
+AlphaBlock EncodeAlpha(const Texels& texels, BlockQuality quality) {
+  int min_alpha = 255;
+  int max_alpha = 0;
+  // The extremes apart from 0 and 255, which the 6-alpha mode has anyway.
+  int min_inner = 255;
+  int max_inner = 0;
+  for (const Texel& texel : texels) {
+    min_alpha = std::min(min_alpha, texel[3]);
+    max_alpha = std::max(max_alpha, texel[3]);
+    if (texel[3] != 0 && texel[3] != 255) {
+      min_inner = std::min(min_inner, texel[3]);
+      max_inner = std::max(max_inner, texel[3]);
+    }
+  }
+  AlphaBlock best = FitAlpha(texels, max_alpha, min_alpha);
+  if (quality != BlockQuality::kFast && best.error > 0 &&
+      min_inner <= max_inner) {
+    const AlphaBlock candidate = FitAlpha(texels, min_inner, max_inner);
+    if (candidate.error < best.error) {
+      best = candidate;
+    }
+  }
+
+  for (int iteration = LeastSquaresIterations(quality);
+       iteration > 0 && best.error > 0; --iteration) {
+    const bool eight_alphas = best.a0 > best.a1;
+    std::array<float, 16> weights;
+    for (int i = 0; i < 16; ++i) {
+      const int index = best.indices[i];
+      if (index < 2) {
+        weights[i] = static_cast<float>(index);
+      } else if (eight_alphas) {
+        weights[i] = (index - 1) / 7.0f;
+      } else {
+        weights[i] = index < 6 ? (index - 1) / 5.0f : -1.0f;
+      }
+    }
+    Color e0;
+    Color e1;
+    if (!FitEndpoints(texels, weights, 3, 4, &e0, &e1)) {
+      break;
+    }
+    int a0 = std::lround(e0[3]);
+    int a1 = std::lround(e1[3]);
+    if (eight_alphas ? a0 < a1 : a0 > a1) {
+      std::swap(a0, a1);
+    }
+    const AlphaBlock candidate = FitAlpha(texels, a0, a1);
+    if (candidate.error >= best.error) {
+      break;
+    }
+    best = candidate;
+  }
+  return best;
+}
+
+void WriteAlpha(const AlphaBlock& block, uint8_t* out) {
+  uint64_t indices = 0;
+  for (int i = 0; i < 16; ++i) {
+    indices |= static_cast<uint64_t>(block.indices[i]) << (i * 3);
+  }
+  out[0] = static_cast<uint8_t>(block.a0);
+  out[1] = static_cast<uint8_t>(block.a1);
+  for (int i = 0; i < 6; ++i) {
+    out[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+  }
+}
+
+void DecodeAlpha(const uint8_t* block, uint8_t* texels) {
+  const std::array<Texel, 8> palette = AlphaPalette(block[0], block[1]);
+  uint64_t indices = 0;
+  for (int i = 0; i < 6; ++i) {
+    indices |= static_cast<uint64_t>(block[2 + i]) << (i * 8);
+  }
+  for (int i = 0; i < 16; ++i) {
+    texels[i * 4 + 3] =
+        static_cast<uint8_t>(palette[indices >> (i * 3) & 7][3]);
+  }
+}
+
+// --- BC7 mode 6 ---
+
+struct Bc7Block {
+  Texel q0{};
+  Texel q1{};
+  int p0 = 0;
+  int p1 = 0;
+  std::array<int, 16> indices{};
+  int64_t error = std::numeric_limits<int64_t>::max();
+};
+
+Texel Bc7Endpoint(const Texel& q, int p) {
+  return {q[0] << 1 | p, q[1] << 1 | p, q[2] << 1 | p, q[3] << 1 | p};
+}
+
+std::array<Texel, 16> Bc7Palette(const Texel& e0, const Texel& e1) {
+  std::array<Texel, 16> palette;
+  for (int i = 0; i < 16; ++i) {
+    const int w = kBc7Weights[i];
+    for (int c = 0; c < 4; ++c) {
+      palette[i][c] = ((64 - w) * e0[c] + w * e1[c] + 32) >> 6;
+    }
+  }
+  return palette;
+}
+
+// The 7 high bits of an endpoint of which the low bit is `p`.
+Texel QuantizeBc7(const Color& color, int p) {
+  Texel q;
+  for (int c = 0; c < 4; ++c) {
+    q[c] = std::clamp<int>(std::lround((color[c] - p) * 0.5f), 0, 127);
+  }
+  return q;
+}
+
+float QuantizationError(const Color& color, const Texel& endpoint) {
+  float error = 0.0f;
+  for (int c = 0; c < 4; ++c) {
+    error += (color[c] - endpoint[c]) * (color[c] - endpoint[c]);
+  }
+  return error;
+}
+
+Bc7Block FitBc7(const Texels& texels, const Texel& q0, int p0, const Texel& q1,
+                int p1) {
+  Bc7Block block;
+  block.q0 = q0;
+  block.q1 = q1;
+  block.p0 = p0;
+  block.p1 = p1;
+  block.error = NearestIndices(
+      texels, Bc7Palette(Bc7Endpoint(q0, p0), Bc7Endpoint(q1, p1)), 16, 0, 4,
+      &block.indices);
+  return block;
+}
+
+// Quantizes the endpoints. The fast preset picks the low bit of each endpoint
+// that is nearest to it, and the others try all 4 combinations.
+Bc7Block QuantizeBc7Endpoints(const Texels& texels, const Color& e0,
+                              const Color& e1, BlockQuality quality) {
+  if (quality == BlockQuality::kFast) {
+    auto nearest_bit = [](const Color& color) {
+      return QuantizationError(color, Bc7Endpoint(QuantizeBc7(color, 1), 1)) <
+                     QuantizationError(color,
+                                       Bc7Endpoint(QuantizeBc7(color, 0), 0))
+                 ? 1
+                 : 0;
+    };
+    const int p0 = nearest_bit(e0);
+    const int p1 = nearest_bit(e1);
+    return FitBc7(texels, QuantizeBc7(e0, p0), p0, QuantizeBc7(e1, p1), p1);
+  }
+  Bc7Block best;
+  for (int p = 0; p < 4; ++p) {
+    const int p0 = p & 1;
+    const int p1 = p >> 1;
+    Bc7Block candidate =
+        FitBc7(texels, QuantizeBc7(e0, p0), p0, QuantizeBc7(e1, p1), p1);
+    if (candidate.error < best.error) {
+      best = candidate;
+    }
+  }
+  return best;
+}
+
+Bc7Block EncodeBc7(const Texels& texels, BlockQuality quality) {
+  Color e0;
+  Color e1;
+  FitSegment(texels, 4, &e0, &e1);
+  Bc7Block best = QuantizeBc7Endpoints(texels, e0, e1, quality);
+  for (int iteration = LeastSquaresIterations(quality);
+       iteration > 0 && best.error > 0; --iteration) {
+    std::array<float, 16> weights;
+    for (int i = 0; i < 16; ++i) {
+      weights[i] = kBc7Weights[best.indices[i]] / 64.0f;
+    }
+    if (!FitEndpoints(texels, weights, 0, 4, &e0, &e1)) {
+      break;
+    }
+    const Bc7Block candidate = QuantizeBc7Endpoints(texels, e0, e1, quality);
+    if (candidate.error >= best.error) {
+      break;
+    }
+    best = candidate;
+  }
+  return best;
+}
+
+// Writes the bits of a block from the lowest bit of its first byte.
+class BitWriter {
+ public:
+  explicit BitWriter(uint8_t* out) : out_(out) {}
+
+  void Write(uint32_t value, int bits) {
+    for (int i = 0; i < bits; ++i, ++position_) {
+      out_[position_ / 8] |= (value >> i & 1) << (position_ % 8);
+    }
+  }
+
+ private:
+  uint8_t* out_;
+  int position_ = 0;
+};
+
+class BitReader {
+ public:
+  explicit BitReader(const uint8_t* in) : in_(in) {}
+
+  uint32_t Read(int bits) {
+    uint32_t value = 0;
+    for (int i = 0; i < bits; ++i, ++position_) {
+      value |= static_cast<uint32_t>(in_[position_ / 8] >> (position_ % 8) & 1)
+               << i;
+    }
+    return value;
+  }
+
+ private:
+  const uint8_t* in_;
+  int position_ = 0;
+};
+
+// Mode 6 is 7 bits of mode, the channels of both endpoints, their low bits
+// and the indices, of which the first one drops its high bit: the endpoints
+// are swapped when it is set.
+void WriteBc7(Bc7Block block, uint8_t* out) {
+  if (block.indices[0] >= 8) {
+    std::swap(block.q0, block.q1);
+    std::swap(block.p0, block.p1);
+    for (int& index : block.indices) {
+      index = 15 - index;
+    }
+  }
+  std::memset(out, 0, 16);
+  BitWriter writer(out);
+  writer.Write(1 << 6, 7);
+  for (int c = 0; c < 4; ++c) {
+    writer.Write(block.q0[c], 7);
+    writer.Write(block.q1[c], 7);
+  }
+  writer.Write(block.p0, 1);
+  writer.Write(block.p1, 1);
+  for (int i = 0; i < 16; ++i) {
+    writer.Write(block.indices[i], i == 0 ? 3 : 4);
+  }
+}
+
+bool DecodeBc7(const uint8_t* block, uint8_t* texels) {
+  BitReader reader(block);
+  if (reader.Read(7) != 1 << 6) {
+    return false;
+  }
+  Texel q0;
+  Texel q1;
+  for (int c = 0; c < 4; ++c) {
+    q0[c] = reader.Read(7);
+    q1[c] = reader.Read(7);
+  }
+  const int p0 = reader.Read(1);
+  const int p1 = reader.Read(1);
+  const std::array<Texel, 16> palette =
+      Bc7Palette(Bc7Endpoint(q0, p0), Bc7Endpoint(q1, p1));
+  for (int i = 0; i < 16; ++i) {
+    const Texel& texel = palette[reader.Read(i == 0 ? 3 : 4)];
+    for (int c = 0; c < 4; ++c) {
+      texels[i * 4 + c] = static_cast<uint8_t>(texel[c]);
+    }
+  }
+  return true;
+}
+
+double Psnr(double error, uint64_t samples) {
+  if (error == 0.0 || samples == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 10.0 * std::log10(255.0 * 255.0 * samples / error);
+}
+
+}  // namespace
+
+std::string_view BlockFormatName(BlockFormat format) {
+  switch (format) {
+    case BlockFormat::kBc1:
+      return "bc1";
+    case BlockFormat::kBc3:
+      return "bc3";
+    case BlockFormat::kBc7:
+      return "bc7";
+  }
+  return "unknown";
+}
+
+std::string_view BlockQualityName(BlockQuality quality) {
+  switch (quality) {
+    case BlockQuality::kFast:
+      return "fast";
+    case BlockQuality::kNormal:
+      return "normal";
+    case BlockQuality::kBest:
+      return "best";
+  }
+  return "unknown";
+}
+
+size_t BlockSize(BlockFormat format) {
+  return format == BlockFormat::kBc1 ? 8 : 16;
+}
+
+int BlockRowCount(const RgbaImage& image) { return (image.height + 3) / 4; }
+
+int BlockColumnCount(const RgbaImage& image) { return (image.width + 3) / 4; }
+
+BlockError& BlockError::operator+=(const BlockError& other) {
+  color += other.color;
+  color_samples += other.color_samples;
+  alpha += other.alpha;
+  alpha_samples += other.alpha_samples;
+  return *this;
+}
+
+double BlockError::ColorPsnr() const { return Psnr(color, color_samples); }
+
+double BlockError::AlphaPsnr() const { return Psnr(alpha, alpha_samples); }
+
+BlockError CompressBlockRows(const RgbaImage& image, BlockFormat format,
+                             BlockQuality quality, int begin_row, int end_row,
+                             uint8_t* blocks) {
+  const int num_columns = BlockColumnCount(image);
+  const size_t block_size = BlockSize(format);
+  BlockError error;
+  for (int by = begin_row; by < end_row; ++by) {
+    for (int bx = 0; bx < num_columns; ++bx) {
+      Texels texels;
+      std::array<bool, 16> inside;
+      LoadBlock(image, bx, by, &texels, &inside);
+      uint8_t* block = blocks + (size_t(by) * num_columns + bx) * block_size;
+      switch (format) {
+        case BlockFormat::kBc1:
+          WriteBc1(EncodeBc1(texels, quality), block);
+          break;
+        case BlockFormat::kBc3:
+          WriteAlpha(EncodeAlpha(texels, quality), block);
+          WriteBc1(EncodeBc1(texels, quality), block + 8);
+          break;
+        case BlockFormat::kBc7:
+          WriteBc7(EncodeBc7(texels, quality), block);
+          break;
+      }
+
+      uint8_t decoded[64];
+      CHECK(DecodeBlock(format, block, decoded));
+      for (int i = 0; i < 16; ++i) {
+        if (!inside[i]) {
+          continue;
+        }
+        for (int c = 0; c < 3; ++c) {
+          const int d = decoded[i * 4 + c] - texels[i][c];
+          error.color += d * d;
+        }
+        error.color_samples += 3;
+        if (format != BlockFormat::kBc1) {
+          const int d = decoded[i * 4 + 3] - texels[i][3];
+          error.alpha += d * d;
+          ++error.alpha_samples;
+        }
+      }
+    }
+  }
+  return error;
+}
+
+std::vector<uint8_t> CompressImage(const RgbaImage& image, BlockFormat format,
+                                   BlockQuality quality, BlockError* error) {
+  const int num_rows = BlockRowCount(image);
+  std::vector<uint8_t> blocks(size_t(num_rows) * BlockColumnCount(image) *
+                              BlockSize(format));
+  const BlockError image_error =
+      CompressBlockRows(image, format, quality, 0, num_rows, blocks.data());
+  if (error) {
+    *error = image_error;
+  }
+  return blocks;
+}
+
+bool DecodeBlock(BlockFormat format, const uint8_t* block, uint8_t* texels) {
+  switch (format) {
+    case BlockFormat::kBc1:
+      DecodeBc1(block, /*force_four_colors=*/false, texels);
+      return true;
+    case BlockFormat::kBc3:
+      DecodeBc1(block + 8, /*force_four_colors=*/true, texels);
+      DecodeAlpha(block, texels);
+      return true;
+    case BlockFormat::kBc7:
+      return DecodeBc7(block, texels);
+  }
+  return false;
+}
+
+}  // namespace ioq3_map
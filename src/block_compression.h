@@ -0,0 +1,86 @@
+#ifndef IOQ3_MAP_BLOCK_COMPRESSION_H_
+#define IOQ3_MAP_BLOCK_COMPRESSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "texture_mips.h"
+
+namespace ioq3_map {
+
+// The GPU block-compressed formats, which store every 4x4 texels in a block
+// of fixed size that the GPU samples without decompressing the texture.
+enum class BlockFormat {
+  // 8 bytes per block, opaque: two RGB565 endpoints and a 2-bit index per
+  // texel into the 4 colors they interpolate.
+  kBc1,
+  // 16 bytes per block: 3-bit indices into 8 alphas interpolated between two
+  // endpoints, followed by a BC1 block of 4 colors.
+  kBc3,
+  // 16 bytes per block, in mode 6 only: two RGBA endpoints of 7 bits and a
+  // low bit each, and a 4-bit index per texel into the 16 colors they
+  // interpolate.
+  kBc7,
+};
+
+// How hard the encoder searches the endpoints of a block.
+enum class BlockQuality {
+  // Endpoints at the extremes of the texels along their principal axis.
+  kFast,
+  // Then fitted once to the indices by least squares, and with every
+  // combination of the BC7 low bits and both BC3 alpha modes tried.
+  kNormal,
+  // Fitted by least squares until the error stops decreasing.
+  kBest,
+};
+
+std::string_view BlockFormatName(BlockFormat format);
+std::string_view BlockQualityName(BlockQuality quality);
+
+// The size of a block, in bytes.
+size_t BlockSize(BlockFormat format);
+
+// The number of rows and columns of blocks that cover an image.
+int BlockRowCount(const RgbaImage& image);
+int BlockColumnCount(const RgbaImage& image);
+
+// The sums of the squared errors of compressed texels in 8-bit sRGB.
+struct BlockError {
+  // Over the color channels.
+  double color = 0.0;
+  uint64_t color_samples = 0;
+  // Over the alpha channel, for BC3 and BC7.
+  double alpha = 0.0;
+  uint64_t alpha_samples = 0;
+
+  BlockError& operator+=(const BlockError& other);
+
+  // The peak signal-to-noise ratios, in dB. They are infinite without error.
+  double ColorPsnr() const;
+  double AlphaPsnr() const;
+};
+
+// Compresses the rows of blocks [begin_row, end_row) of `image` into
+// `blocks`, which holds the blocks of the whole image, row by row. The texels
+// of the blocks past the edges of the image repeat the last row or column.
+// Different rows may be compressed concurrently. The per-texel loops work on
+// fixed arrays of 16 texels that the compiler vectorizes. Returns the error of
+// the decoded texels of the image.
+BlockError CompressBlockRows(const RgbaImage& image, BlockFormat format,
+                             BlockQuality quality, int begin_row, int end_row,
+                             uint8_t* blocks);
+
+// Compresses the whole image.
+std::vector<uint8_t> CompressImage(const RgbaImage& image, BlockFormat format,
+                                   BlockQuality quality,
+                                   BlockError* error = nullptr);
+
+// Decodes a block to its 4x4 texels, RGBA row by row. Returns false for the
+// BC7 modes that CompressBlockRows does not write.
+bool DecodeBlock(BlockFormat format, const uint8_t* block, uint8_t* texels);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_BLOCK_COMPRESSION_H_
@@ -0,0 +1,169 @@
+#include "block_compression.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace ioq3_map {
+namespace {
+
+// Smooth gradients in every channel, with some noise.
+RgbaImage GradientImage(int width, int height) {
+  std::mt19937 rng(3);
+  std::uniform_int_distribution<int> noise(-3, 3);
+  RgbaImage image{width, height, {}};
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const int values[4] = {x * 255 / width, y * 255 / height,
+                             (x + y) * 127 / (width + height) + 64,
+                             255 - x * 200 / width};
+      for (int value : values) {
+        image.pixels.push_back(
+            static_cast<uint8_t>(std::clamp(value + noise(rng), 0, 255)));
+      }
+    }
+  }
+  return image;
+}
+
+// Decodes the blocks of a compressed image.
+RgbaImage Decode(const std::vector<uint8_t>& blocks, BlockFormat format,
+                 int width, int height) {
+  RgbaImage image{width, height,
+                  std::vector<uint8_t>(size_t(width) * height * 4)};
+  const int num_columns = BlockColumnCount(image);
+  for (int by = 0; by < BlockRowCount(image); ++by) {
+    for (int bx = 0; bx < num_columns; ++bx) {
+      uint8_t texels[64];
+      EXPECT_TRUE(DecodeBlock(
+          format, &blocks[(by * num_columns + bx) * BlockSize(format)],
+          texels));
+      for (int i = 0; i < 16; ++i) {
+        const int x = bx * 4 + i % 4;
+        const int y = by * 4 + i / 4;
+        if (x < width && y < height) {
+          std::copy(&texels[i * 4], &texels[i * 4 + 4],
+                    &image.pixels[(size_t(y) * width + x) * 4]);
+        }
+      }
+    }
+  }
+  return image;
+}
+
+TEST(BlockCompressionTest, BlockLayout) {
+  const RgbaImage image{5, 9, std::vector<uint8_t>(5 * 9 * 4, 255)};
+  EXPECT_EQ(BlockColumnCount(image), 2);
+  EXPECT_EQ(BlockRowCount(image), 3);
+  EXPECT_EQ(CompressImage(image, BlockFormat::kBc1, BlockQuality::kFast).size(),
+            2 * 3 * 8);
+  EXPECT_EQ(CompressImage(image, BlockFormat::kBc7, BlockQuality::kFast).size(),
+            2 * 3 * 16);
+  EXPECT_EQ(BlockFormatName(BlockFormat::kBc3), "bc3");
+  EXPECT_EQ(BlockQualityName(BlockQuality::kBest), "best");
+}
+
+TEST(BlockCompressionTest, SolidColorsRoundTrip) {
+  for (const uint8_t color : {0, 1, 37, 128, 200, 254, 255}) {
+    RgbaImage solid{4, 4, {}};
+    for (int i = 0; i < 16; ++i) {
+      solid.pixels.insert(solid.pixels.end(),
+                          {color, static_cast<uint8_t>(255 - color),
+                           static_cast<uint8_t>(color / 2), color});
+    }
+    for (BlockFormat format :
+         {BlockFormat::kBc1, BlockFormat::kBc3, BlockFormat::kBc7}) {
+      BlockError error;
+      const std::vector<uint8_t> blocks =
+          CompressImage(solid, format, BlockQuality::kNormal, &error);
+      const RgbaImage decoded = Decode(blocks, format, 4, 4);
+      for (size_t i = 0; i < decoded.pixels.size(); ++i) {
+        if (format == BlockFormat::kBc1 && i % 4 == 3) {
+          EXPECT_EQ(decoded.pixels[i], 255);
+          continue;
+        }
+        // The interpolated colors match within 1, as the BC7 endpoints share
+        // their low bit across channels.
+        EXPECT_LE(std::abs(decoded.pixels[i] - solid.pixels[i]), 1)
+            << BlockFormatName(format) << " " << int(color) << " " << i;
+      }
+    }
+  }
+}
+
+TEST(BlockCompressionTest, GradientsCompressWell) {
+  const RgbaImage image = GradientImage(61, 45);
+  for (BlockFormat format :
+       {BlockFormat::kBc1, BlockFormat::kBc3, BlockFormat::kBc7}) {
+    BlockError fast;
+    BlockError best;
+    CompressImage(image, format, BlockQuality::kFast, &fast);
+    const std::vector<uint8_t> blocks =
+        CompressImage(image, format, BlockQuality::kBest, &best);
+    EXPECT_LE(best.color, fast.color) << BlockFormatName(format);
+    EXPECT_EQ(best.color_samples, 61 * 45 * 3);
+    EXPECT_GT(best.ColorPsnr(), 36.0) << BlockFormatName(format);
+    if (format == BlockFormat::kBc1) {
+      EXPECT_EQ(best.alpha_samples, 0);
+    } else {
+      EXPECT_EQ(best.alpha_samples, 61 * 45);
+      EXPECT_GT(best.AlphaPsnr(), 36.0) << BlockFormatName(format);
+    }
+
+    // The reported error is that of the decoded image.
+    const RgbaImage decoded = Decode(blocks, format, 61, 45);
+    double color = 0.0;
+    for (size_t i = 0; i < image.pixels.size(); ++i) {
+      const int d = decoded.pixels[i] - image.pixels[i];
+      color += i % 4 == 3 ? 0 : d * d;
+    }
+    EXPECT_EQ(color, best.color) << BlockFormatName(format);
+  }
+}
+
+TEST(BlockCompressionTest, RowsCompressIndependently) {
+  const RgbaImage image = GradientImage(16, 16);
+  const std::vector<uint8_t> whole =
+      CompressImage(image, BlockFormat::kBc7, BlockQuality::kNormal);
+  std::vector<uint8_t> rows(whole.size());
+  BlockError error;
+  for (int row = 0; row < BlockRowCount(image); ++row) {
+    error += CompressBlockRows(image, BlockFormat::kBc7, BlockQuality::kNormal,
+                               row, row + 1, rows.data());
+  }
+  EXPECT_EQ(rows, whole);
+  EXPECT_EQ(error.color_samples, 16 * 16 * 3);
+}
+
+TEST(BlockCompressionTest, DecodesBc7Mode6Fields) {
+  // Mode 6, R0 = 127 and P0 = 1 with the other endpoint bits 0, and every
+  // index 0: the texels are the first endpoint.
+  uint8_t block[16] = {0xc0, 0x3f, 0, 0, 0, 0, 0, 0x80};
+  uint8_t texels[64];
+  ASSERT_TRUE(DecodeBlock(BlockFormat::kBc7, block, texels));
+  EXPECT_EQ(texels[0], 255);
+  EXPECT_EQ(texels[1], 1);
+  EXPECT_EQ(texels[2], 1);
+  EXPECT_EQ(texels[3], 1);
+  EXPECT_EQ(texels[60], 255);
+
+  // Other modes are not decoded.
+  block[0] = 0x01;
+  EXPECT_FALSE(DecodeBlock(BlockFormat::kBc7, block, texels));
+}
+
+TEST(BlockCompressionTest, PsnrWithoutError) {
+  BlockError error;
+  EXPECT_TRUE(std::isinf(error.ColorPsnr()));
+  error.color = 3 * 255.0 * 255.0;
+  error.color_samples = 300;
+  EXPECT_DOUBLE_EQ(error.ColorPsnr(), 20.0);
+}
+
+}  // namespace
+}  // namespace ioq3_map
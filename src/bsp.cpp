@@ -1,9 +1,16 @@
 #include "bsp.h"
 
+#include <fcntl.h>
 #include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <utility>
 
 namespace ioq3_map {
 
@@ -15,33 +22,34 @@ struct dheader_t {
   struct {
     int fileofs;
     int filelen;
-  } lumps[17];
+  } lumps[kNumLumps];
 };
 
 constexpr int kIBSP = 0x50534249;  // "IBSP" little endian
 constexpr int kVersion = 0x2E;
 
-}  // namespace
+struct RecordLayout {
+  size_t size;
+  size_t alignment;
+};
 
-bool IsValidBsp(const std::filesystem::path& bsp_file_path) {
-  if (!std::filesystem::exists(bsp_file_path)) {
-    LOG(ERROR) << "BSP file does not exist: " << bsp_file_path;
-    return false;
-  }
+template <LumpType kType>
+constexpr RecordLayout LayoutOf() {
+  return {sizeof(LumpRecord<kType>), alignof(LumpRecord<kType>)};
+}
 
-  std::ifstream file(bsp_file_path, std::ios::binary);
-  if (!file) {
-    LOG(ERROR) << "Could not open BSP file: " << bsp_file_path;
-    return false;
-  }
+template <size_t... kIndices>
+constexpr std::array<RecordLayout, kNumLumps> MakeRecordLayouts(
+    std::index_sequence<kIndices...>) {
+  return {LayoutOf<static_cast<LumpType>(kIndices)>()...};
+}
 
-  dheader_t header;
-  file.read(reinterpret_cast<char*>(&header), sizeof(header));
-  if (file.gcount() != sizeof(header)) {
-    LOG(ERROR) << "BSP file parsing failed: file too small for header.";
-    return false;
-  }
+// The record layout of each lump, indexed by LumpType.
+constexpr std::array<RecordLayout, kNumLumps> kRecordLayouts =
+    MakeRecordLayouts(std::make_index_sequence<kNumLumps>());
 
+// Checks the magic number and version of a BSP header.
+bool IsValidHeader(const dheader_t& header) {
   if (header.ident != kIBSP) {
     // Try checking if big endian or inverted?
     // Q3 BSPs are typically little endian.
@@ -59,40 +67,169 @@ bool IsValidBsp(const std::filesystem::path& bsp_file_path) {
   return true;
 }
 
-std::optional<BSP> LoadBsp(const std::filesystem::path& bsp_file_path) {
-  if (!IsValidBsp(bsp_file_path)) {
+// Validates the header of the BSP content held by `bsp.buffer` and maps its
+// lumps.
+std::optional<BSP> MapLumps(BSP bsp) {
+  const size_t size = bsp.buffer.size();
+  if (size < sizeof(dheader_t)) {
+    LOG(ERROR) << "BSP file parsing failed: file too small for header.";
     return std::nullopt;
   }
 
-  std::ifstream file(bsp_file_path, std::ios::binary | std::ios::ate);
-  std::streamsize size = file.tellg();
-  file.seekg(0, std::ios::beg);
-
-  BSP bsp;
-  bsp.buffer.resize(size);
-  if (!file.read(bsp.buffer.data(), size)) {
-    LOG(ERROR) << "Failed to read BSP file content.";
+  dheader_t header;
+  std::memcpy(&header, bsp.buffer.data(), sizeof(header));
+  if (!IsValidHeader(header)) {
     return std::nullopt;
   }
 
-  const dheader_t* header =
-      reinterpret_cast<const dheader_t*>(bsp.buffer.data());
-
   // Map Lumps
-  for (int i = 0; i < 17; ++i) {
-    int offset = header->lumps[i].fileofs;
-    int length = header->lumps[i].filelen;
+  for (size_t i = 0; i < kNumLumps; ++i) {
+    const int offset = header.lumps[i].fileofs;
+    const int length = header.lumps[i].filelen;
 
-    if (offset + length > size) {
+    // Compared in size_t so that no sum can overflow.
+    if (offset < 0 || length < 0 || static_cast<size_t>(offset) > size ||
+        static_cast<size_t>(length) > size - static_cast<size_t>(offset)) {
       LOG(ERROR) << "Lump " << i << " out of bounds.";
       return std::nullopt;
     }
 
-    bsp.lumps[static_cast<LumpType>(i)] =
-        std::string_view(bsp.buffer.data() + offset, length);
+    const std::string_view lump = bsp.buffer.view().substr(offset, length);
+    const RecordLayout& layout = kRecordLayouts[i];
+    if (lump.size() % layout.size != 0) {
+      LOG(ERROR) << "Invalid lump size for " << i << ": " << lump.size()
+                 << " is not a multiple of " << layout.size;
+      return std::nullopt;
+    }
+    if (reinterpret_cast<uintptr_t>(lump.data()) % layout.alignment != 0) {
+      LOG(ERROR) << "Lump " << i << " is misaligned.";
+      return std::nullopt;
+    }
+
+    bsp.lumps[i] = lump;
   }
 
   return bsp;
 }
 
+}  // namespace
+
+BspBuffer::BspBuffer(std::string content)
+    : content_(std::make_unique<std::string>(std::move(content))) {
+  data_ = content_->data();
+  size_ = content_->size();
+}
+
+BspBuffer::~BspBuffer() { Release(); }
+
+BspBuffer::BspBuffer(BspBuffer&& other) noexcept { *this = std::move(other); }
+
+BspBuffer& BspBuffer::operator=(BspBuffer&& other) noexcept {
+  if (this != &other) {
+    Release();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    mapping_ = std::exchange(other.mapping_, nullptr);
+    content_ = std::move(other.content_);
+  }
+  return *this;
+}
+
+void BspBuffer::Release() {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, size_);
+  }
+  mapping_ = nullptr;
+  content_.reset();
+  data_ = nullptr;
+  size_ = 0;
+}
+
+std::optional<BspBuffer> BspBuffer::Map(const std::filesystem::path& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open BSP file: " << path;
+    return std::nullopt;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    LOG(ERROR) << "Could not stat BSP file: " << path;
+    close(fd);
+    return std::nullopt;
+  }
+
+  BspBuffer buffer;
+  if (file_stat.st_size > 0) {
+    void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE,
+                         fd, /*offset=*/0);
+    if (mapping == MAP_FAILED) {
+      LOG(ERROR) << "Could not map BSP file: " << path;
+      close(fd);
+      return std::nullopt;
+    }
+    buffer.mapping_ = mapping;
+    buffer.data_ = static_cast<const char*>(mapping);
+    buffer.size_ = file_stat.st_size;
+  }
+  // The mapping stays valid once the descriptor is closed.
+  close(fd);
+  return buffer;
+}
+
+bool IsValidBsp(const std::filesystem::path& bsp_file_path) {
+  if (!std::filesystem::exists(bsp_file_path)) {
+    LOG(ERROR) << "BSP file does not exist: " << bsp_file_path;
+    return false;
+  }
+
+  std::ifstream file(bsp_file_path, std::ios::binary);
+  if (!file) {
+    LOG(ERROR) << "Could not open BSP file: " << bsp_file_path;
+    return false;
+  }
+
+  dheader_t header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (file.gcount() != sizeof(header)) {
+    LOG(ERROR) << "BSP file parsing failed: file too small for header.";
+    return false;
+  }
+
+  return IsValidHeader(header);
+}
+
+std::optional<BSP> LoadBsp(const std::filesystem::path& bsp_file_path) {
+  if (!std::filesystem::exists(bsp_file_path)) {
+    LOG(ERROR) << "BSP file does not exist: " << bsp_file_path;
+    return std::nullopt;
+  }
+
+  auto buffer = BspBuffer::Map(bsp_file_path);
+  if (!buffer) {
+    return std::nullopt;
+  }
+
+  BSP bsp;
+  bsp.buffer = std::move(*buffer);
+  return MapLumps(std::move(bsp));
+}
+
+std::optional<BSP> LoadBsp(const VirtualFilesystem& vfs,
+                           const std::filesystem::path& bsp_file_path) {
+  if (!vfs.in_memory) {
+    return LoadBsp(bsp_file_path);
+  }
+
+  std::optional<std::string> content = vfs.ReadFile(bsp_file_path);
+  if (!content) {
+    LOG(ERROR) << "BSP file does not exist: " << bsp_file_path;
+    return std::nullopt;
+  }
+
+  BSP bsp;
+  bsp.buffer = BspBuffer(std::move(*content));
+  return MapLumps(std::move(bsp));
+}
+
 }  // namespace ioq3_map
@@ -1,65 +1,93 @@
 #ifndef IOQ3_MAP_BSP_H_
 #define IOQ3_MAP_BSP_H_
 
+#include <array>
+#include <cstddef>
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 
+#include "archives.h"
+#include "bsp_lumps.h"
 #include "glog/logging.h"
 
 namespace ioq3_map {
 
-enum class LumpType {
-  Entities = 0,
-  Textures = 1,
-  Planes = 2,
-  Nodes = 3,
-  Leafs = 4,
-  LeafFaces = 5,
-  LeafBrushes = 6,
-  Models = 7,
-  Brushes = 8,
-  BrushSides = 9,
-  Vertexes = 10,
-  MeshVerts = 11,
-  Effects = 12,
-  Faces = 13,
-  Lightmaps = 14,
-  Lightvol = 15,
-  VisData = 16
+// Read-only bytes of a BSP file: either a memory mapping of the file or a
+// buffer inflated from an archive, adopted without a copy. The bytes keep
+// their address when the buffer is moved, so lumps can view into them.
+class BspBuffer {
+ public:
+  BspBuffer() = default;
+  explicit BspBuffer(std::string content);
+  ~BspBuffer();
+
+  BspBuffer(const BspBuffer&) = delete;
+  BspBuffer& operator=(const BspBuffer&) = delete;
+  BspBuffer(BspBuffer&& other) noexcept;
+  BspBuffer& operator=(BspBuffer&& other) noexcept;
+
+  // Maps the file into memory.
+  static std::optional<BspBuffer> Map(const std::filesystem::path& path);
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  std::string_view view() const { return std::string_view(data_, size_); }
+
+ private:
+  void Release();
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+
+  // Set when the bytes are memory mapped.
+  void* mapping_ = nullptr;
+  // Set when the bytes are owned in memory.
+  std::unique_ptr<std::string> content_;
 };
 
 struct BSP {
-  std::string buffer;
-  std::unordered_map<LumpType, std::string_view> lumps;
-};
+  BspBuffer buffer;
+
+  // Indexed by LumpType. The records of every lump loaded by LoadBsp are
+  // checked for size and alignment, see GetLump.
+  std::array<std::string_view, kNumLumps> lumps;
 
-// Helper to get raw pointer from string_view.
-template <typename T>
-const T* GetLumpData(const BSP& bsp, LumpType type, size_t* count) {
-  auto it = bsp.lumps.find(type);
-  if (it == bsp.lumps.end() || it->second.empty()) {
-    *count = 0;
-    return nullptr;
+  std::string_view& lump(LumpType type) {
+    return lumps[static_cast<size_t>(type)];
   }
-  const std::string_view& lump_data = it->second;
-  if (lump_data.size() % sizeof(T) != 0) {
-    LOG(ERROR) << "Invalid lump size for " << static_cast<int>(type);
-    *count = 0;
-    return nullptr;
+  std::string_view lump(LumpType type) const {
+    return lumps[static_cast<size_t>(type)];
   }
-  *count = lump_data.size() / sizeof(T);
-  return reinterpret_cast<const T*>(lump_data.data());
+};
+
+// Returns the records of a lump, e.g. GetLump<LumpType::Faces>(bsp) returns
+// the dsurface_t records. The lump is not checked again.
+template <LumpType kType>
+std::span<const LumpRecord<kType>> GetLump(const BSP& bsp) {
+  const std::string_view lump = bsp.lump(kType);
+  DCHECK_EQ(lump.size() % sizeof(LumpRecord<kType>), 0u);
+  return std::span<const LumpRecord<kType>>(
+      reinterpret_cast<const LumpRecord<kType>*>(lump.data()),
+      lump.size() / sizeof(LumpRecord<kType>));
 }
 
 // Checks if the file is a valid BSP file.
 bool IsValidBsp(const std::filesystem::path& bsp_file_path);
 
-// Loads a BSP file into memory.
+// Maps a BSP file into memory. The file is opened once for both the header
+// validation and the lumps.
 std::optional<BSP> LoadBsp(const std::filesystem::path& bsp_file_path);
 
+// Loads a BSP file through the virtual filesystem. When the filesystem is in
+// memory, only the BSP entry is inflated from its archive and the lumps view
+// into the inflated buffer.
+std::optional<BSP> LoadBsp(const VirtualFilesystem& vfs,
+                           const std::filesystem::path& bsp_file_path);
+
 }  // namespace ioq3_map
 
 #endif  // IOQ3_MAP_BSP_H_
@@ -85,13 +85,7 @@ std::vector<std::unordered_map<std::string, std::string>> ParseEntityString(
 
 std::vector<Entity> BuildBSPEntities(const BSP& bsp) {
   std::vector<Entity> result;
-  // Convert string_view to string for easier debug/handling if needed,
-  // though ParseEntityString takes view.
-  std::string_view entities_lump;
-  if (bsp.lumps.count(LumpType::Entities)) {
-    entities_lump = bsp.lumps.at(LumpType::Entities);
-  }
-  auto raw_entities = ParseEntityString(entities_lump);
+  auto raw_entities = ParseEntityString(bsp.lump(LumpType::Entities));
 
   // First pass: Build a map of targetname -> origin for spotlight target lookup
   std::unordered_map<std::string, Eigen::Vector3f> target_origins;
@@ -21,8 +21,8 @@ TEST(BSPEntityTest, ParseGenericEntities) {
 "origin" "10 20 30"
 }
 )";
-  bsp.buffer = data;
-  bsp.lumps[LumpType::Entities] = bsp.buffer;
+  bsp.buffer = BspBuffer(data);
+  bsp.lump(LumpType::Entities) = bsp.buffer.view();
 
   auto entities = BuildBSPEntities(bsp);
   ASSERT_EQ(entities.size(), 2);
@@ -56,8 +56,8 @@ TEST(BSPEntityTest, ParsePointLight) {
 "_color" "1.0 0.5 0.0"
 }
 )";
-  bsp.buffer = data;
-  bsp.lumps[LumpType::Entities] = bsp.buffer;
+  bsp.buffer = BspBuffer(data);
+  bsp.lump(LumpType::Entities) = bsp.buffer.view();
 
   auto entities = BuildBSPEntities(bsp);
   ASSERT_EQ(entities.size(), 1);
@@ -86,8 +86,8 @@ TEST(BSPEntityTest, ParseSpotLight) {
 "origin" "0 0 0"
 }
 )";
-  bsp.buffer = data;
-  bsp.lumps[LumpType::Entities] = bsp.buffer;
+  bsp.buffer = BspBuffer(data);
+  bsp.lump(LumpType::Entities) = bsp.buffer.view();
 
   auto entities = BuildBSPEntities(bsp);
   ASSERT_EQ(entities.size(), 2);
@@ -2,104 +2,103 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <span>
 
 #include "bsp.h"
+#include "parallel.h"
 
 namespace ioq3_map {
+namespace {
+
+// Builds the geometry of face `i`. Returns nothing for faces that are not
+// drawn or are malformed.
+std::optional<BSPGeometry> BuildSurfaceGeometry(
+    size_t i, const dsurface_t& face, std::span<const vertex_t> vertices,
+    std::span<const int> meshverts) {
+  BSPGeometry geo;
+  geo.texture_index = face.shader_no;
+
+  // Validate vertex range
+  if (face.first_vert < 0 || face.num_verts < 0 ||
+      face.num_verts > static_cast<int>(vertices.size()) - face.first_vert) {
+    LOG(ERROR) << "Invalid vertex range for face " << i;
+    return std::nullopt;
+  }
 
-std::unordered_map<BSPSurfaceIndex, BSPGeometry> BuildBSPGeometries(
-    const BSP& bsp) {
-  std::unordered_map<BSPSurfaceIndex, BSPGeometry> geometries;
+  // Common: View the vertices of this face
+  const std::span<const vertex_t> face_vertices =
+      vertices.subspan(face.first_vert, face.num_verts);
+
+  switch (face.surface_type) {
+    case MapSurfaceType::PLANAR:
+    case MapSurfaceType::TRIANGLE_SOUP: {
+      // Validate index range
+      if (face.first_index < 0 || face.num_indexes < 0 ||
+          face.num_indexes >
+              static_cast<int>(meshverts.size()) - face.first_index) {
+        LOG(ERROR) << "Invalid index range for face " << i;
+        return std::nullopt;
+      }
 
-  size_t num_faces = 0;
-  const dsurface_t* faces =
-      GetLumpData<dsurface_t>(bsp, LumpType::Faces, &num_faces);
+      // Meshverts are offsets relative to firstVert, and must stay within
+      // the vertices of the face.
+      const std::span<const int> face_indices =
+          meshverts.subspan(face.first_index, face.num_indexes);
+      if (std::any_of(face_indices.begin(), face_indices.end(), [&](int v) {
+            return v < 0 || v >= face.num_verts;
+          })) {
+        LOG(ERROR) << "Invalid index range for face " << i;
+        return std::nullopt;
+      }
 
-  size_t num_verts = 0;
-  const vertex_t* vertices =
-      GetLumpData<vertex_t>(bsp, LumpType::Vertexes, &num_verts);
+      if (face.surface_type == MapSurfaceType::PLANAR) {
+        geo.primitive = BSPPolygon{face_vertices, face_indices};
+      } else {
+        geo.primitive = BSPMesh{face_vertices, face_indices};
+      }
+      return geo;
+    }
+    case MapSurfaceType::PATCH: {
+      // For patches, face.num_verts should be width * height
+      // Vertices are control points
+      if (face.patch_width < 0 || face.patch_height < 0 ||
+          static_cast<int64_t>(face.patch_width) * face.patch_height !=
+              face.num_verts) {
+        LOG(ERROR) << "Invalid patch size for face " << i;
+        return std::nullopt;
+      }
 
-  size_t num_meshverts = 0;
-  const int* meshverts =
-      GetLumpData<int>(bsp, LumpType::MeshVerts, &num_meshverts);
+      BSPPatch patch;
+      patch.width = face.patch_width;
+      patch.height = face.patch_height;
+      patch.control_points = face_vertices;
 
-  if (!faces || !vertices) {
-    LOG(ERROR) << "Missing faces or vertices";
-    return geometries;
+      geo.primitive = patch;
+      return geo;
+    }
+    default: {
+      // Ignore other types (FLARE, BAD)
+      return std::nullopt;
+    }
   }
+}
 
-  for (size_t i = 0; i < num_faces; ++i) {
-    const dsurface_t& face = faces[i];
-    BSPGeometry geo;
-    geo.texture_index = face.shader_no;
-
-    // Validate vertex range
-    if (face.first_vert < 0 ||
-        face.first_vert + face.num_verts > static_cast<int>(num_verts)) {
-      LOG(ERROR) << "Invalid vertex range for face " << i;
-      continue;
-    }
+}  // namespace
 
-    // Common: Extract vertices for this face
-    std::vector<vertex_t> face_vertices;
-    face_vertices.reserve(face.num_verts);
-    for (int v = 0; v < face.num_verts; ++v) {
-      face_vertices.push_back(vertices[face.first_vert + v]);
-    }
+BSPGeometries BuildBSPGeometries(const BSP& bsp, int num_threads) {
+  const std::span<const dsurface_t> faces = GetLump<LumpType::Faces>(bsp);
+  const std::span<const vertex_t> vertices = GetLump<LumpType::Vertexes>(bsp);
+  const std::span<const int> meshverts = GetLump<LumpType::MeshVerts>(bsp);
 
-    switch (face.surface_type) {
-      case MapSurfaceType::PLANAR:
-      case MapSurfaceType::TRIANGLE_SOUP: {
-        if (!meshverts) {
-          LOG(ERROR) << "Missing meshverts for face " << i;
-          continue;
-        }
-
-        // Validate index range
-        if (face.first_index < 0 || face.first_index + face.num_indexes >
-                                        static_cast<int>(num_meshverts)) {
-          LOG(ERROR) << "Invalid index range for face " << i;
-          continue;
-        }
-
-        std::vector<int> face_indices;
-        face_indices.reserve(face.num_indexes);
-        for (int idx = 0; idx < face.num_indexes; ++idx) {
-          // Meshverts are offsets relative to firstVert
-          int meshvert = meshverts[face.first_index + idx];
-          face_indices.push_back(meshvert);
-        }
-
-        if (face.surface_type == MapSurfaceType::PLANAR) {
-          geo.primitive =
-              BSPPolygon{std::move(face_vertices), std::move(face_indices)};
-        } else {
-          geo.primitive =
-              BSPMesh{std::move(face_vertices), std::move(face_indices)};
-        }
-
-        geometries.emplace(static_cast<BSPSurfaceIndex>(i), std::move(geo));
-        break;
-      }
-      case MapSurfaceType::PATCH: {
-        // For patches, face.num_verts should be width * height
-        // Vertices are control points
-        BSPPatch patch;
-        patch.width = face.patch_width;
-        patch.height = face.patch_height;
-        patch.control_points = std::move(face_vertices);
-
-        geo.primitive = std::move(patch);
-        geometries.emplace(static_cast<BSPSurfaceIndex>(i), std::move(geo));
-        break;
-      }
-      default: {
-        // Ignore other types (FLARE, BAD)
-        break;
-      }
-    }
-  }
+  // Each face writes its own slot, so the result does not depend on the
+  // number of threads.
+  BSPGeometries geometries(faces.size());
+  ParallelFor(faces.size(), num_threads, [&](size_t i) {
+    geometries[i] = BuildSurfaceGeometry(i, faces[i], vertices, meshverts);
+  });
 
   return geometries;
 }
@@ -30,7 +30,7 @@ class BspGeometryTest : public ::testing::Test {
 
   void SetLump(BSP& bsp, LumpType type, std::string&& data) {
     lump_storage_.push_back(std::move(data));
-    bsp.lumps[type] = lump_storage_.back();
+    bsp.lump(type) = lump_storage_.back();
   }
 };
 
@@ -71,7 +71,8 @@ TEST_F(BspGeometryTest, BuildBSPGeometriesSinglePlanar) {
   auto result = BuildBSPGeometries(bsp);
   ASSERT_THAT(result, SizeIs(1));
 
-  const auto& geo = result[0];
+  ASSERT_TRUE(result[0].has_value());
+  const auto& geo = *result[0];
   EXPECT_EQ(geo.texture_index, 5);
   ASSERT_TRUE(std::holds_alternative<BSPPolygon>(geo.primitive));
 
@@ -111,7 +112,8 @@ TEST_F(BspGeometryTest, BuildBSPGeometriesMeshWithOffset) {
 
   auto result = BuildBSPGeometries(bsp);
   ASSERT_THAT(result, SizeIs(1));
-  const auto& geo = result[0];
+  ASSERT_TRUE(result[0].has_value());
+  const auto& geo = *result[0];
   ASSERT_TRUE(std::holds_alternative<BSPMesh>(geo.primitive));
   const auto& mesh = std::get<BSPMesh>(geo.primitive);
 
@@ -142,7 +144,8 @@ TEST_F(BspGeometryTest, BuildBSPGeometriesPatch) {
 
   auto result = BuildBSPGeometries(bsp);
   ASSERT_THAT(result, SizeIs(1));
-  const auto& geo = result[0];
+  ASSERT_TRUE(result[0].has_value());
+  const auto& geo = *result[0];
   ASSERT_TRUE(std::holds_alternative<BSPPatch>(geo.primitive));
   const auto& patch = std::get<BSPPatch>(geo.primitive);
 
@@ -151,5 +154,124 @@ TEST_F(BspGeometryTest, BuildBSPGeometriesPatch) {
   EXPECT_THAT(patch.control_points, SizeIs(9));
 }
 
+TEST_F(BspGeometryTest, BuildBSPGeometriesViewsIntoLumps) {
+  BSP bsp;
+
+  std::vector<vertex_t> verts(4);
+  SetLump(bsp, LumpType::Vertexes, CreateLump(verts));
+  std::vector<int> meshverts = {0, 1, 2};
+  SetLump(bsp, LumpType::MeshVerts, CreateLump(meshverts));
+
+  dsurface_t face{};
+  face.surface_type = MapSurfaceType::TRIANGLE_SOUP;
+  face.first_vert = 1;
+  face.num_verts = 3;
+  face.first_index = 0;
+  face.num_indexes = 3;
+
+  dsurface_t flare{};
+  flare.surface_type = MapSurfaceType::FLARE;
+
+  std::vector<dsurface_t> faces = {flare, face};
+  SetLump(bsp, LumpType::Faces, CreateLump(faces));
+
+  auto result = BuildBSPGeometries(bsp);
+  ASSERT_THAT(result, SizeIs(2));
+  EXPECT_FALSE(result[0].has_value());
+  ASSERT_TRUE(result[1].has_value());
+
+  const auto& mesh = std::get<BSPMesh>(result[1]->primitive);
+  EXPECT_EQ(mesh.vertices.data(),
+            GetLump<LumpType::Vertexes>(bsp).data() + face.first_vert);
+  EXPECT_EQ(mesh.indices.data(), GetLump<LumpType::MeshVerts>(bsp).data());
+}
+
+TEST_F(BspGeometryTest, BuildBSPGeometriesRejectsPatchSizeMismatch) {
+  BSP bsp;
+
+  std::vector<vertex_t> verts(9);
+  SetLump(bsp, LumpType::Vertexes, CreateLump(verts));
+
+  dsurface_t face{};
+  face.surface_type = MapSurfaceType::PATCH;
+  face.first_vert = 0;
+  face.num_verts = 9;
+  face.patch_width = 5;
+  face.patch_height = 3;
+
+  std::vector<dsurface_t> faces = {face};
+  SetLump(bsp, LumpType::Faces, CreateLump(faces));
+
+  auto result = BuildBSPGeometries(bsp);
+  ASSERT_THAT(result, SizeIs(1));
+  EXPECT_FALSE(result[0].has_value());
+}
+
+TEST_F(BspGeometryTest, BuildBSPGeometriesRejectsMeshvertOutOfRange) {
+  BSP bsp;
+
+  std::vector<vertex_t> verts(6);
+  SetLump(bsp, LumpType::Vertexes, CreateLump(verts));
+
+  // The first face references its 4th vertex, but only has 3; the second a
+  // negative one.
+  std::vector<int> meshverts = {0, 1, 3, 0, -1, 2};
+  SetLump(bsp, LumpType::MeshVerts, CreateLump(meshverts));
+
+  dsurface_t face{};
+  face.surface_type = MapSurfaceType::TRIANGLE_SOUP;
+  face.first_vert = 0;
+  face.num_verts = 3;
+  face.first_index = 0;
+  face.num_indexes = 3;
+
+  dsurface_t negative = face;
+  negative.surface_type = MapSurfaceType::PLANAR;
+  negative.first_vert = 3;
+  negative.first_index = 3;
+
+  std::vector<dsurface_t> faces = {face, negative};
+  SetLump(bsp, LumpType::Faces, CreateLump(faces));
+
+  auto result = BuildBSPGeometries(bsp);
+  ASSERT_THAT(result, SizeIs(2));
+  EXPECT_FALSE(result[0].has_value());
+  EXPECT_FALSE(result[1].has_value());
+}
+
+TEST_F(BspGeometryTest, BuildBSPGeometriesInParallel) {
+  BSP bsp;
+
+  std::vector<vertex_t> verts(9);
+  SetLump(bsp, LumpType::Vertexes, CreateLump(verts));
+  std::vector<int> meshverts = {0, 1, 2};
+  SetLump(bsp, LumpType::MeshVerts, CreateLump(meshverts));
+
+  // Alternate patches, meshes and flares.
+  std::vector<dsurface_t> faces(300);
+  for (size_t i = 0; i < faces.size(); ++i) {
+    dsurface_t& face = faces[i];
+    face.shader_no = static_cast<int>(i);
+    face.surface_type = static_cast<MapSurfaceType>(2 + i % 3);
+    face.num_verts = 9;
+    face.num_indexes = 3;
+    face.patch_width = 3;
+    face.patch_height = 3;
+  }
+  SetLump(bsp, LumpType::Faces, CreateLump(faces));
+
+  auto serial = BuildBSPGeometries(bsp, /*num_threads=*/1);
+  auto parallel = BuildBSPGeometries(bsp, /*num_threads=*/4);
+  ASSERT_THAT(parallel, SizeIs(faces.size()));
+  for (size_t i = 0; i < faces.size(); ++i) {
+    ASSERT_EQ(parallel[i].has_value(), serial[i].has_value()) << i;
+    EXPECT_EQ(parallel[i].has_value(), i % 3 != 2) << i;
+    if (parallel[i]) {
+      EXPECT_EQ(parallel[i]->texture_index, static_cast<int>(i));
+      EXPECT_EQ(parallel[i]->primitive.index(), serial[i]->primitive.index());
+    }
+  }
+}
+
 }  // namespace
 }  // namespace ioq3_map
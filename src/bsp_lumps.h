@@ -0,0 +1,211 @@
+#ifndef IOQ3_MAP_BSP_LUMPS_H_
+#define IOQ3_MAP_BSP_LUMPS_H_
+
+#include <stdint.h>
+
+#include <Eigen/Dense>  // IWYU pragma: keep
+#include <cstddef>
+
+namespace ioq3_map {
+
+// --- Raw Q3 Data Structures (matching qfiles.h) ---
+
+enum class LumpType {
+  Entities = 0,
+  Textures = 1,
+  Planes = 2,
+  Nodes = 3,
+  Leafs = 4,
+  LeafFaces = 5,
+  LeafBrushes = 6,
+  Models = 7,
+  Brushes = 8,
+  BrushSides = 9,
+  Vertexes = 10,
+  MeshVerts = 11,
+  Effects = 12,
+  Faces = 13,
+  Lightmaps = 14,
+  Lightvol = 15,
+  VisData = 16
+};
+
+inline constexpr size_t kNumLumps = 17;
+
+// Q3 defined constants
+inline constexpr int kMaxQPath = 64;
+inline constexpr int kLightmapSize = 128;
+
+// Lump 1: Shaders
+struct dshader_t {
+  char shader[kMaxQPath];
+  int surface_flags;
+  int content_flags;
+};
+
+// Lump 2
+struct dplane_t {
+  Eigen::Vector3f normal;
+  float dist;
+};
+
+// Lump 3
+struct dnode_t {
+  int plane_num;
+  // Negative numbers are -(leafs + 1), not nodes.
+  int children[2];
+  Eigen::Vector3i mins;
+  Eigen::Vector3i maxs;
+};
+
+// Lump 4
+struct dleaf_t {
+  int cluster;
+  int area;
+
+  Eigen::Vector3i mins;
+  Eigen::Vector3i maxs;
+
+  int first_leaf_surface;
+  int num_leaf_surfaces;
+
+  int first_leaf_brush;
+  int num_leaf_brushes;
+};
+
+// Lump 7
+struct dmodel_t {
+  Eigen::Vector3f mins;
+  Eigen::Vector3f maxs;
+
+  int first_surface;
+  int num_surfaces;
+
+  int first_brush;
+  int num_brushes;
+};
+
+// Lump 8
+struct dbrush_t {
+  int first_side;
+  int num_sides;
+  int shader_num;
+};
+
+// Lump 9
+struct dbrushside_t {
+  int plane_num;
+  int shader_num;
+};
+
+// Lump 10: Vertex data layout as stored in the BSP file.
+struct vertex_t {
+  Eigen::Vector3f xyz;
+  Eigen::Vector2f st;
+  Eigen::Vector2f lightmap;
+  Eigen::Vector3f normal;
+  uint8_t color[4];
+};
+
+// Lump 12
+struct dfog_t {
+  char shader[kMaxQPath];
+  int brush_num;
+  // The brush side that the fog is seen through, or -1.
+  int visible_side;
+};
+
+enum class MapSurfaceType : int {
+  BAD = 0,
+  PLANAR = 1,
+  PATCH = 2,
+  TRIANGLE_SOUP = 3,
+  FLARE = 4
+};
+
+// Lump 13: Face data layout as stored in the BSP file.
+struct dsurface_t {
+  int shader_no;
+  int fog_num;
+  MapSurfaceType surface_type;
+
+  int first_vert;
+  int num_verts;
+
+  int first_index;
+  int num_indexes;
+
+  int lightmap_num;
+  int lightmap_x, lightmap_y;
+  int lightmap_width, lightmap_height;
+
+  Eigen::Vector3f lightmap_origin;
+  Eigen::Vector3f lightmap_vecs[3];
+
+  int patch_width;
+  int patch_height;
+};
+
+// Lump 14
+struct dlightmap_t {
+  uint8_t rgb[kLightmapSize][kLightmapSize][3];
+};
+
+// Lump 15
+struct dlightgrid_t {
+  uint8_t ambient[3];
+  uint8_t directional[3];
+  // Latitude and longitude of the light direction.
+  uint8_t dir[2];
+};
+
+static_assert(sizeof(dshader_t) == 72);
+static_assert(sizeof(dplane_t) == 16);
+static_assert(sizeof(dnode_t) == 36);
+static_assert(sizeof(dleaf_t) == 48);
+static_assert(sizeof(dmodel_t) == 40);
+static_assert(sizeof(dbrush_t) == 12);
+static_assert(sizeof(dbrushside_t) == 8);
+static_assert(sizeof(vertex_t) == 44);
+static_assert(sizeof(dfog_t) == 72);
+static_assert(sizeof(dsurface_t) == 104);
+static_assert(sizeof(dlightmap_t) == kLightmapSize * kLightmapSize * 3);
+static_assert(sizeof(dlightgrid_t) == 8);
+
+// Binds each lump to the type of its records. A lump is an array of records,
+// which LoadBsp checks for size and alignment.
+template <LumpType kType>
+struct LumpTraits;
+
+#define IOQ3_MAP_DEFINE_LUMP(kType, RecordType) \
+  template <>                                   \
+  struct LumpTraits<LumpType::kType> {          \
+    using Record = RecordType;                  \
+  }
+
+IOQ3_MAP_DEFINE_LUMP(Entities, char);
+IOQ3_MAP_DEFINE_LUMP(Textures, dshader_t);
+IOQ3_MAP_DEFINE_LUMP(Planes, dplane_t);
+IOQ3_MAP_DEFINE_LUMP(Nodes, dnode_t);
+IOQ3_MAP_DEFINE_LUMP(Leafs, dleaf_t);
+IOQ3_MAP_DEFINE_LUMP(LeafFaces, int);
+IOQ3_MAP_DEFINE_LUMP(LeafBrushes, int);
+IOQ3_MAP_DEFINE_LUMP(Models, dmodel_t);
+IOQ3_MAP_DEFINE_LUMP(Brushes, dbrush_t);
+IOQ3_MAP_DEFINE_LUMP(BrushSides, dbrushside_t);
+IOQ3_MAP_DEFINE_LUMP(Vertexes, vertex_t);
+IOQ3_MAP_DEFINE_LUMP(MeshVerts, int);
+IOQ3_MAP_DEFINE_LUMP(Effects, dfog_t);
+IOQ3_MAP_DEFINE_LUMP(Faces, dsurface_t);
+IOQ3_MAP_DEFINE_LUMP(Lightmaps, dlightmap_t);
+IOQ3_MAP_DEFINE_LUMP(Lightvol, dlightgrid_t);
+IOQ3_MAP_DEFINE_LUMP(VisData, uint8_t);
+
+#undef IOQ3_MAP_DEFINE_LUMP
+
+template <LumpType kType>
+using LumpRecord = typename LumpTraits<kType>::Record;
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_BSP_LUMPS_H_
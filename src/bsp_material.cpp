@@ -2,7 +2,9 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <cstring>
+#include <span>
 #include <string>
 #include <unordered_set>
 
@@ -27,16 +29,14 @@ std::unordered_map<BSPTextureIndex, BSPMaterial> BuildBSPMaterials(
     const CreateDefaultShaderFn& create_default_shader) {
   std::unordered_map<BSPTextureIndex, BSPMaterial> materials;
 
-  size_t num_shaders = 0;
-  const dshader_t* shader_lump =
-      GetLumpData<dshader_t>(bsp, LumpType::Textures, &num_shaders);
-
-  if (!shader_lump) {
+  const std::span<const dshader_t> shader_lump =
+      GetLump<LumpType::Textures>(bsp);
+  if (shader_lump.empty()) {
     LOG(ERROR) << "No shader lump found in BSP.";
     return materials;
   }
 
-  for (size_t i = 0; i < num_shaders; ++i) {
+  for (size_t i = 0; i < shader_lump.size(); ++i) {
     const dshader_t& ds = shader_lump[i];
 
     // Ensure null termination safe read
@@ -82,4 +82,21 @@ std::unordered_map<BSPTextureIndex, BSPMaterial> BuildBSPMaterials(
   return materials;
 }
 
+std::vector<std::filesystem::path> CollectMaterialTextures(
+    const std::unordered_map<BSPTextureIndex, BSPMaterial>& materials) {
+  std::vector<std::filesystem::path> textures;
+  for (const auto& [id, material] : materials) {
+    for (const auto& layer : material.texture_layers) {
+      textures.push_back(layer.path);
+    }
+    if (material.q3map_lightimage) {
+      textures.push_back(*material.q3map_lightimage);
+    }
+  }
+  std::sort(textures.begin(), textures.end());
+  textures.erase(std::unique(textures.begin(), textures.end()),
+                 textures.end());
+  return textures;
+}
+
 }  // namespace ioq3_map
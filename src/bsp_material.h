@@ -1,26 +1,18 @@
 #ifndef IOQ3_MAP_EXPORTER_BSP_MATERIAL_H_
 #define IOQ3_MAP_EXPORTER_BSP_MATERIAL_H_
 
+#include <filesystem>
 #include <functional>
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "bsp.h"
 #include "shader_parser.h"
 
 namespace ioq3_map {
 
-// Q3 defined constants
-inline constexpr int kMaxQPath = 64;
-
-// Lump 1: Shaders
-struct dshader_t {
-  char shader[kMaxQPath];
-  int surface_flags;
-  int content_flags;
-};
-
 using BSPMaterial = Q3Shader;
 
 // Index to Lump 1 (Textures)
@@ -37,6 +29,11 @@ std::unordered_map<BSPTextureIndex, BSPMaterial> BuildBSPMaterials(
     const std::unordered_map<Q3ShaderName, Q3Shader>& parsed_shaders,
     const CreateDefaultShaderFn& create_default_shader);
 
+// Returns the texture files referenced by the materials, i.e. the texture
+// layers and q3map_lightimage, sorted and without duplicates.
+std::vector<std::filesystem::path> CollectMaterialTextures(
+    const std::unordered_map<BSPTextureIndex, BSPMaterial>& materials);
+
 }  // namespace ioq3_map
 
 #endif  // IOQ3_MAP_EXPORTER_BSP_MATERIAL_H_
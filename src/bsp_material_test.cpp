@@ -5,6 +5,8 @@
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "bsp.h"
@@ -33,18 +35,13 @@ class BspMaterialTest : public ::testing::Test {
   }
 
   void SetShaderLump(BSP& bsp, const std::vector<dshader_t>& shaders) {
-    size_t size = shaders.size() * sizeof(dshader_t);
-    // Ensure buffer has space and append.
-    // Note: Reallocation invalidates existing views,
-    // so in a real scenario we'd reserve or be careful.
+    std::string content(shaders.size() * sizeof(dshader_t), '\0');
+    std::memcpy(content.data(), shaders.data(), content.size());
     // Here we assume we only set one lump for the test.
-    size_t offset = bsp.buffer.size();
-    bsp.buffer.resize(offset + size);
-    std::memcpy(bsp.buffer.data() + offset, shaders.data(), size);
+    bsp.buffer = BspBuffer(std::move(content));
 
     // LumpType::Textures corresponds to Lump 1 (Shaders) in Q3
-    bsp.lumps[LumpType::Textures] =
-        std::string_view(bsp.buffer.data() + offset, size);
+    bsp.lump(LumpType::Textures) = bsp.buffer.view();
   }
 };
 
@@ -133,5 +130,19 @@ TEST_F(BspMaterialTest, BuildBSPMaterialsFindsTextureOnDisk) {
   EXPECT_EQ(mat.surface_flags, 1);
 }
 
+TEST_F(BspMaterialTest, CollectMaterialTexturesDeduplicates) {
+  BSPMaterial wall;
+  wall.texture_layers.push_back(Q3TextureLayer{.path = "textures/wall.tga"});
+  wall.texture_layers.push_back(Q3TextureLayer{.path = "textures/glow.jpg"});
+  BSPMaterial light;
+  light.texture_layers.push_back(Q3TextureLayer{.path = "textures/wall.tga"});
+  light.q3map_lightimage = "textures/light.tga";
+
+  auto textures = CollectMaterialTextures({{0, wall}, {1, light}});
+  EXPECT_EQ(textures, (std::vector<std::filesystem::path>{
+                          "textures/glow.jpg", "textures/light.tga",
+                          "textures/wall.tga"}));
+}
+
 }  // namespace
 }  // namespace ioq3_map
@@ -2,8 +2,11 @@
 
 #include <gtest/gtest.h>
 
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <span>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -12,6 +15,8 @@ namespace {
 
 namespace fs = std::filesystem;
 
+constexpr int kHeaderSize = sizeof(int) * 2 + sizeof(int) * 2 * 17;
+
 class BspTest : public ::testing::Test {
  protected:
   void SetUp() override {
@@ -53,6 +58,15 @@ class BspTest : public ::testing::Test {
     }
   }
 
+  // Overwrites the directory entry of a lump in a BSP file.
+  void SetLumpEntry(const fs::path& path, LumpType type, int offset,
+                    int length) {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(sizeof(int) * (2 + 2 * static_cast<int>(type)));
+    file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+  }
+
   fs::path test_dir_;
 };
 
@@ -93,11 +107,67 @@ TEST_F(BspTest, LoadBspReadsLumps) {
   ASSERT_TRUE(bsp.has_value());
 
   // Check Lump 0 (Entities) which we populated
-  auto it = bsp->lumps.find(LumpType::Entities);
-  ASSERT_NE(it, bsp->lumps.end());
-
-  std::string_view content = it->second;
+  std::string_view content = bsp->lump(LumpType::Entities);
   EXPECT_EQ(content, "Hello");
+
+  // The lump views into the mapped file.
+  EXPECT_GE(content.data(), bsp->buffer.data());
+  EXPECT_LE(content.data() + content.size(),
+            bsp->buffer.data() + bsp->buffer.size());
+}
+
+TEST_F(BspTest, LoadBspRejectsOutOfBoundsLump) {
+  fs::path p = test_dir_ / "overflow.bsp";
+  WriteBsp(p, 0x50534249, 0x2E, {'H', 'e', 'l', 'l', 'o'});
+
+  // Lump 0's length would wrap a 32-bit offset + length sum.
+  SetLumpEntry(p, LumpType::Entities, kHeaderSize, 0x7FFFFFFF);
+
+  EXPECT_FALSE(LoadBsp(p).has_value());
+}
+
+TEST_F(BspTest, LoadBspRejectsPartialRecords) {
+  fs::path p = test_dir_ / "partial.bsp";
+  WriteBsp(p, 0x50534249, 0x2E, std::vector<char>(sizeof(dplane_t) + 1));
+  SetLumpEntry(p, LumpType::Entities, kHeaderSize, 0);
+  SetLumpEntry(p, LumpType::Planes, kHeaderSize, sizeof(dplane_t) + 1);
+
+  EXPECT_FALSE(LoadBsp(p).has_value());
+}
+
+TEST_F(BspTest, GetLumpReturnsTypedRecords) {
+  fs::path p = test_dir_ / "planes.bsp";
+  std::vector<dplane_t> planes(2);
+  planes[1].normal = Eigen::Vector3f(0, 0, 1);
+  planes[1].dist = 64;
+  std::vector<char> data(sizeof(dplane_t) * planes.size());
+  std::memcpy(data.data(), planes.data(), data.size());
+  WriteBsp(p, 0x50534249, 0x2E, data);
+  SetLumpEntry(p, LumpType::Entities, kHeaderSize, 0);
+  SetLumpEntry(p, LumpType::Planes, kHeaderSize, data.size());
+
+  auto bsp = LoadBsp(p);
+  ASSERT_TRUE(bsp.has_value());
+
+  std::span<const dplane_t> loaded = GetLump<LumpType::Planes>(*bsp);
+  ASSERT_EQ(loaded.size(), 2);
+  EXPECT_EQ(loaded[1].normal, Eigen::Vector3f(0, 0, 1));
+  EXPECT_EQ(loaded[1].dist, 64);
+  EXPECT_TRUE(GetLump<LumpType::Faces>(*bsp).empty());
+}
+
+TEST(BspBufferTest, AdoptsContentWithoutCopy) {
+  // Long enough not to be stored inline by std::string.
+  std::string content(1024, 'x');
+  const char* data = content.data();
+
+  BspBuffer buffer(std::move(content));
+  EXPECT_EQ(buffer.data(), data);
+  EXPECT_EQ(buffer.view(), std::string(1024, 'x'));
+
+  BspBuffer moved = std::move(buffer);
+  EXPECT_EQ(moved.data(), data);
+  EXPECT_EQ(buffer.size(), 0);
 }
 
 }  // namespace
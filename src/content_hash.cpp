@@ -0,0 +1,129 @@
+#include "content_hash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace ioq3_map {
+
+namespace {
+
+constexpr uint64_t kPrime1 = 11400714785074694791ULL;
+constexpr uint64_t kPrime2 = 14029467366897019727ULL;
+constexpr uint64_t kPrime3 = 1609587929392839161ULL;
+constexpr uint64_t kPrime4 = 9650029242287828579ULL;
+constexpr uint64_t kPrime5 = 2870177450012600261ULL;
+
+uint64_t Read64(const uint8_t* data) {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint32_t Read32(const uint8_t* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint64_t Round(uint64_t accumulator, uint64_t input) {
+  accumulator += input * kPrime2;
+  return std::rotl(accumulator, 31) * kPrime1;
+}
+
+uint64_t MergeRound(uint64_t hash, uint64_t accumulator) {
+  hash ^= Round(0, accumulator);
+  return hash * kPrime1 + kPrime4;
+}
+
+}  // namespace
+
+ContentHasher::ContentHasher(uint64_t seed)
+    : seed_(seed),
+      accumulators_{seed + kPrime1 + kPrime2, seed + kPrime2, seed,
+                    seed - kPrime1} {}
+
+void ContentHasher::Update(std::string_view data) {
+  const uint8_t* input = reinterpret_cast<const uint8_t*>(data.data());
+  size_t size = data.size();
+  total_length_ += size;
+
+  auto consume_stripe = [this](const uint8_t* stripe) {
+    for (int i = 0; i < 4; ++i) {
+      accumulators_[i] = Round(accumulators_[i], Read64(stripe + i * 8));
+    }
+  };
+  if (stripe_size_ > 0) {
+    const size_t n = std::min(size, stripe_.size() - stripe_size_);
+    std::memcpy(stripe_.data() + stripe_size_, input, n);
+    stripe_size_ += n;
+    input += n;
+    size -= n;
+    if (stripe_size_ < stripe_.size()) {
+      return;
+    }
+    consume_stripe(stripe_.data());
+    stripe_size_ = 0;
+  }
+  for (; size >= stripe_.size(); input += 32, size -= 32) {
+    consume_stripe(input);
+  }
+  std::memcpy(stripe_.data(), input, size);
+  stripe_size_ = size;
+}
+
+uint64_t ContentHasher::Digest() const {
+  uint64_t hash;
+  if (total_length_ >= stripe_.size()) {
+    const auto& [v1, v2, v3, v4] = accumulators_;
+    hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) +
+           std::rotl(v4, 18);
+    for (uint64_t v : accumulators_) {
+      hash = MergeRound(hash, v);
+    }
+  } else {
+    hash = seed_ + kPrime5;
+  }
+  hash += total_length_;
+
+  const uint8_t* tail = stripe_.data();
+  size_t size = stripe_size_;
+  for (; size >= 8; tail += 8, size -= 8) {
+    hash ^= Round(0, Read64(tail));
+    hash = std::rotl(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (size >= 4) {
+    hash ^= Read32(tail) * kPrime1;
+    hash = std::rotl(hash, 23) * kPrime2 + kPrime3;
+    tail += 4;
+    size -= 4;
+  }
+  for (; size > 0; ++tail, --size) {
+    hash ^= *tail * kPrime5;
+    hash = std::rotl(hash, 11) * kPrime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+uint64_t HashContent(std::string_view data) {
+  ContentHasher hasher;
+  hasher.Update(data);
+  return hasher.Digest();
+}
+
+std::string ContentHashString(uint64_t hash) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string digits(16, '0');
+  for (int i = 15; i >= 0; --i, hash >>= 4) {
+    digits[i] = kDigits[hash & 15];
+  }
+  return digits;
+}
+
+}  // namespace ioq3_map
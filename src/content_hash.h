@@ -0,0 +1,41 @@
+#ifndef IOQ3_MAP_CONTENT_HASH_H_
+#define IOQ3_MAP_CONTENT_HASH_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ioq3_map {
+
+// Computes XXH64, a fast non-cryptographic 64-bit hash, of a stream of bytes
+// fed in pieces of any size. Its digests match the reference implementation.
+class ContentHasher {
+ public:
+  explicit ContentHasher(uint64_t seed = 0);
+
+  void Update(std::string_view data);
+
+  // The hash of the bytes so far. More bytes may follow.
+  uint64_t Digest() const;
+
+ private:
+  uint64_t seed_;
+  uint64_t total_length_ = 0;
+  std::array<uint64_t, 4> accumulators_;
+  // The bytes of the current 32-byte stripe.
+  std::array<uint8_t, 32> stripe_;
+  size_t stripe_size_ = 0;
+};
+
+// The XXH64 of `data`.
+uint64_t HashContent(std::string_view data);
+
+// The hash as 16 lowercase hexadecimal digits, e.g. to name a file after its
+// content.
+std::string ContentHashString(uint64_t hash);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_CONTENT_HASH_H_
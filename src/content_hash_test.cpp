@@ -0,0 +1,41 @@
+#include "content_hash.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace ioq3_map {
+namespace {
+
+TEST(ContentHashTest, MatchesReferenceDigests) {
+  EXPECT_EQ(HashContent(""), 0xef46db3751d8e999ULL);
+  EXPECT_EQ(HashContent("a"), 0xd24ec4f1a98c6e5bULL);
+  EXPECT_EQ(HashContent("abc"), 0x44bc2cf5ad770999ULL);
+  // Longer than a stripe of 32 bytes.
+  EXPECT_EQ(HashContent("Nobody inspects the spammish repetition"),
+            0xfbcea83c8a378bf1ULL);
+}
+
+TEST(ContentHashTest, UpdatesInPieces) {
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    data.push_back(static_cast<char>(i * 7));
+  }
+  const uint64_t expected = HashContent(data);
+  for (size_t piece : {1, 3, 31, 32, 33, 200}) {
+    ContentHasher hasher;
+    for (size_t i = 0; i < data.size(); i += piece) {
+      hasher.Update(std::string_view(data).substr(i, piece));
+    }
+    EXPECT_EQ(hasher.Digest(), expected) << piece;
+  }
+  EXPECT_NE(HashContent(data.substr(1)), expected);
+}
+
+TEST(ContentHashTest, ContentHashString) {
+  EXPECT_EQ(ContentHashString(0xef46db3751d8e999ULL), "ef46db3751d8e999");
+  EXPECT_EQ(ContentHashString(0x1a), "000000000000001a");
+}
+
+}  // namespace
+}  // namespace ioq3_map
@@ -0,0 +1,240 @@
+#include "file_copy.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace ioq3_map {
+
+namespace {
+
+constexpr size_t kCopyBufferSize = 1 << 20;
+
+// Owns a file descriptor.
+class FileDescriptor {
+ public:
+  explicit FileDescriptor(int fd) : fd_(fd) {}
+  ~FileDescriptor() { Close(); }
+
+  FileDescriptor(const FileDescriptor&) = delete;
+  FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+  int get() const { return fd_; }
+
+  // Closes the descriptor. Returns false if it was not open or if writes were
+  // lost.
+  bool Close() {
+    if (fd_ < 0) {
+      return false;
+    }
+    const bool ok = close(fd_) == 0;
+    fd_ = -1;
+    return ok;
+  }
+
+ private:
+  int fd_;
+};
+
+std::string ErrnoMessage() { return std::generic_category().message(errno); }
+
+// Copies the first `size` bytes in the kernel. Returns false, with part of the
+// data possibly copied, when the filesystems do not support it.
+bool CopyRange(int in, int out, off_t size) {
+#ifdef __linux__
+  loff_t in_offset = 0;
+  loff_t out_offset = 0;
+  while (in_offset < size) {
+    const ssize_t n = copy_file_range(in, &in_offset, out, &out_offset,
+                                      size - in_offset, /*flags=*/0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool CopyBuffered(int in, int out) {
+  std::vector<char> buffer(kCopyBufferSize);
+  for (off_t offset = 0;;) {
+    const ssize_t n = pread(in, buffer.data(), buffer.size(), offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n == 0;
+    }
+    for (ssize_t written = 0; written < n;) {
+      const ssize_t w = pwrite(out, buffer.data() + written, n - written,
+                               offset + written);
+      if (w < 0 && errno == EINTR) {
+        continue;
+      }
+      if (w < 0) {
+        return false;
+      }
+      written += w;
+    }
+    offset += n;
+  }
+}
+
+}  // namespace
+
+std::string_view CopyMethodName(CopyMethod method) {
+  switch (method) {
+    case CopyMethod::kExisting:
+      return "existing";
+    case CopyMethod::kHardLink:
+      return "hard link";
+    case CopyMethod::kReflink:
+      return "reflink";
+    case CopyMethod::kCopyFileRange:
+      return "copy_file_range";
+    case CopyMethod::kBuffered:
+      return "buffered copy";
+  }
+  return "unknown";
+}
+
+std::optional<CopyMethod> CopyFileFast(const std::filesystem::path& from,
+                                       const std::filesystem::path& to,
+                                       CopyMethod first) {
+  std::error_code ec;
+  if (std::filesystem::equivalent(from, to, ec)) {
+    return CopyMethod::kExisting;
+  }
+  // A link cannot replace the destination, and a copy must not write through
+  // the destination to a file it is linked to.
+  std::filesystem::remove(to, ec);
+
+  if (first <= CopyMethod::kHardLink) {
+    std::filesystem::create_hard_link(from, to, ec);
+    if (!ec) {
+      return CopyMethod::kHardLink;
+    }
+  }
+
+  FileDescriptor in(open(from.c_str(), O_RDONLY | O_CLOEXEC));
+  struct stat in_stat;
+  if (in.get() < 0 || fstat(in.get(), &in_stat) != 0) {
+    LOG(ERROR) << "Could not open " << from << ": " << ErrnoMessage();
+    return std::nullopt;
+  }
+  FileDescriptor out(open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                          in_stat.st_mode & 0777));
+  if (out.get() < 0) {
+    LOG(ERROR) << "Could not create " << to << ": " << ErrnoMessage();
+    return std::nullopt;
+  }
+
+  std::optional<CopyMethod> method;
+#ifdef FICLONE
+  if (first <= CopyMethod::kReflink &&
+      ioctl(out.get(), FICLONE, in.get()) == 0) {
+    method = CopyMethod::kReflink;
+  }
+#endif
+  if (!method && first <= CopyMethod::kCopyFileRange &&
+      CopyRange(in.get(), out.get(), in_stat.st_size)) {
+    method = CopyMethod::kCopyFileRange;
+  }
+  // Starts over after a partial in-kernel copy.
+  if (!method && ftruncate(out.get(), 0) == 0 &&
+      CopyBuffered(in.get(), out.get())) {
+    method = CopyMethod::kBuffered;
+  }
+  if (!out.Close()) {
+    method.reset();
+  }
+  if (!method) {
+    LOG(ERROR) << "Failed to copy " << from << " to " << to << ": "
+               << ErrnoMessage();
+    std::filesystem::remove(to, ec);
+  }
+  return method;
+}
+
+bool WriteFile(const std::filesystem::path& path, std::string_view content) {
+  FILE* fout = fopen(path.string().c_str(), "wb");
+  if (!fout) {
+    LOG(ERROR) << "Could not open output file: " << path;
+    return false;
+  }
+  bool ok = fwrite(content.data(), 1, content.size(), fout) == content.size();
+  ok = fclose(fout) == 0 && ok;
+  if (!ok) {
+    LOG(ERROR) << "Failed to write output file: " << path;
+  }
+  return ok;
+}
+
+std::string UniqueTemporarySuffix() {
+  static std::atomic<uint64_t> counter{0};
+  return ".tmp." + std::to_string(getpid()) + "." +
+         std::to_string(counter.fetch_add(1));
+}
+
+bool WriteFileAtomically(const std::filesystem::path& path,
+                         std::string_view content) {
+  std::filesystem::path temporary = path;
+  temporary += UniqueTemporarySuffix();
+  if (!WriteFile(temporary, content)) {
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(temporary, path, ec);
+  if (ec) {
+    LOG(ERROR) << "Failed to move " << temporary << " to " << path << ": "
+               << ec.message();
+    std::filesystem::remove(temporary, ec);
+    return false;
+  }
+  return true;
+}
+
+std::optional<CopyMethod> CopyFileAtomically(const std::filesystem::path& from,
+                                             const std::filesystem::path& to,
+                                             CopyMethod first) {
+  std::error_code ec;
+  if (std::filesystem::equivalent(from, to, ec)) {
+    return CopyMethod::kExisting;
+  }
+  std::filesystem::path temporary = to;
+  temporary += UniqueTemporarySuffix();
+  std::optional<CopyMethod> method = CopyFileFast(from, temporary, first);
+  if (!method) {
+    return std::nullopt;
+  }
+  std::filesystem::rename(temporary, to, ec);
+  if (ec) {
+    LOG(ERROR) << "Failed to move " << temporary << " to " << to << ": "
+               << ec.message();
+    method.reset();
+  }
+  // The rename leaves the temporary link if `to` became a link to the same
+  // file in the meantime.
+  std::filesystem::remove(temporary, ec);
+  return method;
+}
+
+}  // namespace ioq3_map
@@ -0,0 +1,56 @@
+#ifndef IOQ3_MAP_FILE_COPY_H_
+#define IOQ3_MAP_FILE_COPY_H_
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace ioq3_map {
+
+// The ways CopyFileFast materializes a file, from the cheapest.
+enum class CopyMethod {
+  // The destination already is the source.
+  kExisting,
+  // A hard link: no data is written, and the destination shares the inode,
+  // hence later edits, with the source.
+  kHardLink,
+  // A reflink (FICLONE): a new inode that shares the extents of the source
+  // until either file is modified, on copy-on-write filesystems.
+  kReflink,
+  // An in-kernel copy (copy_file_range), which some filesystems offload.
+  kCopyFileRange,
+  // A read/write copy through a user-space buffer.
+  kBuffered,
+};
+
+std::string_view CopyMethodName(CopyMethod method);
+
+// Copies `from` to `to`, replacing `to`, with the cheapest method that the
+// filesystems support, starting from `first`: methods that are not supported
+// fall back to the next one. Returns the method used, or std::nullopt on
+// failure.
+std::optional<CopyMethod> CopyFileFast(
+    const std::filesystem::path& from, const std::filesystem::path& to,
+    CopyMethod first = CopyMethod::kHardLink);
+
+// Writes `content` to `path`, replacing it.
+bool WriteFile(const std::filesystem::path& path, std::string_view content);
+
+// A suffix for a temporary file name that no other process or thread uses.
+std::string UniqueTemporarySuffix();
+
+// Writes to a temporary file first so that readers never observe a partially
+// written file.
+bool WriteFileAtomically(const std::filesystem::path& path,
+                         std::string_view content);
+
+// Copies like CopyFileFast, but to a temporary file that is then renamed to
+// `to`, so that readers never observe a partial copy.
+std::optional<CopyMethod> CopyFileAtomically(
+    const std::filesystem::path& from, const std::filesystem::path& to,
+    CopyMethod first = CopyMethod::kHardLink);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_FILE_COPY_H_
@@ -0,0 +1,121 @@
+#include "file_copy.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+
+namespace ioq3_map {
+namespace {
+
+std::string ReadAll(const std::filesystem::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+}
+
+void WriteAll(const std::filesystem::path& path, const std::string& content) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file << content;
+}
+
+class FileCopyTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    test_dir_ = std::filesystem::temp_directory_path() / "file_copy_test";
+    std::filesystem::remove_all(test_dir_);
+    std::filesystem::create_directories(test_dir_);
+
+    // Spans several buffers of the buffered copy.
+    std::mt19937 rng(3);
+    content_.resize(3 << 20);
+    for (char& c : content_) {
+      c = static_cast<char>(rng());
+    }
+    WriteAll(test_dir_ / "from.tga", content_);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(test_dir_); }
+
+  std::filesystem::path test_dir_;
+  std::string content_;
+};
+
+TEST_F(FileCopyTest, CopiesFromEveryMethod) {
+  for (CopyMethod first :
+       {CopyMethod::kHardLink, CopyMethod::kReflink, CopyMethod::kCopyFileRange,
+        CopyMethod::kBuffered}) {
+    // A linked destination would already be the source.
+    const std::filesystem::path to = test_dir_ / "to.tga";
+    std::filesystem::remove(to);
+    std::optional<CopyMethod> method =
+        CopyFileFast(test_dir_ / "from.tga", to, first);
+    ASSERT_TRUE(method.has_value()) << CopyMethodName(first);
+    EXPECT_GE(*method, first) << CopyMethodName(first);
+    EXPECT_EQ(ReadAll(to), content_) << CopyMethodName(*method);
+  }
+}
+
+TEST_F(FileCopyTest, CopiesAtomically) {
+  // The destination is a link to another file, which must be kept.
+  WriteAll(test_dir_ / "other.tga", "other");
+  std::filesystem::create_hard_link(test_dir_ / "other.tga",
+                                    test_dir_ / "to.tga");
+  for (CopyMethod first : {CopyMethod::kBuffered, CopyMethod::kHardLink}) {
+    std::optional<CopyMethod> method = CopyFileAtomically(
+        test_dir_ / "from.tga", test_dir_ / "to.tga", first);
+    ASSERT_TRUE(method.has_value()) << CopyMethodName(first);
+    EXPECT_GE(*method, first) << CopyMethodName(first);
+    EXPECT_EQ(ReadAll(test_dir_ / "to.tga"), content_);
+  }
+  EXPECT_EQ(ReadAll(test_dir_ / "other.tga"), "other");
+  EXPECT_EQ(CopyFileAtomically(test_dir_ / "from.tga", test_dir_ / "to.tga"),
+            CopyMethod::kExisting);
+
+  // No temporary file is left behind.
+  EXPECT_EQ(std::distance(std::filesystem::directory_iterator(test_dir_),
+                          std::filesystem::directory_iterator()),
+            3);
+}
+
+TEST_F(FileCopyTest, ReplacesDestinationWithoutWritingThroughLinks) {
+  // The destination is a link to another file, which must be kept.
+  WriteAll(test_dir_ / "other.tga", "other");
+  std::filesystem::create_hard_link(test_dir_ / "other.tga",
+                                    test_dir_ / "to.tga");
+  EXPECT_EQ(CopyFileFast(test_dir_ / "from.tga", test_dir_ / "to.tga",
+                         CopyMethod::kBuffered),
+            CopyMethod::kBuffered);
+  EXPECT_EQ(ReadAll(test_dir_ / "to.tga"), content_);
+  EXPECT_EQ(ReadAll(test_dir_ / "other.tga"), "other");
+}
+
+TEST_F(FileCopyTest, KeepsFileCopiedOntoItself) {
+  EXPECT_EQ(CopyFileFast(test_dir_ / "from.tga", test_dir_ / "from.tga"),
+            CopyMethod::kExisting);
+  EXPECT_EQ(ReadAll(test_dir_ / "from.tga"), content_);
+}
+
+TEST_F(FileCopyTest, FailsOnMissingSource) {
+  EXPECT_FALSE(CopyFileFast(test_dir_ / "missing.tga", test_dir_ / "to.tga")
+                   .has_value());
+  EXPECT_FALSE(std::filesystem::exists(test_dir_ / "to.tga"));
+}
+
+TEST_F(FileCopyTest, WritesFileAtomically) {
+  const std::filesystem::path path = test_dir_ / "to.ktx2";
+  ASSERT_TRUE(WriteFileAtomically(path, "first"));
+  ASSERT_TRUE(WriteFileAtomically(path, "second"));
+  EXPECT_EQ(ReadAll(path), "second");
+
+  // No temporary file is left behind.
+  EXPECT_EQ(std::distance(std::filesystem::directory_iterator(test_dir_),
+                          std::filesystem::directory_iterator()),
+            2);
+}
+
+}  // namespace
+}  // namespace ioq3_map
@@ -0,0 +1,258 @@
+#include "geometry_batching.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <span>
+
+#include "mesh_optimization.h"
+#include "mesh_simplification.h"
+
+namespace ioq3_map {
+namespace {
+
+// Appends the attribute of a surface, or zeros when it does not have it.
+template <typename T>
+void AppendAttribute(const std::vector<T>& from, size_t vertex_count,
+                     std::vector<T>* to) {
+  if (from.size() == vertex_count) {
+    to->insert(to->end(), from.begin(), from.end());
+  } else {
+    to->resize(to->size() + vertex_count, T::Zero());
+  }
+}
+
+void AppendGeometry(BSPSurfaceIndex surface, const Geometry& geo,
+                    GeometryBatch* batch) {
+  Geometry& merged = batch->geometry;
+  SurfaceRange range;
+  range.surface = surface;
+  range.first_index = static_cast<uint32_t>(merged.indices.size());
+  range.index_count = static_cast<uint32_t>(geo.indices.size());
+  range.first_vertex = static_cast<uint32_t>(merged.vertices.size());
+  range.vertex_count = static_cast<uint32_t>(geo.vertices.size());
+  batch->surfaces.push_back(range);
+
+  // Surfaces are in world space already, apart from those of a non-identity
+  // transform.
+  if (geo.transform.matrix().isIdentity()) {
+    merged.vertices.insert(merged.vertices.end(), geo.vertices.begin(),
+                           geo.vertices.end());
+    AppendAttribute(geo.normals, geo.vertices.size(), &merged.normals);
+  } else {
+    for (const Eigen::Vector3f& v : geo.vertices) {
+      merged.vertices.push_back(geo.transform * v);
+    }
+    const Eigen::Matrix3f normal_matrix =
+        geo.transform.linear().inverse().transpose();
+    std::vector<Eigen::Vector3f> normals;
+    normals.reserve(geo.normals.size());
+    for (const Eigen::Vector3f& n : geo.normals) {
+      normals.push_back((normal_matrix * n).normalized());
+    }
+    AppendAttribute(normals, geo.vertices.size(), &merged.normals);
+  }
+  AppendAttribute(geo.texture_uvs, geo.vertices.size(), &merged.texture_uvs);
+  AppendAttribute(geo.lightmap_uvs, geo.vertices.size(),
+                  &merged.lightmap_uvs);
+
+  for (uint32_t index : geo.indices) {
+    merged.indices.push_back(range.first_vertex + index);
+  }
+}
+
+// Drops the attributes that no surface of the batch has.
+void DropMissingAttributes(
+    const std::unordered_map<BSPSurfaceIndex, Geometry>& geometries,
+    GeometryBatch* batch) {
+  bool normals = false;
+  bool texture_uvs = false;
+  bool lightmap_uvs = false;
+  for (const SurfaceRange& range : batch->surfaces) {
+    const Geometry& geo = geometries.at(range.surface);
+    normals |= !geo.normals.empty();
+    texture_uvs |= !geo.texture_uvs.empty();
+    lightmap_uvs |= !geo.lightmap_uvs.empty();
+  }
+  if (!normals) batch->geometry.normals.clear();
+  if (!texture_uvs) batch->geometry.texture_uvs.clear();
+  if (!lightmap_uvs) batch->geometry.lightmap_uvs.clear();
+}
+
+// Sets the vertex range of every surface to the vertices its indices
+// reference.
+void UpdateVertexRanges(GeometryBatch* batch) {
+  for (SurfaceRange& range : batch->surfaces) {
+    if (range.index_count == 0) {
+      range.first_vertex = 0;
+      range.vertex_count = 0;
+      continue;
+    }
+    const auto first = batch->geometry.indices.begin() + range.first_index;
+    const auto [min_it, max_it] =
+        std::minmax_element(first, first + range.index_count);
+    range.first_vertex = *min_it;
+    range.vertex_count = *max_it - *min_it + 1;
+  }
+}
+
+// Updates the surface ranges after triangles were dropped: `kept_triangles`
+// tells whether each triangle of the indices the ranges refer to was kept.
+void UpdateSurfaceRanges(const std::vector<bool>& kept_triangles,
+                         GeometryBatch* batch) {
+  uint32_t first_index = 0;
+  for (SurfaceRange& range : batch->surfaces) {
+    uint32_t index_count = 0;
+    for (uint32_t t = range.first_index / 3;
+         t < (range.first_index + range.index_count) / 3; ++t) {
+      index_count += kept_triangles[t] ? 3 : 0;
+    }
+    range.first_index = first_index;
+    range.index_count = index_count;
+    first_index += index_count;
+  }
+  UpdateVertexRanges(batch);
+}
+
+nlohmann::json SurfaceRangesToJson(const std::vector<SurfaceRange>& ranges) {
+  nlohmann::json surfaces = nlohmann::json::array();
+  for (const SurfaceRange& range : ranges) {
+    surfaces.push_back({{"surface", range.surface},
+                        {"first_index", range.first_index},
+                        {"index_count", range.index_count},
+                        {"first_vertex", range.first_vertex},
+                        {"vertex_count", range.vertex_count}});
+  }
+  return surfaces;
+}
+
+}  // namespace
+
+std::vector<GeometryBatch> BatchGeometriesByMaterial(
+    const std::unordered_map<BSPSurfaceIndex, Geometry>& geometries,
+    size_t max_vertices,
+    const std::function<bool(BSPSurfaceIndex)>& filter) {
+  std::map<BSPTextureIndex, std::vector<BSPSurfaceIndex>> surfaces_by_material;
+  for (const auto& [surface, geo] : geometries) {
+    if (filter && !filter(surface)) {
+      continue;
+    }
+    surfaces_by_material[geo.material_id].push_back(surface);
+  }
+
+  std::vector<GeometryBatch> batches;
+  batches.reserve(surfaces_by_material.size());
+  for (auto& [material, surfaces] : surfaces_by_material) {
+    std::sort(surfaces.begin(), surfaces.end());
+
+    // Consecutive surfaces go to the same batch while their vertices fit.
+    for (size_t begin = 0; begin < surfaces.size();) {
+      size_t end = begin;
+      size_t num_vertices = 0;
+      size_t num_indices = 0;
+      while (end < surfaces.size()) {
+        const Geometry& geo = geometries.at(surfaces[end]);
+        if (end > begin && num_vertices + geo.vertices.size() > max_vertices) {
+          break;
+        }
+        num_vertices += geo.vertices.size();
+        num_indices += geo.indices.size();
+        ++end;
+      }
+      if (num_vertices > max_vertices) {
+        LOG(WARNING) << "Surface " << surfaces[begin] << " has "
+                     << num_vertices << " vertices, more than the "
+                     << max_vertices << " of a batch.";
+      }
+
+      GeometryBatch& batch = batches.emplace_back();
+      batch.geometry.material_id = material;
+      batch.geometry.vertices.reserve(num_vertices);
+      batch.geometry.normals.reserve(num_vertices);
+      batch.geometry.texture_uvs.reserve(num_vertices);
+      batch.geometry.lightmap_uvs.reserve(num_vertices);
+      batch.geometry.indices.reserve(num_indices);
+
+      for (size_t i = begin; i < end; ++i) {
+        AppendGeometry(surfaces[i], geometries.at(surfaces[i]), &batch);
+      }
+      DropMissingAttributes(geometries, &batch);
+      begin = end;
+    }
+  }
+  return batches;
+}
+
+WeldStats WeldGeometryBatch(const WeldOptions& options, GeometryBatch* batch) {
+  std::vector<bool> kept_triangles;
+  const WeldStats stats =
+      WeldVertices(options, &batch->geometry, &kept_triangles);
+
+  UpdateSurfaceRanges(kept_triangles, batch);
+  return stats;
+}
+
+void AddGeometryBatchLods(std::span<const float> ratios, GeometryBatch* batch) {
+  for (float ratio : ratios) {
+    GeometryBatch lod;
+    std::vector<bool> kept_triangles;
+    lod.geometry = SimplifyGeometry(batch->geometry, ratio, &kept_triangles);
+    lod.surfaces = batch->surfaces;
+    UpdateSurfaceRanges(kept_triangles, &lod);
+    batch->lods.push_back(std::move(lod));
+  }
+}
+
+void OptimizeGeometryBatch(GeometryBatch* batch) {
+  Geometry& geo = batch->geometry;
+  for (const SurfaceRange& range : batch->surfaces) {
+    // Each surface is optimized within its own vertex range, rather than
+    // over the vertices of the whole batch.
+    const std::span<uint32_t> indices =
+        std::span(geo.indices).subspan(range.first_index, range.index_count);
+    for (uint32_t& index : indices) {
+      index -= range.first_vertex;
+    }
+    OptimizeVertexCache(indices, range.vertex_count);
+    for (uint32_t& index : indices) {
+      index += range.first_vertex;
+    }
+  }
+  OptimizeVertexFetch(&geo);
+  UpdateVertexRanges(batch);
+
+  for (GeometryBatch& lod : batch->lods) {
+    OptimizeGeometryBatch(&lod);
+  }
+}
+
+bool SaveBatchManifest(std::span<const GeometryBatch> batches,
+                       const std::filesystem::path& path) {
+  nlohmann::json json_batches = nlohmann::json::array();
+  for (const GeometryBatch& batch : batches) {
+    nlohmann::json json_batch = {
+        {"material", batch.geometry.material_id},
+        {"surfaces", SurfaceRangesToJson(batch.surfaces)}};
+    if (!batch.lods.empty()) {
+      nlohmann::json lods = nlohmann::json::array();
+      for (const GeometryBatch& lod : batch.lods) {
+        lods.push_back({{"surfaces", SurfaceRangesToJson(lod.surfaces)}});
+      }
+      json_batch["lods"] = std::move(lods);
+    }
+    json_batches.push_back(std::move(json_batch));
+  }
+
+  std::ofstream file(path, std::ios::trunc);
+  file << nlohmann::json{{"batches", std::move(json_batches)}}.dump(2);
+  if (!file) {
+    LOG(ERROR) << "Failed to write the batch manifest to " << path;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace ioq3_map
@@ -0,0 +1,88 @@
+#ifndef IOQ3_MAP_GEOMETRY_BATCHING_H_
+#define IOQ3_MAP_GEOMETRY_BATCHING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "bsp_geometry.h"
+#include "scene.h"
+#include "vertex_welding.h"
+
+namespace ioq3_map {
+
+// Where a surface ended up in a merged geometry.
+struct SurfaceRange {
+  BSPSurfaceIndex surface = -1;
+
+  uint32_t first_index = 0;
+  uint32_t index_count = 0;
+  uint32_t first_vertex = 0;
+  uint32_t vertex_count = 0;
+};
+
+// The surfaces of one material, merged into a single geometry so that they
+// can be drawn with one call.
+struct GeometryBatch {
+  // In world space: the transforms of the surfaces are applied, and the
+  // geometry's transform is the identity. Indices are rebased onto the
+  // merged vertices.
+  Geometry geometry;
+
+  // In surface order.
+  std::vector<SurfaceRange> surfaces;
+
+  // Simplified versions of the batch, from the finest to the coarsest, with
+  // their own surface ranges. The lods have no lods themselves.
+  std::vector<GeometryBatch> lods;
+};
+
+// Merges the geometries that share a material. Batches are sorted by
+// material, and the surfaces of a batch by surface index, so the result does
+// not depend on the iteration order of the map. An attribute is kept when any
+// surface of the batch has it, and zero-filled for the surfaces that do not.
+//
+// The surfaces of a material are split into consecutive batches of at most
+// `max_vertices` vertices, e.g. so that their indices fit 16 bits. Surfaces
+// are not split: a surface with more vertices makes a batch of its own.
+//
+// Only the surfaces that pass `filter`, when there is one, are batched, e.g.
+// those of the world (see IsWorldSurface).
+std::vector<GeometryBatch> BatchGeometriesByMaterial(
+    const std::unordered_map<BSPSurfaceIndex, Geometry>& geometries,
+    size_t max_vertices = SIZE_MAX,
+    const std::function<bool(BSPSurfaceIndex)>& filter = nullptr);
+
+// Welds the vertices of the batch (see WeldVertices), across its surfaces,
+// and updates the surface ranges. The vertex range of a surface then spans
+// the vertices it references, which may be shared with other surfaces.
+WeldStats WeldGeometryBatch(const WeldOptions& options, GeometryBatch* batch);
+
+// Optimizes the batch for the vertex cache and then for vertex fetch (see
+// mesh_optimization.h). Triangles are reordered within their surface, so the
+// index ranges are kept, and the vertex ranges are updated. So are the lods.
+void OptimizeGeometryBatch(GeometryBatch* batch);
+
+// Adds a level of detail to the batch for every ratio, simplified from the
+// batch to about that ratio of its triangles (see SimplifyGeometry).
+// Simplification keeps the order of the triangles, so every lod has its own
+// surface ranges.
+void AddGeometryBatchLods(std::span<const float> ratios, GeometryBatch* batch);
+
+// Writes the surface ranges of the batches as JSON, so that per-surface
+// identity survives the merge:
+//   {"batches": [{"material": 3, "surfaces": [{"surface": 12,
+//     "first_index": 0, "index_count": 6, "first_vertex": 0,
+//     "vertex_count": 4}, ...], "lods": [{"surfaces": [...]}, ...]}, ...]}
+// Batch i is the i-th primitive of the merged mesh, and lod j of a batch the
+// i-th primitive of the j-th lod mesh.
+bool SaveBatchManifest(std::span<const GeometryBatch> batches,
+                       const std::filesystem::path& path);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_GEOMETRY_BATCHING_H_
@@ -0,0 +1,278 @@
+#include "geometry_batching.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <numbers>
+#include <unordered_map>
+
+#include "scene.h"
+#include "test_util.h"
+
+namespace ioq3_map {
+namespace {
+
+Geometry CreateTriangle(BSPTextureIndex material, float offset) {
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(offset, 0, 0),
+                  Eigen::Vector3f(offset + 1, 0, 0),
+                  Eigen::Vector3f(offset, 1, 0)};
+  geo.normals = {Eigen::Vector3f::UnitZ(), Eigen::Vector3f::UnitZ(),
+                 Eigen::Vector3f::UnitZ()};
+  geo.texture_uvs = {Eigen::Vector2f(0, 0), Eigen::Vector2f(1, 0),
+                     Eigen::Vector2f(0, 1)};
+  geo.indices = {0, 1, 2};
+  geo.material_id = material;
+  return geo;
+}
+
+TEST(GeometryBatchingTest, MergesSurfacesByMaterial) {
+  std::unordered_map<BSPSurfaceIndex, Geometry> geometries;
+  geometries[7] = CreateTriangle(/*material=*/1, 0);
+  geometries[2] = CreateTriangle(/*material=*/1, 10);
+  geometries[5] = CreateTriangle(/*material=*/0, 20);
+
+  const std::vector<GeometryBatch> batches =
+      BatchGeometriesByMaterial(geometries);
+  ASSERT_EQ(batches.size(), 2);
+
+  EXPECT_EQ(batches[0].geometry.material_id, 0);
+  ASSERT_EQ(batches[0].surfaces.size(), 1);
+  EXPECT_EQ(batches[0].surfaces[0].surface, 5);
+
+  // Surfaces are in surface order, and their indices are rebased.
+  const GeometryBatch& batch = batches[1];
+  EXPECT_EQ(batch.geometry.material_id, 1);
+  ASSERT_EQ(batch.surfaces.size(), 2);
+  EXPECT_EQ(batch.surfaces[0].surface, 2);
+  EXPECT_EQ(batch.surfaces[1].surface, 7);
+  EXPECT_EQ(batch.surfaces[1].first_index, 3);
+  EXPECT_EQ(batch.surfaces[1].index_count, 3);
+  EXPECT_EQ(batch.surfaces[1].first_vertex, 3);
+  EXPECT_EQ(batch.surfaces[1].vertex_count, 3);
+
+  EXPECT_EQ(batch.geometry.indices,
+            (std::vector<uint32_t>{0, 1, 2, 3, 4, 5}));
+  ASSERT_EQ(batch.geometry.vertices.size(), 6);
+  EXPECT_EQ(batch.geometry.vertices[0], Eigen::Vector3f(10, 0, 0));
+  EXPECT_EQ(batch.geometry.vertices[3], Eigen::Vector3f(0, 0, 0));
+  EXPECT_EQ(batch.geometry.normals.size(), 6);
+  EXPECT_EQ(batch.geometry.texture_uvs.size(), 6);
+  EXPECT_TRUE(batch.geometry.lightmap_uvs.empty());
+}
+
+TEST(GeometryBatchingTest, SplitsBatchesAtMaxVertices) {
+  std::unordered_map<BSPSurfaceIndex, Geometry> geometries;
+  for (int i = 0; i < 5; ++i) {
+    geometries[i] = CreateTriangle(/*material=*/0, i * 10.0f);
+  }
+  geometries[5] = CreateTriangle(/*material=*/1, 50);
+
+  // 7 vertices hold 2 triangles of 3 vertices.
+  const std::vector<GeometryBatch> batches =
+      BatchGeometriesByMaterial(geometries, /*max_vertices=*/7);
+  ASSERT_EQ(batches.size(), 4);
+  const std::vector<std::vector<BSPSurfaceIndex>> expected = {
+      {0, 1}, {2, 3}, {4}, {5}};
+  for (size_t i = 0; i < batches.size(); ++i) {
+    std::vector<BSPSurfaceIndex> surfaces;
+    for (const SurfaceRange& range : batches[i].surfaces) {
+      surfaces.push_back(range.surface);
+    }
+    EXPECT_EQ(surfaces, expected[i]) << i;
+    EXPECT_LE(batches[i].geometry.vertices.size(), 7);
+  }
+  EXPECT_EQ(batches[1].geometry.indices,
+            (std::vector<uint32_t>{0, 1, 2, 3, 4, 5}));
+  EXPECT_EQ(batches[3].geometry.material_id, 1);
+
+  // A surface larger than a batch is kept whole.
+  EXPECT_EQ(BatchGeometriesByMaterial(geometries, /*max_vertices=*/2).size(),
+            6);
+}
+
+TEST(GeometryBatchingTest, BatchesOnlyFilteredSurfaces) {
+  // Surfaces 0 and 1 are the world, and surface 2 a door of the same
+  // material.
+  Scene scene;
+  for (int i = 0; i < 3; ++i) {
+    scene.geometries[i] = CreateTriangle(/*material=*/0, i * 10.0f);
+  }
+  scene.first_world_surface = 0;
+  scene.num_world_surfaces = 2;
+
+  const std::vector<GeometryBatch> batches = BatchGeometriesByMaterial(
+      scene.geometries, SIZE_MAX, [&](BSPSurfaceIndex surface) {
+        return IsWorldSurface(scene, surface);
+      });
+  ASSERT_EQ(batches.size(), 1);
+  ASSERT_EQ(batches[0].surfaces.size(), 2);
+  EXPECT_EQ(batches[0].surfaces[0].surface, 0);
+  EXPECT_EQ(batches[0].surfaces[1].surface, 1);
+  EXPECT_EQ(batches[0].geometry.vertices.size(), 6);
+}
+
+TEST(GeometryBatchingTest, FillsMissingAttributesAndAppliesTransforms) {
+  std::unordered_map<BSPSurfaceIndex, Geometry> geometries;
+  geometries[0] = CreateTriangle(/*material=*/0, 0);
+  geometries[1] = CreateTriangle(/*material=*/0, 0);
+  geometries[1].texture_uvs.clear();
+  const float angle = std::numbers::pi_v<float> / 2;
+  geometries[1].transform = Eigen::Translation3f(0, 0, 5) *
+                            Eigen::AngleAxisf(angle, Eigen::Vector3f::UnitX());
+
+  const std::vector<GeometryBatch> batches =
+      BatchGeometriesByMaterial(geometries);
+  ASSERT_EQ(batches.size(), 1);
+  const Geometry& merged = batches[0].geometry;
+  ASSERT_EQ(merged.texture_uvs.size(), 6);
+  EXPECT_EQ(merged.texture_uvs[4], Eigen::Vector2f::Zero());
+
+  EXPECT_TRUE(merged.vertices[5].isApprox(Eigen::Vector3f(0, 0, 6)));
+  EXPECT_TRUE(merged.normals[5].isApprox(Eigen::Vector3f(0, -1, 0)));
+  EXPECT_TRUE(merged.transform.matrix().isIdentity());
+}
+
+TEST(GeometryBatchingTest, WeldGeometryBatchUpdatesSurfaceRanges) {
+  // The two triangles share their edge from (1, 0, 0) to (0, 1, 0).
+  std::unordered_map<BSPSurfaceIndex, Geometry> geometries;
+  geometries[0] = CreateTriangle(/*material=*/0, 0);
+  geometries[1] = CreateTriangle(/*material=*/0, 0);
+  geometries[1].vertices[0] = Eigen::Vector3f(1, 1, 0);
+  geometries[1].texture_uvs = geometries[0].texture_uvs;
+  std::swap(geometries[1].texture_uvs[0], geometries[1].texture_uvs[2]);
+  std::swap(geometries[1].vertices[0], geometries[1].vertices[2]);
+
+  std::vector<GeometryBatch> batches = BatchGeometriesByMaterial(geometries);
+  ASSERT_EQ(batches.size(), 1);
+  const WeldStats stats = WeldGeometryBatch(WeldOptions(), &batches[0]);
+  EXPECT_EQ(stats.vertices_before, 6);
+  EXPECT_EQ(stats.vertices_after, 4);
+
+  const std::vector<SurfaceRange>& surfaces = batches[0].surfaces;
+  ASSERT_EQ(surfaces.size(), 2);
+  EXPECT_EQ(surfaces[1].first_index, 3);
+  EXPECT_EQ(surfaces[1].index_count, 3);
+  EXPECT_EQ(surfaces[1].first_vertex, 1);
+  EXPECT_EQ(surfaces[1].vertex_count, 3);
+}
+
+TEST(GeometryBatchingTest, OptimizeGeometryBatchKeepsSurfaceTriangles) {
+  // A lone triangle, then a 4x4 grid from the 4th vertex of the batch.
+  std::unordered_map<BSPSurfaceIndex, Geometry> geometries;
+  geometries[0] = CreateTriangle(/*material=*/0, 10);
+  Geometry& grid = geometries[1];
+  grid.material_id = 0;
+  for (int y = 0; y <= 4; ++y) {
+    for (int x = 0; x <= 4; ++x) {
+      grid.vertices.push_back(Eigen::Vector3f(x, y, 0));
+    }
+  }
+  grid.indices = GridIndices(4);
+
+  std::vector<GeometryBatch> batches = BatchGeometriesByMaterial(geometries);
+  ASSERT_EQ(batches.size(), 1);
+  GeometryBatch& batch = batches[0];
+
+  // The centroids of the triangles of every surface, in any order.
+  auto centroids = [&](const SurfaceRange& range) {
+    std::vector<std::array<float, 3>> result;
+    for (uint32_t i = range.first_index;
+         i < range.first_index + range.index_count; i += 3) {
+      Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+      for (int k = 0; k < 3; ++k) {
+        sum += batch.geometry.vertices[batch.geometry.indices[i + k]];
+      }
+      result.push_back({sum.x(), sum.y(), sum.z()});
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+  const auto triangle = centroids(batch.surfaces[0]);
+  const auto grid_triangles = centroids(batch.surfaces[1]);
+
+  OptimizeGeometryBatch(&batch);
+  ASSERT_EQ(batch.surfaces.size(), 2);
+  EXPECT_EQ(centroids(batch.surfaces[0]), triangle);
+  EXPECT_EQ(centroids(batch.surfaces[1]), grid_triangles);
+  for (const SurfaceRange& range : batch.surfaces) {
+    for (uint32_t i = range.first_index;
+         i < range.first_index + range.index_count; ++i) {
+      EXPECT_GE(batch.geometry.indices[i], range.first_vertex);
+      EXPECT_LT(batch.geometry.indices[i],
+                range.first_vertex + range.vertex_count);
+    }
+  }
+}
+
+TEST(GeometryBatchingTest, AddGeometryBatchLods) {
+  // A flat 4x4 grid, whose interior simplifies away, and a lone triangle,
+  // which is all border.
+  Geometry grid;
+  grid.material_id = 0;
+  for (int y = 0; y <= 4; ++y) {
+    for (int x = 0; x <= 4; ++x) {
+      grid.vertices.push_back(Eigen::Vector3f(x, y, 0));
+    }
+  }
+  for (uint32_t y = 0; y < 4; ++y) {
+    for (uint32_t x = 0; x < 4; ++x) {
+      const uint32_t v0 = y * 5 + x;
+      grid.indices.insert(grid.indices.end(),
+                          {v0, v0 + 1, v0 + 6, v0, v0 + 6, v0 + 5});
+    }
+  }
+  std::unordered_map<BSPSurfaceIndex, Geometry> geometries;
+  geometries[0] = grid;
+  geometries[1] = CreateTriangle(/*material=*/0, 10);
+  geometries[1].normals.clear();
+  geometries[1].texture_uvs.clear();
+
+  std::vector<GeometryBatch> batches = BatchGeometriesByMaterial(geometries);
+  ASSERT_EQ(batches.size(), 1);
+  const std::vector<float> ratios = {0.0f};
+  AddGeometryBatchLods(ratios, &batches[0]);
+  ASSERT_EQ(batches[0].lods.size(), 1);
+
+  const GeometryBatch& lod = batches[0].lods[0];
+  ASSERT_EQ(lod.surfaces.size(), 2);
+  EXPECT_EQ(lod.surfaces[0].first_index, 0);
+  EXPECT_LT(lod.surfaces[0].index_count, grid.indices.size());
+  EXPECT_EQ(lod.surfaces[0].vertex_count, 16);
+  EXPECT_EQ(lod.surfaces[1].first_index, lod.surfaces[0].index_count);
+  EXPECT_EQ(lod.surfaces[1].index_count, 3);
+  EXPECT_EQ(lod.surfaces[1].first_vertex, 16);
+  EXPECT_EQ(lod.geometry.indices.size(),
+            lod.surfaces[0].index_count + lod.surfaces[1].index_count);
+}
+
+TEST(GeometryBatchingTest, SaveBatchManifest) {
+  std::unordered_map<BSPSurfaceIndex, Geometry> geometries;
+  geometries[3] = CreateTriangle(/*material=*/4, 0);
+  geometries[9] = CreateTriangle(/*material=*/4, 1);
+
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "batch_manifest_test.json";
+  ASSERT_TRUE(SaveBatchManifest(BatchGeometriesByMaterial(geometries), path));
+
+  std::ifstream file(path);
+  const nlohmann::json manifest = nlohmann::json::parse(file);
+  ASSERT_EQ(manifest["batches"].size(), 1);
+  const nlohmann::json& batch = manifest["batches"][0];
+  EXPECT_EQ(batch["material"], 4);
+  ASSERT_EQ(batch["surfaces"].size(), 2);
+  EXPECT_EQ(batch["surfaces"][1]["surface"], 9);
+  EXPECT_EQ(batch["surfaces"][1]["first_index"], 3);
+  EXPECT_EQ(batch["surfaces"][1]["index_count"], 3);
+  EXPECT_EQ(batch["surfaces"][1]["first_vertex"], 3);
+  EXPECT_EQ(batch["surfaces"][1]["vertex_count"], 3);
+
+  std::filesystem::remove(path);
+}
+
+}  // namespace
+}  // namespace ioq3_map
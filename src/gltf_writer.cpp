@@ -0,0 +1,211 @@
+#include "gltf_writer.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+
+namespace ioq3_map {
+namespace {
+
+constexpr uint32_t kGlbMagic = 0x46546C67;      // "glTF"
+constexpr uint32_t kGlbVersion = 2;
+constexpr uint32_t kGlbChunkJson = 0x4E4F534A;  // "JSON"
+constexpr uint32_t kGlbChunkBin = 0x004E4942;   // "BIN\0"
+
+constexpr char kMeshoptCompression[] = "EXT_meshopt_compression";
+
+size_t Align4(size_t size) { return (size + 3) & ~size_t{3}; }
+
+// GLB is little-endian, like every platform the exporter runs on.
+void WriteUint32(uint32_t value, std::ostream& out) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void WritePadding(size_t size, char c, std::ostream& out) {
+  for (size_t i = 0; i < size; ++i) {
+    out.put(c);
+  }
+}
+
+}  // namespace
+
+size_t GltfComponentSize(int component_type) {
+  switch (component_type) {
+    case kGltfComponentTypeByte:
+    case kGltfComponentTypeUnsignedByte:
+      return 1;
+    case kGltfComponentTypeShort:
+    case kGltfComponentTypeUnsignedShort:
+      return 2;
+    default:
+      return 4;
+  }
+}
+
+GltfWriter::GltfWriter() {
+  document_["asset"] = {{"generator", "ioq3-map-exporter"},
+                        {"version", "2.0"}};
+}
+
+int GltfWriter::Add(const std::string& name, nlohmann::json value) {
+  nlohmann::json& array = document_[name];
+  array.push_back(std::move(value));
+  return static_cast<int>(array.size() - 1);
+}
+
+void GltfWriter::UseExtension(const std::string& extension, bool required) {
+  auto add_once = [&extension](nlohmann::json& extensions) {
+    if (std::find(extensions.begin(), extensions.end(), extension) ==
+        extensions.end()) {
+      extensions.push_back(extension);
+    }
+  };
+  add_once(document_["extensionsUsed"]);
+  if (required) {
+    add_once(document_["extensionsRequired"]);
+  }
+}
+
+size_t GltfWriter::AddBufferData(size_t byte_length, ViewWriter writer) {
+  const size_t byte_offset = Align4(byte_length_);
+  views_.push_back({byte_offset, byte_length, std::move(writer)});
+  byte_length_ = byte_offset + byte_length;
+  return byte_offset;
+}
+
+int GltfWriter::AddBufferView(size_t byte_length, size_t byte_stride,
+                              int target, ViewWriter writer) {
+  const size_t byte_offset = AddBufferData(byte_length, std::move(writer));
+  nlohmann::json view = {
+      {"buffer", 0}, {"byteOffset", byte_offset}, {"byteLength", byte_length}};
+  if (byte_stride != 0) {
+    view["byteStride"] = byte_stride;
+  }
+  if (target != 0) {
+    view["target"] = target;
+  }
+  return Add("bufferViews", std::move(view));
+}
+
+int GltfWriter::AddMeshoptBufferView(size_t count, size_t byte_stride,
+                                     int target, const std::string& mode,
+                                     std::vector<uint8_t> data) {
+  UseExtension(kMeshoptCompression, /*required=*/true);
+  const size_t data_length = data.size();
+  const size_t data_offset = AddBufferData(
+      data_length, [data = std::move(data)](std::ostream& out) {
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+      });
+
+  // Index views have no stride, but their elements still have a size.
+  const size_t byte_length = count * byte_stride;
+  const size_t byte_offset = Align4(fallback_byte_length_);
+  fallback_byte_length_ = byte_offset + byte_length;
+  nlohmann::json view = {{"buffer", 1},
+                         {"byteOffset", byte_offset},
+                         {"byteLength", byte_length},
+                         {"target", target}};
+  if (target == kGltfTargetArrayBuffer) {
+    view["byteStride"] = byte_stride;
+  }
+  view["extensions"][kMeshoptCompression] = {{"buffer", 0},
+                                             {"byteOffset", data_offset},
+                                             {"byteLength", data_length},
+                                             {"byteStride", byte_stride},
+                                             {"count", count},
+                                             {"mode", mode}};
+  return Add("bufferViews", std::move(view));
+}
+
+bool GltfWriter::WriteBuffer(std::ostream& out) const {
+  const std::streampos start = out.tellp();
+  auto position = [&] { return static_cast<size_t>(out.tellp() - start); };
+  for (const View& view : views_) {
+    WritePadding(view.byte_offset - position(), '\0', out);
+    view.writer(out);
+    if (!out) {
+      return false;
+    }
+    const size_t written = position() - view.byte_offset;
+    if (written != view.byte_length) {
+      LOG(ERROR) << "Buffer view wrote " << written << " bytes, planned "
+                 << view.byte_length;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool GltfWriter::Write(const std::filesystem::path& path, bool binary) const {
+  nlohmann::json document = document_;
+  if (byte_length_ > 0) {
+    document["buffers"] = {{{"byteLength", byte_length_}}};
+  }
+  if (fallback_byte_length_ > 0) {
+    document["buffers"].push_back(
+        {{"byteLength", fallback_byte_length_},
+         {"extensions", {{kMeshoptCompression, {{"fallback", true}}}}}});
+  }
+
+  if (!binary) {
+    if (byte_length_ > 0) {
+      std::filesystem::path bin_path = path;
+      bin_path.replace_extension(".bin");
+      document["buffers"][0]["uri"] = bin_path.filename().string();
+      std::ofstream bin(bin_path, std::ios::binary | std::ios::trunc);
+      if (!WriteBuffer(bin)) {
+        LOG(ERROR) << "Failed to write the glTF buffer to " << bin_path;
+        return false;
+      }
+    }
+    std::ofstream file(path, std::ios::trunc);
+    file << document.dump();
+    if (!file) {
+      LOG(ERROR) << "Failed to write glTF file to " << path;
+      return false;
+    }
+    return true;
+  }
+
+  // The JSON chunk is padded with spaces and the binary chunk with zeros.
+  const std::string json = document.dump();
+  const size_t json_length = Align4(json.size());
+  const size_t bin_length = Align4(byte_length_);
+  size_t total_length = 12 + 8 + json_length;
+  if (bin_length > 0) {
+    total_length += 8 + bin_length;
+  }
+
+  if (total_length > UINT32_MAX) {
+    LOG(ERROR) << "The scene does not fit in a GLB file: " << total_length
+               << " bytes";
+    return false;
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  WriteUint32(kGlbMagic, file);
+  WriteUint32(kGlbVersion, file);
+  WriteUint32(static_cast<uint32_t>(total_length), file);
+  WriteUint32(static_cast<uint32_t>(json_length), file);
+  WriteUint32(kGlbChunkJson, file);
+  file.write(json.data(), json.size());
+  WritePadding(json_length - json.size(), ' ', file);
+  if (bin_length > 0) {
+    WriteUint32(static_cast<uint32_t>(bin_length), file);
+    WriteUint32(kGlbChunkBin, file);
+    if (!WriteBuffer(file)) {
+      LOG(ERROR) << "Failed to write the GLB binary chunk to " << path;
+      return false;
+    }
+    WritePadding(bin_length - byte_length_, '\0', file);
+  }
+  if (!file) {
+    LOG(ERROR) << "Failed to write GLB file to " << path;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace ioq3_map
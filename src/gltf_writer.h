@@ -0,0 +1,97 @@
+#ifndef IOQ3_MAP_GLTF_WRITER_H_
+#define IOQ3_MAP_GLTF_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <nlohmann/json.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ioq3_map {
+
+// glTF enum values.
+constexpr int kGltfComponentTypeByte = 5120;
+constexpr int kGltfComponentTypeUnsignedByte = 5121;
+constexpr int kGltfComponentTypeShort = 5122;
+constexpr int kGltfComponentTypeUnsignedShort = 5123;
+constexpr int kGltfComponentTypeUnsignedInt = 5125;
+constexpr int kGltfComponentTypeFloat = 5126;
+constexpr int kGltfTargetArrayBuffer = 34962;
+constexpr int kGltfTargetElementArrayBuffer = 34963;
+constexpr int kGltfModeTriangles = 4;
+
+// The size in bytes of a component of the type, e.g. 2 for
+// kGltfComponentTypeShort.
+size_t GltfComponentSize(int component_type);
+
+// Writes a glTF asset without holding its binary buffer in memory. The buffer
+// is planned as a sequence of views of which only the lengths are known up
+// front. The content of a view is produced by its callback as the file is
+// written, so at most one view is encoded at a time, and the JSON only holds
+// metadata.
+class GltfWriter {
+ public:
+  // Writes the content of a view, exactly its planned length, to `out`.
+  using ViewWriter = std::function<void(std::ostream& out)>;
+
+  GltfWriter();
+
+  // The glTF JSON. "buffers" and "bufferViews" are filled in by the writer.
+  nlohmann::json& document() { return document_; }
+
+  // Appends `value` to the top-level array `name`, e.g. "meshes", and returns
+  // its index.
+  int Add(const std::string& name, nlohmann::json value);
+
+  // Adds the extension to "extensionsUsed", and to "extensionsRequired" if
+  // the asset cannot be loaded without it, once.
+  void UseExtension(const std::string& extension, bool required = false);
+
+  // Plans a view of `byte_length` bytes at the next 4-byte boundary of the
+  // buffer and returns its index. A `byte_stride` or `target` of 0 is left
+  // out of the view.
+  int AddBufferView(size_t byte_length, size_t byte_stride, int target,
+                    ViewWriter writer);
+
+  // Plans a view compressed with EXT_meshopt_compression. `data` holds its
+  // `count` elements of `byte_stride` bytes encoded in `mode`, "ATTRIBUTES"
+  // or "TRIANGLES" (see meshopt_compression.h), and is stored in the buffer.
+  // The view itself covers a fallback buffer without content, which loaders
+  // decode the data into, so the extension is required.
+  int AddMeshoptBufferView(size_t count, size_t byte_stride, int target,
+                           const std::string& mode, std::vector<uint8_t> data);
+
+  // The length of the planned buffer.
+  size_t byte_length() const { return byte_length_; }
+
+  // Writes a GLB file, with the buffer as its binary chunk, or a .gltf file
+  // with the buffer in a .bin file next to it. Fails if a view writes a
+  // different number of bytes than planned.
+  bool Write(const std::filesystem::path& path, bool binary) const;
+
+ private:
+  struct View {
+    size_t byte_offset = 0;
+    size_t byte_length = 0;
+    ViewWriter writer;
+  };
+
+  // Plans `byte_length` bytes of the buffer at the next 4-byte boundary and
+  // returns their offset.
+  size_t AddBufferData(size_t byte_length, ViewWriter writer);
+
+  // Streams the views, padded to their offsets, to `out`.
+  bool WriteBuffer(std::ostream& out) const;
+
+  nlohmann::json document_;
+  std::vector<View> views_;
+  size_t byte_length_ = 0;
+  size_t fallback_byte_length_ = 0;
+};
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_GLTF_WRITER_H_
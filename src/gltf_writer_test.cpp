@@ -0,0 +1,155 @@
+#include "gltf_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace ioq3_map {
+namespace {
+
+std::string ReadAll(const std::filesystem::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+}
+
+uint32_t ReadUint32(const std::string& data, size_t offset) {
+  uint32_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+class GltfWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    test_dir_ = std::filesystem::temp_directory_path() / "gltf_writer_test";
+    std::filesystem::create_directories(test_dir_);
+
+    // Two views of 3 and 4 bytes: the second starts at offset 4.
+    writer_.AddBufferView(3, 0, 0, [](std::ostream& out) { out << "abc"; });
+    writer_.AddBufferView(4, 4, kGltfTargetArrayBuffer,
+                          [](std::ostream& out) { out << "wxyz"; });
+    writer_.UseExtension("EXT_test");
+    writer_.UseExtension("EXT_test");
+    writer_.Add("meshes", {{"name", "Mesh"}});
+  }
+
+  void TearDown() override { std::filesystem::remove_all(test_dir_); }
+
+  std::filesystem::path test_dir_;
+  GltfWriter writer_;
+};
+
+TEST_F(GltfWriterTest, WritesGltfAndBin) {
+  EXPECT_EQ(writer_.byte_length(), 8);
+  ASSERT_TRUE(writer_.Write(test_dir_ / "scene.gltf", /*binary=*/false));
+
+  EXPECT_EQ(ReadAll(test_dir_ / "scene.bin"), std::string("abc\0wxyz", 8));
+
+  const nlohmann::json document =
+      nlohmann::json::parse(ReadAll(test_dir_ / "scene.gltf"));
+  EXPECT_EQ(document["asset"]["version"], "2.0");
+  EXPECT_EQ(document["buffers"][0]["uri"], "scene.bin");
+  EXPECT_EQ(document["buffers"][0]["byteLength"], 8);
+  ASSERT_EQ(document["bufferViews"].size(), 2);
+  EXPECT_FALSE(document["bufferViews"][0].contains("byteStride"));
+  EXPECT_FALSE(document["bufferViews"][0].contains("target"));
+  EXPECT_EQ(document["bufferViews"][1]["byteOffset"], 4);
+  EXPECT_EQ(document["bufferViews"][1]["byteLength"], 4);
+  EXPECT_EQ(document["bufferViews"][1]["byteStride"], 4);
+  EXPECT_EQ(document["bufferViews"][1]["target"], kGltfTargetArrayBuffer);
+  EXPECT_EQ(document["extensionsUsed"], nlohmann::json({"EXT_test"}));
+  EXPECT_EQ(document["meshes"][0]["name"], "Mesh");
+}
+
+TEST_F(GltfWriterTest, WritesGlb) {
+  const std::filesystem::path path = test_dir_ / "scene.glb";
+  ASSERT_TRUE(writer_.Write(path, /*binary=*/true));
+  EXPECT_FALSE(std::filesystem::exists(test_dir_ / "scene.bin"));
+
+  const std::string glb = ReadAll(path);
+  ASSERT_GE(glb.size(), 20);
+  EXPECT_EQ(glb.substr(0, 4), "glTF");
+  EXPECT_EQ(ReadUint32(glb, 4), 2);
+  EXPECT_EQ(ReadUint32(glb, 8), glb.size());
+
+  const uint32_t json_length = ReadUint32(glb, 12);
+  EXPECT_EQ(json_length % 4, 0);
+  EXPECT_EQ(glb.substr(16, 4), "JSON");
+  const nlohmann::json document =
+      nlohmann::json::parse(glb.substr(20, json_length));
+  EXPECT_FALSE(document["buffers"][0].contains("uri"));
+  EXPECT_EQ(document["buffers"][0]["byteLength"], 8);
+
+  const size_t bin_chunk = 20 + json_length;
+  ASSERT_EQ(glb.size(), bin_chunk + 8 + 8);
+  EXPECT_EQ(ReadUint32(glb, bin_chunk), 8);
+  EXPECT_EQ(glb.substr(bin_chunk + 4, 4), std::string("BIN\0", 4));
+  EXPECT_EQ(glb.substr(bin_chunk + 8), std::string("abc\0wxyz", 8));
+}
+
+TEST_F(GltfWriterTest, WritesMeshoptViews) {
+  // 2 vertices of 8 bytes, compressed to 5 bytes at offset 8.
+  writer_.AddMeshoptBufferView(2, 8, kGltfTargetArrayBuffer, "ATTRIBUTES",
+                               {1, 2, 3, 4, 5});
+  writer_.AddMeshoptBufferView(3, 4, kGltfTargetElementArrayBuffer,
+                               "TRIANGLES", {6, 7});
+  EXPECT_EQ(writer_.byte_length(), 18);
+  ASSERT_TRUE(writer_.Write(test_dir_ / "scene.gltf", /*binary=*/false));
+
+  EXPECT_EQ(ReadAll(test_dir_ / "scene.bin"),
+            std::string("abc\0wxyz\1\2\3\4\5\0\0\0\6\7", 18));
+
+  const nlohmann::json document =
+      nlohmann::json::parse(ReadAll(test_dir_ / "scene.gltf"));
+  EXPECT_EQ(document["extensionsRequired"],
+            nlohmann::json({"EXT_meshopt_compression"}));
+  ASSERT_EQ(document["buffers"].size(), 2);
+  EXPECT_FALSE(document["buffers"][1].contains("uri"));
+  EXPECT_EQ(document["buffers"][1]["byteLength"], 28);
+  EXPECT_EQ(document["buffers"][1]["extensions"]["EXT_meshopt_compression"]
+                    ["fallback"],
+            true);
+
+  const nlohmann::json& vertices = document["bufferViews"][2];
+  EXPECT_EQ(vertices["buffer"], 1);
+  EXPECT_EQ(vertices["byteOffset"], 0);
+  EXPECT_EQ(vertices["byteLength"], 16);
+  EXPECT_EQ(vertices["byteStride"], 8);
+  EXPECT_EQ(vertices["extensions"]["EXT_meshopt_compression"],
+            nlohmann::json({{"buffer", 0},
+                            {"byteOffset", 8},
+                            {"byteLength", 5},
+                            {"byteStride", 8},
+                            {"count", 2},
+                            {"mode", "ATTRIBUTES"}}));
+
+  const nlohmann::json& indices = document["bufferViews"][3];
+  EXPECT_EQ(indices["byteOffset"], 16);
+  EXPECT_EQ(indices["byteLength"], 12);
+  EXPECT_FALSE(indices.contains("byteStride"));
+  EXPECT_EQ(indices["extensions"]["EXT_meshopt_compression"]["byteOffset"],
+            16);
+  EXPECT_EQ(indices["extensions"]["EXT_meshopt_compression"]["mode"],
+            "TRIANGLES");
+}
+
+TEST_F(GltfWriterTest, FailsOnViewLengthMismatch) {
+  writer_.AddBufferView(2, 0, 0, [](std::ostream& out) { out << "abc"; });
+  EXPECT_FALSE(writer_.Write(test_dir_ / "scene.glb", /*binary=*/true));
+}
+
+TEST(GltfComponentSizeTest, SizesOfComponentTypes) {
+  EXPECT_EQ(GltfComponentSize(kGltfComponentTypeUnsignedByte), 1);
+  EXPECT_EQ(GltfComponentSize(kGltfComponentTypeShort), 2);
+  EXPECT_EQ(GltfComponentSize(kGltfComponentTypeUnsignedInt), 4);
+  EXPECT_EQ(GltfComponentSize(kGltfComponentTypeFloat), 4);
+}
+
+}  // namespace
+}  // namespace ioq3_map
@@ -0,0 +1,214 @@
+#include "ktx2.h"
+
+#include <glog/logging.h>
+
+#include <numeric>
+#include <string_view>
+
+namespace ioq3_map {
+
+namespace {
+
+constexpr uint8_t kIdentifier[12] = {0xab, 0x4b, 0x54, 0x58, 0x20, 0x32,
+                                     0x30, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a};
+constexpr size_t kHeaderSize = 80;
+constexpr size_t kLevelIndexEntrySize = 24;
+constexpr std::string_view kWriter = "ioq3_map_exporter";
+
+// Constants of the Khronos Data Format Specification.
+constexpr uint32_t kDfdModelRgbsda = 1;
+constexpr uint32_t kDfdModelBc1a = 128;
+constexpr uint32_t kDfdModelBc3 = 130;
+constexpr uint32_t kDfdModelBc7 = 134;
+constexpr uint32_t kDfdPrimariesBt709 = 1;
+constexpr uint32_t kDfdTransferSrgb = 2;
+constexpr uint32_t kDfdChannelAlpha = 15;
+constexpr uint32_t kDfdSampleLinear = 0x10;
+// The upper bound of the samples of block-compressed data.
+constexpr uint32_t kDfdBlockUpper = 0xffffffff;
+
+// A sample of the basic data format descriptor block: a channel of a texel
+// block.
+struct DfdSample {
+  uint32_t bit_offset;
+  uint32_t bit_length;
+  uint32_t channel;
+  uint32_t upper;
+};
+
+struct FormatInfo {
+  uint32_t vk_format;
+  uint32_t type_size;
+  uint32_t color_model;
+  uint32_t block_width;
+  uint32_t block_height;
+  uint32_t bytes_per_block;
+  std::vector<DfdSample> samples;
+};
+
+FormatInfo GetFormatInfo(Ktx2Format format) {
+  switch (format) {
+    case Ktx2Format::kRgba8Srgb:
+      // The alpha of an sRGB format is linear.
+      return {.vk_format = 43,
+              .type_size = 1,
+              .color_model = kDfdModelRgbsda,
+              .block_width = 1,
+              .block_height = 1,
+              .bytes_per_block = 4,
+              .samples = {{0, 8, 0, 255},
+                          {8, 8, 1, 255},
+                          {16, 8, 2, 255},
+                          {24, 8, kDfdChannelAlpha | kDfdSampleLinear, 255}}};
+    case Ktx2Format::kBc1RgbSrgb:
+      return {.vk_format = 132,
+              .type_size = 1,
+              .color_model = kDfdModelBc1a,
+              .block_width = 4,
+              .block_height = 4,
+              .bytes_per_block = 8,
+              .samples = {{0, 64, 0, kDfdBlockUpper}}};
+    case Ktx2Format::kBc3Srgb:
+      return {.vk_format = 138,
+              .type_size = 1,
+              .color_model = kDfdModelBc3,
+              .block_width = 4,
+              .block_height = 4,
+              .bytes_per_block = 16,
+              .samples = {{0, 64, kDfdChannelAlpha | kDfdSampleLinear,
+                           kDfdBlockUpper},
+                          {64, 64, 0, kDfdBlockUpper}}};
+    case Ktx2Format::kBc7Srgb:
+      return {.vk_format = 146,
+              .type_size = 1,
+              .color_model = kDfdModelBc7,
+              .block_width = 4,
+              .block_height = 4,
+              .bytes_per_block = 16,
+              .samples = {{0, 128, 0, kDfdBlockUpper}}};
+  }
+  LOG(FATAL) << "Unknown KTX2 format " << static_cast<int>(format);
+  return {};
+}
+
+void Append32(uint32_t value, std::vector<uint8_t>* out) {
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(static_cast<uint8_t>(value >> (i * 8)));
+  }
+}
+
+void Append64(uint64_t value, std::vector<uint8_t>* out) {
+  Append32(static_cast<uint32_t>(value), out);
+  Append32(static_cast<uint32_t>(value >> 32), out);
+}
+
+void Write64(uint64_t value, size_t offset, std::vector<uint8_t>* out) {
+  for (int i = 0; i < 8; ++i) {
+    (*out)[offset + i] = static_cast<uint8_t>(value >> (i * 8));
+  }
+}
+
+// The data format descriptor: its total size, then the basic descriptor
+// block.
+std::vector<uint8_t> EncodeDfd(const FormatInfo& info) {
+  const uint32_t block_size = 24 + 16 * info.samples.size();
+  std::vector<uint8_t> dfd;
+  Append32(4 + block_size, &dfd);
+  // Khronos vendor, basic descriptor type.
+  Append32(0, &dfd);
+  // Version 2 of the specification.
+  Append32(2 | block_size << 16, &dfd);
+  Append32(info.color_model | kDfdPrimariesBt709 << 8 |
+               kDfdTransferSrgb << 16,
+           &dfd);
+  Append32((info.block_width - 1) | (info.block_height - 1) << 8, &dfd);
+  Append32(info.bytes_per_block, &dfd);
+  Append32(0, &dfd);
+  for (const DfdSample& sample : info.samples) {
+    Append32(sample.bit_offset | (sample.bit_length - 1) << 16 |
+                 sample.channel << 24,
+             &dfd);
+    Append32(0, &dfd);
+    Append32(0, &dfd);
+    Append32(sample.upper, &dfd);
+  }
+  return dfd;
+}
+
+// The key/value data: the writer of the file.
+std::vector<uint8_t> EncodeKeyValueData() {
+  std::vector<uint8_t> kvd;
+  const std::string_view key = "KTXwriter";
+  Append32(key.size() + kWriter.size() + 2, &kvd);
+  kvd.insert(kvd.end(), key.begin(), key.end());
+  kvd.push_back(0);
+  kvd.insert(kvd.end(), kWriter.begin(), kWriter.end());
+  kvd.push_back(0);
+  kvd.resize((kvd.size() + 3) & ~size_t{3});
+  return kvd;
+}
+
+}  // namespace
+
+std::string_view Ktx2FormatName(Ktx2Format format) {
+  switch (format) {
+    case Ktx2Format::kRgba8Srgb:
+      return "rgba8";
+    case Ktx2Format::kBc1RgbSrgb:
+      return "bc1";
+    case Ktx2Format::kBc3Srgb:
+      return "bc3";
+    case Ktx2Format::kBc7Srgb:
+      return "bc7";
+  }
+  return "unknown";
+}
+
+std::vector<uint8_t> EncodeKtx2(
+    Ktx2Format format, int width, int height,
+    const std::vector<std::vector<uint8_t>>& levels) {
+  const FormatInfo info = GetFormatInfo(format);
+  const std::vector<uint8_t> dfd = EncodeDfd(info);
+  const std::vector<uint8_t> kvd = EncodeKeyValueData();
+  const size_t dfd_offset = kHeaderSize + levels.size() * kLevelIndexEntrySize;
+  const size_t kvd_offset = dfd_offset + dfd.size();
+
+  std::vector<uint8_t> out(kIdentifier, kIdentifier + sizeof(kIdentifier));
+  Append32(info.vk_format, &out);
+  Append32(info.type_size, &out);
+  Append32(width, &out);
+  Append32(height, &out);
+  // A 2D texture: no depth, not an array, a single face.
+  Append32(0, &out);
+  Append32(0, &out);
+  Append32(1, &out);
+  Append32(levels.size(), &out);
+  // No supercompression.
+  Append32(0, &out);
+  Append32(dfd_offset, &out);
+  Append32(dfd.size(), &out);
+  Append32(kvd_offset, &out);
+  Append32(kvd.size(), &out);
+  // No supercompression global data.
+  Append64(0, &out);
+  Append64(0, &out);
+
+  const size_t level_index = out.size();
+  out.resize(out.size() + levels.size() * kLevelIndexEntrySize);
+  out.insert(out.end(), dfd.begin(), dfd.end());
+  out.insert(out.end(), kvd.begin(), kvd.end());
+
+  // Every level starts at a multiple of both the texel block size and 4.
+  const size_t alignment = std::lcm<size_t>(info.bytes_per_block, 4);
+  for (size_t level = levels.size(); level-- > 0;) {
+    out.resize((out.size() + alignment - 1) / alignment * alignment);
+    const size_t entry = level_index + level * kLevelIndexEntrySize;
+    Write64(out.size(), entry, &out);
+    Write64(levels[level].size(), entry + 8, &out);
+    Write64(levels[level].size(), entry + 16, &out);
+    out.insert(out.end(), levels[level].begin(), levels[level].end());
+  }
+  return out;
+}
+
+}  // namespace ioq3_map
@@ -0,0 +1,36 @@
+#ifndef IOQ3_MAP_KTX2_H_
+#define IOQ3_MAP_KTX2_H_
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace ioq3_map {
+
+// The texel formats of the KTX2 textures written.
+enum class Ktx2Format {
+  // Uncompressed 8-bit RGBA in sRGB, VK_FORMAT_R8G8B8A8_SRGB.
+  kRgba8Srgb,
+  // Blocks of 4x4 texels in sRGB, see BlockFormat:
+  // VK_FORMAT_BC1_RGB_SRGB_BLOCK, VK_FORMAT_BC3_SRGB_BLOCK and
+  // VK_FORMAT_BC7_SRGB_BLOCK.
+  kBc1RgbSrgb,
+  kBc3Srgb,
+  kBc7Srgb,
+};
+
+// A short name of the format, e.g. to name files.
+std::string_view Ktx2FormatName(Ktx2Format format);
+
+// Encodes a 2D texture in a KTX2 container, without supercompression.
+// `levels` holds the data of the mip levels, base level first, laid out as
+// the format defines it, i.e. rows of texels or of texel blocks. The levels
+// are stored smallest first, so that a loader streaming the file gets a
+// usable texture early.
+std::vector<uint8_t> EncodeKtx2(
+    Ktx2Format format, int width, int height,
+    const std::vector<std::vector<uint8_t>>& levels);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_KTX2_H_
@@ -0,0 +1,125 @@
+#include "ktx2.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ioq3_map {
+namespace {
+
+uint32_t Read32(const std::vector<uint8_t>& data, size_t offset) {
+  uint32_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+uint64_t Read64(const std::vector<uint8_t>& data, size_t offset) {
+  uint64_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+TEST(Ktx2Test, EncodesRgba8MipChain) {
+  // A 3x2 texture with 2 levels: 24 and 4 bytes.
+  std::vector<std::vector<uint8_t>> levels = {std::vector<uint8_t>(24),
+                                              {1, 2, 3, 4}};
+  for (size_t i = 0; i < levels[0].size(); ++i) {
+    levels[0][i] = 100 + i;
+  }
+  const std::vector<uint8_t> ktx =
+      EncodeKtx2(Ktx2Format::kRgba8Srgb, 3, 2, levels);
+
+  ASSERT_GE(ktx.size(), 80);
+  EXPECT_EQ(std::string(ktx.begin(), ktx.begin() + 12),
+            "\xabKTX 20\xbb\r\n\x1a\n");
+  EXPECT_EQ(Read32(ktx, 12), 43);  // VK_FORMAT_R8G8B8A8_SRGB
+  EXPECT_EQ(Read32(ktx, 16), 1);
+  EXPECT_EQ(Read32(ktx, 20), 3);
+  EXPECT_EQ(Read32(ktx, 24), 2);
+  EXPECT_EQ(Read32(ktx, 28), 0);
+  EXPECT_EQ(Read32(ktx, 32), 0);
+  EXPECT_EQ(Read32(ktx, 36), 1);
+  EXPECT_EQ(Read32(ktx, 40), 2);
+  EXPECT_EQ(Read32(ktx, 44), 0);
+
+  // The data format descriptor follows the level index: RGBA in sRGB, with
+  // a linear alpha sample.
+  const uint32_t dfd_offset = Read32(ktx, 48);
+  EXPECT_EQ(dfd_offset, 80 + 2 * 24);
+  EXPECT_EQ(Read32(ktx, 52), 92);
+  EXPECT_EQ(Read32(ktx, dfd_offset), 92);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 8), 2 | 88 << 16);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 12), 1 | 1 << 8 | 2 << 16);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 20), 4);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 28 + 3 * 16), 24 | 7 << 16 | 0x1f << 24);
+
+  const uint32_t kvd_offset = Read32(ktx, 56);
+  EXPECT_EQ(kvd_offset, dfd_offset + 92);
+  const std::string kvd(ktx.begin() + kvd_offset + 4,
+                        ktx.begin() + kvd_offset + Read32(ktx, kvd_offset) + 4);
+  EXPECT_EQ(kvd, std::string("KTXwriter\0ioq3_map_exporter\0", 28));
+  EXPECT_EQ(Read32(ktx, 60) % 4, 0);
+  EXPECT_EQ(Read64(ktx, 64), 0);
+  EXPECT_EQ(Read64(ktx, 72), 0);
+
+  // The smallest level comes first, every level aligned to 4 bytes, and the
+  // base level ends the file.
+  const uint64_t base_offset = Read64(ktx, 80);
+  const uint64_t small_offset = Read64(ktx, 104);
+  EXPECT_EQ(Read64(ktx, 88), 24);
+  EXPECT_EQ(Read64(ktx, 96), 24);
+  EXPECT_EQ(Read64(ktx, 112), 4);
+  EXPECT_GE(small_offset, kvd_offset + Read32(ktx, 60));
+  EXPECT_EQ(small_offset % 4, 0);
+  EXPECT_EQ(base_offset, small_offset + 4);
+  EXPECT_EQ(ktx.size(), base_offset + 24);
+  EXPECT_EQ(std::vector<uint8_t>(ktx.begin() + small_offset,
+                                 ktx.begin() + small_offset + 4),
+            levels[1]);
+  EXPECT_EQ(std::vector<uint8_t>(ktx.begin() + base_offset, ktx.end()),
+            levels[0]);
+}
+
+TEST(Ktx2Test, EncodesBlockCompressedLevels) {
+  // A 6x5 BC3 texture: 2x2 blocks of 16 bytes, then a single block for each
+  // of the 3x2 and 1x1 levels.
+  const std::vector<std::vector<uint8_t>> levels = {
+      std::vector<uint8_t>(64, 1), std::vector<uint8_t>(16, 2),
+      std::vector<uint8_t>(16, 3)};
+  const std::vector<uint8_t> ktx =
+      EncodeKtx2(Ktx2Format::kBc3Srgb, 6, 5, levels);
+  EXPECT_EQ(Read32(ktx, 12), 138);  // VK_FORMAT_BC3_SRGB_BLOCK
+  EXPECT_EQ(Read32(ktx, 16), 1);
+  EXPECT_EQ(Read32(ktx, 40), 3);
+
+  // The BC3 model with 4x4 texel blocks of 16 bytes: a linear alpha sample of
+  // 64 bits, then the color.
+  const uint32_t dfd_offset = Read32(ktx, 48);
+  EXPECT_EQ(Read32(ktx, dfd_offset), 60);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 12), 130 | 1 << 8 | 2 << 16);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 16), 3 | 3 << 8);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 20), 16);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 28), 63 << 16 | 0x1f << 24);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 40), 0xffffffff);
+  EXPECT_EQ(Read32(ktx, dfd_offset + 44), 64 | 63 << 16);
+
+  // Every level is aligned to the 16 bytes of a block.
+  for (int level = 0; level < 3; ++level) {
+    const uint64_t offset = Read64(ktx, 80 + level * 24);
+    EXPECT_EQ(offset % 16, 0) << level;
+    EXPECT_EQ(Read64(ktx, 88 + level * 24), levels[level].size()) << level;
+    EXPECT_EQ(ktx[offset], level + 1) << level;
+  }
+  EXPECT_EQ(ktx.size(), Read64(ktx, 80) + 64);
+}
+
+TEST(Ktx2Test, FormatName) {
+  EXPECT_EQ(Ktx2FormatName(Ktx2Format::kRgba8Srgb), "rgba8");
+  EXPECT_EQ(Ktx2FormatName(Ktx2Format::kBc7Srgb), "bc7");
+}
+
+}  // namespace
+}  // namespace ioq3_map
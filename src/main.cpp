@@ -1,9 +1,13 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <charconv>
 #include <filesystem>
 #include <iostream>
 #include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
 #include <unordered_map>
 #include <vector>
 
@@ -19,6 +23,69 @@
 DEFINE_string(base_path, "", "Path to Quake 3 .pk3 archives");
 DEFINE_string(map, "", "Map name (e.g., q3dm1)");
 DEFINE_string(output, "", "Output directory");
+DEFINE_string(vfs, "memory",
+              "How the .pk3 archives are mounted: 'memory' inflates files on "
+              "demand without extracting them, 'disk' extracts every archive "
+              "to ./vfs_mount_point, 'selective' only extracts the files "
+              "the map references to ./vfs_mount_point, 'cache' extracts "
+              "them once into --cache_dir and reuses the extraction across "
+              "runs");
+DEFINE_string(format, "gltf",
+              "Output format: 'gltf' writes scene.gltf with its buffer in "
+              "scene.bin and the textures next to it, 'glb' writes a "
+              "self-contained scene.glb");
+DEFINE_string(cache_dir, "vfs_cache",
+              "Persistent extraction cache used by --vfs=cache");
+DEFINE_string(texture_dir, "",
+              "Directory the 'gltf' textures are written to instead of next "
+              "to scene.gltf, e.g. shared by the exports of several maps. "
+              "Textures are named by their content");
+DEFINE_string(texture_format, "original",
+              "'original' writes the texture files as they are, 'ktx2' also "
+              "transcodes them to KTX2 files with mip chains, referenced "
+              "through the non-standard IOQ3_texture_ktx2 extension, and "
+              "'ktx2_bc' block compresses the mip chains to BC1, or BC3/BC7 "
+              "for alpha-blended stages");
+DEFINE_string(texture_quality, "normal",
+              "Block compression preset of --texture_format=ktx2_bc: 'fast', "
+              "'normal' or 'best'");
+DEFINE_int32(threads, 0,
+             "Number of worker threads, 0 uses one per hardware thread");
+DEFINE_double(patch_error, 0,
+              "Tolerance, in world units, of the adaptive subdivision of "
+              "curved patches. 0 subdivides every patch uniformly");
+DEFINE_bool(weld, false,
+            "Weld the vertices of every surface, or of every material batch "
+            "with --merge_by_material, that are within the --weld_*_epsilon "
+            "of each other");
+DEFINE_double(weld_position_epsilon, 1e-4,
+              "Position tolerance of --weld, in meters");
+DEFINE_double(weld_normal_epsilon, 1e-3,
+              "Per-component normal tolerance of --weld");
+DEFINE_double(weld_uv_epsilon, 1e-4,
+              "Texture and lightmap coordinate tolerance of --weld");
+DEFINE_bool(optimize_vertex_cache, false,
+            "Reorder the triangles of every written geometry for the GPU "
+            "vertex cache, and its vertices for fetch locality");
+DEFINE_string(lod_ratios, "",
+              "Comma-separated target triangle ratios of the coarser levels "
+              "of detail written for every geometry, each strictly between 0 "
+              "and 1, e.g. '0.5,0.25'");
+DEFINE_bool(quantize, false,
+            "Write the vertex attributes in fixed point with "
+            "KHR_mesh_quantization, which about halves their size");
+DEFINE_bool(interleave, false,
+            "Interleave the vertex attributes of every primitive in one "
+            "buffer view");
+DEFINE_bool(compress, false,
+            "Compress the vertex attributes and indices with "
+            "EXT_meshopt_compression, which loaders must then support");
+DEFINE_bool(merge_by_material, false,
+            "Merge the surfaces that share a material into one draw primitive "
+            "and write their ranges to scene.surfaces.json");
+DEFINE_bool(strict_16bit_indices, false,
+            "With --merge_by_material, split the batches of a material so "
+            "that their indices fit 16 bits");
 
 int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -30,6 +97,38 @@ int main(int argc, char* argv[]) {
               << std::endl;
     return 1;
   }
+  if (FLAGS_format != "gltf" && FLAGS_format != "glb") {
+    LOG(ERROR) << "Unknown --format: " << FLAGS_format;
+    return 1;
+  }
+  if (FLAGS_texture_format != "original" && FLAGS_texture_format != "ktx2" &&
+      FLAGS_texture_format != "ktx2_bc") {
+    LOG(ERROR) << "Unknown --texture_format: " << FLAGS_texture_format;
+    return 1;
+  }
+  if (FLAGS_texture_quality != "fast" && FLAGS_texture_quality != "normal" &&
+      FLAGS_texture_quality != "best") {
+    LOG(ERROR) << "Unknown --texture_quality: " << FLAGS_texture_quality;
+    return 1;
+  }
+  if (FLAGS_strict_16bit_indices && !FLAGS_merge_by_material) {
+    LOG(WARNING) << "--strict_16bit_indices has no effect without "
+                    "--merge_by_material.";
+  }
+  std::vector<float> lod_ratios;
+  std::stringstream lod_ratio_list(FLAGS_lod_ratios);
+  for (std::string ratio; std::getline(lod_ratio_list, ratio, ',');) {
+    const char* end = ratio.data() + ratio.size();
+    float value = 0.0f;
+    const auto [parsed_end, error] = std::from_chars(ratio.data(), end, value);
+    if (error != std::errc() || parsed_end != end ||
+        !(value > 0.0f && value < 1.0f)) {
+      LOG(ERROR) << "Invalid --lod_ratios entry '" << ratio
+                 << "': expected a number strictly between 0 and 1.";
+      return 1;
+    }
+    lod_ratios.push_back(value);
+  }
 
   LOG(INFO) << "Starting ioq3-map-exporter";
   LOG(INFO) << "Base Path: " << FLAGS_base_path;
@@ -45,7 +144,20 @@ int main(int argc, char* argv[]) {
   LOG(INFO) << "Found " << archives.size() << " archives.";
 
   // 2. Build Virtual Filesystem
-  auto vfs = ioq3_map::BuildVirtualFilesystem(archives);
+  std::optional<ioq3_map::VirtualFilesystem> vfs;
+  if (FLAGS_vfs == "memory") {
+    vfs = ioq3_map::BuildInMemoryVirtualFilesystem(archives);
+  } else if (FLAGS_vfs == "disk") {
+    vfs = ioq3_map::BuildVirtualFilesystem(archives, FLAGS_threads);
+  } else if (FLAGS_vfs == "selective") {
+    vfs = ioq3_map::BuildSelectiveVirtualFilesystem(archives);
+  } else if (FLAGS_vfs == "cache") {
+    vfs = ioq3_map::BuildCachedVirtualFilesystem(archives, FLAGS_cache_dir,
+                                                 FLAGS_threads);
+  } else {
+    LOG(ERROR) << "Unknown --vfs mode: " << FLAGS_vfs;
+    return 1;
+  }
   if (!vfs) {
     LOG(ERROR) << "Failed to build virtual filesystem.";
     return 1;
@@ -55,20 +167,32 @@ int main(int argc, char* argv[]) {
   // 3. Locate Map
   std::filesystem::path map_path =
       vfs->mount_point / "maps" / (FLAGS_map + ".bsp");
-  if (!std::filesystem::exists(map_path)) {
+  if (!vfs->Exists(map_path)) {
     LOG(ERROR) << "Map file not found in VFS: " << map_path;
     return 1;
   }
   LOG(INFO) << "Found map at: " << map_path;
 
+  // 3b. Selective extraction, first phase: the map and the shader scripts.
+  const bool selective = FLAGS_vfs == "selective";
+  if (selective) {
+    std::vector<std::filesystem::path> files =
+        ioq3_map::ListQ3ShaderScripts(*vfs);
+    files.push_back(map_path);
+    if (!ioq3_map::ExtractFiles(*vfs, files, FLAGS_threads)) {
+      LOG(ERROR) << "Failed to extract the map and shader scripts.";
+      return 1;
+    }
+  }
+
   // 4. Load BSP
-  auto bsp = ioq3_map::LoadBsp(map_path);
+  auto bsp = ioq3_map::LoadBsp(*vfs, map_path);
   if (!bsp) {
     LOG(ERROR) << "Failed to load BSP file.";
     return 1;
   }
-  LOG(INFO) << "Successfully loaded BSP header. Lumps found: "
-            << bsp->lumps.size();
+  LOG(INFO) << "Successfully loaded BSP. Surfaces found: "
+            << ioq3_map::GetLump<ioq3_map::LumpType::Faces>(*bsp).size();
 
   // 5. Shader Extraction
   LOG(INFO) << "Extracting Shaders...";
@@ -86,9 +210,19 @@ int main(int argc, char* argv[]) {
       });
   LOG(INFO) << "Extracted " << bsp_materials.size() << " materials.";
 
+  // 6b. Selective extraction, second phase: the textures the materials
+  // resolved to, through the index, from the BSP texture lump.
+  if (selective) {
+    auto textures = ioq3_map::CollectMaterialTextures(bsp_materials);
+    LOG(INFO) << "Extracting " << textures.size() << " textures...";
+    if (!ioq3_map::ExtractFiles(*vfs, textures, FLAGS_threads)) {
+      LOG(WARNING) << "Some textures could not be extracted.";
+    }
+  }
+
   // 7. Build Geometry
   LOG(INFO) << "Building BSP Geometry...";
-  auto bsp_geometries = ioq3_map::BuildBSPGeometries(*bsp);
+  auto bsp_geometries = ioq3_map::BuildBSPGeometries(*bsp, FLAGS_threads);
   LOG(INFO) << "Parsed " << bsp_geometries.size() << " BSP surfaces.";
 
   // 7b. Build Entities
@@ -98,8 +232,11 @@ int main(int argc, char* argv[]) {
 
   // 8. Assemble Scene
   LOG(INFO) << "Assembling Scene...";
+  ioq3_map::AssembleOptions assemble_options;
+  assemble_options.num_threads = FLAGS_threads;
+  assemble_options.patch_tessellation.max_error = FLAGS_patch_error;
   auto scene = ioq3_map::AssembleBSPObjects(*bsp, bsp_geometries, bsp_materials,
-                                            bsp_entities);
+                                            bsp_entities, assemble_options);
   LOG(INFO) << "Scene Assembled. Total Geometries: " << scene.geometries.size();
   LOG(INFO) << "Total Materials: " << scene.materials.size();
   LOG(INFO) << "Total Lights: " << scene.lights.size();
@@ -107,11 +244,38 @@ int main(int argc, char* argv[]) {
   // 9. Export glTF
   LOG(INFO) << "Exporting to glTF...";
   std::filesystem::path output_path =
-      std::filesystem::path(FLAGS_output) / "scene.gltf";
+      std::filesystem::path(FLAGS_output) / ("scene." + FLAGS_format);
   // Ensure parent directory exists
   std::filesystem::create_directories(output_path.parent_path());
 
-  if (!ioq3_map::SaveScene(scene, output_path)) {
+  ioq3_map::SaveOptions save_options;
+  save_options.format = FLAGS_format == "glb" ? ioq3_map::SaveFormat::kGlb
+                                             : ioq3_map::SaveFormat::kGltf;
+  save_options.vfs = &*vfs;
+  save_options.texture_dir = FLAGS_texture_dir;
+  save_options.texture_format =
+      FLAGS_texture_format == "ktx2"      ? ioq3_map::TextureFormat::kKtx2
+      : FLAGS_texture_format == "ktx2_bc" ? ioq3_map::TextureFormat::kKtx2Bc
+                                          : ioq3_map::TextureFormat::kOriginal;
+  save_options.texture_quality =
+      FLAGS_texture_quality == "fast"   ? ioq3_map::BlockQuality::kFast
+      : FLAGS_texture_quality == "best" ? ioq3_map::BlockQuality::kBest
+                                        : ioq3_map::BlockQuality::kNormal;
+  save_options.merge_by_material = FLAGS_merge_by_material;
+  save_options.strict_uint16_indices = FLAGS_strict_16bit_indices;
+  save_options.optimize_vertex_cache = FLAGS_optimize_vertex_cache;
+  save_options.quantize = FLAGS_quantize;
+  save_options.interleave = FLAGS_interleave;
+  save_options.compress = FLAGS_compress;
+  save_options.num_threads = FLAGS_threads;
+  save_options.lod_ratios = std::move(lod_ratios);
+  if (FLAGS_weld) {
+    save_options.weld = ioq3_map::WeldOptions{
+        .position_epsilon = static_cast<float>(FLAGS_weld_position_epsilon),
+        .normal_epsilon = static_cast<float>(FLAGS_weld_normal_epsilon),
+        .uv_epsilon = static_cast<float>(FLAGS_weld_uv_epsilon)};
+  }
+  if (!ioq3_map::SaveScene(scene, output_path, save_options)) {
     LOG(ERROR) << "Failed to save glTF scene to " << output_path;
     return 1;
   }
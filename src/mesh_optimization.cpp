@@ -0,0 +1,204 @@
+#include "mesh_optimization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace ioq3_map {
+namespace {
+
+// The parameters of Forsyth's reference implementation.
+constexpr int kCacheSize = 32;
+constexpr float kCacheDecayPower = 1.5f;
+constexpr float kLastTriangleScore = 0.75f;
+constexpr float kValenceBoostScale = 2.0f;
+constexpr float kValenceBoostPower = 0.5f;
+
+float VertexScore(int cache_position, uint32_t remaining_triangles) {
+  if (remaining_triangles == 0) {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if (cache_position >= 0 && cache_position < 3) {
+    // The vertices of the last triangle are scored the same, so that the
+    // next triangle does not favour one of its edges.
+    score = kLastTriangleScore;
+  } else if (cache_position >= 3) {
+    const float scale = 1.0f / (kCacheSize - 3);
+    score = std::pow(1.0f - (cache_position - 3) * scale, kCacheDecayPower);
+  }
+
+  // Vertices with few triangles left are finished first, so that they do
+  // not leave lone triangles behind.
+  score += kValenceBoostScale *
+           std::pow(static_cast<float>(remaining_triangles),
+                    -kValenceBoostPower);
+  return score;
+}
+
+// Keeps the attribute values in the new vertex order.
+template <typename Vector>
+void Reorder(const std::vector<uint32_t>& order,
+             std::vector<Vector>* attribute) {
+  if (attribute->empty()) {
+    return;
+  }
+  std::vector<Vector> reordered;
+  reordered.reserve(order.size());
+  for (uint32_t v : order) {
+    reordered.push_back((*attribute)[v]);
+  }
+  *attribute = std::move(reordered);
+}
+
+}  // namespace
+
+void OptimizeVertexCache(std::span<uint32_t> indices, size_t vertex_count) {
+  const size_t num_triangles = indices.size() / 3;
+  if (num_triangles == 0) {
+    return;
+  }
+
+  // The triangles of every vertex that are not emitted yet, packed: the
+  // active triangles of v are active[offsets[v], offsets[v] + remaining[v]).
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  for (size_t i = 0; i < num_triangles * 3; ++i) {
+    ++offsets[indices[i] + 1];
+  }
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  std::vector<uint32_t> active(num_triangles * 3);
+  std::vector<uint32_t> remaining(vertex_count, 0);
+  for (size_t i = 0; i < num_triangles * 3; ++i) {
+    const uint32_t v = indices[i];
+    active[offsets[v] + remaining[v]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  std::vector<int> cache_position(vertex_count, -1);
+  std::vector<float> vertex_score(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v) {
+    vertex_score[v] = VertexScore(-1, remaining[v]);
+  }
+  auto triangle_score = [&](size_t t) {
+    return vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] +
+           vertex_score[indices[t * 3 + 2]];
+  };
+
+  // Start from the best triangle.
+  size_t best = 0;
+  for (size_t t = 1; t < num_triangles; ++t) {
+    if (triangle_score(t) > triangle_score(best)) {
+      best = t;
+    }
+  }
+
+  std::vector<uint32_t> output;
+  output.reserve(num_triangles * 3);
+  std::vector<bool> emitted(num_triangles, false);
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> new_cache;
+  size_t next_unemitted = 0;
+  while (true) {
+    emitted[best] = true;
+
+    // Emit the triangle and move its vertices to the front of the cache.
+    new_cache.clear();
+    for (int k = 0; k < 3; ++k) {
+      const uint32_t v = indices[best * 3 + k];
+      output.push_back(v);
+      if (std::find(new_cache.begin(), new_cache.end(), v) ==
+          new_cache.end()) {
+        new_cache.push_back(v);
+      }
+
+      const auto begin = active.begin() + offsets[v];
+      const auto end = begin + remaining[v];
+      *std::find(begin, end, static_cast<uint32_t>(best)) = *(end - 1);
+      --remaining[v];
+    }
+    for (uint32_t v : cache) {
+      if (std::find(new_cache.begin(), new_cache.end(), v) ==
+          new_cache.end()) {
+        new_cache.push_back(v);
+      }
+    }
+
+    // Rescore the vertices whose cache position changed, including the
+    // evicted ones.
+    for (size_t i = 0; i < new_cache.size(); ++i) {
+      const uint32_t v = new_cache[i];
+      cache_position[v] = i < kCacheSize ? static_cast<int>(i) : -1;
+      vertex_score[v] = VertexScore(cache_position[v], remaining[v]);
+    }
+
+    // The next triangle is the best one that uses a rescored vertex.
+    float best_score = -1.0f;
+    bool found = false;
+    for (uint32_t v : new_cache) {
+      for (uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; ++i) {
+        const uint32_t t = active[i];
+        const float score = triangle_score(t);
+        if (score > best_score) {
+          best_score = score;
+          best = t;
+          found = true;
+        }
+      }
+    }
+
+    if (new_cache.size() > kCacheSize) {
+      new_cache.resize(kCacheSize);
+    }
+    std::swap(cache, new_cache);
+
+    if (!found) {
+      // None of the cached vertices has triangles left: continue with any.
+      while (next_unemitted < num_triangles && emitted[next_unemitted]) {
+        ++next_unemitted;
+      }
+      if (next_unemitted == num_triangles) {
+        break;
+      }
+      best = next_unemitted;
+    }
+  }
+
+  std::copy(output.begin(), output.end(), indices.begin());
+}
+
+void OptimizeVertexFetch(Geometry* geometry) {
+  Geometry& geo = *geometry;
+  constexpr uint32_t kUnused = UINT32_MAX;
+  std::vector<uint32_t> remap(geo.vertices.size(), kUnused);
+  std::vector<uint32_t> order;
+  order.reserve(geo.vertices.size());
+  for (uint32_t& index : geo.indices) {
+    if (remap[index] == kUnused) {
+      remap[index] = static_cast<uint32_t>(order.size());
+      order.push_back(index);
+    }
+    index = remap[index];
+  }
+
+  Reorder(order, &geo.vertices);
+  Reorder(order, &geo.normals);
+  Reorder(order, &geo.texture_uvs);
+  Reorder(order, &geo.lightmap_uvs);
+}
+
+size_t CountCacheMisses(std::span<const uint32_t> indices, size_t vertex_count,
+                        int cache_size) {
+  // A vertex is cached until cache_size more vertices are transformed.
+  std::vector<int64_t> transformed_at(vertex_count, -cache_size);
+  int64_t misses = 0;
+  for (uint32_t v : indices) {
+    if (misses - transformed_at[v] >= cache_size) {
+      transformed_at[v] = ++misses;
+    }
+  }
+  return static_cast<size_t>(misses);
+}
+
+}  // namespace ioq3_map
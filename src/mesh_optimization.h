@@ -0,0 +1,34 @@
+#ifndef IOQ3_MAP_MESH_OPTIMIZATION_H_
+#define IOQ3_MAP_MESH_OPTIMIZATION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "scene.h"
+
+namespace ioq3_map {
+
+// Reorders the triangles for the post-transform vertex cache of the GPU, with
+// Tom Forsyth's linear-speed vertex cache optimization: triangles are emitted
+// greedily by the score of their vertices, which favours vertices that are
+// recently used and have few triangles left. Grids tessellated row by row
+// otherwise miss the cache on almost every vertex of the next row. The
+// winding of every triangle is kept.
+void OptimizeVertexCache(std::span<uint32_t> indices, size_t vertex_count);
+
+// Reorders the vertices of the geometry by their first use in the indices,
+// so that vertex fetches are sequential, and remaps the indices. Vertices
+// that are not referenced are dropped.
+void OptimizeVertexFetch(Geometry* geometry);
+
+// Returns the number of vertices transformed when drawing the triangles
+// through a FIFO post-transform cache of `cache_size` entries. Divided by the
+// number of triangles, this is the average cache miss ratio (ACMR): 3 without
+// any reuse, 0.5 at best on a regular grid.
+size_t CountCacheMisses(std::span<const uint32_t> indices, size_t vertex_count,
+                        int cache_size = 16);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_MESH_OPTIMIZATION_H_
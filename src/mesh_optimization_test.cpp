@@ -0,0 +1,77 @@
+#include "mesh_optimization.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "scene.h"
+#include "test_util.h"
+
+namespace ioq3_map {
+namespace {
+
+// The triangles, each rotated to start at its smallest index, sorted.
+std::vector<std::array<uint32_t, 3>> CanonicalTriangles(
+    const std::vector<uint32_t>& indices) {
+  std::vector<std::array<uint32_t, 3>> triangles;
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    std::array<uint32_t, 3> t = {indices[i], indices[i + 1], indices[i + 2]};
+    std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+    triangles.push_back(t);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+TEST(MeshOptimizationTest, CountCacheMisses) {
+  // Each vertex once, then all again within the cache.
+  const std::vector<uint32_t> indices = {0, 1, 2, 2, 1, 0};
+  EXPECT_EQ(CountCacheMisses(indices, 3), 3);
+  // A cache of 2 has evicted vertex 0 by the time it is used again.
+  EXPECT_EQ(CountCacheMisses(indices, 3, /*cache_size=*/2), 4);
+}
+
+TEST(MeshOptimizationTest, OptimizeVertexCacheOnGrid) {
+  constexpr int kSize = 64;
+  constexpr size_t kNumVertices = (kSize + 1) * (kSize + 1);
+  const std::vector<uint32_t> original = GridIndices(kSize);
+  std::vector<uint32_t> indices = original;
+
+  OptimizeVertexCache(indices, kNumVertices);
+
+  // The same triangles, with the same winding.
+  EXPECT_EQ(CanonicalTriangles(indices), CanonicalTriangles(original));
+
+  const double num_triangles = original.size() / 3;
+  const double acmr_before =
+      CountCacheMisses(original, kNumVertices) / num_triangles;
+  const double acmr_after =
+      CountCacheMisses(indices, kNumVertices) / num_triangles;
+  EXPECT_LT(acmr_after, acmr_before);
+  EXPECT_LT(acmr_after, 0.8);
+}
+
+TEST(MeshOptimizationTest, OptimizeVertexFetch) {
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(2, 0, 0), Eigen::Vector3f(3, 0, 0)};
+  geo.texture_uvs = {Eigen::Vector2f(0, 0), Eigen::Vector2f(1, 0),
+                     Eigen::Vector2f(2, 0), Eigen::Vector2f(3, 0)};
+  // Vertex 1 is not referenced.
+  geo.indices = {3, 0, 2, 2, 0, 3};
+
+  OptimizeVertexFetch(&geo);
+
+  EXPECT_EQ(geo.indices, (std::vector<uint32_t>{0, 1, 2, 2, 1, 0}));
+  ASSERT_EQ(geo.vertices.size(), 3);
+  EXPECT_EQ(geo.vertices[0], Eigen::Vector3f(3, 0, 0));
+  EXPECT_EQ(geo.vertices[1], Eigen::Vector3f(0, 0, 0));
+  EXPECT_EQ(geo.vertices[2], Eigen::Vector3f(2, 0, 0));
+  EXPECT_EQ(geo.texture_uvs[0], Eigen::Vector2f(3, 0));
+  EXPECT_TRUE(geo.normals.empty());
+}
+
+}  // namespace
+}  // namespace ioq3_map
@@ -0,0 +1,307 @@
+#include "mesh_simplification.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+
+namespace ioq3_map {
+namespace {
+
+// The squared distance to a set of planes, weighted by area.
+struct Quadric {
+  Eigen::Matrix4d m = Eigen::Matrix4d::Zero();
+
+  double Evaluate(const Eigen::Vector3f& p) const {
+    const Eigen::Vector4d v(p.x(), p.y(), p.z(), 1.0);
+    return v.dot(m * v);
+  }
+};
+
+// Collapses `from` onto `to`. Stale once either vertex has changed since.
+struct Collapse {
+  double cost;
+  // Ties, e.g. on flat surfaces, go to the shortest edge. Otherwise the
+  // collapses pile onto a few vertices and build large fans.
+  float length;
+  uint32_t from;
+  uint32_t to;
+  uint32_t from_version;
+  uint32_t to_version;
+
+  bool operator>(const Collapse& other) const {
+    return cost > other.cost || (cost == other.cost && length > other.length);
+  }
+};
+
+uint64_t EdgeKey(uint32_t a, uint32_t b) {
+  return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+}
+
+Eigen::Vector3f TriangleNormal(const Eigen::Vector3f& p0,
+                               const Eigen::Vector3f& p1,
+                               const Eigen::Vector3f& p2) {
+  return (p1 - p0).cross(p2 - p0);
+}
+
+class Simplifier {
+ public:
+  explicit Simplifier(const Geometry& geometry)
+      : positions_(geometry.vertices),
+        indices_(geometry.indices),
+        num_triangles_(geometry.indices.size() / 3),
+        vertex_triangles_(positions_.size()),
+        quadrics_(positions_.size()),
+        locked_(positions_.size(), false),
+        collapsed_(positions_.size(), false),
+        versions_(positions_.size(), 0),
+        removed_(num_triangles_, false) {
+    indices_.resize(num_triangles_ * 3);
+
+    std::unordered_map<uint64_t, int> edge_uses;
+    for (uint32_t t = 0; t < num_triangles_; ++t) {
+      const uint32_t* v = &indices_[t * 3];
+      if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) {
+        removed_[t] = true;
+        continue;
+      }
+      ++live_triangles_;
+      for (int k = 0; k < 3; ++k) {
+        vertex_triangles_[v[k]].push_back(t);
+        ++edge_uses[EdgeKey(v[k], v[(k + 1) % 3])];
+      }
+
+      // The plane quadric of the triangle, weighted by its area.
+      const Eigen::Vector3f n =
+          TriangleNormal(positions_[v[0]], positions_[v[1]], positions_[v[2]]);
+      const float double_area = n.norm();
+      if (double_area == 0.0f) {
+        continue;
+      }
+      const Eigen::Vector3d unit = (n / double_area).cast<double>();
+      const Eigen::Vector4d plane(unit.x(), unit.y(), unit.z(),
+                                  -unit.dot(positions_[v[0]].cast<double>()));
+      const Eigen::Matrix4d k = 0.5 * double_area * plane * plane.transpose();
+      for (int i = 0; i < 3; ++i) {
+        quadrics_[v[i]].m += k;
+      }
+    }
+
+    for (const auto& [key, uses] : edge_uses) {
+      if (uses != 2) {
+        locked_[key >> 32] = true;
+        locked_[key & UINT32_MAX] = true;
+      }
+    }
+  }
+
+  void Run(size_t target_triangles) {
+    for (uint32_t v = 0; v < positions_.size(); ++v) {
+      for (uint32_t n : Neighbours(v)) {
+        if (v < n) {
+          PushCollapses(v, n);
+        }
+      }
+    }
+
+    while (live_triangles_ > target_triangles && !queue_.empty()) {
+      const Collapse collapse = queue_.top();
+      queue_.pop();
+      if (collapsed_[collapse.from] || collapsed_[collapse.to] ||
+          versions_[collapse.from] != collapse.from_version ||
+          versions_[collapse.to] != collapse.to_version ||
+          !CanCollapse(collapse.from, collapse.to)) {
+        continue;
+      }
+      Apply(collapse.from, collapse.to);
+    }
+  }
+
+  Geometry Output(const Geometry& geometry,
+                  std::vector<bool>* kept_triangles) const {
+    constexpr uint32_t kUnused = UINT32_MAX;
+    std::vector<uint32_t> remap(positions_.size(), kUnused);
+    for (uint32_t t = 0; t < num_triangles_; ++t) {
+      if (!removed_[t]) {
+        for (int k = 0; k < 3; ++k) {
+          remap[indices_[t * 3 + k]] = 0;
+        }
+      }
+    }
+
+    // Keep the referenced vertices in their original order.
+    Geometry out;
+    out.material_id = geometry.material_id;
+    out.transform = geometry.transform;
+    uint32_t num_kept = 0;
+    for (uint32_t v = 0; v < positions_.size(); ++v) {
+      if (remap[v] == kUnused) {
+        continue;
+      }
+      remap[v] = num_kept++;
+      out.vertices.push_back(geometry.vertices[v]);
+      if (!geometry.normals.empty()) {
+        out.normals.push_back(geometry.normals[v]);
+      }
+      if (!geometry.texture_uvs.empty()) {
+        out.texture_uvs.push_back(geometry.texture_uvs[v]);
+      }
+      if (!geometry.lightmap_uvs.empty()) {
+        out.lightmap_uvs.push_back(geometry.lightmap_uvs[v]);
+      }
+    }
+
+    if (kept_triangles != nullptr) {
+      kept_triangles->assign(num_triangles_, false);
+    }
+    out.indices.reserve(live_triangles_ * 3);
+    for (uint32_t t = 0; t < num_triangles_; ++t) {
+      if (removed_[t]) {
+        continue;
+      }
+      for (int k = 0; k < 3; ++k) {
+        out.indices.push_back(remap[indices_[t * 3 + k]]);
+      }
+      if (kept_triangles != nullptr) {
+        (*kept_triangles)[t] = true;
+      }
+    }
+    return out;
+  }
+
+ private:
+  // The vertices that share a live triangle with v.
+  std::vector<uint32_t> Neighbours(uint32_t v) const {
+    std::vector<uint32_t> neighbours;
+    for (uint32_t t : vertex_triangles_[v]) {
+      if (removed_[t]) {
+        continue;
+      }
+      for (int k = 0; k < 3; ++k) {
+        const uint32_t n = indices_[t * 3 + k];
+        if (n != v && std::find(neighbours.begin(), neighbours.end(), n) ==
+                          neighbours.end()) {
+          neighbours.push_back(n);
+        }
+      }
+    }
+    return neighbours;
+  }
+
+  void PushCollapses(uint32_t a, uint32_t b) {
+    Quadric sum;
+    sum.m = quadrics_[a].m + quadrics_[b].m;
+    const float length = (positions_[a] - positions_[b]).squaredNorm();
+    if (!locked_[a]) {
+      queue_.push({sum.Evaluate(positions_[b]), length, a, b, versions_[a],
+                   versions_[b]});
+    }
+    if (!locked_[b]) {
+      queue_.push({sum.Evaluate(positions_[a]), length, b, a, versions_[b],
+                   versions_[a]});
+    }
+  }
+
+  bool CanCollapse(uint32_t from, uint32_t to) const {
+    // The link condition: an interior edge has exactly two triangles, so its
+    // endpoints must share exactly two neighbours. Otherwise the collapse
+    // pinches the surface.
+    const std::vector<uint32_t> from_neighbours = Neighbours(from);
+    const std::vector<uint32_t> to_neighbours = Neighbours(to);
+    int shared = 0;
+    for (uint32_t n : from_neighbours) {
+      shared += std::count(to_neighbours.begin(), to_neighbours.end(), n);
+    }
+    if (shared != 2) {
+      return false;
+    }
+
+    // The triangles that move must not flip or degenerate.
+    for (uint32_t t : vertex_triangles_[from]) {
+      if (removed_[t]) {
+        continue;
+      }
+      const uint32_t* v = &indices_[t * 3];
+      if (v[0] == to || v[1] == to || v[2] == to) {
+        continue;  // Collapses.
+      }
+      Eigen::Vector3f p[3];
+      for (int k = 0; k < 3; ++k) {
+        p[k] = positions_[v[k]];
+      }
+      const Eigen::Vector3f before = TriangleNormal(p[0], p[1], p[2]);
+      for (int k = 0; k < 3; ++k) {
+        if (v[k] == from) {
+          p[k] = positions_[to];
+        }
+      }
+      const Eigen::Vector3f after = TriangleNormal(p[0], p[1], p[2]);
+      if (after.dot(before) <= 0.0f ||
+          after.squaredNorm() <= 1e-12f * before.squaredNorm()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Apply(uint32_t from, uint32_t to) {
+    for (uint32_t t : vertex_triangles_[from]) {
+      if (removed_[t]) {
+        continue;
+      }
+      uint32_t* v = &indices_[t * 3];
+      if (v[0] == to || v[1] == to || v[2] == to) {
+        removed_[t] = true;
+        --live_triangles_;
+        continue;
+      }
+      for (int k = 0; k < 3; ++k) {
+        if (v[k] == from) {
+          v[k] = to;
+        }
+      }
+      vertex_triangles_[to].push_back(t);
+    }
+    vertex_triangles_[from].clear();
+    collapsed_[from] = true;
+
+    // The collapses of the other edges keep their cost, and their topology
+    // is checked again when they are popped.
+    quadrics_[to].m += quadrics_[from].m;
+    ++versions_[to];
+    std::erase_if(vertex_triangles_[to],
+                  [this](uint32_t t) { return removed_[t]; });
+    for (uint32_t n : Neighbours(to)) {
+      PushCollapses(to, n);
+    }
+  }
+
+  const std::vector<Eigen::Vector3f>& positions_;
+  std::vector<uint32_t> indices_;
+  const size_t num_triangles_;
+  size_t live_triangles_ = 0;
+
+  std::vector<std::vector<uint32_t>> vertex_triangles_;
+  std::vector<Quadric> quadrics_;
+  std::vector<bool> locked_;
+  std::vector<bool> collapsed_;
+  std::vector<uint32_t> versions_;
+  std::vector<bool> removed_;
+
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>>
+      queue_;
+};
+
+}  // namespace
+
+Geometry SimplifyGeometry(const Geometry& geometry, float target_ratio,
+                          std::vector<bool>* kept_triangles) {
+  Simplifier simplifier(geometry);
+  const size_t num_triangles = geometry.indices.size() / 3;
+  simplifier.Run(static_cast<size_t>(
+      std::ceil(std::clamp(target_ratio, 0.0f, 1.0f) * num_triangles)));
+  return simplifier.Output(geometry, kept_triangles);
+}
+
+}  // namespace ioq3_map
@@ -0,0 +1,30 @@
+#ifndef IOQ3_MAP_MESH_SIMPLIFICATION_H_
+#define IOQ3_MAP_MESH_SIMPLIFICATION_H_
+
+#include <vector>
+
+#include "scene.h"
+
+namespace ioq3_map {
+
+// Simplifies the geometry to about `target_ratio` of its triangles by edge
+// collapses ordered by the quadric error metric (Garland and Heckbert 1997).
+// Vertices are collapsed onto a neighbour, so the attributes of the kept
+// vertices are exact.
+//
+// Vertices on an open or non-manifold edge never move: the borders of the
+// geometry, and so the boundaries between materials, stay in place, and so do
+// UV and normal seams, whose vertices are split. Collapses that would flip a
+// triangle or pinch the surface are skipped, so the target may not be met.
+// Welding the geometry first (see WeldVertices) joins the faces of a map into
+// surfaces that simplify much further.
+//
+// The kept triangles are in their original order. If `kept_triangles` is
+// set, it receives whether each triangle of the original indices was kept.
+// Vertices that are no longer referenced are dropped.
+Geometry SimplifyGeometry(const Geometry& geometry, float target_ratio,
+                          std::vector<bool>* kept_triangles = nullptr);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_MESH_SIMPLIFICATION_H_
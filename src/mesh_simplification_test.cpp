@@ -0,0 +1,111 @@
+#include "mesh_simplification.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "scene.h"
+#include "test_util.h"
+
+namespace ioq3_map {
+namespace {
+
+// A grid of size x size quads over [0, 1]^2 at height(x, y), with texture
+// coordinates from u_offset.
+Geometry CreateGrid(int size, float (*height)(float, float),
+                    float u_offset = 0.0f) {
+  Geometry geo;
+  for (int y = 0; y <= size; ++y) {
+    for (int x = 0; x <= size; ++x) {
+      const float fx = static_cast<float>(x) / size;
+      const float fy = static_cast<float>(y) / size;
+      geo.vertices.push_back(Eigen::Vector3f(fx, fy, height(fx, fy)));
+      geo.normals.push_back(Eigen::Vector3f::UnitZ());
+      geo.texture_uvs.push_back(Eigen::Vector2f(u_offset + fx, fy));
+    }
+  }
+  geo.indices = GridIndices(size);
+  return geo;
+}
+
+float Flat(float, float) { return 0.0f; }
+float Bump(float x, float y) {
+  return 0.25f * std::exp(-((x - 0.5f) * (x - 0.5f) + (y - 0.5f) * (y - 0.5f)) *
+                          20.0f);
+}
+
+bool HasVertex(const Geometry& geo, const Eigen::Vector3f& p) {
+  return std::find(geo.vertices.begin(), geo.vertices.end(), p) !=
+         geo.vertices.end();
+}
+
+TEST(MeshSimplificationTest, SimplifiesFlatGridKeepingBorders) {
+  const Geometry grid = CreateGrid(16, Flat);
+  const Geometry simplified = SimplifyGeometry(grid, 0.1f);
+
+  EXPECT_LE(simplified.indices.size() / 3, grid.indices.size() / 3 / 10 + 64);
+  EXPECT_LT(simplified.vertices.size(), grid.vertices.size());
+  EXPECT_EQ(simplified.normals.size(), simplified.vertices.size());
+  EXPECT_EQ(simplified.texture_uvs.size(), simplified.vertices.size());
+
+  // The border vertices stay.
+  for (int i = 0; i <= 16; ++i) {
+    const float t = i / 16.0f;
+    EXPECT_TRUE(HasVertex(simplified, Eigen::Vector3f(t, 0, 0)));
+    EXPECT_TRUE(HasVertex(simplified, Eigen::Vector3f(0, t, 0)));
+  }
+
+  // No triangle flips.
+  for (size_t i = 0; i < simplified.indices.size(); i += 3) {
+    const Eigen::Vector3f& p0 = simplified.vertices[simplified.indices[i]];
+    const Eigen::Vector3f& p1 = simplified.vertices[simplified.indices[i + 1]];
+    const Eigen::Vector3f& p2 = simplified.vertices[simplified.indices[i + 2]];
+    EXPECT_GT((p1 - p0).cross(p2 - p0).z(), 0.0f);
+  }
+}
+
+TEST(MeshSimplificationTest, PrefersFlatRegions) {
+  const Geometry grid = CreateGrid(16, Bump);
+  const Geometry simplified = SimplifyGeometry(grid, 0.5f);
+  EXPECT_LE(simplified.indices.size(), grid.indices.size() / 2 + 6);
+
+  // The summit of the bump is kept while the flat surroundings collapse.
+  EXPECT_TRUE(HasVertex(simplified, Eigen::Vector3f(0.5f, 0.5f, 0.25f)));
+}
+
+TEST(MeshSimplificationTest, KeepsUvSeams) {
+  // Two halves of a flat grid that share positions along x = 1 but not
+  // texture coordinates, as after welding.
+  Geometry geo = CreateGrid(8, Flat);
+  const Geometry right = CreateGrid(8, Flat, /*u_offset=*/5.0f);
+  const uint32_t offset = static_cast<uint32_t>(geo.vertices.size());
+  for (const Eigen::Vector3f& v : right.vertices) {
+    geo.vertices.push_back(v + Eigen::Vector3f(1, 0, 0));
+  }
+  geo.normals.insert(geo.normals.end(), right.normals.begin(),
+                     right.normals.end());
+  geo.texture_uvs.insert(geo.texture_uvs.end(), right.texture_uvs.begin(),
+                         right.texture_uvs.end());
+  for (uint32_t index : right.indices) {
+    geo.indices.push_back(offset + index);
+  }
+
+  std::vector<bool> kept_triangles;
+  const Geometry simplified = SimplifyGeometry(geo, 0.0f, &kept_triangles);
+  EXPECT_EQ(kept_triangles.size(), geo.indices.size() / 3);
+  EXPECT_EQ(std::count(kept_triangles.begin(), kept_triangles.end(), true),
+            simplified.indices.size() / 3);
+
+  // Both sides of the seam keep all their vertices.
+  for (int i = 0; i <= 8; ++i) {
+    const Eigen::Vector3f p(1, i / 8.0f, 0);
+    EXPECT_EQ(std::count(simplified.vertices.begin(),
+                         simplified.vertices.end(), p),
+              2);
+  }
+}
+
+}  // namespace
+}  // namespace ioq3_map
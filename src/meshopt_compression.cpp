@@ -0,0 +1,328 @@
+#include "meshopt_compression.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace ioq3_map {
+namespace {
+
+constexpr uint8_t kAttributeHeader = 0xa0;
+constexpr uint8_t kTriangleHeader = 0xe1;
+
+// Attribute codec.
+constexpr size_t kByteGroupSize = 16;
+constexpr size_t kMaxBlockBytes = 8192;
+constexpr size_t kMaxBlockElements = 256;
+constexpr size_t kMinTailSize = 32;
+
+// Triangle codec. Codes of the vertex FIFO below kMaxVertexFifoCode refer to
+// recent vertices; the others to the next, previous or an explicit vertex.
+constexpr int kMaxVertexFifoCode = 13;
+constexpr int kCodeLastMinusOne = 13;
+constexpr int kCodeLastPlusOne = 14;
+constexpr int kCodeExplicit = 15;
+
+// The pairs of vertex codes of new triangles that are coded through this
+// table instead of an extra byte, frequent ones on typical meshes. The table
+// is stored at the end of the stream: the last two entries only pad it.
+constexpr std::array<uint8_t, 16> kCodeAuxTable = {
+    0x00, 0x76, 0x87, 0x56, 0x67, 0x78, 0xa9, 0x86,
+    0x65, 0x89, 0x68, 0x98, 0x01, 0x69, 0x00, 0x00};
+constexpr int kCodeAuxTableEntries = 14;
+
+uint8_t ZigZag8(uint8_t delta) {
+  return static_cast<uint8_t>((delta << 1) ^ -(delta >> 7));
+}
+
+// The size of a group of 16 bytes packed to `bits` bits per byte, with the
+// bytes that do not fit, which are stored after the packed ones, or -1 if it
+// cannot be packed at all.
+int ByteGroupSize(const uint8_t* values, int bits) {
+  if (bits == 0) {
+    return std::all_of(values, values + kByteGroupSize,
+                       [](uint8_t v) { return v == 0; })
+               ? 0
+               : -1;
+  }
+  if (bits == 8) {
+    return static_cast<int>(kByteGroupSize);
+  }
+  const int sentinel = (1 << bits) - 1;
+  return static_cast<int>(kByteGroupSize * bits / 8 +
+                          std::count_if(values, values + kByteGroupSize,
+                                        [sentinel](uint8_t v) {
+                                          return v >= sentinel;
+                                        }));
+}
+
+void EncodeByteGroup(const uint8_t* values, int bits,
+                     std::vector<uint8_t>* out) {
+  if (bits == 0) {
+    return;
+  }
+  if (bits == 8) {
+    out->insert(out->end(), values, values + kByteGroupSize);
+    return;
+  }
+  // Values are packed from the most significant bits. The sentinel, all
+  // bits set, stands for the next of the bytes that follow.
+  const int sentinel = (1 << bits) - 1;
+  const size_t packed = out->size();
+  out->resize(packed + kByteGroupSize * bits / 8, 0);
+  for (size_t i = 0; i < kByteGroupSize; ++i) {
+    const int code = std::min<int>(values[i], sentinel);
+    const size_t bit = i * bits;
+    (*out)[packed + bit / 8] |= code << (8 - bits - bit % 8);
+  }
+  for (size_t i = 0; i < kByteGroupSize; ++i) {
+    if (values[i] >= sentinel) {
+      out->push_back(values[i]);
+    }
+  }
+}
+
+// Encodes a multiple of 16 bytes: a header of 2 bits per group, that selects
+// 0, 2, 4 or 8 bits, followed by the groups.
+void EncodeBytes(std::span<const uint8_t> values, std::vector<uint8_t>* out) {
+  const size_t num_groups = values.size() / kByteGroupSize;
+  const size_t header = out->size();
+  out->resize(header + (num_groups + 3) / 4, 0);
+  for (size_t g = 0; g < num_groups; ++g) {
+    const uint8_t* group = values.data() + g * kByteGroupSize;
+    int best_code = 3;
+    int best_size = static_cast<int>(kByteGroupSize);
+    for (int code = 0; code < 3; ++code) {
+      const int size = ByteGroupSize(group, code == 0 ? 0 : 1 << code);
+      if (size >= 0 && size < best_size) {
+        best_code = code;
+        best_size = size;
+      }
+    }
+    (*out)[header + g / 4] |= best_code << (g % 4 * 2);
+    EncodeByteGroup(group, best_code == 0 ? 0 : 1 << best_code, out);
+  }
+}
+
+// The recent edges and vertices that triangles are coded against. The
+// decoder keeps the same FIFOs, so they must be updated identically.
+class TriangleFifos {
+ public:
+  TriangleFifos() { Reset(); }
+
+  void Reset() {
+    edges_.fill({kEmpty, kEmpty});
+    vertices_.fill(kEmpty);
+  }
+
+  // The position from the newest of an edge of the triangle, times 4, plus
+  // the rotation of the triangle that starts with it, or -1.
+  int FindEdge(uint32_t a, uint32_t b, uint32_t c) const {
+    for (size_t i = 0; i < 16; ++i) {
+      const auto& [e0, e1] = edges_[(edge_offset_ - 1 - i) & 15];
+      if (e0 == a && e1 == b) return static_cast<int>(i << 2);
+      if (e0 == b && e1 == c) return static_cast<int>(i << 2 | 1);
+      if (e0 == c && e1 == a) return static_cast<int>(i << 2 | 2);
+    }
+    return -1;
+  }
+
+  // The position of the vertex from the newest, or -1.
+  int FindVertex(uint32_t v) const {
+    for (size_t i = 0; i < 16; ++i) {
+      if (vertices_[(vertex_offset_ - 1 - i) & 15] == v) {
+        return static_cast<int>(i);
+      }
+    }
+    return -1;
+  }
+
+  void PushEdge(uint32_t a, uint32_t b) {
+    edges_[edge_offset_] = {a, b};
+    edge_offset_ = (edge_offset_ + 1) & 15;
+  }
+
+  void PushVertex(uint32_t v) {
+    vertices_[vertex_offset_] = v;
+    vertex_offset_ = (vertex_offset_ + 1) & 15;
+  }
+
+ private:
+  static constexpr uint32_t kEmpty = ~0u;
+
+  std::array<std::pair<uint32_t, uint32_t>, 16> edges_;
+  std::array<uint32_t, 16> vertices_;
+  size_t edge_offset_ = 0;
+  size_t vertex_offset_ = 0;
+};
+
+// Appends the difference to the last explicit index, zigzag encoded, in 7
+// bit groups from the least significant.
+void EncodeIndex(uint32_t index, uint32_t* last, std::vector<uint8_t>* data) {
+  const uint32_t delta = index - *last;
+  uint32_t v = (delta << 1) ^ -(delta >> 31);
+  do {
+    data->push_back(static_cast<uint8_t>((v & 127) | (v > 127 ? 128 : 0)));
+    v >>= 7;
+  } while (v != 0);
+  *last = index;
+}
+
+}  // namespace
+
+std::vector<uint8_t> EncodeMeshoptAttributes(std::span<const uint8_t> data,
+                                             size_t byte_stride) {
+  const size_t count = data.size() / byte_stride;
+  const size_t block_elements =
+      std::min((kMaxBlockBytes / byte_stride) & ~(kByteGroupSize - 1),
+               kMaxBlockElements);
+
+  // Deltas of the first block start from the first element, which is also
+  // stored at the end as the baseline of the decoder.
+  std::vector<uint8_t> baseline(byte_stride, 0);
+  if (count > 0) {
+    std::memcpy(baseline.data(), data.data(), byte_stride);
+  }
+  std::vector<uint8_t> last = baseline;
+
+  std::vector<uint8_t> out = {kAttributeHeader};
+  std::vector<uint8_t> deltas(kMaxBlockElements);
+  for (size_t begin = 0; begin < count; begin += block_elements) {
+    const size_t n = std::min(block_elements, count - begin);
+    const size_t aligned = (n + kByteGroupSize - 1) & ~(kByteGroupSize - 1);
+    for (size_t k = 0; k < byte_stride; ++k) {
+      std::fill(deltas.begin(), deltas.begin() + aligned, 0);
+      uint8_t previous = last[k];
+      for (size_t i = 0; i < n; ++i) {
+        const uint8_t v = data[(begin + i) * byte_stride + k];
+        deltas[i] = ZigZag8(v - previous);
+        previous = v;
+      }
+      EncodeBytes(std::span(deltas.data(), aligned), &out);
+    }
+    std::memcpy(last.data(), &data[(begin + n - 1) * byte_stride],
+                byte_stride);
+  }
+
+  // The tail also lets the decoder read groups without bounds checks.
+  out.resize(out.size() + kMinTailSize - std::min(byte_stride, kMinTailSize),
+             0);
+  out.insert(out.end(), baseline.begin(), baseline.end());
+  return out;
+}
+
+std::vector<uint8_t> EncodeMeshoptTriangles(
+    std::span<const uint32_t> indices) {
+  // A code byte per triangle, then the extra bytes of the triangles, then
+  // kCodeAuxTable.
+  const size_t num_triangles = indices.size() / 3;
+  std::vector<uint8_t> codes;
+  codes.reserve(1 + num_triangles);
+  codes.push_back(kTriangleHeader);
+  std::vector<uint8_t> data;
+
+  TriangleFifos fifos;
+  uint32_t next = 0;
+  uint32_t last = 0;
+  for (size_t t = 0; t < num_triangles; ++t) {
+    const uint32_t* triangle = &indices[t * 3];
+
+    // A triangle on a recent edge a-b only codes its third vertex c.
+    const int edge = fifos.FindEdge(triangle[0], triangle[1], triangle[2]);
+    if (edge >= 0 && (edge >> 2) < 15) {
+      const int rotation = edge & 3;
+      const uint32_t a = triangle[rotation];
+      const uint32_t b = triangle[(rotation + 1) % 3];
+      const uint32_t c = triangle[(rotation + 2) % 3];
+
+      const int fifo_c = fifos.FindVertex(c);
+      int code_c;
+      if (fifo_c >= 1 && fifo_c < kMaxVertexFifoCode) {
+        code_c = fifo_c;
+      } else if (c == next) {
+        code_c = 0;
+        ++next;
+      } else if (c + 1 == last) {
+        code_c = kCodeLastMinusOne;
+        last = c;
+      } else if (c == last + 1) {
+        code_c = kCodeLastPlusOne;
+        last = c;
+      } else {
+        code_c = kCodeExplicit;
+        EncodeIndex(c, &last, &data);
+      }
+      codes.push_back(static_cast<uint8_t>((edge >> 2) << 4 | code_c));
+
+      if (code_c == 0 || code_c >= kMaxVertexFifoCode) {
+        fifos.PushVertex(c);
+      }
+      fifos.PushEdge(c, b);
+      fifos.PushEdge(a, c);
+      continue;
+    }
+
+    // Otherwise the triangle starts with the next vertex if it has it.
+    int rotation = 0;
+    if (triangle[1] == next) {
+      rotation = 1;
+    } else if (triangle[2] == next) {
+      rotation = 2;
+    }
+    const uint32_t a = triangle[rotation];
+    const uint32_t b = triangle[(rotation + 1) % 3];
+    const uint32_t c = triangle[(rotation + 2) % 3];
+
+    // Triangle 0, 1, 2 restarts the numbering, e.g. at a new primitive.
+    const bool reset = a == 0 && b == 1 && c == 2 && next > 0;
+    if (reset) {
+      next = 0;
+      fifos.Reset();
+    }
+
+    const int fifo_b = fifos.FindVertex(b);
+    const int fifo_c = fifos.FindVertex(c);
+    auto vertex_code = [&next](uint32_t v, int fifo) {
+      if (fifo >= 0 && fifo < 14) {
+        return fifo + 1;
+      }
+      if (v == next) {
+        ++next;
+        return 0;
+      }
+      return kCodeExplicit;
+    };
+    const int code_a = a == next ? (++next, 0) : kCodeExplicit;
+    const int code_b = vertex_code(b, fifo_b);
+    const int code_c = vertex_code(c, fifo_c);
+
+    const uint8_t code_aux = static_cast<uint8_t>(code_b << 4 | code_c);
+    const auto table_it = std::find(
+        kCodeAuxTable.begin(), kCodeAuxTable.begin() + kCodeAuxTableEntries,
+        code_aux);
+    const int table_index =
+        static_cast<int>(table_it - kCodeAuxTable.begin());
+    if (code_a == 0 && table_index < kCodeAuxTableEntries && !reset) {
+      codes.push_back(static_cast<uint8_t>(0xf0 | table_index));
+    } else {
+      codes.push_back(code_a == 0 ? 0xfe : 0xff);
+      data.push_back(code_aux);
+    }
+    if (code_a == kCodeExplicit) EncodeIndex(a, &last, &data);
+    if (code_b == kCodeExplicit) EncodeIndex(b, &last, &data);
+    if (code_c == kCodeExplicit) EncodeIndex(c, &last, &data);
+
+    fifos.PushVertex(a);
+    if (code_b == 0 || code_b == kCodeExplicit) fifos.PushVertex(b);
+    if (code_c == 0 || code_c == kCodeExplicit) fifos.PushVertex(c);
+    fifos.PushEdge(b, a);
+    fifos.PushEdge(c, b);
+    fifos.PushEdge(a, c);
+  }
+
+  codes.insert(codes.end(), data.begin(), data.end());
+  codes.insert(codes.end(), kCodeAuxTable.begin(), kCodeAuxTable.end());
+  return codes;
+}
+
+}  // namespace ioq3_map
@@ -0,0 +1,32 @@
+#ifndef IOQ3_MAP_MESHOPT_COMPRESSION_H_
+#define IOQ3_MAP_MESHOPT_COMPRESSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace ioq3_map {
+
+// Encoders of the EXT_meshopt_compression bitstreams. Both codecs turn the
+// redundancy of optimized meshes into runs of small bytes, which a general
+// purpose compressor, e.g. the gzip of a transfer, squeezes further.
+
+// Encodes `data`, an array of elements of `byte_stride` bytes, with the
+// attribute codec (mode "ATTRIBUTES", version 0): every byte of an element
+// is stored as the zigzag delta from the same byte of the previous element,
+// in groups of 16 bit-packed to 0, 2, 4 or 8 bits. `byte_stride` must be a
+// multiple of 4 of at most 256.
+std::vector<uint8_t> EncodeMeshoptAttributes(std::span<const uint8_t> data,
+                                             size_t byte_stride);
+
+// Encodes a triangle list with the triangle codec (mode "TRIANGLES", version
+// 1): triangles are coded relative to an edge or vertices of the recent
+// triangles when they share them, which, after OptimizeVertexCache and
+// OptimizeVertexFetch, leaves about one byte per triangle. Triangles may be
+// rotated, but keep their winding.
+std::vector<uint8_t> EncodeMeshoptTriangles(std::span<const uint32_t> indices);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_MESHOPT_COMPRESSION_H_
@@ -0,0 +1,269 @@
+#include "meshopt_compression.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "mesh_optimization.h"
+#include "test_util.h"
+
+namespace ioq3_map {
+namespace {
+
+// Decoders of the EXT_meshopt_compression bitstreams, as loaders implement
+// them, to check that the encoded data round trips.
+
+const uint8_t* DecodeByteGroup(const uint8_t* data, int bits,
+                               uint8_t* values) {
+  if (bits == 0) {
+    std::memset(values, 0, 16);
+    return data;
+  }
+  if (bits == 8) {
+    std::memcpy(values, data, 16);
+    return data + 16;
+  }
+  const uint8_t* extra = data + 16 * bits / 8;
+  const int sentinel = (1 << bits) - 1;
+  for (int i = 0; i < 16; ++i) {
+    const int bit = i * bits;
+    const int code = (data[bit / 8] >> (8 - bits - bit % 8)) & sentinel;
+    values[i] = code == sentinel ? *extra++ : static_cast<uint8_t>(code);
+  }
+  return extra;
+}
+
+std::optional<std::vector<uint8_t>> DecodeAttributes(
+    const std::vector<uint8_t>& buffer, size_t count, size_t byte_stride) {
+  const size_t tail_size = std::max<size_t>(byte_stride, 32);
+  if (buffer.size() < 1 + tail_size || buffer[0] != 0xa0) {
+    return std::nullopt;
+  }
+  const uint8_t* data = buffer.data() + 1;
+  const uint8_t* data_end = buffer.data() + buffer.size();
+  std::vector<uint8_t> last(data_end - byte_stride, data_end);
+
+  const size_t block_elements =
+      std::min<size_t>((8192 / byte_stride) & ~size_t{15}, 256);
+  std::vector<uint8_t> result(count * byte_stride);
+  std::vector<uint8_t> deltas(256);
+  for (size_t begin = 0; begin < count; begin += block_elements) {
+    const size_t n = std::min(block_elements, count - begin);
+    const size_t num_groups = (n + 15) / 16;
+    for (size_t k = 0; k < byte_stride; ++k) {
+      const uint8_t* header = data;
+      data += (num_groups + 3) / 4;
+      for (size_t g = 0; g < num_groups; ++g) {
+        if (data_end - data < 24) {
+          return std::nullopt;
+        }
+        const int code = (header[g / 4] >> (g % 4 * 2)) & 3;
+        data = DecodeByteGroup(data, code == 0 ? 0 : 1 << code,
+                               &deltas[g * 16]);
+      }
+      uint8_t previous = last[k];
+      for (size_t i = 0; i < n; ++i) {
+        const uint8_t delta = deltas[i];
+        previous += static_cast<uint8_t>((delta >> 1) ^ -(delta & 1));
+        result[(begin + i) * byte_stride + k] = previous;
+      }
+    }
+    std::memcpy(last.data(), &result[(begin + n - 1) * byte_stride],
+                byte_stride);
+  }
+  if (static_cast<size_t>(data_end - data) != tail_size) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+uint32_t DecodeIndex(const uint8_t*& data, uint32_t last) {
+  uint32_t v = 0;
+  for (int shift = 0;; shift += 7) {
+    const uint8_t byte = *data++;
+    v |= static_cast<uint32_t>(byte & 127) << shift;
+    if (byte < 128) {
+      break;
+    }
+  }
+  return last + ((v >> 1) ^ -(v & 1));
+}
+
+std::optional<std::vector<uint32_t>> DecodeTriangles(
+    const std::vector<uint8_t>& buffer, size_t index_count) {
+  if (buffer.size() < 1 + index_count / 3 + 16 || buffer[0] != 0xe1) {
+    return std::nullopt;
+  }
+  std::array<std::array<uint32_t, 2>, 16> edges;
+  std::array<uint32_t, 16> vertices;
+  edges.fill({~0u, ~0u});
+  vertices.fill(~0u);
+  size_t edge_offset = 0;
+  size_t vertex_offset = 0;
+  auto push_edge = [&](uint32_t a, uint32_t b) {
+    edges[edge_offset] = {a, b};
+    edge_offset = (edge_offset + 1) & 15;
+  };
+  auto push_vertex = [&](uint32_t v, bool cond = true) {
+    vertices[vertex_offset] = v;
+    vertex_offset = (vertex_offset + cond) & 15;
+  };
+
+  uint32_t next = 0;
+  uint32_t last = 0;
+  const uint8_t* code = buffer.data() + 1;
+  const uint8_t* data = code + index_count / 3;
+  const uint8_t* data_safe_end = buffer.data() + buffer.size() - 16;
+  const uint8_t* code_aux_table = data_safe_end;
+
+  std::vector<uint32_t> result;
+  for (size_t i = 0; i < index_count; i += 3) {
+    if (data > data_safe_end) {
+      return std::nullopt;
+    }
+    const uint8_t code_tri = *code++;
+    uint32_t a, b, c;
+    if (code_tri < 0xf0) {
+      const int fe = code_tri >> 4;
+      a = edges[(edge_offset - 1 - fe) & 15][0];
+      b = edges[(edge_offset - 1 - fe) & 15][1];
+      const int fec = code_tri & 15;
+      if (fec < 13) {
+        c = fec == 0 ? next++ : vertices[(vertex_offset - 1 - fec) & 15];
+        push_vertex(c, fec == 0);
+      } else {
+        c = last = fec == 15   ? DecodeIndex(data, last)
+                   : fec == 13 ? last - 1
+                               : last + 1;
+        push_vertex(c);
+      }
+      push_edge(c, b);
+      push_edge(a, c);
+    } else {
+      int fea, feb, fec;
+      if (code_tri < 0xfe) {
+        const uint8_t code_aux = code_aux_table[code_tri & 15];
+        fea = 0;
+        feb = code_aux >> 4;
+        fec = code_aux & 15;
+      } else {
+        const uint8_t code_aux = *data++;
+        fea = code_tri == 0xfe ? 0 : 15;
+        feb = code_aux >> 4;
+        fec = code_aux & 15;
+        if (code_aux == 0) {
+          next = 0;
+        }
+      }
+      a = fea == 0 ? next++ : 0;
+      b = feb == 0 ? next++ : vertices[(vertex_offset - feb) & 15];
+      c = fec == 0 ? next++ : vertices[(vertex_offset - fec) & 15];
+      if (fea == 15) a = last = DecodeIndex(data, last);
+      if (feb == 15) b = last = DecodeIndex(data, last);
+      if (fec == 15) c = last = DecodeIndex(data, last);
+      push_vertex(a);
+      push_vertex(b, feb == 0 || feb == 15);
+      push_vertex(c, fec == 0 || fec == 15);
+      push_edge(b, a);
+      push_edge(c, b);
+      push_edge(a, c);
+    }
+    result.insert(result.end(), {a, b, c});
+  }
+  if (data != data_safe_end) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+// Whether the triangles are the same, up to their rotation.
+bool SameTriangles(const std::vector<uint32_t>& expected,
+                   const std::vector<uint32_t>& actual) {
+  if (expected.size() != actual.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < expected.size(); i += 3) {
+    bool same = false;
+    for (int r = 0; r < 3; ++r) {
+      same |= actual[i] == expected[i + r] &&
+              actual[i + 1] == expected[i + (r + 1) % 3] &&
+              actual[i + 2] == expected[i + (r + 2) % 3];
+    }
+    if (!same) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST(MeshoptCompressionTest, AttributesRoundTrip) {
+  // Smooth positions compress, noise does not, and both must round trip,
+  // over several blocks.
+  std::mt19937 rng(7);
+  std::vector<float> values;
+  for (int i = 0; i < 1000; ++i) {
+    values.insert(values.end(), {i * 0.25f, 8.0f, -i * 0.5f,
+                                 std::uniform_real_distribution<float>()(rng)});
+  }
+  std::vector<uint8_t> bytes(values.size() * sizeof(float));
+  std::memcpy(bytes.data(), values.data(), bytes.size());
+
+  for (size_t stride : {4, 8, 16}) {
+    const std::vector<uint8_t> encoded =
+        EncodeMeshoptAttributes(bytes, stride);
+    EXPECT_LT(encoded.size(), bytes.size()) << stride;
+    std::optional<std::vector<uint8_t>> decoded =
+        DecodeAttributes(encoded, bytes.size() / stride, stride);
+    ASSERT_TRUE(decoded.has_value()) << stride;
+    EXPECT_EQ(*decoded, bytes) << stride;
+  }
+}
+
+TEST(MeshoptCompressionTest, AttributesOfFewElements) {
+  const std::vector<uint8_t> one = {1, 2, 3, 4, 5, 6, 7, 8};
+  const std::vector<uint8_t> encoded = EncodeMeshoptAttributes(one, 8);
+  EXPECT_EQ(DecodeAttributes(encoded, 1, 8), one);
+
+  const std::vector<uint8_t> empty =
+      EncodeMeshoptAttributes(std::vector<uint8_t>{}, 4);
+  EXPECT_EQ(empty.size(), 1 + 32);
+  EXPECT_EQ(DecodeAttributes(empty, 0, 4), std::vector<uint8_t>{});
+}
+
+TEST(MeshoptCompressionTest, TrianglesRoundTrip) {
+  std::vector<uint32_t> indices = GridIndices(20);
+  const std::vector<uint8_t> raw = EncodeMeshoptTriangles(indices);
+  std::optional<std::vector<uint32_t>> decoded =
+      DecodeTriangles(raw, indices.size());
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_TRUE(SameTriangles(indices, *decoded));
+
+  // Optimized indices mostly reuse edges and the next vertex: less than
+  // two bytes per triangle.
+  OptimizeVertexCache(indices, 21 * 21);
+  const std::vector<uint8_t> optimized = EncodeMeshoptTriangles(indices);
+  decoded = DecodeTriangles(optimized, indices.size());
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_TRUE(SameTriangles(indices, *decoded));
+  EXPECT_LT(optimized.size(), indices.size() / 3 * 2);
+}
+
+TEST(MeshoptCompressionTest, ScatteredTrianglesRoundTrip) {
+  // Large, unrelated and repeated indices, and a restart at 0, 1, 2.
+  const std::vector<uint32_t> indices = {
+      0, 1, 2, 2, 1, 3, 100000, 5, 70000, 4000000000u, 7, 7,
+      0, 1, 2, 9, 8, 3, 3,      2, 1,     12,          11, 10};
+  const std::vector<uint8_t> encoded = EncodeMeshoptTriangles(indices);
+  std::optional<std::vector<uint32_t>> decoded =
+      DecodeTriangles(encoded, indices.size());
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_TRUE(SameTriangles(indices, *decoded));
+}
+
+}  // namespace
+}  // namespace ioq3_map
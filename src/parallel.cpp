@@ -0,0 +1,47 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace ioq3_map {
+
+int ResolveThreadCount(int num_threads) {
+  if (num_threads > 0) {
+    return num_threads;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void ParallelFor(size_t count, int num_threads,
+                 const std::function<void(size_t)>& fn) {
+  const size_t num_workers = std::min<size_t>(
+      static_cast<size_t>(ResolveThreadCount(num_threads)), count);
+  if (num_workers <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+      fn(i);
+    }
+  };
+
+  // The calling thread is one of the workers.
+  std::vector<std::thread> threads;
+  threads.reserve(num_workers - 1);
+  for (size_t t = 1; t < num_workers; ++t) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace ioq3_map
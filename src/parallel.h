@@ -0,0 +1,22 @@
+#ifndef IOQ3_MAP_PARALLEL_H_
+#define IOQ3_MAP_PARALLEL_H_
+
+#include <cstddef>
+#include <functional>
+
+namespace ioq3_map {
+
+// Returns the number of worker threads to use for a requested count. A
+// non-positive request means one thread per hardware thread.
+int ResolveThreadCount(int num_threads);
+
+// Calls fn(i) for every i in [0, count) on a pool of up to `num_threads`
+// workers. Items are handed out dynamically, so their cost may vary. Runs
+// inline when a single thread is requested or there is a single item. fn must
+// be safe to call concurrently for different items.
+void ParallelFor(size_t count, int num_threads,
+                 const std::function<void(size_t)>& fn);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_PARALLEL_H_
@@ -0,0 +1,40 @@
+#include "parallel.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+namespace ioq3_map {
+namespace {
+
+TEST(ParallelTest, ResolveThreadCount) {
+  EXPECT_EQ(ResolveThreadCount(3), 3);
+  EXPECT_GE(ResolveThreadCount(0), 1);
+  EXPECT_GE(ResolveThreadCount(-1), 1);
+}
+
+TEST(ParallelTest, ParallelForVisitsEveryItemOnce) {
+  constexpr size_t kCount = 1000;
+  std::vector<std::atomic<int>> visits(kCount);
+  ParallelFor(kCount, 4, [&](size_t i) { visits[i].fetch_add(1); });
+
+  for (size_t i = 0; i < kCount; ++i) {
+    EXPECT_EQ(visits[i].load(), 1) << "item " << i;
+  }
+}
+
+TEST(ParallelTest, ParallelForHandlesNoItems) {
+  int calls = 0;
+  ParallelFor(0, 4, [&](size_t) { ++calls; });
+  EXPECT_EQ(calls, 0);
+}
+
+TEST(ParallelTest, ParallelForSingleThreadRunsInOrder) {
+  std::vector<size_t> order;
+  ParallelFor(5, 1, [&](size_t i) { order.push_back(i); });
+  EXPECT_EQ(order, (std::vector<size_t>{0, 1, 2, 3, 4}));
+}
+
+}  // namespace
+}  // namespace ioq3_map
@@ -0,0 +1,223 @@
+#include "patch_stitching.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <map>
+
+namespace ioq3_map {
+namespace {
+
+// Parameters closer than this are the same grid line.
+constexpr float kParameterEpsilon = 1e-4f;
+
+// Stitching stops after this many passes over the seams, e.g. for chains of
+// seams that keep exchanging rounding errors.
+constexpr int kMaxStitchPasses = 16;
+
+// Control points are matched on a 1/16 unit grid.
+constexpr float kPositionScale = 16.0f;
+
+using QuantizedPoint = std::array<int64_t, 3>;
+
+QuantizedPoint Quantize(const Eigen::Vector3f& p) {
+  return {std::llround(p.x() * kPositionScale),
+          std::llround(p.y() * kPositionScale),
+          std::llround(p.z() * kPositionScale)};
+}
+
+// The control points of a segment, in canonical order.
+using SegmentKey = std::array<QuantizedPoint, 3>;
+
+const vertex_t& ControlPoint(const BSPPatch& patch, int x, int y) {
+  return patch.control_points[y * patch.width + x];
+}
+
+// The grid parameters that an edge is sampled at.
+std::vector<float>& EdgeParameters(const PatchEdge& edge, PatchGrid* grid) {
+  return edge.along_rows ? grid->rows : grid->columns;
+}
+
+// The parameters of the edge's span, as local parameters in [0, 1] in the
+// direction of the seam's reference edge.
+std::vector<float> SeamParameters(const PatchEdge& edge,
+                                  const std::vector<float>& params) {
+  std::vector<float> ts;
+  auto it = std::lower_bound(params.begin(), params.end(),
+                             edge.span - kParameterEpsilon);
+  for (; it != params.end() && *it <= edge.span + 1 + kParameterEpsilon;
+       ++it) {
+    const float t = std::clamp(*it - edge.span, 0.0f, 1.0f);
+    ts.push_back(edge.reversed ? 1.0f - t : t);
+  }
+  return ts;
+}
+
+// The grid parameter of the seam parameter t on the edge.
+float GridParameter(const PatchEdge& edge, float t) {
+  return edge.span + (edge.reversed ? 1.0f - t : t);
+}
+
+// Returns the index of the parameter, or -1 if it is not a grid line.
+int FindParameter(const std::vector<float>& params, float value) {
+  auto it =
+      std::lower_bound(params.begin(), params.end(), value - kParameterEpsilon);
+  if (it == params.end() || *it > value + kParameterEpsilon) {
+    return -1;
+  }
+  return static_cast<int>(it - params.begin());
+}
+
+// Adds a grid line at the parameter unless there is one already. Returns
+// whether it was added.
+bool InsertParameter(std::vector<float>* params, float value) {
+  if (FindParameter(*params, value) >= 0) {
+    return false;
+  }
+  params->insert(std::lower_bound(params->begin(), params->end(), value),
+                 value);
+  return true;
+}
+
+// Returns the index of the vertex of the grid on the edge at the parameter
+// index.
+int EdgeVertex(const PatchEdge& edge, const PatchGrid& grid, int index) {
+  if (edge.along_rows) {
+    const int column = edge.at_end ? grid.width() - 1 : 0;
+    return index * grid.width() + column;
+  }
+  const int row = edge.at_end ? grid.height() - 1 : 0;
+  return row * grid.width() + index;
+}
+
+// Registers the boundary segments of a patch.
+void AddPatchEdges(const BSPPatch& patch, int patch_index,
+                   std::map<SegmentKey, std::vector<PatchEdge>>* segments) {
+  auto add = [&](const vertex_t& p0, const vertex_t& p1, const vertex_t& p2,
+                 PatchEdge edge) {
+    SegmentKey key = {Quantize(p0.xyz), Quantize(p1.xyz), Quantize(p2.xyz)};
+    if (key[0] == key[2]) {
+      // Collapsed edges, e.g. at the tip of a cone, join nothing.
+      return;
+    }
+    if (key[2] < key[0]) {
+      std::swap(key[0], key[2]);
+      edge.reversed = true;
+    }
+    (*segments)[key].push_back(edge);
+  };
+
+  const int last_x = patch.width - 1;
+  const int last_y = patch.height - 1;
+  for (int span = 0; span < last_x / 2; ++span) {
+    const int x = span * 2;
+    for (bool at_end : {false, true}) {
+      const int y = at_end ? last_y : 0;
+      add(ControlPoint(patch, x, y), ControlPoint(patch, x + 1, y),
+          ControlPoint(patch, x + 2, y),
+          PatchEdge{.patch = patch_index,
+                    .along_rows = false,
+                    .at_end = at_end,
+                    .span = span});
+    }
+  }
+  for (int span = 0; span < last_y / 2; ++span) {
+    const int y = span * 2;
+    for (bool at_end : {false, true}) {
+      const int x = at_end ? last_x : 0;
+      add(ControlPoint(patch, x, y), ControlPoint(patch, x, y + 1),
+          ControlPoint(patch, x, y + 2),
+          PatchEdge{.patch = patch_index,
+                    .along_rows = true,
+                    .at_end = at_end,
+                    .span = span});
+    }
+  }
+}
+
+}  // namespace
+
+std::vector<PatchSeam> StitchPatchGrids(std::span<const BSPPatch> patches,
+                                        std::span<PatchGrid> grids) {
+  CHECK_EQ(patches.size(), grids.size());
+
+  std::map<SegmentKey, std::vector<PatchEdge>> segments;
+  for (size_t i = 0; i < patches.size(); ++i) {
+    if (grids[i].columns.empty() || grids[i].rows.empty()) {
+      continue;  // Invalid patch.
+    }
+    AddPatchEdges(patches[i], static_cast<int>(i), &segments);
+  }
+
+  std::vector<PatchSeam> seams;
+  for (auto& [key, edges] : segments) {
+    if (edges.size() < 2) {
+      continue;
+    }
+    // Orient the edges relative to the first one.
+    const bool first_reversed = edges.front().reversed;
+    for (PatchEdge& edge : edges) {
+      edge.reversed = edge.reversed != first_reversed;
+    }
+    seams.push_back(PatchSeam{std::move(edges)});
+  }
+
+  // Inserting a column or row into a patch also changes its opposite edge,
+  // which may be part of another seam: repeat until no seam changes.
+  int pass = 0;
+  for (bool changed = true; changed && pass < kMaxStitchPasses; ++pass) {
+    changed = false;
+    for (const PatchSeam& seam : seams) {
+      std::vector<float> ts;
+      for (const PatchEdge& edge : seam.edges) {
+        const std::vector<float> edge_ts =
+            SeamParameters(edge, EdgeParameters(edge, &grids[edge.patch]));
+        ts.insert(ts.end(), edge_ts.begin(), edge_ts.end());
+      }
+      for (const PatchEdge& edge : seam.edges) {
+        std::vector<float>& params = EdgeParameters(edge, &grids[edge.patch]);
+        for (float t : ts) {
+          changed |= InsertParameter(&params, GridParameter(edge, t));
+        }
+      }
+    }
+  }
+  if (pass == kMaxStitchPasses) {
+    LOG(WARNING) << "Patch stitching did not converge after " << pass
+                 << " passes.";
+  }
+
+  return seams;
+}
+
+void WeldPatchSeams(std::span<const PatchSeam> seams,
+                    std::span<PatchGrid> grids) {
+  for (const PatchSeam& seam : seams) {
+    const PatchEdge& reference = seam.edges.front();
+    PatchGrid& reference_grid = grids[reference.patch];
+    const std::vector<float>& reference_params =
+        EdgeParameters(reference, &reference_grid);
+
+    for (size_t e = 1; e < seam.edges.size(); ++e) {
+      const PatchEdge& edge = seam.edges[e];
+      PatchGrid& grid = grids[edge.patch];
+      const std::vector<float>& params = EdgeParameters(edge, &grid);
+      for (float t : SeamParameters(reference, reference_params)) {
+        const int from =
+            FindParameter(reference_params, GridParameter(reference, t));
+        const int to = FindParameter(params, GridParameter(edge, t));
+        if (from < 0 || to < 0) {
+          continue;  // The seam did not converge.
+        }
+        grid.vertices[EdgeVertex(edge, grid, to)].xyz =
+            reference_grid.vertices[EdgeVertex(reference, reference_grid, from)]
+                .xyz;
+      }
+    }
+  }
+}
+
+}  // namespace ioq3_map
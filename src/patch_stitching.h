@@ -0,0 +1,55 @@
+#ifndef IOQ3_MAP_PATCH_STITCHING_H_
+#define IOQ3_MAP_PATCH_STITCHING_H_
+
+#include <span>
+#include <vector>
+
+#include "bsp_geometry.h"
+#include "triangulation.h"
+
+namespace ioq3_map {
+
+// One side of a seam: a 3 control point segment on the boundary of a patch,
+// i.e. the edge of a sub-patch.
+struct PatchEdge {
+  // Index into the patches being stitched.
+  int patch = 0;
+
+  // Whether the edge runs along the grid rows, i.e. is the first or last
+  // control column. Otherwise, it runs along the grid columns and is the first
+  // or last control row.
+  bool along_rows = false;
+  // Whether the edge is the last control column (row) rather than the first.
+  bool at_end = false;
+
+  // The sub-patch along the edge, i.e. the edge spans grid parameters
+  // [span, span + 1].
+  int span = 0;
+
+  // Whether the edge runs in the opposite direction to the seam's first edge.
+  bool reversed = false;
+};
+
+// Edges of several patches that have the same control points, so the patches
+// meet there. The first edge is the reference of the seam.
+struct PatchSeam {
+  std::vector<PatchEdge> edges;
+};
+
+// Like the engine's R_StitchAllPatches: finds the edges that patches share
+// and inserts columns and rows into their planned grids (see PlanPatchGrid)
+// until both sides of every seam are sampled at the same parameters. Patches
+// tessellated at different densities then meet without T-junction cracks.
+// Returns the seams, for WeldPatchSeams.
+std::vector<PatchSeam> StitchPatchGrids(std::span<const BSPPatch> patches,
+                                        std::span<PatchGrid> grids);
+
+// Copies the positions of the evaluated vertices on the reference edge of
+// every seam to the other edges, so that the seams are watertight down to
+// the last bit.
+void WeldPatchSeams(std::span<const PatchSeam> seams,
+                    std::span<PatchGrid> grids);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_PATCH_STITCHING_H_
@@ -0,0 +1,123 @@
+#include "patch_stitching.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "bsp_geometry.h"
+#include "triangulation.h"
+
+namespace ioq3_map {
+namespace {
+
+std::vector<vertex_t> CreateControlPoints(
+    int width, int height,
+    const std::function<Eigen::Vector3f(int x, int y)>& position) {
+  std::vector<vertex_t> control_points(width * height);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      vertex_t& v = control_points[y * width + x];
+      v.xyz = position(x, y);
+      v.normal = Eigen::Vector3f::UnitZ();
+    }
+  }
+  return control_points;
+}
+
+// The positions of the vertices of the first or last grid column.
+std::vector<Eigen::Vector3f> ColumnPositions(const PatchGrid& grid,
+                                             bool last) {
+  std::vector<Eigen::Vector3f> positions;
+  for (int y = 0; y < grid.height(); ++y) {
+    const int x = last ? grid.width() - 1 : 0;
+    positions.push_back(grid.vertices[y * grid.width() + x].xyz);
+  }
+  return positions;
+}
+
+// Plans, stitches, evaluates and welds the grids of the patches.
+std::vector<PatchGrid> TessellateStitched(const std::vector<BSPPatch>& patches,
+                                          const PatchTessellation& options) {
+  std::vector<PatchGrid> grids;
+  for (const BSPPatch& patch : patches) {
+    grids.push_back(PlanPatchGrid(patch, options));
+  }
+  const std::vector<PatchSeam> seams = StitchPatchGrids(patches, grids);
+  for (size_t i = 0; i < patches.size(); ++i) {
+    EvaluatePatchGrid(patches[i], &grids[i]);
+  }
+  WeldPatchSeams(seams, grids);
+  return grids;
+}
+
+TEST(PatchStitchingTest, MatchesDensityAcrossSharedEdge) {
+  // A bulges along y at its far edge, so it is subdivided into many rows. B
+  // is flat and shares A's straight edge at x = 64.
+  const std::vector<vertex_t> a = CreateControlPoints(3, 3, [](int x, int y) {
+    return Eigen::Vector3f(x * 32, y * 32, (x == 0 && y == 1) ? 64 : 0);
+  });
+  const std::vector<vertex_t> b = CreateControlPoints(3, 3, [](int x, int y) {
+    return Eigen::Vector3f(64 + x * 32, y * 32, 0);
+  });
+  const std::vector<BSPPatch> patches = {{3, 3, a}, {3, 3, b}};
+  const PatchTessellation options{.max_error = 1.0f};
+
+  // Unstitched, B is a single quad, which leaves T-junctions along A's edge.
+  ASSERT_GT(PlanPatchGrid(patches[0], options).height(), 2);
+  ASSERT_EQ(PlanPatchGrid(patches[1], options).height(), 2);
+
+  const std::vector<PatchGrid> grids = TessellateStitched(patches, options);
+  EXPECT_EQ(grids[1].rows, grids[0].rows);
+  EXPECT_EQ(ColumnPositions(grids[1], /*last=*/false),
+            ColumnPositions(grids[0], /*last=*/true));
+
+  // The columns of B are not affected.
+  EXPECT_EQ(grids[1].width(), 2);
+}
+
+TEST(PatchStitchingTest, MatchesReversedEdge) {
+  // A's first column of sub-patches is curved, its second flat. B is a flat
+  // patch whose rows run in the opposite direction along the shared edge.
+  const std::vector<vertex_t> a = CreateControlPoints(3, 5, [](int x, int y) {
+    return Eigen::Vector3f(x * 32, y * 32, (x == 0 && y == 1) ? 64 : 0);
+  });
+  const std::vector<vertex_t> b = CreateControlPoints(3, 5, [](int x, int y) {
+    return Eigen::Vector3f(64 + x * 32, (4 - y) * 32, 0);
+  });
+  const std::vector<BSPPatch> patches = {{3, 5, a}, {3, 5, b}};
+  const PatchTessellation options{.max_error = 1.0f};
+
+  const std::vector<PatchGrid> grids = TessellateStitched(patches, options);
+  ASSERT_EQ(grids[1].height(), grids[0].height());
+  ASSERT_GT(grids[0].height(), 3);
+  for (int y = 0; y < grids[0].height(); ++y) {
+    EXPECT_FLOAT_EQ(grids[1].rows[grids[1].height() - 1 - y],
+                    2.0f - grids[0].rows[y]);
+  }
+
+  std::vector<Eigen::Vector3f> a_edge = ColumnPositions(grids[0], true);
+  std::vector<Eigen::Vector3f> b_edge = ColumnPositions(grids[1], false);
+  std::reverse(b_edge.begin(), b_edge.end());
+  EXPECT_EQ(b_edge, a_edge);
+}
+
+TEST(PatchStitchingTest, LeavesSeparatePatchesAlone) {
+  const std::vector<vertex_t> a = CreateControlPoints(3, 3, [](int x, int y) {
+    return Eigen::Vector3f(x * 32, y * 32, (x == 0 && y == 1) ? 64 : 0);
+  });
+  const std::vector<vertex_t> b = CreateControlPoints(3, 3, [](int x, int y) {
+    return Eigen::Vector3f(128 + x * 32, y * 32, 0);
+  });
+  const std::vector<BSPPatch> patches = {{3, 3, a}, {3, 3, b}};
+  const PatchTessellation options{.max_error = 1.0f};
+
+  std::vector<PatchGrid> grids = {PlanPatchGrid(patches[0], options),
+                                  PlanPatchGrid(patches[1], options)};
+  EXPECT_TRUE(StitchPatchGrids(patches, grids).empty());
+  EXPECT_EQ(grids[1].height(), 2);
+}
+
+}  // namespace
+}  // namespace ioq3_map
@@ -1,13 +1,41 @@
 #include "saver.h"
 
 #include <glog/logging.h>
-#include <tiny_gltf.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
 #include <map>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+
+#include "block_compression.h"
+#include "content_hash.h"
+#include "file_copy.h"
+#include "geometry_batching.h"
+#include "gltf_writer.h"
+#include "ktx2.h"
+#include "mesh_optimization.h"
+#include "meshopt_compression.h"
+#include "parallel.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include "texture_mips.h"
+#include "vertex_quantization.h"
 
 namespace ioq3_map {
 namespace {
@@ -15,414 +43,1575 @@ namespace {
 const float kAreaLightIntensityScale = 1.0f;
 const float kPunctualLightIntensityScale = 100.0f;
 
-// Helpers for buffer management
-void AddBufferView(const void* data, size_t size, size_t stride, int target,
-                   int& view_index, tinygltf::Model* model) {
-  if (model->buffers.empty()) {
-    model->buffers.emplace_back();
-  }
-  tinygltf::Buffer& buffer = model->buffers[0];
-
-  // Align to 4 bytes
-  size_t padding = 0;
-  if (buffer.data.size() % 4 != 0) {
-    padding = 4 - (buffer.data.size() % 4);
-  }
-  for (size_t i = 0; i < padding; ++i) buffer.data.push_back(0);
-
-  size_t byte_offset = buffer.data.size();
-  const unsigned char* bytes = static_cast<const unsigned char*>(data);
-  buffer.data.insert(buffer.data.end(), bytes, bytes + size);
-
-  tinygltf::BufferView view;
-  view.buffer = 0;
-  view.byteOffset = byte_offset;
-  view.byteLength = size;
-  view.byteStride = stride;
-  view.target = target;
-  model->bufferViews.push_back(view);
-  view_index = static_cast<int>(model->bufferViews.size() - 1);
-}
-
-int AddAccessor(int buffer_view, int component_type, size_t count, int type,
-                const std::vector<double>& min_vals,
-                const std::vector<double>& max_vals, tinygltf::Model* model) {
-  tinygltf::Accessor acc;
-  acc.bufferView = buffer_view;
-  acc.byteOffset = 0;
-  acc.componentType = component_type;
-  acc.count = count;
-  acc.type = type;
-  acc.minValues = min_vals;
-  acc.maxValues = max_vals;
-  model->accessors.push_back(acc);
-  return static_cast<int>(model->accessors.size() - 1);
-}
-
-std::optional<int> AddOrReuseTexture(
-    const std::filesystem::path& from_uri,
-    const std::filesystem::path& output_dir, tinygltf::Model* model,
-    std::unordered_map<std::string, int>* texture_allocations) {
-  // Copy the file to the same directory as the output file.
-  // We use the filename as the relative URI in the glTF.
-  std::filesystem::path filename = from_uri.filename();
-  if (from_uri.has_parent_path() && from_uri.parent_path().has_filename()) {
-    std::string new_name =
-        from_uri.parent_path().filename().string() + "@" + filename.string();
-    filename = std::filesystem::path(new_name);
-  }
-  std::filesystem::path destination = output_dir / filename;
-
-  std::string uri_key = filename.string();
-  auto texture_index_it = texture_allocations->find(uri_key);
-  if (texture_index_it != texture_allocations->end()) {
-    return texture_index_it->second;
+// The most vertices whose indices fit uint16, without the restart value.
+constexpr size_t kMaxUint16Vertices = UINT16_MAX;
+
+// The attributes are written straight from the geometries.
+static_assert(sizeof(Eigen::Vector3f) == 3 * sizeof(float));
+static_assert(sizeof(Eigen::Vector2f) == 2 * sizeof(float));
+
+// The attribute and index views compressed with EXT_meshopt_compression,
+// before and after compression, and the time spent compressing them.
+struct CompressionStats {
+  size_t attribute_bytes = 0;
+  size_t compressed_attribute_bytes = 0;
+  size_t index_bytes = 0;
+  size_t compressed_index_bytes = 0;
+  std::chrono::steady_clock::duration time{};
+};
+
+// What the primitives refer to, and how their attributes are encoded.
+struct PrimitiveEncoding {
+  std::unordered_map<BSPTextureIndex, int> materials;
+
+  // Whether the attributes are quantized (see vertex_quantization.h), with
+  // the scale of the texture coordinates of every material.
+  bool quantize = false;
+  std::unordered_map<BSPTextureIndex, float> texture_uv_scales;
+
+  // The error of the quantized attributes, as they are written.
+  QuantizationError error;
+
+  // Whether the attributes of a primitive share one strided view.
+  bool interleave = false;
+
+  // The number of primitives by index component type.
+  std::map<int, size_t> index_types;
+
+  // Whether the views are compressed (see meshopt_compression.h).
+  bool compress = false;
+  CompressionStats compression;
+};
+
+template <typename Values>
+std::span<const uint8_t> AsBytes(const Values& values) {
+  return {reinterpret_cast<const uint8_t*>(values.data()),
+          values.size() * sizeof(values[0])};
+}
+
+// An attribute of the vertices of a primitive: its accessor, less the view,
+// and how it is encoded, `size` bytes per vertex.
+struct VertexAttribute {
+  std::string name;
+  int component_type = 0;
+  bool normalized = false;
+  std::string type;
+  size_t size = 0;
+  nlohmann::json min = nullptr;
+  nlohmann::json max = nullptr;
+
+  // Encodes the attribute of the vertices [begin, end) to every `stride`
+  // bytes of `out`.
+  std::function<void(size_t begin, size_t end, size_t stride, uint8_t* out)>
+      write;
+};
+
+// Vertices are encoded in blocks, to bound the temporary arrays of the
+// encoded attributes.
+constexpr size_t kVertexBlockSize = 4096;
+
+// Writes `values`, `size` bytes per vertex, to every `stride` bytes of `out`.
+template <typename Values>
+void WriteStrided(const Values& values, size_t size, size_t stride,
+                  uint8_t* out) {
+  const std::span<const uint8_t> bytes = AsBytes(values);
+  if (stride == size) {
+    std::memcpy(out, bytes.data(), bytes.size());
+    return;
+  }
+  for (size_t i = 0; i * size < bytes.size(); ++i) {
+    std::memcpy(out + i * stride, bytes.data() + i * size, size);
+  }
+}
+
+// The attribute of the vertices [begin, end).
+template <typename T>
+std::span<const T> VertexRange(const std::vector<T>& values, size_t begin,
+                               size_t end) {
+  return std::span(values).subspan(begin, end - begin);
+}
+
+// Encodes the vertices [begin, end) to `out`, `stride` bytes each, with the
+// attributes one after another.
+void EncodeVertices(std::span<const VertexAttribute> attributes,
+                    size_t stride, size_t begin, size_t end, uint8_t* out) {
+  size_t offset = 0;
+  for (const VertexAttribute& attribute : attributes) {
+    attribute.write(begin, end, stride, out + offset);
+    offset += attribute.size;
+  }
+}
+
+// Plans a view of `count` vertices that holds the attributes, interleaved
+// when there are several. The vertices are encoded as the buffer is written,
+// or right away when they are compressed, to know their compressed length.
+int AddVertexView(size_t count,
+                  const std::vector<VertexAttribute>& attributes,
+                  PrimitiveEncoding* encoding, GltfWriter* writer) {
+  size_t stride = 0;
+  for (const VertexAttribute& attribute : attributes) {
+    stride += attribute.size;
+  }
+
+  if (encoding->compress) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> vertices(count * stride);
+    for (size_t begin = 0; begin < count; begin += kVertexBlockSize) {
+      EncodeVertices(attributes, stride, begin,
+                     std::min(count, begin + kVertexBlockSize),
+                     &vertices[begin * stride]);
+    }
+    std::vector<uint8_t> data = EncodeMeshoptAttributes(vertices, stride);
+    CompressionStats& stats = encoding->compression;
+    stats.time += std::chrono::steady_clock::now() - start;
+    stats.attribute_bytes += vertices.size();
+    stats.compressed_attribute_bytes += data.size();
+    return writer->AddMeshoptBufferView(count, stride, kGltfTargetArrayBuffer,
+                                        "ATTRIBUTES", std::move(data));
+  }
+  return writer->AddBufferView(
+      count * stride, stride, kGltfTargetArrayBuffer,
+      [count, stride, attributes](std::ostream& out) {
+        std::vector<uint8_t> block(std::min(count, kVertexBlockSize) * stride);
+        for (size_t begin = 0; begin < count; begin += kVertexBlockSize) {
+          const size_t end = std::min(count, begin + kVertexBlockSize);
+          EncodeVertices(attributes, stride, begin, end, block.data());
+          out.write(reinterpret_cast<const char*>(block.data()),
+                    (end - begin) * stride);
+        }
+      });
+}
+
+// The narrowest index type that the indices fit. The largest value of a type
+// is left out, as it restarts strips in graphics APIs, and 8-bit indices when
+// compressing, as EXT_meshopt_compression does not decode them.
+int IndexComponentType(std::span<const uint32_t> indices, bool compress) {
+  const uint32_t max_index =
+      indices.empty() ? 0 : *std::max_element(indices.begin(), indices.end());
+  if (max_index < UINT8_MAX && !compress) {
+    return kGltfComponentTypeUnsignedByte;
+  }
+  if (max_index < UINT16_MAX) {
+    return kGltfComponentTypeUnsignedShort;
+  }
+  return kGltfComponentTypeUnsignedInt;
+}
+
+template <typename T>
+void WriteIndices(std::span<const uint32_t> indices, std::ostream& out) {
+  const std::vector<T> narrowed(indices.begin(), indices.end());
+  out.write(reinterpret_cast<const char*>(narrowed.data()),
+            narrowed.size() * sizeof(T));
+}
+
+// Plans a view of the triangle list in `component_type`, which is written as
+// is, or compressed.
+int AddIndexView(const std::vector<uint32_t>& indices, int component_type,
+                 PrimitiveEncoding* encoding, GltfWriter* writer) {
+  const size_t index_size = GltfComponentSize(component_type);
+  if (encoding->compress) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> data = EncodeMeshoptTriangles(indices);
+    CompressionStats& stats = encoding->compression;
+    stats.time += std::chrono::steady_clock::now() - start;
+    stats.index_bytes += indices.size() * index_size;
+    stats.compressed_index_bytes += data.size();
+    return writer->AddMeshoptBufferView(indices.size(), index_size,
+                                        kGltfTargetElementArrayBuffer,
+                                        "TRIANGLES", std::move(data));
+  }
+  return writer->AddBufferView(
+      indices.size() * index_size, 0, kGltfTargetElementArrayBuffer,
+      [&indices, component_type](std::ostream& out) {
+        if (component_type == kGltfComponentTypeUnsignedByte) {
+          WriteIndices<uint8_t>(indices, out);
+        } else if (component_type == kGltfComponentTypeUnsignedShort) {
+          WriteIndices<uint16_t>(indices, out);
+        } else {
+          WriteIndices<uint32_t>(indices, out);
+        }
+      });
+}
+
+int AddAccessor(int buffer_view, size_t byte_offset, int component_type,
+                bool normalized, size_t count, const std::string& type,
+                GltfWriter* writer, nlohmann::json min_vals = nullptr,
+                nlohmann::json max_vals = nullptr) {
+  nlohmann::json acc = {{"bufferView", buffer_view},
+                        {"componentType", component_type},
+                        {"count", count},
+                        {"type", type}};
+  if (byte_offset != 0) {
+    acc["byteOffset"] = byte_offset;
+  }
+  if (normalized) {
+    acc["normalized"] = true;
+  }
+  if (!min_vals.is_null()) {
+    acc["min"] = std::move(min_vals);
+    acc["max"] = std::move(max_vals);
+  }
+  return writer->Add("accessors", std::move(acc));
+}
+
+constexpr size_t kHashBlockSize = 1 << 20;
+
+// An image of the materials. Images are identified by the hash of their
+// content, which also names their files: sources with the same content share
+// one glTF image, whatever their paths.
+struct TextureSource {
+  std::filesystem::path from_uri;
+
+  // Set once the image is read. Missing images are left out of the materials.
+  std::optional<uint64_t> hash;
+  uint64_t size = 0;
+
+  // The content of the image, on the first source of the image, when it was
+  // inflated from an in-memory virtual filesystem to be hashed: the later
+  // stages reuse it rather than inflate the entry again.
+  std::optional<std::string> content;
+
+  // Whether a material blends by the alpha of the source.
+  bool alpha_blended = false;
+
+  // The image re-encoded as PNG, on the first source of the image, when it is
+  // embedded but glTF does not define its type.
+  std::string png;
+
+  // The KTX2 transcoding of the image, on the first source of the image,
+  // once transcoded. Its data is only kept to be embedded.
+  std::string ktx2_file_name;
+  std::vector<uint8_t> ktx2;
+};
+
+// The images of the materials, in the order the materials use them.
+struct TextureSet {
+  std::vector<TextureSource> sources;
+  // Path of a source -> index in `sources`.
+  std::unordered_map<std::string, size_t> source_indices;
+  // Content hash -> index of the first source with that content, which names
+  // the image.
+  std::unordered_map<uint64_t, size_t> images;
+  // Content hash -> glTF texture index, once the texture is added.
+  std::unordered_map<uint64_t, int> textures;
+
+  void Add(const Texture& texture) {
+    if (texture.file_path.empty()) {
+      return;
+    }
+    auto [it, inserted] =
+        source_indices.emplace(texture.file_path.string(), sources.size());
+    if (inserted) {
+      sources.emplace_back().from_uri = texture.file_path;
+    }
+    sources[it->second].alpha_blended |= texture.alpha_blended;
+  }
+};
+
+// Collects the textures that the materials of the scene use.
+TextureSet CollectTextures(const Scene& scene) {
+  TextureSet textures;
+  for (const auto& [bsp_tex_idx, mat] : scene.materials) {
+    textures.Add(mat.albedo);
+    if (mat.emission_intensity > 0.0f) {
+      textures.Add(mat.emission);
+    }
+  }
+  return textures;
+}
+
+// Reads and hashes the image: from the inflated entry when the virtual
+// filesystem is in memory, in blocks from disk otherwise.
+void HashTexture(const VirtualFilesystem* vfs, TextureSource* source) {
+  if (vfs != nullptr && vfs->in_memory) {
+    source->content = vfs->ReadFile(source->from_uri);
+    if (source->content) {
+      source->hash = HashContent(*source->content);
+      source->size = source->content->size();
+    }
+    return;
+  }
+  std::ifstream file(source->from_uri, std::ios::binary);
+  if (!file) {
+    LOG(ERROR) << "Could not open texture: " << source->from_uri;
+    return;
+  }
+  ContentHasher hasher;
+  std::vector<char> block(kHashBlockSize);
+  uint64_t size = 0;
+  do {
+    file.read(block.data(), block.size());
+    hasher.Update(std::string_view(block.data(), file.gcount()));
+    size += file.gcount();
+  } while (file);
+  if (file.bad()) {
+    LOG(ERROR) << "Could not read texture: " << source->from_uri;
+    return;
+  }
+  source->hash = hasher.Digest();
+  source->size = size;
+}
+
+// Hashes the sources on a pool of workers, and then identifies their images.
+void HashTextures(const VirtualFilesystem* vfs, int num_threads,
+                  TextureSet* textures) {
+  const auto start = std::chrono::steady_clock::now();
+  ParallelFor(textures->sources.size(), num_threads, [&](size_t i) {
+    HashTexture(vfs, &textures->sources[i]);
+  });
+  for (size_t i = 0; i < textures->sources.size(); ++i) {
+    TextureSource& source = textures->sources[i];
+    if (source.hash && !textures->images.emplace(*source.hash, i).second) {
+      source.content.reset();
+    }
+  }
+  if (!textures->sources.empty()) {
+    LOG(INFO) << "Hashed " << textures->sources.size() << " textures in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+              << " ms: " << textures->images.size() << " unique images.";
+  }
+}
+
+// The file name of an image: the hash of its content, with the extension of
+// its source.
+std::string TextureFileName(const TextureSource& source) {
+  return ContentHashString(*source.hash) + source.from_uri.extension().string();
+}
+
+// Reads the texture, through the virtual filesystem if there is one.
+std::optional<std::string> ReadTexture(const std::filesystem::path& from_uri,
+                                       const VirtualFilesystem* vfs) {
+  if (vfs != nullptr) {
+    return vfs->ReadFile(from_uri);
+  }
+  std::ifstream file(from_uri, std::ios::binary);
+  if (!file) {
+    LOG(ERROR) << "Could not open texture: " << from_uri;
+    return std::nullopt;
+  }
+  return std::string((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+}
+
+// The content of the image: kept from hashing, or else read into `storage`.
+std::optional<std::string_view> TextureContent(const TextureSource& source,
+                                               const VirtualFilesystem* vfs,
+                                               std::string* storage) {
+  if (source.content) {
+    return *source.content;
+  }
+  std::optional<std::string> content = ReadTexture(source.from_uri, vfs);
+  if (!content) {
+    return std::nullopt;
+  }
+  *storage = *std::move(content);
+  return *storage;
+}
+
+// An image file to write.
+struct TextureCopy {
+  const TextureSource* source = nullptr;
+  std::filesystem::path destination;
+};
+
+// Writes the image file: from the inflated entry when the virtual filesystem
+// is in memory, with CopyFileAtomically otherwise. Either way the file is
+// written under a temporary name and renamed, so that the exports sharing a
+// texture directory never see a partial file. Returns the method used.
+std::optional<std::string_view> MaterializeTexture(
+    const TextureCopy& copy, const VirtualFilesystem* vfs) {
+  // The name of the file stands for its content, and files are only ever
+  // renamed into place once complete: a file of the same size is the same
+  // image, e.g. written by a previous export to a shared directory.
+  std::error_code error;
+  const uint64_t existing_size =
+      std::filesystem::file_size(copy.destination, error);
+  if (!error && existing_size == copy.source->size) {
+    return CopyMethodName(CopyMethod::kExisting);
   }
 
-  try {
-    // to_uri is usually unique, but just in case we have a collision we
-    // will overwrite the file.
-    if (!std::filesystem::exists(destination) ||
-        !std::filesystem::equivalent(from_uri, destination)) {
-      std::filesystem::copy_file(
-          from_uri, destination,
-          std::filesystem::copy_options::overwrite_existing);
+  if (copy.source->content || (vfs != nullptr && vfs->in_memory)) {
+    std::string storage;
+    std::optional<std::string_view> content =
+        TextureContent(*copy.source, vfs, &storage);
+    if (!content) {
+      return std::nullopt;
+    }
+    // Replaced rather than truncated, which would write through a hard link
+    // left by a previous export to the file it is linked to.
+    if (!WriteFileAtomically(copy.destination, *content)) {
+      LOG(ERROR) << "Failed to write texture to " << copy.destination;
+      return std::nullopt;
     }
-  } catch (const std::filesystem::filesystem_error& e) {
-    LOG(ERROR) << "Failed to copy file from " << from_uri << " to "
-               << destination << ". Cause: " << e.what();
+    return "memory";
+  }
+
+  std::optional<CopyMethod> method =
+      CopyFileAtomically(copy.source->from_uri, copy.destination);
+  if (!method) {
     return std::nullopt;
   }
+  return CopyMethodName(*method);
+}
+
+// Materializes the textures on a pool of workers, since the copies mostly wait
+// on I/O. Returns false if any texture could not be written.
+bool MaterializeTextures(const std::vector<TextureCopy>& copies,
+                         const VirtualFilesystem* vfs, int num_threads) {
+  struct Result {
+    std::optional<std::string_view> method;
+    std::chrono::steady_clock::duration time{};
+  };
+  std::vector<Result> results(copies.size());
+  const auto start = std::chrono::steady_clock::now();
+  ParallelFor(copies.size(), num_threads, [&](size_t i) {
+    const auto copy_start = std::chrono::steady_clock::now();
+    results[i].method = MaterializeTexture(copies[i], vfs);
+    results[i].time = std::chrono::steady_clock::now() - copy_start;
+  });
+  const auto time = std::chrono::steady_clock::now() - start;
+
+  auto ms = [](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  std::map<std::string_view, size_t> method_counts;
+  size_t num_failed = 0;
+  for (size_t i = 0; i < copies.size(); ++i) {
+    if (!results[i].method) {
+      ++num_failed;
+      continue;
+    }
+    ++method_counts[*results[i].method];
+    VLOG(1) << "Texture " << copies[i].destination.filename() << ": "
+            << *results[i].method << " in " << ms(results[i].time) << " ms.";
+  }
+  if (num_failed > 0) {
+    LOG(ERROR) << "Failed to write " << num_failed << " textures.";
+    return false;
+  }
+  if (!copies.empty()) {
+    std::string methods;
+    for (const auto& [method, count] : method_counts) {
+      methods += (methods.empty() ? "" : ", ") + std::to_string(count) + " " +
+                 std::string(method);
+    }
+    LOG(INFO) << "Wrote " << copies.size() << " textures (" << methods
+              << ") in " << ms(time) << " ms.";
+  }
+  return true;
+}
+
+// Writes a file per image to `texture_dir`, from the first source of the
+// image. Returns false if any file could not be written.
+bool WriteTextureFiles(const TextureSet& textures,
+                       const std::filesystem::path& texture_dir,
+                       const VirtualFilesystem* vfs, int num_threads) {
+  std::vector<TextureCopy> copies;
+  for (size_t i = 0; i < textures.sources.size(); ++i) {
+    const TextureSource& source = textures.sources[i];
+    if (source.hash && textures.images.at(*source.hash) == i) {
+      copies.push_back({&source, texture_dir / TextureFileName(source)});
+    }
+  }
+  return MaterializeTextures(copies, vfs, num_threads);
+}
 
-  tinygltf::Image img;
-  img.uri = uri_key;
-  model->images.push_back(img);
+// The MIME type of an image embedded in the buffer. glTF only defines PNG and
+// JPEG, so other images, e.g. TGA, have none and are re-encoded as PNG.
+std::optional<std::string> ImageMimeType(const std::filesystem::path& path) {
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (extension == ".png") {
+    return "image/png";
+  }
+  if (extension == ".jpg" || extension == ".jpeg") {
+    return "image/jpeg";
+  }
+  return std::nullopt;
+}
 
-  tinygltf::Texture tex;
-  tex.source = static_cast<int>(model->images.size() - 1);
-  model->textures.push_back(tex);
+// Decodes the image to 8-bit RGBA.
+std::optional<RgbaImage> DecodeTexture(const TextureSource& source,
+                                       const VirtualFilesystem* vfs) {
+  std::string storage;
+  std::optional<std::string_view> content =
+      TextureContent(source, vfs, &storage);
+  if (!content) {
+    return std::nullopt;
+  }
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  stbi_uc* pixels = stbi_load_from_memory(
+      reinterpret_cast<const stbi_uc*>(content->data()),
+      static_cast<int>(content->size()), &width, &height, &channels,
+      /*desired_channels=*/4);
+  if (pixels == nullptr) {
+    LOG(WARNING) << "Could not decode texture " << source.from_uri << ": "
+                 << stbi_failure_reason();
+    return std::nullopt;
+  }
+  RgbaImage image{
+      width, height,
+      std::vector<uint8_t>(pixels, pixels + size_t(width) * height * 4)};
+  stbi_image_free(pixels);
+  return image;
+}
 
-  texture_index_it =
-      texture_allocations->emplace(uri_key, model->textures.size() - 1).first;
-  return texture_index_it->second;
+// Re-encodes the embedded images of a type that glTF does not define as PNG,
+// on a pool of workers. The images that cannot be decoded are left out of the
+// materials.
+void EncodeEmbeddedImages(const VirtualFilesystem* vfs, int num_threads,
+                          TextureSet* textures) {
+  std::vector<TextureSource*> images;
+  for (size_t i = 0; i < textures->sources.size(); ++i) {
+    TextureSource& source = textures->sources[i];
+    if (source.hash && textures->images.at(*source.hash) == i &&
+        !ImageMimeType(source.from_uri)) {
+      images.push_back(&source);
+    }
+  }
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<size_t> num_failed{0};
+  ParallelFor(images.size(), num_threads, [&](size_t i) {
+    TextureSource& source = *images[i];
+    std::optional<RgbaImage> image = DecodeTexture(source, vfs);
+    if (!image ||
+        !stbi_write_png_to_func(
+            [](void* context, void* data, int size) {
+              static_cast<std::string*>(context)->append(
+                  static_cast<const char*>(data), size);
+            },
+            &source.png, image->width, image->height, /*comp=*/4,
+            image->pixels.data(), image->width * 4)) {
+      LOG(WARNING) << "Leaving out texture " << source.from_uri
+                   << ": it cannot be embedded as PNG.";
+      source.png.clear();
+      ++num_failed;
+    }
+  });
+  if (!images.empty()) {
+    LOG(INFO) << "Re-encoded " << images.size() - num_failed << " of "
+              << images.size() << " images as PNG in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+              << " ms.";
+  }
 }
 
-}  // namespace
+// The block format of an image: BC1 unless a stage blends by its alpha.
+BlockFormat TextureBlockFormat(bool alpha_blended, BlockQuality quality) {
+  if (!alpha_blended) {
+    return BlockFormat::kBc1;
+  }
+  return quality == BlockQuality::kFast ? BlockFormat::kBc3
+                                        : BlockFormat::kBc7;
+}
+
+Ktx2Format Ktx2BlockFormat(BlockFormat format) {
+  switch (format) {
+    case BlockFormat::kBc1:
+      return Ktx2Format::kBc1RgbSrgb;
+    case BlockFormat::kBc3:
+      return Ktx2Format::kBc3Srgb;
+    case BlockFormat::kBc7:
+      return Ktx2Format::kBc7Srgb;
+  }
+  LOG(FATAL) << "Unknown block format " << static_cast<int>(format);
+  return Ktx2Format::kRgba8Srgb;
+}
+
+// The transcoding of an image to KTX2.
+struct Transcoding {
+  // The first source of the image.
+  TextureSource* image = nullptr;
+  std::optional<BlockFormat> block_format;
+  Ktx2Format format = Ktx2Format::kRgba8Srgb;
+  std::string file_name;
+
+  // The mip chain, base level first, once decoded, and then the data of its
+  // levels.
+  int width = 0;
+  int height = 0;
+  std::vector<RgbaImage> mips;
+  std::vector<std::vector<uint8_t>> levels;
+
+  // The block compression error of the base level.
+  BlockError error;
+};
+
+// A range of block rows of a mip level.
+struct BlockRowTask {
+  Transcoding* transcoding;
+  size_t level;
+  int begin_row;
+  int end_row;
+};
+
+constexpr int kBlockRowsPerTask = 16;
+
+// Block compresses the mip chains. The levels of all the images are split into
+// ranges of block rows, compressed on one pool of workers, so that a few large
+// textures do not leave workers idle. The mip chains are released.
+void CompressMipChains(BlockQuality quality, int num_threads,
+                       std::vector<Transcoding>* transcodings) {
+  std::vector<BlockRowTask> tasks;
+  for (Transcoding& transcoding : *transcodings) {
+    for (size_t level = 0; level < transcoding.mips.size(); ++level) {
+      const RgbaImage& mip = transcoding.mips[level];
+      const int num_rows = BlockRowCount(mip);
+      transcoding.levels.emplace_back(size_t(num_rows) *
+                                      BlockColumnCount(mip) *
+                                      BlockSize(*transcoding.block_format));
+      for (int row = 0; row < num_rows; row += kBlockRowsPerTask) {
+        tasks.push_back({&transcoding, level, row,
+                         std::min(row + kBlockRowsPerTask, num_rows)});
+      }
+    }
+  }
+  std::vector<BlockError> errors(tasks.size());
+  ParallelFor(tasks.size(), num_threads, [&](size_t i) {
+    const BlockRowTask& task = tasks[i];
+    Transcoding& transcoding = *task.transcoding;
+    errors[i] = CompressBlockRows(
+        transcoding.mips[task.level], *transcoding.block_format, quality,
+        task.begin_row, task.end_row, transcoding.levels[task.level].data());
+  });
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    if (tasks[i].level == 0) {
+      tasks[i].transcoding->error += errors[i];
+    }
+  }
+  for (Transcoding& transcoding : *transcodings) {
+    transcoding.mips = {};
+  }
+}
+
+// Transcodes the images to KTX2 on a pool of workers: their mip chains as
+// they are, or block compressed with `block_quality` when set (see
+// TextureBlockFormat). The KTX2 files are written to `texture_dir`, named
+// after the content of their image and their format, unless they are
+// embedded: their data is then kept until the buffer is written. An image
+// whose KTX2 file exists is not transcoded again. Images that cannot be
+// decoded are left with their original file only. Returns false if any KTX2
+// file could not be written.
+bool TranscodeTextures(const std::filesystem::path& texture_dir, bool embed,
+                       std::optional<BlockQuality> block_quality,
+                       const VirtualFilesystem* vfs, int num_threads,
+                       TextureSet* textures) {
+  // An image keeps its alpha if any of its sources is blended by it.
+  std::unordered_map<uint64_t, bool> alpha_blended;
+  for (const TextureSource& source : textures->sources) {
+    if (source.hash) {
+      alpha_blended[*source.hash] |= source.alpha_blended;
+    }
+  }
+  std::vector<Transcoding> transcodings;
+  for (size_t i = 0; i < textures->sources.size(); ++i) {
+    TextureSource& source = textures->sources[i];
+    if (!source.hash || textures->images.at(*source.hash) != i) {
+      continue;
+    }
+    Transcoding transcoding;
+    transcoding.image = &source;
+    std::string format_name(Ktx2FormatName(transcoding.format));
+    if (block_quality) {
+      transcoding.block_format =
+          TextureBlockFormat(alpha_blended.at(*source.hash), *block_quality);
+      transcoding.format = Ktx2BlockFormat(*transcoding.block_format);
+      format_name = std::string(Ktx2FormatName(transcoding.format)) + "-" +
+                    std::string(BlockQualityName(*block_quality));
+    }
+    transcoding.file_name =
+        ContentHashString(*source.hash) + "." + format_name + ".ktx2";
+    transcodings.push_back(std::move(transcoding));
+  }
 
-bool SaveScene(const Scene& scene, const std::filesystem::path& path) {
-  tinygltf::Model model;
-  model.asset.generator = "ioq3-map-exporter";
-  model.asset.version = "2.0";
+  std::atomic<size_t> num_existing{0};
+  const auto start = std::chrono::steady_clock::now();
+  ParallelFor(transcodings.size(), num_threads, [&](size_t i) {
+    Transcoding& transcoding = transcodings[i];
+    const std::filesystem::path destination =
+        texture_dir / transcoding.file_name;
+    if (!embed && std::filesystem::exists(destination)) {
+      ++num_existing;
+      transcoding.image->ktx2_file_name = transcoding.file_name;
+      return;
+    }
+    std::optional<RgbaImage> base =
+        DecodeTexture(*transcoding.image, vfs);
+    if (!base) {
+      return;
+    }
+    transcoding.width = base->width;
+    transcoding.height = base->height;
+    transcoding.mips = GenerateMipChain(*std::move(base));
+  });
+  if (block_quality) {
+    CompressMipChains(*block_quality, num_threads, &transcodings);
+  } else {
+    for (Transcoding& transcoding : transcodings) {
+      for (RgbaImage& mip : transcoding.mips) {
+        transcoding.levels.push_back(std::move(mip.pixels));
+      }
+      transcoding.mips = {};
+    }
+  }
 
-  // Texture Allocations: absolute path string -> glTF texture index
-  std::unordered_map<std::string, int> texture_allocations;
-  // Material Mapping: BSPTextureIndex -> glTF Material Index
-  std::unordered_map<BSPTextureIndex, int> bsp_to_gltf_material;
+  std::atomic<size_t> num_transcoded{0};
+  std::atomic<size_t> num_failed{0};
+  std::atomic<uint64_t> num_bytes{0};
+  ParallelFor(transcodings.size(), num_threads, [&](size_t i) {
+    Transcoding& transcoding = transcodings[i];
+    if (transcoding.levels.empty()) {
+      return;
+    }
+    std::vector<uint8_t> ktx2 =
+        EncodeKtx2(transcoding.format, transcoding.width, transcoding.height,
+                   transcoding.levels);
+    transcoding.levels = {};
+    if (!embed &&
+        !WriteFileAtomically(
+            texture_dir / transcoding.file_name,
+            std::string_view(reinterpret_cast<const char*>(ktx2.data()),
+                             ktx2.size()))) {
+      ++num_failed;
+      return;
+    }
+    if (transcoding.block_format) {
+      const BlockError& error = transcoding.error;
+      std::ostringstream psnr;
+      psnr << error.ColorPsnr() << " dB in color";
+      if (error.alpha_samples > 0) {
+        psnr << " and " << error.AlphaPsnr() << " dB in alpha";
+      }
+      LOG(INFO) << "Texture " << transcoding.image->from_uri.filename() << ": "
+                << ktx2.size() << " bytes of "
+                << Ktx2FormatName(transcoding.format) << ", PSNR "
+                << psnr.str() << ".";
+    } else {
+      VLOG(1) << "Texture " << transcoding.image->from_uri.filename() << ": "
+              << ktx2.size() << " bytes of KTX2.";
+    }
+    ++num_transcoded;
+    num_bytes += ktx2.size();
+    transcoding.image->ktx2_file_name = transcoding.file_name;
+    if (embed) {
+      transcoding.image->ktx2 = std::move(ktx2);
+    }
+  });
+  if (num_failed > 0) {
+    LOG(ERROR) << "Failed to write " << num_failed << " KTX2 textures.";
+    return false;
+  }
+  if (!transcodings.empty()) {
+    LOG(INFO) << "Transcoded " << num_transcoded << " of "
+              << transcodings.size() << " images to " << num_bytes
+              << " bytes of KTX2, and reused " << num_existing
+              << " KTX2 files, in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+              << " ms.";
+  }
+  return true;
+}
+
+// The directory of the image files relative to the output file, as a URI
+// prefix: empty when they are written next to it.
+std::optional<std::string> TextureUriPrefix(
+    const std::filesystem::path& texture_dir,
+    const std::filesystem::path& output_dir) {
+  std::error_code error;
+  std::filesystem::path relative = std::filesystem::relative(
+      texture_dir, output_dir.empty() ? "." : output_dir, error);
+  if (error || relative.empty()) {
+    LOG(ERROR) << "Could not locate " << texture_dir << " from "
+               << output_dir;
+    return std::nullopt;
+  }
+  if (relative == ".") {
+    return "";
+  }
+  return relative.generic_string() + "/";
+}
+
+// Adds a texture for the image, once per content. The image is embedded in the
+// buffer when `embed` is set: as the PNG it was re-encoded to (see
+// EncodeEmbeddedImages), or else as it is, from the content kept from hashing
+// or read as the buffer is written. Otherwise, it refers to its file under
+// `uri_prefix` (see TextureFileName).
+std::optional<int> AddOrReuseTexture(const std::filesystem::path& from_uri,
+                                     const std::string& uri_prefix,
+                                     const VirtualFilesystem* vfs, bool embed,
+                                     GltfWriter* writer,
+                                     TextureSet* textures) {
+  auto source_it = textures->source_indices.find(from_uri.string());
+  if (source_it == textures->source_indices.end() ||
+      !textures->sources[source_it->second].hash) {
+    return std::nullopt;
+  }
+  const uint64_t hash = *textures->sources[source_it->second].hash;
+  auto texture_index_it = textures->textures.find(hash);
+  if (texture_index_it != textures->textures.end()) {
+    return texture_index_it->second;
+  }
+
+  // The image is named after its first source, e.g. "base_wall@concrete.tga".
+  const TextureSource& image = textures->sources[textures->images.at(hash)];
+  std::string name = image.from_uri.filename().string();
+  if (image.from_uri.has_parent_path() &&
+      image.from_uri.parent_path().has_filename()) {
+    name = image.from_uri.parent_path().filename().string() + "@" + name;
+  }
+
+  nlohmann::json img;
+  img["name"] = name;
+  std::optional<std::string> mime_type = ImageMimeType(image.from_uri);
+  if (embed && !mime_type) {
+    if (image.png.empty()) {
+      return std::nullopt;
+    }
+    const std::string& data = image.png;
+    img["mimeType"] = "image/png";
+    img["bufferView"] = writer->AddBufferView(
+        data.size(), /*byte_stride=*/0, /*target=*/0,
+        [&data](std::ostream& out) { out.write(data.data(), data.size()); });
+  } else if (embed) {
+    img["mimeType"] = *std::move(mime_type);
+    img["bufferView"] = writer->AddBufferView(
+        image.size, /*byte_stride=*/0, /*target=*/0,
+        [&image, vfs](std::ostream& out) {
+          std::string storage;
+          std::optional<std::string_view> content =
+              TextureContent(image, vfs, &storage);
+          if (!content) {
+            out.setstate(std::ios::failbit);
+            return;
+          }
+          out.write(content->data(), content->size());
+        });
+  } else {
+    img["uri"] = uri_prefix + TextureFileName(image);
+  }
+  nlohmann::json texture = {{"source", writer->Add("images", std::move(img))}};
+
+  // The KTX2 transcoding, for the loaders that support it. It is not a glTF
+  // image: KHR_texture_basisu only allows Basis Universal KTX2 images, so the
+  // transcoding is referenced by a vendor extension that other loaders ignore.
+  if (!image.ktx2_file_name.empty()) {
+    nlohmann::json ktx2 = {{"mimeType", "image/ktx2"}};
+    if (embed) {
+      const std::vector<uint8_t>& data = image.ktx2;
+      ktx2["bufferView"] = writer->AddBufferView(
+          data.size(), /*byte_stride=*/0, /*target=*/0,
+          [&data](std::ostream& out) {
+            out.write(reinterpret_cast<const char*>(data.data()), data.size());
+          });
+    } else {
+      ktx2["uri"] = uri_prefix + image.ktx2_file_name;
+    }
+    writer->UseExtension("IOQ3_texture_ktx2");
+    texture["extensions"]["IOQ3_texture_ktx2"] = std::move(ktx2);
+  }
+  const int texture_index = writer->Add("textures", std::move(texture));
+  textures->textures.emplace(hash, texture_index);
+  return texture_index;
+}
+
+// Post-transform cache misses of the geometries, before and after their
+// optimization.
+struct CacheStats {
+  size_t misses_before = 0;
+  size_t misses_after = 0;
+  size_t triangles = 0;
+
+  CacheStats& operator+=(const CacheStats& other) {
+    misses_before += other.misses_before;
+    misses_after += other.misses_after;
+    triangles += other.triangles;
+    return *this;
+  }
+
+  void Count(const Geometry& geo, bool optimized) {
+    const size_t misses = CountCacheMisses(geo.indices, geo.vertices.size());
+    if (optimized) {
+      misses_after += misses;
+    } else {
+      misses_before += misses;
+      triangles += geo.indices.size() / 3;
+    }
+  }
+};
+
+// Whether the lightmap coordinates fit normalized uint16, up to rounding.
+bool InUnitRange(const std::vector<Eigen::Vector2f>& uvs) {
+  constexpr float kTolerance = 1e-3f;
+  return std::all_of(uvs.begin(), uvs.end(), [](const Eigen::Vector2f& uv) {
+    return uv.minCoeff() >= -kTolerance && uv.maxCoeff() <= 1 + kTolerance;
+  });
+}
+
+// The attributes of the geometry's vertices, as the encoding writes them.
+// The positions are quantized by `quantization` if the encoding quantizes.
+std::vector<VertexAttribute> VertexAttributes(
+    const Geometry& geo, const PositionQuantization& quantization,
+    PrimitiveEncoding* encoding) {
+  std::vector<VertexAttribute> attributes;
+  QuantizationError* error = &encoding->error;
+
+  // Position
+  {
+    Eigen::Vector3f min_v = Eigen::Vector3f::Zero();
+    Eigen::Vector3f max_v = Eigen::Vector3f::Zero();
+    if (!geo.vertices.empty()) {
+      min_v = max_v = geo.vertices.front();
+      for (const auto& v : geo.vertices) {
+        min_v = min_v.cwiseMin(v);
+        max_v = max_v.cwiseMax(v);
+      }
+    }
+    VertexAttribute& position = attributes.emplace_back();
+    position.name = "POSITION";
+    position.type = "VEC3";
+    if (encoding->quantize) {
+      // Rounding is monotonic, so the bounds quantize to the bounds. They are
+      // written as integers, as the components are.
+      min_v = quantization.Quantize(min_v);
+      max_v = quantization.Quantize(max_v);
+      position.min = {std::lround(min_v.x()), std::lround(min_v.y()),
+                      std::lround(min_v.z())};
+      position.max = {std::lround(max_v.x()), std::lround(max_v.y()),
+                      std::lround(max_v.z())};
+      position.component_type = kGltfComponentTypeShort;
+      position.normalized = true;
+      position.size = 8;
+      position.write = [&geo, quantization, error](size_t begin, size_t end,
+                                                   size_t stride,
+                                                   uint8_t* out) {
+        WriteStrided(QuantizePositions(VertexRange(geo.vertices, begin, end),
+                                       quantization, &error->position),
+                     8, stride, out);
+      };
+    } else {
+      position.component_type = kGltfComponentTypeFloat;
+      position.size = 12;
+      position.write = [&geo](size_t begin, size_t end, size_t stride,
+                              uint8_t* out) {
+        WriteStrided(VertexRange(geo.vertices, begin, end), 12, stride, out);
+      };
+      position.min = {min_v.x(), min_v.y(), min_v.z()};
+      position.max = {max_v.x(), max_v.y(), max_v.z()};
+    }
+  }
+
+  // Normal
+  if (!geo.normals.empty()) {
+    VertexAttribute& normal = attributes.emplace_back();
+    normal.name = "NORMAL";
+    normal.type = "VEC3";
+    if (encoding->quantize) {
+      normal.component_type = kGltfComponentTypeByte;
+      normal.normalized = true;
+      normal.size = 4;
+      normal.write = [&geo, error](size_t begin, size_t end, size_t stride,
+                                   uint8_t* out) {
+        WriteStrided(QuantizeNormals(VertexRange(geo.normals, begin, end),
+                                     &error->normal),
+                     4, stride, out);
+      };
+    } else {
+      normal.component_type = kGltfComponentTypeFloat;
+      normal.size = 12;
+      normal.write = [&geo](size_t begin, size_t end, size_t stride,
+                            uint8_t* out) {
+        WriteStrided(VertexRange(geo.normals, begin, end), 12, stride, out);
+      };
+    }
+  }
+
+  // Texcoord 0 (Texture UVs)
+  if (!geo.texture_uvs.empty()) {
+    VertexAttribute& texture_uv = attributes.emplace_back();
+    texture_uv.name = "TEXCOORD_0";
+    texture_uv.type = "VEC2";
+    if (encoding->quantize) {
+      const float scale = encoding->texture_uv_scales.at(geo.material_id);
+      texture_uv.component_type = kGltfComponentTypeShort;
+      texture_uv.normalized = true;
+      texture_uv.size = 4;
+      texture_uv.write = [&geo, scale, error](size_t begin, size_t end,
+                                              size_t stride, uint8_t* out) {
+        WriteStrided(
+            QuantizeTextureUvs(VertexRange(geo.texture_uvs, begin, end), scale,
+                               &error->texture_uv),
+            4, stride, out);
+      };
+    } else {
+      texture_uv.component_type = kGltfComponentTypeFloat;
+      texture_uv.size = 8;
+      texture_uv.write = [&geo](size_t begin, size_t end, size_t stride,
+                                uint8_t* out) {
+        WriteStrided(VertexRange(geo.texture_uvs, begin, end), 8, stride, out);
+      };
+    }
+  }
+
+  // Texcoord 1 (Lightmap UVs). Coordinates outside of the lightmap are kept
+  // as floats.
+  if (!geo.lightmap_uvs.empty()) {
+    VertexAttribute& lightmap_uv = attributes.emplace_back();
+    lightmap_uv.name = "TEXCOORD_1";
+    lightmap_uv.type = "VEC2";
+    if (encoding->quantize && InUnitRange(geo.lightmap_uvs)) {
+      lightmap_uv.component_type = kGltfComponentTypeUnsignedShort;
+      lightmap_uv.normalized = true;
+      lightmap_uv.size = 4;
+      lightmap_uv.write = [&geo, error](size_t begin, size_t end,
+                                        size_t stride, uint8_t* out) {
+        WriteStrided(
+            QuantizeLightmapUvs(VertexRange(geo.lightmap_uvs, begin, end),
+                                &error->lightmap_uv),
+            4, stride, out);
+      };
+    } else {
+      lightmap_uv.component_type = kGltfComponentTypeFloat;
+      lightmap_uv.size = 8;
+      lightmap_uv.write = [&geo](size_t begin, size_t end, size_t stride,
+                                 uint8_t* out) {
+        WriteStrided(VertexRange(geo.lightmap_uvs, begin, end), 8, stride,
+                     out);
+      };
+    }
+  }
+  return attributes;
+}
+
+// Plans the attributes and indices of the geometry and returns a primitive
+// that draws them. The geometry is only read as the buffer is written, unless
+// it is compressed. Every attribute has a view of its own, or shares one
+// with the others at its offset in the vertex when the encoding interleaves.
+nlohmann::json AddPrimitive(const Geometry& geo,
+                            const PositionQuantization& quantization,
+                            PrimitiveEncoding* encoding, GltfWriter* writer) {
+  nlohmann::json prim = {{"mode", kGltfModeTriangles}};
+
+  // Find assigned material
+  auto mat_it = encoding->materials.find(geo.material_id);
+  if (mat_it != encoding->materials.end()) {
+    prim["material"] = mat_it->second;
+  }
+
+  const size_t num_vertices = geo.vertices.size();
+  std::vector<VertexAttribute> attributes =
+      VertexAttributes(geo, quantization, encoding);
+  std::vector<std::vector<VertexAttribute>> views;
+  if (encoding->interleave) {
+    views.push_back(attributes);
+  } else {
+    for (const VertexAttribute& attribute : attributes) {
+      views.push_back({attribute});
+    }
+  }
+  for (const std::vector<VertexAttribute>& view : views) {
+    const int view_idx = AddVertexView(num_vertices, view, encoding, writer);
+    size_t offset = 0;
+    for (const VertexAttribute& attribute : view) {
+      prim["attributes"][attribute.name] = AddAccessor(
+          view_idx, offset, attribute.component_type, attribute.normalized,
+          num_vertices, attribute.type, writer, attribute.min, attribute.max);
+      offset += attribute.size;
+    }
+  }
+
+  // Indices
+  {
+    const int component_type =
+        IndexComponentType(geo.indices, encoding->compress);
+    ++encoding->index_types[component_type];
+    const int view_idx =
+        AddIndexView(geo.indices, component_type, encoding, writer);
+    prim["indices"] = AddAccessor(view_idx, /*byte_offset=*/0, component_type,
+                                  /*normalized=*/false, geo.indices.size(),
+                                  "SCALAR", writer);
+  }
+  return prim;
+}
+
+// Scales the texture coordinates of the material's textures back from their
+// quantized range.
+void ApplyTextureUvScale(float scale, nlohmann::json* material) {
+  const nlohmann::json transform = {{"scale", {scale, scale}}};
+  nlohmann::json& pbr = (*material)["pbrMetallicRoughness"];
+  if (pbr.contains("baseColorTexture")) {
+    pbr["baseColorTexture"]["extensions"]["KHR_texture_transform"] = transform;
+  }
+  if (material->contains("emissiveTexture")) {
+    (*material)["emissiveTexture"]["extensions"]["KHR_texture_transform"] =
+        transform;
+  }
+}
+
+// One batch per surface that passes `filter`, when there is one, in surface
+// order, with the transform of the surface.
+std::vector<GeometryBatch> SplitGeometriesBySurface(
+    const std::unordered_map<BSPSurfaceIndex, Geometry>& geometries,
+    const std::function<bool(BSPSurfaceIndex)>& filter = nullptr) {
+  std::vector<BSPSurfaceIndex> surfaces;
+  surfaces.reserve(geometries.size());
+  for (const auto& [surface, geo] : geometries) {
+    if (!filter || filter(surface)) {
+      surfaces.push_back(surface);
+    }
+  }
+  std::sort(surfaces.begin(), surfaces.end());
+
+  std::vector<GeometryBatch> batches(surfaces.size());
+  for (size_t i = 0; i < surfaces.size(); ++i) {
+    const Geometry& geo = geometries.at(surfaces[i]);
+    batches[i].geometry = geo;
+    batches[i].surfaces.push_back(
+        {.surface = surfaces[i],
+         .index_count = static_cast<uint32_t>(geo.indices.size()),
+         .vertex_count = static_cast<uint32_t>(geo.vertices.size())});
+  }
+  return batches;
+}
+
+// Welds, simplifies and optimizes the batch as the options ask.
+void PrepareBatch(const SaveOptions& options, GeometryBatch* batch,
+                  WeldStats* weld_stats, CacheStats* cache_stats) {
+  if (options.weld) {
+    *weld_stats += WeldGeometryBatch(*options.weld, batch);
+  }
+  AddGeometryBatchLods(options.lod_ratios, batch);
+  if (options.optimize_vertex_cache) {
+    cache_stats->Count(batch->geometry, /*optimized=*/false);
+    OptimizeGeometryBatch(batch);
+    cache_stats->Count(batch->geometry, /*optimized=*/true);
+  }
+}
+
+// Adds a node that draws the geometries of levels[0], with a primitive per
+// geometry. Further levels are coarser levels of detail of the same
+// geometries: they are written as nodes of their own, which the node refers
+// to through MSFT_lod. Returns the index of the node.
+//
+// When quantizing, the positions of a node share a quantization, whose
+// dequantization is part of the node transform.
+int AddMeshNode(const std::string& name,
+                const std::vector<std::vector<const Geometry*>>& levels,
+                const Eigen::Affine3f* transform,
+                PrimitiveEncoding* encoding, GltfWriter* writer) {
+  std::vector<int> level_nodes;
+  for (size_t l = 0; l < levels.size(); ++l) {
+    PositionQuantization quantization;
+    if (encoding->quantize) {
+      Eigen::AlignedBox3f bounds;
+      for (const Geometry* geo : levels[l]) {
+        for (const Eigen::Vector3f& v : geo->vertices) {
+          bounds.extend(v);
+        }
+      }
+      if (!bounds.isEmpty()) {
+        quantization =
+            PositionQuantization::FromBounds(bounds.min(), bounds.max());
+      }
+    }
+
+    nlohmann::json mesh;
+    mesh["name"] = l == 0 ? name : name + "_LOD" + std::to_string(l);
+    for (const Geometry* geo : levels[l]) {
+      mesh["primitives"].push_back(
+          AddPrimitive(*geo, quantization, encoding, writer));
+    }
+
+    nlohmann::json node = {{"name", mesh["name"]}};
+    node["mesh"] = writer->Add("meshes", std::move(mesh));
+    if (transform != nullptr || encoding->quantize) {
+      Eigen::Affine3f node_transform = Eigen::Affine3f::Identity();
+      if (transform != nullptr) {
+        node_transform = *transform;
+      }
+      if (encoding->quantize) {
+        node_transform = node_transform * quantization.Dequantization();
+      }
+      Eigen::Matrix4f mat = node_transform.matrix();
+      node["matrix"] = std::vector<float>(mat.data(), mat.data() + 16);
+    }
+    level_nodes.push_back(writer->Add("nodes", std::move(node)));
+  }
+
+  if (level_nodes.size() > 1) {
+    writer->UseExtension("MSFT_lod");
+    writer->document()["nodes"][level_nodes[0]]["extensions"]["MSFT_lod"] = {
+        {"ids", std::vector<int>(level_nodes.begin() + 1, level_nodes.end())}};
+  }
+  return level_nodes[0];
+}
+
+}  // namespace
+
+bool SaveScene(const Scene& scene, const std::filesystem::path& path,
+               const SaveOptions& options) {
+  GltfWriter writer;
+  nlohmann::json& document = writer.document();
+  const bool binary = options.format == SaveFormat::kGlb;
+
+  // The images of the materials are hashed first, and their files written
+  // next to the output file or to the shared texture directory, unless they
+  // are embedded.
+  TextureSet textures = CollectTextures(scene);
+  HashTextures(options.vfs, options.num_threads, &textures);
+  if (binary) {
+    EncodeEmbeddedImages(options.vfs, options.num_threads, &textures);
+  }
+  std::filesystem::path texture_dir = path.parent_path();
+  std::string texture_uri_prefix;
+  if (!binary) {
+    if (!options.texture_dir.empty()) {
+      texture_dir = options.texture_dir;
+      std::error_code error;
+      std::filesystem::create_directories(texture_dir, error);
+      std::optional<std::string> prefix =
+          TextureUriPrefix(texture_dir, path.parent_path());
+      if (!prefix) {
+        return false;
+      }
+      texture_uri_prefix = *std::move(prefix);
+    }
+    if (!WriteTextureFiles(textures, texture_dir, options.vfs,
+                           options.num_threads)) {
+      return false;
+    }
+  }
+  if (options.texture_format != TextureFormat::kOriginal &&
+      !TranscodeTextures(texture_dir, binary,
+                         options.texture_format == TextureFormat::kKtx2Bc
+                             ? std::optional(options.texture_quality)
+                             : std::nullopt,
+                         options.vfs, options.num_threads, &textures)) {
+    return false;
+  }
+  // Only the images embedded as they are still need the content kept from
+  // hashing.
+  for (TextureSource& source : textures.sources) {
+    if (!binary || !ImageMimeType(source.from_uri)) {
+      source.content.reset();
+    }
+  }
+  // Material Mapping: BSPTextureIndex -> glTF Material Index, and how the
+  // vertices are encoded.
+  PrimitiveEncoding encoding;
+  encoding.quantize = options.quantize;
+  encoding.interleave = options.interleave;
+  encoding.compress = options.compress;
 
   // 1. Export Materials
   for (const auto& [bsp_tex_idx, mat] : scene.materials) {
-    tinygltf::Material gmat;
-    gmat.name = mat.name;
+    nlohmann::json gmat;
+    gmat["name"] = mat.name;
 
     // Populate PBR
-    gmat.pbrMetallicRoughness.metallicFactor = 0.;
-    gmat.pbrMetallicRoughness.roughnessFactor = 1.;
+    gmat["pbrMetallicRoughness"] = {{"metallicFactor", 0.},
+                                    {"roughnessFactor", 1.}};
 
     // Handle Albedo Texture
     if (!mat.albedo.file_path.empty()) {
       auto texture_index =
-          AddOrReuseTexture(mat.albedo.file_path, path.parent_path(), &model,
-                            &texture_allocations);
+          AddOrReuseTexture(mat.albedo.file_path, texture_uri_prefix,
+                            options.vfs, binary, &writer, &textures);
       if (texture_index.has_value()) {
-        gmat.pbrMetallicRoughness.baseColorTexture.index = *texture_index;
+        gmat["pbrMetallicRoughness"]["baseColorTexture"] = {
+            {"index", *texture_index}};
       }
     }
 
     // Handle Emission (Area Light)
     if (mat.emission_intensity > 0.0f) {
       // 1. Set Emissive Factor (White)
-      gmat.emissiveFactor = {1.0, 1.0, 1.0};
+      gmat["emissiveFactor"] = {1.0, 1.0, 1.0};
 
       // 2. Use Emission Texture
       if (!mat.emission.file_path.empty()) {
         auto texture_index =
-            AddOrReuseTexture(mat.emission.file_path, path.parent_path(),
-                              &model, &texture_allocations);
+            AddOrReuseTexture(mat.emission.file_path, texture_uri_prefix,
+                              options.vfs, binary, &writer, &textures);
         if (texture_index.has_value()) {
-          gmat.emissiveTexture.index = *texture_index;
+          gmat["emissiveTexture"] = {{"index", *texture_index}};
         }
       }
 
       // 3. Use KHR_materials_emissive_strength for high intensity
-      if (std::find(model.extensionsUsed.begin(), model.extensionsUsed.end(),
-                    "KHR_materials_emissive_strength") ==
-          model.extensionsUsed.end()) {
-        model.extensionsUsed.push_back("KHR_materials_emissive_strength");
-      }
-
-      tinygltf::Value::Object ext_obj;
-      ext_obj["emissiveStrength"] = tinygltf::Value(
-          double(mat.emission_intensity * kAreaLightIntensityScale));
-      gmat.extensions["KHR_materials_emissive_strength"] =
-          tinygltf::Value(ext_obj);
+      writer.UseExtension("KHR_materials_emissive_strength");
+      gmat["extensions"]["KHR_materials_emissive_strength"] = {
+          {"emissiveStrength",
+           double(mat.emission_intensity * kAreaLightIntensityScale)}};
     }
 
-    model.materials.push_back(gmat);
-    bsp_to_gltf_material[bsp_tex_idx] =
-        static_cast<int>(model.materials.size() - 1);
+    encoding.materials[bsp_tex_idx] = writer.Add("materials", std::move(gmat));
   }
 
   // 2. Create Root "Worldspawn" Node
-  tinygltf::Node world_node;
-  world_node.name = "Worldspawn";
-  // We will push this node last to ensure all children indices are valid,
-  // or we can push it first and update children later.
-  // Let's push it first to be node 0.
-  model.nodes.push_back(world_node);
-  int world_node_idx = 0;
-
-  tinygltf::Scene gscene;
-  gscene.nodes.push_back(world_node_idx);
-
-  // 3. Export Geometries
-  for (const auto& [bsp_surf_idx, geo] : scene.geometries) {
-    // Create Mesh
-    tinygltf::Mesh mesh;
-    tinygltf::Primitive prim;
-    prim.mode = TINYGLTF_MODE_TRIANGLES;
-
-    // Find assigned material
-    auto mat_it = bsp_to_gltf_material.find(geo.material_id);
-    if (mat_it != bsp_to_gltf_material.end()) {
-      prim.material = mat_it->second;
-    }
-
-    // Position
-    {
-      int view_idx;
-      std::vector<float> buffer_data;
-      buffer_data.reserve(geo.vertices.size() * 3);
-      std::vector<double> min_v = {1e9, 1e9, 1e9};
-      std::vector<double> max_v = {-1e9, -1e9, -1e9};
+  // Push it first to be node 0; its children are added as they are written.
+  const int world_node_idx =
+      writer.Add("nodes", nlohmann::json{{"name", "Worldspawn"}});
+  auto add_world_child = [&](int node_idx) {
+    document["nodes"][world_node_idx]["children"].push_back(node_idx);
+  };
+  writer.Add("scenes", nlohmann::json{{"nodes", {world_node_idx}}});
+  document["scene"] = 0;
+
+  // 3. Export Geometries. Geometries that are welded, optimized or
+  // simplified are prepared as batches first: one per material when merging,
+  // one per surface otherwise. Only the surfaces of the world are merged:
+  // those of brush entities move on their own, so they keep a batch per
+  // surface, after the merged ones. Only their layout is planned here: their
+  // data is streamed to the buffer when the file is written.
+  const bool prepare = options.weld || options.optimize_vertex_cache ||
+                       !options.lod_ratios.empty();
+  std::vector<GeometryBatch> batches;
+  size_t num_merged_batches = 0;
+  if (options.merge_by_material) {
+    batches = BatchGeometriesByMaterial(
+        scene.geometries,
+        options.strict_uint16_indices ? kMaxUint16Vertices : SIZE_MAX,
+        [&](BSPSurfaceIndex surface) {
+          return IsWorldSurface(scene, surface);
+        });
+    num_merged_batches = batches.size();
+    std::vector<GeometryBatch> entity_batches = SplitGeometriesBySurface(
+        scene.geometries, [&](BSPSurfaceIndex surface) {
+          return !IsWorldSurface(scene, surface);
+        });
+    batches.insert(batches.end(),
+                   std::make_move_iterator(entity_batches.begin()),
+                   std::make_move_iterator(entity_batches.end()));
+  } else if (prepare) {
+    batches = SplitGeometriesBySurface(scene.geometries);
+  }
 
-      for (const auto& v : geo.vertices) {
-        buffer_data.push_back(v.x());
-        buffer_data.push_back(v.y());
-        buffer_data.push_back(v.z());
-
-        if (v.x() < min_v[0]) min_v[0] = v.x();
-        if (v.y() < min_v[1]) min_v[1] = v.y();
-        if (v.z() < min_v[2]) min_v[2] = v.z();
-        if (v.x() > max_v[0]) max_v[0] = v.x();
-        if (v.y() > max_v[1]) max_v[1] = v.y();
-        if (v.z() > max_v[2]) max_v[2] = v.z();
-      }
-      if (buffer_data.empty()) {
-        min_v = {0, 0, 0};
-        max_v = {0, 0, 0};
-      }
-      AddBufferView(buffer_data.data(), buffer_data.size() * sizeof(float), 12,
-                    TINYGLTF_TARGET_ARRAY_BUFFER, view_idx, &model);
-      prim.attributes["POSITION"] = AddAccessor(
-          view_idx, TINYGLTF_COMPONENT_TYPE_FLOAT, geo.vertices.size(),
-          TINYGLTF_TYPE_VEC3, min_v, max_v, &model);
-    }
-
-    // Normal
-    if (!geo.normals.empty()) {
-      int view_idx;
-      std::vector<float> buffer_data;
-      buffer_data.reserve(geo.normals.size() * 3);
-      for (const auto& n : geo.normals) {
-        buffer_data.push_back(n.x());
-        buffer_data.push_back(n.y());
-        buffer_data.push_back(n.z());
-      }
-      AddBufferView(buffer_data.data(), buffer_data.size() * sizeof(float), 12,
-                    TINYGLTF_TARGET_ARRAY_BUFFER, view_idx, &model);
-      prim.attributes["NORMAL"] =
-          AddAccessor(view_idx, TINYGLTF_COMPONENT_TYPE_FLOAT,
-                      geo.normals.size(), TINYGLTF_TYPE_VEC3, {}, {}, &model);
-    }
-
-    // Texcoord 0 (Texture UVs)
-    if (!geo.texture_uvs.empty()) {
-      int view_idx;
-      std::vector<float> buffer_data;
-      buffer_data.reserve(geo.texture_uvs.size() * 2);
-      for (const auto& uv : geo.texture_uvs) {
-        buffer_data.push_back(uv.x());
-        buffer_data.push_back(uv.y());
-      }
-      AddBufferView(buffer_data.data(), buffer_data.size() * sizeof(float), 8,
-                    TINYGLTF_TARGET_ARRAY_BUFFER, view_idx, &model);
-      prim.attributes["TEXCOORD_0"] = AddAccessor(
-          view_idx, TINYGLTF_COMPONENT_TYPE_FLOAT, geo.texture_uvs.size(),
-          TINYGLTF_TYPE_VEC2, {}, {}, &model);
-    }
-
-    // Texcoord 1 (Lightmap UVs)
-    if (!geo.lightmap_uvs.empty()) {
-      int view_idx;
-      std::vector<float> buffer_data;
-      buffer_data.reserve(geo.lightmap_uvs.size() * 2);
-      for (const auto& uv : geo.lightmap_uvs) {
-        buffer_data.push_back(uv.x());
-        buffer_data.push_back(uv.y());
+  std::vector<WeldStats> batch_weld_stats(batches.size());
+  std::vector<CacheStats> batch_cache_stats(batches.size());
+  if (prepare) {
+    ParallelFor(batches.size(), options.num_threads, [&](size_t i) {
+      PrepareBatch(options, &batches[i], &batch_weld_stats[i],
+                   &batch_cache_stats[i]);
+    });
+  }
+  WeldStats weld_stats;
+  CacheStats cache_stats;
+  for (size_t i = 0; i < batches.size(); ++i) {
+    weld_stats += batch_weld_stats[i];
+    cache_stats += batch_cache_stats[i];
+  }
+
+  // The nodes to write, each with its levels of detail.
+  struct MeshNode {
+    std::string name;
+    std::vector<std::vector<const Geometry*>> levels;
+    const Eigen::Affine3f* transform = nullptr;
+  };
+  std::vector<MeshNode> mesh_nodes;
+  const size_t num_levels = 1 + options.lod_ratios.size();
+  if (options.merge_by_material) {
+    // One primitive per material, all on one child of Worldspawn, so that
+    // its levels of detail do not swap out the lights.
+    const std::span<const GeometryBatch> merged_batches =
+        std::span(batches).first(num_merged_batches);
+    if (!merged_batches.empty()) {
+      MeshNode& node = mesh_nodes.emplace_back();
+      node.name = "Batches";
+      node.levels.resize(num_levels);
+      for (const GeometryBatch& batch : merged_batches) {
+        node.levels[0].push_back(&batch.geometry);
+        for (size_t l = 1; l < num_levels; ++l) {
+          node.levels[l].push_back(&batch.lods[l - 1].geometry);
+        }
       }
-      AddBufferView(buffer_data.data(), buffer_data.size() * sizeof(float), 8,
-                    TINYGLTF_TARGET_ARRAY_BUFFER, view_idx, &model);
-      prim.attributes["TEXCOORD_1"] = AddAccessor(
-          view_idx, TINYGLTF_COMPONENT_TYPE_FLOAT, geo.lightmap_uvs.size(),
-          TINYGLTF_TYPE_VEC2, {}, {}, &model);
     }
 
-    // Indices
-    {
-      int view_idx;
-      AddBufferView(geo.indices.data(), geo.indices.size() * sizeof(uint32_t),
-                    0, TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER, view_idx, &model);
-      prim.indices =
-          AddAccessor(view_idx, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,
-                      geo.indices.size(), TINYGLTF_TYPE_SCALAR, {}, {}, &model);
+    std::filesystem::path manifest_path = path;
+    manifest_path.replace_extension(".surfaces.json");
+    if (!SaveBatchManifest(merged_batches, manifest_path)) {
+      return false;
     }
+  }
+  if (options.merge_by_material || prepare) {
+    for (const GeometryBatch& batch :
+         std::span(batches).subspan(num_merged_batches)) {
+      MeshNode& node = mesh_nodes.emplace_back();
+      node.name = "Geometry_" + std::to_string(batch.surfaces.front().surface);
+      node.levels = {{&batch.geometry}};
+      for (const GeometryBatch& lod : batch.lods) {
+        node.levels.push_back({&lod.geometry});
+      }
+      node.transform = &batch.geometry.transform;
+    }
+  } else {
+    for (const auto& [bsp_surf_idx, geo] : scene.geometries) {
+      mesh_nodes.push_back({"Geometry_" + std::to_string(bsp_surf_idx),
+                            {{&geo}},
+                            &geo.transform});
+    }
+  }
 
-    mesh.primitives.push_back(prim);
-    model.meshes.push_back(mesh);
-
-    // Node for this mesh
-    tinygltf::Node node;
-    node.mesh = static_cast<int>(model.meshes.size() - 1);
-    node.name =
-        "Geometry_" + std::to_string(bsp_surf_idx);  // Optional: Name it
+  if (encoding.quantize) {
+    // The texture coordinates of a material share a scale, which its
+    // textures apply back through KHR_texture_transform.
+    for (const MeshNode& node : mesh_nodes) {
+      for (const std::vector<const Geometry*>& level : node.levels) {
+        for (const Geometry* geo : level) {
+          float& scale = encoding.texture_uv_scales[geo->material_id];
+          scale = std::max(scale, TextureUvScale(geo->texture_uvs));
+        }
+      }
+    }
+    writer.UseExtension("KHR_mesh_quantization", /*required=*/true);
+    for (const auto& [bsp_tex_idx, scale] : encoding.texture_uv_scales) {
+      auto mat_it = encoding.materials.find(bsp_tex_idx);
+      if (scale > 1.0f && mat_it != encoding.materials.end()) {
+        writer.UseExtension("KHR_texture_transform", /*required=*/true);
+        ApplyTextureUvScale(scale, &document["materials"][mat_it->second]);
+      }
+    }
+  }
 
-    // Transform
-    Eigen::Matrix4f mat = geo.transform.matrix();
-    std::vector<double> matrix;
-    for (int k = 0; k < 16; ++k) matrix.push_back(mat(k));
-    node.matrix = matrix;
+  for (const MeshNode& node : mesh_nodes) {
+    add_world_child(AddMeshNode(node.name, node.levels, node.transform,
+                                &encoding, &writer));
+  }
 
-    model.nodes.push_back(node);
+  if (options.weld) {
+    LOG(INFO) << "Welded " << weld_stats.vertices_before << " vertices into "
+              << weld_stats.vertices_after << ", "
+              << weld_stats.triangles_before - weld_stats.triangles_after
+              << " of " << weld_stats.triangles_before
+              << " triangles collapsed.";
+  }
 
-    // Add as child of Worldspawn
-    model.nodes[world_node_idx].children.push_back(
-        static_cast<int>(model.nodes.size() - 1));
+  if (options.optimize_vertex_cache && cache_stats.triangles > 0) {
+    LOG(INFO) << "Average cache miss ratio: "
+              << double(cache_stats.misses_before) / cache_stats.triangles
+              << " -> "
+              << double(cache_stats.misses_after) / cache_stats.triangles;
   }
 
+  LOG(INFO) << "Index types: "
+            << encoding.index_types[kGltfComponentTypeUnsignedByte]
+            << " uint8, "
+            << encoding.index_types[kGltfComponentTypeUnsignedShort]
+            << " uint16, "
+            << encoding.index_types[kGltfComponentTypeUnsignedInt]
+            << " uint32 primitives.";
+
   // TODO: Export Environment (Skybox)
 
   // 4. Export Lights (KHR_lights_punctual)
-  if (!scene.lights.empty()) {
-    tinygltf::Value::Array light_array;
-    std::vector<int> light_node_indices;
-
-    int light_idx = 0;
-    for (const auto& light : scene.lights) {
-      if (light.type == Light::Type::Area) continue;
-
-      tinygltf::Value::Object light_obj;
-
-      // Color
-      std::vector<tinygltf::Value> color_vec;
-      color_vec.push_back(tinygltf::Value(double(light.color.x())));
-      color_vec.push_back(tinygltf::Value(double(light.color.y())));
-      color_vec.push_back(tinygltf::Value(double(light.color.z())));
-      light_obj["color"] = tinygltf::Value(color_vec);
-
-      light_obj["intensity"] = tinygltf::Value(
-          double(light.intensity * kPunctualLightIntensityScale));
-
-      std::string type_str;
-      if (light.type == Light::Type::Directional) {
-        type_str = "directional";
-      } else if (light.type == Light::Type::Point) {
-        type_str = "point";
-      } else if (light.type == Light::Type::Spot) {
-        type_str = "spot";
-
-        tinygltf::Value::Object spot_obj;
-        // Clamp to [-1, 1] to avoid NaN from std::acos with -ffast-math
-        auto safe_acos = [](float cos_val) -> double {
-          if (cos_val >= 1.0f) return 0.0;
-          if (cos_val <= -1.0f) return 3.14159265358979323846;
-          return std::acos(cos_val);
-        };
-
-        spot_obj["innerConeAngle"] =
-            tinygltf::Value(safe_acos(light.cos_inner_cone));
-        spot_obj["outerConeAngle"] =
-            tinygltf::Value(safe_acos(light.cos_outer_cone));
-        light_obj["spot"] = tinygltf::Value(spot_obj);
-      }
-      light_obj["type"] = tinygltf::Value(type_str);
-      light_obj["name"] = tinygltf::Value("Light_" + std::to_string(light_idx));
-
-      light_array.push_back(tinygltf::Value(light_obj));
-
-      // Create Node for this light
-      tinygltf::Node node;
-      node.name = "LightNode_" + std::to_string(light_idx);
-
-      // Position (Translation)
-      node.translation.push_back(light.position.x());
-      node.translation.push_back(light.position.y());
-      node.translation.push_back(light.position.z());
-
-      // Orientation (Rotation)
-      // glTF lights point down -Z. We need to align -Z with light.direction.
-      if (light.type == Light::Type::Directional ||
-          light.type == Light::Type::Spot) {
-        Eigen::Vector3f Z = -light.direction.normalized();
-        Eigen::Vector3f up = Eigen::Vector3f::UnitY();
-        if (std::abs(Z.dot(up)) > 0.99f) up = Eigen::Vector3f::UnitX();
-
-        Eigen::Vector3f X = up.cross(Z).normalized();
-        Eigen::Vector3f Y = Z.cross(X).normalized();
-
-        Eigen::Matrix3f rot;
-        rot.col(0) = X;
-        rot.col(1) = Y;
-        rot.col(2) = Z;
-
-        Eigen::Quaternionf q(rot);
-        node.rotation.push_back(q.x());
-        node.rotation.push_back(q.y());
-        node.rotation.push_back(q.z());
-        node.rotation.push_back(q.w());
-      }
-
-      // Extension on Node
-      node.light = light_idx;
+  nlohmann::json light_array = nlohmann::json::array();
+  for (const auto& light : scene.lights) {
+    if (light.type == Light::Type::Area) continue;
+    const int light_idx = static_cast<int>(light_array.size());
+
+    nlohmann::json light_obj;
+    light_obj["color"] = {light.color.x(), light.color.y(), light.color.z()};
+    light_obj["intensity"] =
+        double(light.intensity * kPunctualLightIntensityScale);
+
+    std::string type_str;
+    if (light.type == Light::Type::Directional) {
+      type_str = "directional";
+    } else if (light.type == Light::Type::Point) {
+      type_str = "point";
+    } else if (light.type == Light::Type::Spot) {
+      type_str = "spot";
+
+      // Clamp to [-1, 1] to avoid NaN from std::acos with -ffast-math
+      auto safe_acos = [](float cos_val) -> double {
+        if (cos_val >= 1.0f) return 0.0;
+        if (cos_val <= -1.0f) return 3.14159265358979323846;
+        return std::acos(cos_val);
+      };
+      light_obj["spot"] = {
+          {"innerConeAngle", safe_acos(light.cos_inner_cone)},
+          {"outerConeAngle", safe_acos(light.cos_outer_cone)}};
+    }
+    light_obj["type"] = type_str;
+    light_obj["name"] = "Light_" + std::to_string(light_idx);
+    light_array.push_back(std::move(light_obj));
+
+    // Create Node for this light
+    nlohmann::json node;
+    node["name"] = "LightNode_" + std::to_string(light_idx);
+
+    // Position (Translation)
+    node["translation"] = {light.position.x(), light.position.y(),
+                           light.position.z()};
+
+    // Orientation (Rotation)
+    // glTF lights point down -Z. We need to align -Z with light.direction.
+    if (light.type == Light::Type::Directional ||
+        light.type == Light::Type::Spot) {
+      Eigen::Vector3f Z = -light.direction.normalized();
+      Eigen::Vector3f up = Eigen::Vector3f::UnitY();
+      if (std::abs(Z.dot(up)) > 0.99f) up = Eigen::Vector3f::UnitX();
+
+      Eigen::Vector3f X = up.cross(Z).normalized();
+      Eigen::Vector3f Y = Z.cross(X).normalized();
+
+      Eigen::Matrix3f rot;
+      rot.col(0) = X;
+      rot.col(1) = Y;
+      rot.col(2) = Z;
+
+      Eigen::Quaternionf q(rot);
+      node["rotation"] = {q.x(), q.y(), q.z(), q.w()};
+    }
 
-      model.nodes.push_back(node);
-      // Add light as child of world
-      model.nodes[world_node_idx].children.push_back(
-          static_cast<int>(model.nodes.size() - 1));
+    // Extension on Node
+    node["extensions"]["KHR_lights_punctual"] = {{"light", light_idx}};
 
-      light_idx++;
-    }
+    // Add light as child of world
+    add_world_child(writer.Add("nodes", std::move(node)));
+  }
 
-    if (light_idx > 0) {
-      if (std::find(model.extensionsUsed.begin(), model.extensionsUsed.end(),
-                    "KHR_lights_punctual") == model.extensionsUsed.end()) {
-        model.extensionsUsed.push_back("KHR_lights_punctual");
-      }
+  if (!light_array.empty()) {
+    writer.UseExtension("KHR_lights_punctual");
+    document["extensions"]["KHR_lights_punctual"] = {
+        {"lights", std::move(light_array)}};
+  }
 
-      tinygltf::Value::Object ext_container;
-      ext_container["lights"] = tinygltf::Value(light_array);
-      model.extensions["KHR_lights_punctual"] = tinygltf::Value(ext_container);
-    }
+  if (!writer.Write(path, binary)) {
+    return false;
   }
 
-  model.scenes.push_back(gscene);
-  model.defaultScene = 0;
+  if (encoding.quantize) {
+    LOG(INFO) << "Quantization error: POSITION " << encoding.error.position
+              << " m, NORMAL " << encoding.error.normal << ", TEXCOORD_0 "
+              << encoding.error.texture_uv << ", TEXCOORD_1 "
+              << encoding.error.lightmap_uv;
+  }
 
-  tinygltf::TinyGLTF loader;
-  return loader.WriteGltfSceneToFile(&model, path.string(),
-                                     /*embed_images=*/false,
-                                     /*embed_textures=*/false,
-                                     /*embed_buffers=*/false,
-                                     /*embed_binary=*/false);
+  if (encoding.compress) {
+    const CompressionStats& stats = encoding.compression;
+    auto ratio = [](size_t before, size_t after) {
+      return after > 0 ? double(before) / after : 0.0;
+    };
+    LOG(INFO) << "Compressed attributes from " << stats.attribute_bytes
+              << " to " << stats.compressed_attribute_bytes << " bytes ("
+              << ratio(stats.attribute_bytes, stats.compressed_attribute_bytes)
+              << "x), indices from " << stats.index_bytes << " to "
+              << stats.compressed_index_bytes << " bytes ("
+              << ratio(stats.index_bytes, stats.compressed_index_bytes)
+              << "x) in "
+              << std::chrono::duration<double, std::milli>(stats.time).count()
+              << " ms.";
+  }
+  return true;
 }
 
 }  // namespace ioq3_map
@@ -2,15 +2,123 @@
 #define IOQ3_MAP_EXPORTER_SRC_SAVER_H_
 
 #include <filesystem>
+#include <optional>
+#include <vector>
 
+#include "archives.h"
+#include "block_compression.h"
 #include "scene.h"
+#include "vertex_welding.h"
 
 namespace ioq3_map {
 
-// Saves the Scene to a glTF file.
+enum class SaveFormat {
+  // A .gltf file, with the buffer in a .bin file and the textures copied
+  // next to it.
+  kGltf,
+  // A self-contained .glb file, with the textures in its binary chunk.
+  kGlb,
+};
+
+enum class TextureFormat {
+  // The texture files as they are.
+  kOriginal,
+  // The texture files, and their transcoding to KTX2 files holding 8-bit
+  // RGBA with a full mip chain, filtered in linear space (see
+  // GenerateMipChain), which clients upload without decoding. The KTX2 files
+  // are not Basis Universal compressed, so they cannot be glTF images under
+  // KHR_texture_basisu. Textures keep the original image as their source,
+  // and refer to their KTX2 file through the non-standard IOQ3_texture_ktx2
+  // extension, which other loaders ignore:
+  //   "extensions": {"IOQ3_texture_ktx2": {"mimeType": "image/ktx2",
+  //                                        "uri": "<hash>.rgba8.ktx2"}}
+  // with a "bufferView" instead of the "uri" when the texture is embedded.
+  kKtx2,
+  // As kKtx2, with the mip levels block compressed, which GPUs sample
+  // without decoding: BC1 for the textures of opaque stages, and BC7, or BC3
+  // with the fast preset, for the textures that a stage blends by their
+  // alpha. The files, e.g. "<hash>.bc7-normal.ktx2", are referenced through
+  // IOQ3_texture_ktx2 as well. The PSNR of every texture is logged.
+  kKtx2Bc,
+};
+
+struct SaveOptions {
+  SaveFormat format = SaveFormat::kGltf;
+
+  // The filesystem the material textures are read from. Texture files are
+  // copied straight from disk when it is null or extracted to disk.
+  const VirtualFilesystem* vfs = nullptr;
+
+  // Texture files are named after the hash of their content, so that the
+  // materials share one image per content, and written next to the output
+  // file, or to this directory when set. A directory shared by the exports of
+  // several maps holds the textures they have in common once. The files are
+  // renamed into place once complete, so that concurrent exports can share it.
+  std::filesystem::path texture_dir;
+
+  TextureFormat texture_format = TextureFormat::kOriginal;
+  // The search effort of the block compression of kKtx2Bc.
+  BlockQuality texture_quality = BlockQuality::kNormal;
+
+  // Merges the world surfaces that share a material into one primitive of
+  // the Worldspawn mesh, instead of writing a mesh and a node per surface.
+  // The surfaces of brush entities (see IsWorldSurface) keep a node each.
+  // The index and vertex ranges of every merged surface are written next to
+  // the glTF file, to <name>.surfaces.json (see SaveBatchManifest).
+  bool merge_by_material = false;
+
+  // Indices are written in the narrowest type that fits the vertices of
+  // their primitive. When merging by material, this also splits the batches
+  // of a material so that every batch fits 16-bit indices (see
+  // BatchGeometriesByMaterial).
+  bool strict_uint16_indices = false;
+
+  // Welds the vertices of every written geometry, i.e. of every surface or,
+  // when merging by material, of every batch across its surfaces.
+  std::optional<WeldOptions> weld;
+
+  // Reorders the triangles of every written geometry for the post-transform
+  // vertex cache, and then its vertices for fetch locality, after welding.
+  bool optimize_vertex_cache = false;
+
+  // Target triangle ratios of the coarser levels of detail of every written
+  // geometry, e.g. {0.5, 0.25}, finest first. The levels are simplified after
+  // welding (see SimplifyGeometry) and written as MSFT_lod alternatives of
+  // their node. When merging by material, the sidecar also records the
+  // surface ranges of every level.
+  std::vector<float> lod_ratios;
+
+  // Writes the vertex attributes in fixed point under KHR_mesh_quantization:
+  // positions as normalized int16, dequantized by the node transform, normals
+  // as normalized int8, texture coordinates as normalized int16 scaled back
+  // by KHR_texture_transform, and lightmap coordinates as normalized uint16.
+  // The largest error of every attribute is logged.
+  bool quantize = false;
+
+  // Writes the vertex attributes of every primitive interleaved in one
+  // strided view, with their accessors at their offsets in the vertex,
+  // instead of a view per attribute.
+  bool interleave = false;
+
+  // Compresses the vertex attribute and index views with
+  // EXT_meshopt_compression, after quantization if any. The views decode into
+  // a fallback buffer without content, so loaders must support the
+  // extension. The compression ratios and time are logged.
+  bool compress = false;
+
+  // Textures are hashed, copied, transcoded and block compressed, and
+  // geometries welded, simplified and optimized, on a pool of `num_threads`
+  // workers (see ResolveThreadCount).
+  int num_threads = 0;
+};
+
+// Saves the Scene to a glTF or GLB file (see SaveFormat). The vertex data is
+// streamed from the geometries to the file (see GltfWriter), without a copy
+// of the whole buffer in memory.
 // Serializes geometry with both texture_uvs (TEXCOORD_0) and lightmap_uvs
 // (TEXCOORD_1).
-bool SaveScene(const Scene& scene, const std::filesystem::path& path);
+bool SaveScene(const Scene& scene, const std::filesystem::path& path,
+               const SaveOptions& options = {});
 
 }  // namespace ioq3_map
 
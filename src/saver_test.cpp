@@ -3,15 +3,33 @@
 #include <gtest/gtest.h>
 #include <tiny_gltf.h>
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
 
+#include "content_hash.h"
 #include "scene.h"
 #include "stb_image_write.h"
+#include "test_util.h"
 
 namespace ioq3_map {
 namespace {
 
+// The name of the file a texture is written to: the hash of its content.
+std::string TextureFileName(const std::filesystem::path& texture) {
+  std::ifstream file(texture, std::ios::binary);
+  const std::string content((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+  return ContentHashString(HashContent(content)) +
+         texture.extension().string();
+}
+
 // Helper to load scene back for verification
 std::optional<Scene> LoadScene(const std::filesystem::path& path) {
   tinygltf::Model model;
@@ -145,8 +163,10 @@ TEST(SaverTest, SaveSceneWithTexture) {
 
   // Check texture copy
   std::filesystem::path copied_tex_path =
-      output_gltf.parent_path() / "source@test_albedo.png";
+      output_gltf.parent_path() / TextureFileName(source_tex_path);
   EXPECT_TRUE(std::filesystem::exists(copied_tex_path));
+  EXPECT_EQ(std::filesystem::file_size(copied_tex_path),
+            std::filesystem::file_size(source_tex_path));
 
   // Check bin file (External buffers)
   std::filesystem::path bin_path = output_gltf.parent_path() / "scene.bin";
@@ -178,12 +198,709 @@ TEST(SaverTest, SaveSceneWithTexture) {
   ASSERT_GE(source_index, 0);
   ASSERT_LT(source_index, model.images.size());
 
-  EXPECT_EQ(model.images[source_index].uri, "source@test_albedo.png");
+  EXPECT_EQ(model.images[source_index].uri, TextureFileName(source_tex_path));
+  EXPECT_EQ(model.images[source_index].name, "source@test_albedo.png");
 
   // Cleanup
   std::filesystem::remove_all(temp_dir);
 }
 
+TEST(SaverTest, SaveSceneAsGlb) {
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "glb_scene_test";
+  std::filesystem::create_directories(temp_dir / "source");
+  std::filesystem::path source_tex_path = temp_dir / "source" / "albedo.png";
+  {
+    unsigned char pixels[] = {0, 255, 0};
+    stbi_write_png(source_tex_path.string().c_str(), 1, 1, 3, pixels, 3);
+  }
+
+  Scene scene;
+  scene.materials[0].name = "TestMat";
+  scene.materials[0].albedo.file_path = source_tex_path;
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(0, 1, 0)};
+  geo.texture_uvs = {Eigen::Vector2f(0, 0), Eigen::Vector2f(1, 0),
+                     Eigen::Vector2f(0, 1)};
+  geo.indices = {0, 1, 2};
+  scene.geometries[0] = geo;
+
+  std::filesystem::path output_glb = temp_dir / "output" / "scene.glb";
+  std::filesystem::create_directories(output_glb.parent_path());
+  ASSERT_TRUE(SaveScene(scene, output_glb, {.format = SaveFormat::kGlb}));
+
+  // Nothing but the GLB file is written.
+  std::vector<std::filesystem::path> outputs;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(output_glb.parent_path())) {
+    outputs.push_back(entry.path());
+  }
+  EXPECT_EQ(outputs, std::vector<std::filesystem::path>{output_glb});
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  ASSERT_TRUE(
+      loader.LoadBinaryFromFile(&model, &err, &warn, output_glb.string()))
+      << err;
+
+  // One buffer, the binary chunk, holding the geometry and the image.
+  ASSERT_EQ(model.buffers.size(), 1);
+  EXPECT_TRUE(model.buffers[0].uri.empty());
+  const size_t geometry_size = 3 * 12 + 3 * 8 + 3 * 1;
+  const size_t image_size = std::filesystem::file_size(source_tex_path);
+  EXPECT_GE(model.buffers[0].data.size(), geometry_size + image_size);
+
+  ASSERT_EQ(model.images.size(), 1);
+  const tinygltf::Image& image = model.images[0];
+  EXPECT_TRUE(image.uri.empty());
+  EXPECT_EQ(image.mimeType, "image/png");
+  ASSERT_GE(image.bufferView, 0);
+  EXPECT_EQ(model.bufferViews[image.bufferView].byteLength, image_size);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveSceneAsGlbReencodesTgaTextures) {
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "glb_tga_test";
+  std::filesystem::create_directories(temp_dir);
+  std::filesystem::path wall_path = temp_dir / "wall.tga";
+  {
+    unsigned char pixels[] = {255, 0, 0, 0, 0, 255};  // Red, blue
+    stbi_write_tga(wall_path.string().c_str(), 2, 1, 3, pixels);
+  }
+  std::filesystem::path broken_path = temp_dir / "broken.tga";
+  std::ofstream(broken_path) << "not an image";
+
+  Scene scene;
+  scene.materials[0].name = "Wall";
+  scene.materials[0].albedo.file_path = wall_path;
+  scene.materials[1].name = "Broken";
+  scene.materials[1].albedo.file_path = broken_path;
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(0, 1, 0)};
+  geo.texture_uvs = {Eigen::Vector2f(0, 0), Eigen::Vector2f(1, 0),
+                     Eigen::Vector2f(0, 1)};
+  geo.indices = {0, 1, 2};
+  scene.geometries[0] = geo;
+
+  std::filesystem::path output_glb = temp_dir / "scene.glb";
+  ASSERT_TRUE(SaveScene(scene, output_glb, {.format = SaveFormat::kGlb}));
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  ASSERT_TRUE(
+      loader.LoadBinaryFromFile(&model, &err, &warn, output_glb.string()))
+      << err;
+
+  // glTF does not define TGA: the image is embedded as PNG, and the one that
+  // cannot be decoded is left out.
+  ASSERT_EQ(model.images.size(), 1);
+  const tinygltf::Image& image = model.images[0];
+  EXPECT_EQ(image.mimeType, "image/png");
+  EXPECT_EQ(image.width, 2);
+  EXPECT_EQ(image.height, 1);
+  ASSERT_FALSE(image.image.empty());
+  EXPECT_EQ(image.image[0], 255);
+  ASSERT_EQ(model.materials.size(), 2);
+  EXPECT_EQ(model.materials[0].pbrMetallicRoughness.baseColorTexture.index, 0);
+  EXPECT_EQ(model.materials[1].pbrMetallicRoughness.baseColorTexture.index,
+            -1);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveSceneDeduplicatesTexturesByContent) {
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "texture_dedup_test";
+  std::filesystem::remove_all(temp_dir);
+  // Two copies of an image under different paths, and a different image with
+  // the same parent directory and file name as the first.
+  const std::vector<std::filesystem::path> albedos = {
+      temp_dir / "pak0" / "base" / "wall.tga",
+      temp_dir / "mod" / "gothic" / "stone.tga",
+      temp_dir / "mod" / "base" / "wall.tga"};
+  const unsigned char pixels[][3] = {{128, 128, 128}, {128, 128, 128},
+                                     {96, 64, 32}};
+
+  Scene scene;
+  for (size_t i = 0; i < albedos.size(); ++i) {
+    std::filesystem::create_directories(albedos[i].parent_path());
+    stbi_write_tga(albedos[i].string().c_str(), 1, 1, 3, pixels[i]);
+    scene.materials[i].name = "Mat_" + std::to_string(i);
+    scene.materials[i].albedo.file_path = albedos[i];
+    Geometry geo;
+    geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                    Eigen::Vector3f(0, 1, 0)};
+    geo.indices = {0, 1, 2};
+    geo.material_id = i;
+    scene.geometries[i] = geo;
+  }
+
+  // Two maps share the texture directory.
+  const std::filesystem::path texture_dir = temp_dir / "textures";
+  for (const std::string map : {"q3dm1", "q3dm2"}) {
+    const std::filesystem::path output_path =
+        temp_dir / "maps" / map / "scene.gltf";
+    std::filesystem::create_directories(output_path.parent_path());
+    ASSERT_TRUE(SaveScene(scene, output_path, {.texture_dir = texture_dir}));
+
+    tinygltf::Model model;
+    tinygltf::TinyGLTF loader;
+    std::string err, warn;
+    ASSERT_TRUE(
+        loader.LoadASCIIFromFile(&model, &err, &warn, output_path.string()))
+        << err;
+    EXPECT_EQ(model.images.size(), 2);
+    std::map<std::string, std::string> uris;
+    for (const tinygltf::Material& material : model.materials) {
+      const int texture = material.pbrMetallicRoughness.baseColorTexture.index;
+      ASSERT_GE(texture, 0);
+      uris[material.name] = model.images[model.textures[texture].source].uri;
+    }
+    EXPECT_EQ(uris["Mat_0"], "../../textures/" + TextureFileName(albedos[0]));
+    EXPECT_EQ(uris["Mat_1"], uris["Mat_0"]);
+    EXPECT_EQ(uris["Mat_2"], "../../textures/" + TextureFileName(albedos[2]));
+  }
+
+  // A file per content.
+  std::vector<std::filesystem::path> files;
+  for (const auto& entry : std::filesystem::directory_iterator(texture_dir)) {
+    files.push_back(entry.path().filename());
+  }
+  std::sort(files.begin(), files.end());
+  std::vector<std::filesystem::path> expected = {
+      TextureFileName(albedos[0]), TextureFileName(albedos[2])};
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(files, expected);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveSceneWithKtx2Textures) {
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "ktx2_scene_test";
+  std::filesystem::remove_all(temp_dir);
+  std::filesystem::create_directories(temp_dir / "source");
+  const std::filesystem::path source_tex_path =
+      temp_dir / "source" / "albedo.png";
+  {
+    std::vector<unsigned char> pixels(8 * 4 * 3, 128);
+    stbi_write_png(source_tex_path.string().c_str(), 8, 4, 3, pixels.data(),
+                   8 * 3);
+  }
+
+  Scene scene;
+  scene.materials[0].name = "TestMat";
+  scene.materials[0].albedo.file_path = source_tex_path;
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(0, 1, 0)};
+  geo.indices = {0, 1, 2};
+  scene.geometries[0] = geo;
+
+  const std::filesystem::path output_path = temp_dir / "scene.gltf";
+  ASSERT_TRUE(SaveScene(scene, output_path,
+                        {.texture_format = TextureFormat::kKtx2}));
+
+  std::ifstream file(output_path);
+  const nlohmann::json document = nlohmann::json::parse(file);
+  EXPECT_EQ(document["extensionsUsed"], nlohmann::json({"IOQ3_texture_ktx2"}));
+  EXPECT_FALSE(document.contains("extensionsRequired"));
+
+  // The original image stays the only image and the source, for the loaders
+  // without the extension.
+  ASSERT_EQ(document["textures"].size(), 1);
+  ASSERT_EQ(document["images"].size(), 1);
+  const nlohmann::json& texture = document["textures"][0];
+  EXPECT_EQ(document["images"][texture["source"].get<int>()]["uri"],
+            TextureFileName(source_tex_path));
+  const nlohmann::json& ktx2 = texture["extensions"]["IOQ3_texture_ktx2"];
+  EXPECT_EQ(ktx2["mimeType"], "image/ktx2");
+  const std::string ktx2_uri = ktx2["uri"];
+  EXPECT_EQ(ktx2_uri,
+            TextureFileName(source_tex_path).substr(0, 16) + ".rgba8.ktx2");
+
+  // An RGBA8 texture of 8x4 with its 4 levels.
+  std::ifstream ktx2_file(temp_dir / ktx2_uri, std::ios::binary);
+  const std::string ktx2_data((std::istreambuf_iterator<char>(ktx2_file)),
+                              std::istreambuf_iterator<char>());
+  ASSERT_GE(ktx2_data.size(), 80);
+  EXPECT_EQ(ktx2_data.substr(0, 12), "\xabKTX 20\xbb\r\n\x1a\n");
+  uint32_t header[4];
+  std::memcpy(header, ktx2_data.data() + 20, sizeof(header));
+  EXPECT_EQ(header[0], 8);
+  EXPECT_EQ(header[1], 4);
+  std::memcpy(header, ktx2_data.data() + 40, sizeof(header[0]));
+  EXPECT_EQ(header[0], 4);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveSceneWithBlockCompressedTextures) {
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "bc_scene_test";
+  std::filesystem::remove_all(temp_dir);
+  std::filesystem::create_directories(temp_dir / "source");
+  // An opaque wall and a grate that its stage blends by alpha.
+  const std::filesystem::path wall_path = temp_dir / "source" / "wall.png";
+  const std::filesystem::path grate_path = temp_dir / "source" / "grate.png";
+  {
+    std::vector<unsigned char> pixels(8 * 4 * 4);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      pixels[i] = static_cast<unsigned char>(i * 7);
+    }
+    stbi_write_png(wall_path.string().c_str(), 8, 4, 3, pixels.data(), 8 * 3);
+    stbi_write_png(grate_path.string().c_str(), 8, 4, 4, pixels.data(), 8 * 4);
+  }
+
+  Scene scene;
+  scene.materials[0].name = "Wall";
+  scene.materials[0].albedo.file_path = wall_path;
+  scene.materials[1].name = "Grate";
+  scene.materials[1].albedo = {grate_path, /*alpha_blended=*/true};
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(0, 1, 0)};
+  geo.indices = {0, 1, 2};
+  scene.geometries[0] = geo;
+
+  const std::filesystem::path output_path = temp_dir / "scene.gltf";
+  ASSERT_TRUE(SaveScene(scene, output_path,
+                        {.texture_format = TextureFormat::kKtx2Bc}));
+
+  std::ifstream file(output_path);
+  const nlohmann::json document = nlohmann::json::parse(file);
+  // The block-compressed KTX2 files are not Basis Universal either: they are
+  // not glTF images, and only the vendor extension refers to them.
+  EXPECT_EQ(document["extensionsUsed"], nlohmann::json({"IOQ3_texture_ktx2"}));
+  EXPECT_EQ(document["images"].size(), 2);
+  std::map<std::string, std::string> uris;
+  for (const nlohmann::json& material : document["materials"]) {
+    const nlohmann::json& texture =
+        document["textures"][material["pbrMetallicRoughness"]
+                                     ["baseColorTexture"]["index"]
+                                         .get<int>()];
+    const nlohmann::json& ktx2 = texture["extensions"]["IOQ3_texture_ktx2"];
+    EXPECT_EQ(ktx2["mimeType"], "image/ktx2");
+    uris[material["name"]] = ktx2["uri"];
+  }
+  EXPECT_EQ(uris["Wall"],
+            TextureFileName(wall_path).substr(0, 16) + ".bc1-normal.ktx2");
+  EXPECT_EQ(uris["Grate"],
+            TextureFileName(grate_path).substr(0, 16) + ".bc7-normal.ktx2");
+
+  // 8x4 textures of 4 levels: 2, 1, 1 and 1 blocks.
+  for (const auto& [name, uri] : uris) {
+    std::ifstream ktx2_file(temp_dir / uri, std::ios::binary);
+    const std::string ktx2_data((std::istreambuf_iterator<char>(ktx2_file)),
+                                std::istreambuf_iterator<char>());
+    ASSERT_GE(ktx2_data.size(), 80) << name;
+    uint32_t header[8];
+    std::memcpy(header, ktx2_data.data() + 12, sizeof(header));
+    EXPECT_EQ(header[0], name == "Wall" ? 132 : 146) << name;
+    EXPECT_EQ(header[2], 8) << name;
+    EXPECT_EQ(header[3], 4) << name;
+    EXPECT_EQ(header[7], 4) << name;
+    uint64_t base_level[2];
+    std::memcpy(base_level, ktx2_data.data() + 80, sizeof(base_level));
+    EXPECT_EQ(base_level[1], name == "Wall" ? 2 * 8 : 2 * 16) << name;
+    EXPECT_EQ(ktx2_data.size(), base_level[0] + base_level[1]) << name;
+  }
+
+  // Embedded, the extension refers to the buffer views of the KTX2 files.
+  const std::filesystem::path glb_path = temp_dir / "scene.glb";
+  ASSERT_TRUE(SaveScene(scene, glb_path,
+                        {.format = SaveFormat::kGlb,
+                         .texture_format = TextureFormat::kKtx2Bc}));
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  ASSERT_TRUE(loader.LoadBinaryFromFile(&model, &err, &warn, glb_path.string()))
+      << err;
+  EXPECT_EQ(model.images.size(), 2);
+  ASSERT_EQ(model.textures.size(), 2);
+  for (const tinygltf::Texture& texture : model.textures) {
+    ASSERT_TRUE(texture.extensions.count("IOQ3_texture_ktx2"));
+    const tinygltf::Value& ktx2 = texture.extensions.at("IOQ3_texture_ktx2");
+    const tinygltf::BufferView& view =
+        model.bufferViews[ktx2.Get("bufferView").GetNumberAsInt()];
+    const unsigned char* data =
+        model.buffers[view.buffer].data.data() + view.byteOffset;
+    EXPECT_EQ(std::string(data, data + 12), "\xabKTX 20\xbb\r\n\x1a\n");
+  }
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveQuantizedScene) {
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "quantized_scene_test";
+  std::filesystem::create_directories(temp_dir);
+  std::filesystem::path wall_path = temp_dir / "wall.png";
+  {
+    unsigned char pixels[] = {128, 128, 128};
+    stbi_write_png(wall_path.string().c_str(), 1, 1, 3, pixels, 3);
+  }
+
+  Scene scene;
+  scene.materials[0].name = "Mat_0";
+  scene.materials[0].albedo.file_path = wall_path;
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(4, 0, 0),
+                  Eigen::Vector3f(0, 2, 0)};
+  geo.normals = {Eigen::Vector3f::UnitZ(), Eigen::Vector3f::UnitZ(),
+                 Eigen::Vector3f::UnitZ()};
+  geo.texture_uvs = {Eigen::Vector2f(0, 0), Eigen::Vector2f(3, 0),
+                     Eigen::Vector2f(0, 1)};
+  geo.lightmap_uvs = {Eigen::Vector2f(0, 0), Eigen::Vector2f(1, 0),
+                      Eigen::Vector2f(0, 1)};
+  geo.indices = {0, 1, 2};
+  scene.geometries[0] = geo;
+
+  std::filesystem::path output_path = temp_dir / "quantized.gltf";
+  ASSERT_TRUE(SaveScene(scene, output_path, {.quantize = true}));
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  ASSERT_TRUE(
+      loader.LoadASCIIFromFile(&model, &err, &warn, output_path.string()))
+      << err;
+  EXPECT_NE(std::find(model.extensionsRequired.begin(),
+                      model.extensionsRequired.end(), "KHR_mesh_quantization"),
+            model.extensionsRequired.end());
+
+  const tinygltf::Primitive& prim = model.meshes[0].primitives[0];
+  const tinygltf::Accessor& position =
+      model.accessors[prim.attributes.at("POSITION")];
+  EXPECT_EQ(position.componentType, TINYGLTF_COMPONENT_TYPE_SHORT);
+  EXPECT_TRUE(position.normalized);
+  EXPECT_EQ(model.bufferViews[position.bufferView].byteStride, 8);
+  EXPECT_EQ(model.accessors[prim.attributes.at("NORMAL")].componentType,
+            TINYGLTF_COMPONENT_TYPE_BYTE);
+  EXPECT_EQ(model.accessors[prim.attributes.at("TEXCOORD_0")].componentType,
+            TINYGLTF_COMPONENT_TYPE_SHORT);
+  EXPECT_EQ(model.accessors[prim.attributes.at("TEXCOORD_1")].componentType,
+            TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT);
+
+  // The bounds of the positions are integers, as their components are.
+  std::ifstream file(output_path);
+  const nlohmann::json document = nlohmann::json::parse(file);
+  const nlohmann::json& bounds =
+      document["accessors"][prim.attributes.at("POSITION")];
+  for (const char* key : {"min", "max"}) {
+    ASSERT_EQ(bounds[key].size(), 3) << key;
+    for (const nlohmann::json& value : bounds[key]) {
+      EXPECT_TRUE(value.is_number_integer()) << key << " " << value;
+    }
+  }
+  EXPECT_EQ(bounds["min"][0], -32767);
+  EXPECT_EQ(bounds["max"][0], 32767);
+
+  // The node transform dequantizes the positions: the longest axis, x,
+  // spans [-32767, 32767].
+  const tinygltf::Node& node = model.nodes[1];
+  ASSERT_EQ(node.matrix.size(), 16);
+  EXPECT_NEAR(node.matrix[0] * 32767, 2.0, 1e-4);
+  EXPECT_NEAR(node.matrix[12], 2.0, 1e-6);
+  EXPECT_NEAR(node.matrix[13], 1.0, 1e-6);
+
+  // The texture coordinates are scaled back by the material.
+  const tinygltf::TextureInfo& base_color =
+      model.materials[0].pbrMetallicRoughness.baseColorTexture;
+  ASSERT_TRUE(base_color.extensions.count("KHR_texture_transform"));
+  EXPECT_EQ(base_color.extensions.at("KHR_texture_transform")
+                .Get("scale")
+                .Get(0)
+                .GetNumberAsDouble(),
+            4.0);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveInterleavedScene) {
+  Scene scene;
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(0, 1, 0)};
+  geo.normals.assign(3, Eigen::Vector3f::UnitZ());
+  geo.texture_uvs = {Eigen::Vector2f(0, 0), Eigen::Vector2f(1, 0),
+                     Eigen::Vector2f(0, 1)};
+  geo.lightmap_uvs = {Eigen::Vector2f(0.25f, 0.5f), Eigen::Vector2f(0.75f, 0),
+                      Eigen::Vector2f(0, 1)};
+  geo.indices = {0, 1, 2};
+  scene.geometries[0] = geo;
+
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "interleaved_scene_test";
+  std::filesystem::create_directories(temp_dir);
+  std::filesystem::path output_path = temp_dir / "interleaved.gltf";
+  ASSERT_TRUE(SaveScene(scene, output_path, {.interleave = true}));
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  ASSERT_TRUE(
+      loader.LoadASCIIFromFile(&model, &err, &warn, output_path.string()))
+      << err;
+
+  // One view for the vertices and one for the indices.
+  ASSERT_EQ(model.bufferViews.size(), 2);
+  const tinygltf::Primitive& prim = model.meshes[0].primitives[0];
+  const int view = model.accessors[prim.attributes.at("POSITION")].bufferView;
+  EXPECT_EQ(model.bufferViews[view].byteStride, 40);
+  const std::vector<std::pair<std::string, size_t>> offsets = {
+      {"POSITION", 0}, {"NORMAL", 12}, {"TEXCOORD_0", 24}, {"TEXCOORD_1", 32}};
+  for (const auto& [name, offset] : offsets) {
+    const tinygltf::Accessor& accessor =
+        model.accessors[prim.attributes.at(name)];
+    EXPECT_EQ(accessor.bufferView, view) << name;
+    EXPECT_EQ(accessor.byteOffset, offset) << name;
+  }
+
+  // The lightmap coordinates of vertex 1.
+  const tinygltf::BufferView& vertices = model.bufferViews[view];
+  float uv[2];
+  std::memcpy(uv, &model.buffers[0].data[vertices.byteOffset + 40 + 32],
+              sizeof(uv));
+  EXPECT_EQ(uv[0], 0.75f);
+  EXPECT_EQ(uv[1], 0.0f);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveCompressedScene) {
+  Scene scene;
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(0, 1, 0), Eigen::Vector3f(1, 1, 0)};
+  geo.normals.assign(4, Eigen::Vector3f::UnitZ());
+  geo.indices = {0, 1, 2, 2, 1, 3};
+  scene.geometries[0] = geo;
+
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "compressed_scene_test";
+  std::filesystem::create_directories(temp_dir);
+  std::filesystem::path output_path = temp_dir / "compressed.gltf";
+  ASSERT_TRUE(
+      SaveScene(scene, output_path, {.quantize = true, .compress = true}));
+
+  std::ifstream gltf_file(output_path);
+  const nlohmann::json document = nlohmann::json::parse(gltf_file);
+  std::ifstream bin_file(temp_dir / "compressed.bin", std::ios::binary);
+  const std::string bin((std::istreambuf_iterator<char>(bin_file)),
+                        std::istreambuf_iterator<char>());
+
+  EXPECT_NE(std::find(document["extensionsRequired"].begin(),
+                      document["extensionsRequired"].end(),
+                      "EXT_meshopt_compression"),
+            document["extensionsRequired"].end());
+  ASSERT_EQ(document["buffers"].size(), 2);
+  EXPECT_EQ(document["buffers"][0]["byteLength"], bin.size());
+  EXPECT_FALSE(document["buffers"][1].contains("uri"));
+
+  // Every view decodes into the fallback buffer, from a stream of the
+  // attribute or the triangle codec in the file.
+  const nlohmann::json& prim = document["meshes"][0]["primitives"][0];
+  auto compressed_view = [&](int accessor) -> const nlohmann::json& {
+    const int view = document["accessors"][accessor]["bufferView"];
+    EXPECT_EQ(document["bufferViews"][view]["buffer"], 1);
+    return document["bufferViews"][view]["extensions"]
+                   ["EXT_meshopt_compression"];
+  };
+  for (const char* attribute : {"POSITION", "NORMAL"}) {
+    const nlohmann::json& ext = compressed_view(prim["attributes"][attribute]);
+    EXPECT_EQ(ext["mode"], "ATTRIBUTES");
+    EXPECT_EQ(ext["count"], 4);
+    ASSERT_LT(ext["byteOffset"].get<size_t>(), bin.size());
+    EXPECT_EQ(uint8_t(bin[ext["byteOffset"].get<size_t>()]), 0xa0);
+  }
+  EXPECT_EQ(compressed_view(prim["attributes"]["POSITION"])["byteStride"], 8);
+  const nlohmann::json& indices = compressed_view(prim["indices"]);
+  EXPECT_EQ(indices["mode"], "TRIANGLES");
+  EXPECT_EQ(indices["count"], 6);
+  // 16-bit, the narrowest indices of EXT_meshopt_compression.
+  EXPECT_EQ(indices["byteStride"], 2);
+  EXPECT_EQ(uint8_t(bin[indices["byteOffset"].get<size_t>()]), 0xe1);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+// The checks of the Khronos glTF validator on the layout of the vertex
+// attributes and indices of the primitives. `document` is the JSON of the
+// model, whose number types tinygltf does not keep. Returns the codes of the
+// issues the validator reports, e.g. "ACCESSOR_INDEX_OOB".
+std::vector<std::string> ValidatePrimitives(const tinygltf::Model& model,
+                                            const nlohmann::json& document) {
+  std::vector<std::string> issues;
+  for (const tinygltf::Mesh& mesh : model.meshes) {
+    for (const tinygltf::Primitive& prim : mesh.primitives) {
+      size_t num_vertices = 0;
+      for (const auto& [name, accessor_idx] : prim.attributes) {
+        const tinygltf::Accessor& accessor = model.accessors[accessor_idx];
+        const tinygltf::BufferView& view =
+            model.bufferViews[accessor.bufferView];
+        num_vertices = accessor.count;
+        // The bounds of integer components are integers.
+        const nlohmann::json& json = document["accessors"][accessor_idx];
+        if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) {
+          for (const char* key : {"min", "max"}) {
+            for (const nlohmann::json& value :
+                 json.value(key, nlohmann::json::array())) {
+              if (!value.is_number_integer()) {
+                issues.push_back("TYPE_MISMATCH");
+              }
+            }
+          }
+        }
+        if (accessor.byteOffset % 4 != 0 || view.byteOffset % 4 != 0) {
+          issues.push_back("MESH_PRIMITIVE_ACCESSOR_UNALIGNED");
+        }
+        if (view.byteStride % 4 != 0 || view.byteStride > 252) {
+          issues.push_back("BUFFER_VIEW_INVALID_BYTESTRIDE");
+        }
+      }
+
+      const tinygltf::Accessor& accessor = model.accessors[prim.indices];
+      const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+      if (accessor.type != TINYGLTF_TYPE_SCALAR ||
+          (accessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE &&
+           accessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT &&
+           accessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)) {
+        issues.push_back("MESH_PRIMITIVE_INDICES_ACCESSOR_INVALID_FORMAT");
+        continue;
+      }
+      if (view.byteStride != 0) {
+        issues.push_back("MESH_PRIMITIVE_INDICES_ACCESSOR_WITH_BYTESTRIDE");
+      }
+      if (view.target != TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER) {
+        issues.push_back("BUFFER_VIEW_TARGET_MISMATCH");
+      }
+      if (accessor.count % 3 != 0) {
+        issues.push_back("MESH_PRIMITIVE_INCOMPATIBLE_MODE");
+      }
+      const size_t size = tinygltf::GetComponentSizeInBytes(
+          static_cast<uint32_t>(accessor.componentType));
+      const size_t offset = view.byteOffset + accessor.byteOffset;
+      if (offset % size != 0) {
+        issues.push_back("ACCESSOR_TOTAL_OFFSET_ALIGNMENT");
+      }
+      if (accessor.byteOffset + accessor.count * size > view.byteLength) {
+        issues.push_back("ACCESSOR_TOO_LONG");
+        continue;
+      }
+      const uint64_t restart = (uint64_t{1} << (8 * size)) - 1;
+      const unsigned char* data = &model.buffers[view.buffer].data[offset];
+      for (size_t i = 0; i < accessor.count; ++i) {
+        uint32_t index = 0;
+        std::memcpy(&index, data + i * size, size);
+        if (index == restart) {
+          issues.push_back("ACCESSOR_INDEX_PRIMITIVE_RESTART");
+        } else if (index >= num_vertices) {
+          issues.push_back("ACCESSOR_INDEX_OOB");
+        }
+      }
+    }
+  }
+  return issues;
+}
+
+// A grid of `n` x `n` vertices.
+Geometry CreateGrid(int n, BSPTextureIndex material, float offset) {
+  Geometry geo;
+  for (int y = 0; y < n; ++y) {
+    for (int x = 0; x < n; ++x) {
+      geo.vertices.push_back(Eigen::Vector3f(offset + x, y, 0));
+      geo.normals.push_back(Eigen::Vector3f::UnitZ());
+    }
+  }
+  geo.indices = GridIndices(n - 1);
+  geo.material_id = material;
+  return geo;
+}
+
+TEST(SaverTest, SaveNarrowIndicesThatPassValidation) {
+  // 9, 400 and 90000 vertices, in 3 surfaces of 30000.
+  Scene scene;
+  scene.materials[0].name = "Small";
+  scene.materials[1].name = "Large";
+  scene.geometries[0] = CreateGrid(3, /*material=*/0, 0);
+  scene.geometries[1] = CreateGrid(20, /*material=*/0, 10);
+  for (int i = 2; i < 5; ++i) {
+    scene.geometries[i] = CreateGrid(173, /*material=*/1, i * 200.0f);
+  }
+
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "narrow_indices_test";
+  std::filesystem::create_directories(temp_dir);
+
+  auto save_and_load = [&](const std::string& name,
+                           const SaveOptions& options) {
+    const std::filesystem::path path = temp_dir / name;
+    EXPECT_TRUE(SaveScene(scene, path, options));
+    tinygltf::Model model;
+    tinygltf::TinyGLTF loader;
+    std::string err, warn;
+    EXPECT_TRUE(loader.LoadASCIIFromFile(&model, &err, &warn, path.string()))
+        << err;
+    return model;
+  };
+  auto validate = [&](const std::string& name, const tinygltf::Model& model) {
+    std::ifstream file(temp_dir / name);
+    return ValidatePrimitives(model, nlohmann::json::parse(file));
+  };
+  auto index_types = [](const tinygltf::Model& model) {
+    std::vector<int> types;
+    for (const tinygltf::Mesh& mesh : model.meshes) {
+      for (const tinygltf::Primitive& prim : mesh.primitives) {
+        types.push_back(model.accessors[prim.indices].componentType);
+      }
+    }
+    std::sort(types.begin(), types.end());
+    return types;
+  };
+
+  // Per surface, every primitive fits 8 or 16 bits.
+  const tinygltf::Model surfaces = save_and_load("surfaces.gltf", {});
+  EXPECT_EQ(index_types(surfaces),
+            (std::vector<int>{TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE,
+                              TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+                              TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+                              TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+                              TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT}));
+  EXPECT_EQ(validate("surfaces.gltf", surfaces), std::vector<std::string>{});
+
+  // Merged, the large material needs 32 bits.
+  const tinygltf::Model merged =
+      save_and_load("merged.gltf", {.merge_by_material = true});
+  EXPECT_EQ(index_types(merged),
+            (std::vector<int>{TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+                              TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT}));
+  EXPECT_EQ(validate("merged.gltf", merged), std::vector<std::string>{});
+
+  // Unless its batch is split in two, of 2 and 1 surfaces.
+  const tinygltf::Model strict = save_and_load(
+      "strict.gltf",
+      {.merge_by_material = true, .strict_uint16_indices = true});
+  EXPECT_EQ(index_types(strict),
+            (std::vector<int>{TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+                              TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+                              TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT}));
+  EXPECT_EQ(validate("strict.gltf", strict), std::vector<std::string>{});
+
+  // Quantized, with the integer bounds of the positions.
+  const tinygltf::Model quantized =
+      save_and_load("quantized.gltf", {.quantize = true});
+  EXPECT_EQ(validate("quantized.gltf", quantized), std::vector<std::string>{});
+
+  std::filesystem::remove_all(temp_dir);
+}
+
 TEST(SaverTest, SaveComplexScene) {
   Scene scene;
 
@@ -332,7 +1049,7 @@ TEST(SaverTest, SaveAreaLightWithEmissiveMaterial) {
   ASSERT_GE(gmat.emissiveTexture.index, 0);
   const auto& em_tex = model.textures[gmat.emissiveTexture.index];
   const auto& em_img = model.images[em_tex.source];
-  EXPECT_EQ(em_img.uri, "area_light_test@emission.png");
+  EXPECT_EQ(em_img.uri, TextureFileName(emission_tex));
 
   // Check Extension
   // We expect KHR_materials_emissive_strength because intensity is 5.0
@@ -351,4 +1068,159 @@ TEST(SaverTest, SaveAreaLightWithEmissiveMaterial) {
   std::filesystem::remove_all(temp_dir);
 }
 
+TEST(SaverTest, SaveSceneMergedByMaterial) {
+  Scene scene;
+  for (int i = 0; i < 2; ++i) {
+    Material mat;
+    mat.name = "Mat_" + std::to_string(i);
+    scene.materials[i] = mat;
+  }
+
+  // Surfaces 0 and 2 share material 0.
+  for (int i = 0; i < 3; ++i) {
+    Geometry geo;
+    geo.vertices = {Eigen::Vector3f(i, 0, 0), Eigen::Vector3f(i + 1, 0, 0),
+                    Eigen::Vector3f(i, 1, 0)};
+    geo.indices = {0, 1, 2};
+    geo.material_id = i % 2;
+    scene.geometries[i] = geo;
+  }
+
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "merged_scene_test";
+  std::filesystem::create_directories(temp_dir);
+  std::filesystem::path output_path = temp_dir / "merged.gltf";
+
+  ASSERT_TRUE(SaveScene(scene, output_path, {.merge_by_material = true}));
+  EXPECT_TRUE(std::filesystem::exists(temp_dir / "merged.surfaces.json"));
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  ASSERT_TRUE(
+      loader.LoadASCIIFromFile(&model, &err, &warn, output_path.string()));
+
+  // A single mesh under the Worldspawn node, with one primitive per material.
+  ASSERT_EQ(model.meshes.size(), 1);
+  ASSERT_EQ(model.meshes[0].primitives.size(), 2);
+  ASSERT_EQ(model.nodes[0].children, std::vector<int>{1});
+  EXPECT_EQ(model.nodes[1].mesh, 0);
+
+  const tinygltf::Primitive& prim = model.meshes[0].primitives[0];
+  EXPECT_EQ(model.accessors[prim.attributes.at("POSITION")].count, 6);
+  EXPECT_EQ(model.accessors[prim.indices].count, 6);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveMergedSceneKeepsBrushEntitiesApart) {
+  // Surfaces 0 and 1 are the world, and surface 2, of the same material, a
+  // door: the second BSP model.
+  Scene scene;
+  for (int i = 0; i < 3; ++i) {
+    Geometry geo;
+    geo.vertices = {Eigen::Vector3f(i, 0, 0), Eigen::Vector3f(i + 1, 0, 0),
+                    Eigen::Vector3f(i, 1, 0)};
+    geo.indices = {0, 1, 2};
+    geo.material_id = 0;
+    scene.geometries[i] = geo;
+  }
+  scene.first_world_surface = 0;
+  scene.num_world_surfaces = 2;
+
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "merged_entities_test";
+  std::filesystem::create_directories(temp_dir);
+  std::filesystem::path output_path = temp_dir / "merged.gltf";
+
+  ASSERT_TRUE(SaveScene(scene, output_path, {.merge_by_material = true}));
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  ASSERT_TRUE(
+      loader.LoadASCIIFromFile(&model, &err, &warn, output_path.string()));
+
+  // The world surfaces share a primitive, and the door has a node of its own.
+  ASSERT_EQ(model.meshes.size(), 2);
+  ASSERT_EQ(model.nodes[0].children.size(), 2);
+  const tinygltf::Node& batches = model.nodes[model.nodes[0].children[0]];
+  const tinygltf::Node& door = model.nodes[model.nodes[0].children[1]];
+  EXPECT_EQ(batches.name, "Batches");
+  EXPECT_EQ(door.name, "Geometry_2");
+  ASSERT_EQ(model.meshes[batches.mesh].primitives.size(), 1);
+  const tinygltf::Primitive& prim = model.meshes[batches.mesh].primitives[0];
+  EXPECT_EQ(model.accessors[prim.indices].count, 6);
+  EXPECT_EQ(model.accessors[model.meshes[door.mesh].primitives[0].indices]
+                .count,
+            3);
+
+  // The manifest only lists the merged surfaces.
+  std::ifstream manifest_file(temp_dir / "merged.surfaces.json");
+  const nlohmann::json manifest = nlohmann::json::parse(manifest_file);
+  ASSERT_EQ(manifest["batches"].size(), 1);
+  EXPECT_EQ(manifest["batches"][0]["surfaces"].size(), 2);
+
+  std::filesystem::remove_all(temp_dir);
+}
+
+TEST(SaverTest, SaveSceneWithLods) {
+  Scene scene;
+  scene.materials[0].name = "Mat_0";
+
+  // A flat 8x8 grid, which simplifies down to its border.
+  Geometry geo;
+  for (int y = 0; y <= 8; ++y) {
+    for (int x = 0; x <= 8; ++x) {
+      geo.vertices.push_back(Eigen::Vector3f(x, 0, y));
+      geo.normals.push_back(Eigen::Vector3f::UnitY());
+    }
+  }
+  for (uint32_t y = 0; y < 8; ++y) {
+    for (uint32_t x = 0; x < 8; ++x) {
+      const uint32_t v0 = y * 9 + x;
+      geo.indices.insert(geo.indices.end(),
+                         {v0, v0 + 10, v0 + 1, v0, v0 + 9, v0 + 10});
+    }
+  }
+  scene.geometries[0] = geo;
+
+  std::filesystem::path temp_dir =
+      std::filesystem::temp_directory_path() / "lod_scene_test";
+  std::filesystem::create_directories(temp_dir);
+  std::filesystem::path output_path = temp_dir / "lod.gltf";
+
+  ASSERT_TRUE(SaveScene(scene, output_path, {.lod_ratios = {0.5f, 0.0f}}));
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  ASSERT_TRUE(
+      loader.LoadASCIIFromFile(&model, &err, &warn, output_path.string()));
+
+  // The node of the surface refers to its two coarser levels.
+  ASSERT_EQ(model.meshes.size(), 3);
+  ASSERT_EQ(model.nodes[0].children, std::vector<int>{1});
+  const tinygltf::Node& node = model.nodes[1];
+  EXPECT_EQ(node.mesh, 0);
+  ASSERT_TRUE(node.extensions.count("MSFT_lod"));
+  const tinygltf::Value& ids = node.extensions.at("MSFT_lod").Get("ids");
+  ASSERT_EQ(ids.ArrayLen(), 2);
+  EXPECT_EQ(model.nodes[ids.Get(0).GetNumberAsInt()].mesh, 1);
+  EXPECT_EQ(model.nodes[ids.Get(1).GetNumberAsInt()].mesh, 2);
+  EXPECT_NE(std::find(model.extensionsUsed.begin(), model.extensionsUsed.end(),
+                      "MSFT_lod"),
+            model.extensionsUsed.end());
+
+  // Every level has fewer triangles than the one before.
+  size_t previous_count = geo.indices.size() + 1;
+  for (const tinygltf::Mesh& mesh : model.meshes) {
+    const size_t count = model.accessors[mesh.primitives[0].indices].count;
+    EXPECT_LT(count, previous_count);
+    previous_count = count;
+  }
+
+  std::filesystem::remove_all(temp_dir);
+}
+
 }  // namespace ioq3_map
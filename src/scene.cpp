@@ -4,10 +4,14 @@
 
 #include <cmath>
 #include <numbers>
+#include <optional>
+#include <span>
 #include <variant>
 
 #include "bsp.h"
 #include "bsp_geometry.h"
+#include "parallel.h"
+#include "patch_stitching.h"
 #include "triangulation.h"
 
 namespace ioq3_map {
@@ -34,14 +38,15 @@ Eigen::Vector2f TransformUV(const Eigen::Vector2f& uv) {
   return Eigen::Vector2f(uv.x(), uv.y());
 }
 
-// Convert extracted BSPMesh to Scene Geometry (with coordinate transforms)
-void ToGeometry(const BSPMesh& mesh, Geometry* out_geometry) {
-  out_geometry->vertices.reserve(mesh.vertices.size());
-  out_geometry->normals.reserve(mesh.vertices.size());
-  out_geometry->texture_uvs.reserve(mesh.vertices.size());
-  out_geometry->lightmap_uvs.reserve(mesh.vertices.size());
+// Convert a triangle mesh to Scene Geometry (with coordinate transforms)
+void ToGeometry(std::span<const vertex_t> vertices,
+                std::span<const int> indices, Geometry* out_geometry) {
+  out_geometry->vertices.reserve(vertices.size());
+  out_geometry->normals.reserve(vertices.size());
+  out_geometry->texture_uvs.reserve(vertices.size());
+  out_geometry->lightmap_uvs.reserve(vertices.size());
 
-  for (const auto& v : mesh.vertices) {
+  for (const auto& v : vertices) {
     out_geometry->vertices.push_back(TransformPoint(v.xyz));
     out_geometry->normals.push_back(TransformNormal(v.normal));
     out_geometry->texture_uvs.push_back(TransformUV(v.st));
@@ -50,19 +55,53 @@ void ToGeometry(const BSPMesh& mesh, Geometry* out_geometry) {
 
   // This is because Quake3 uses a clockwise winding order whereas OpenGL
   // uses counter-clockwise. So we insert indices in reverse order.
-  out_geometry->indices.reserve(mesh.indices.size());
-  for (int i = int(mesh.indices.size()) - 1; i >= 0; --i) {
-    out_geometry->indices.push_back(static_cast<uint32_t>(mesh.indices[i]));
+  out_geometry->indices.reserve(indices.size());
+  for (int i = int(indices.size()) - 1; i >= 0; --i) {
+    out_geometry->indices.push_back(static_cast<uint32_t>(indices[i]));
   }
 }
 
+// Triangulates a surface and converts it to Scene Geometry. Patches are
+// triangulated from their evaluated grid.
+std::optional<Geometry> ConvertGeometry(const BSPGeometry& geo,
+                                        PatchGrid* patch_grid) {
+  Geometry out_geo;
+  out_geo.material_id = geo.texture_index;
+  out_geo.transform = Eigen::Affine3f::Identity();
+
+  // Triangulate / Convert
+  if (std::holds_alternative<BSPPolygon>(geo.primitive)) {
+    const auto& poly = std::get<BSPPolygon>(geo.primitive);
+    if (!poly.indices.empty()) {
+      // Read the triangulation from the meshverts directly.
+      ToGeometry(poly.vertices, poly.indices, &out_geo);
+    } else {
+      ToGeometry(poly.vertices, Triangulate(poly), &out_geo);
+    }
+  } else if (std::holds_alternative<BSPMesh>(geo.primitive)) {
+    const auto& mesh = std::get<BSPMesh>(geo.primitive);
+    ToGeometry(mesh.vertices, mesh.indices, &out_geo);
+  } else if (std::holds_alternative<BSPPatch>(geo.primitive)) {
+    TriangleMesh mesh = Triangulate(std::move(*patch_grid));
+    ToGeometry(mesh.vertices, mesh.indices, &out_geo);
+  } else {
+    LOG(ERROR) << "Unknown primitive type: " << geo.primitive.index();
+    return std::nullopt;
+  }
+  return out_geo;
+}
+
 }  // namespace
 
+bool IsWorldSurface(const Scene& scene, BSPSurfaceIndex surface) {
+  return surface >= scene.first_world_surface &&
+         surface - scene.first_world_surface < scene.num_world_surfaces;
+}
+
 Scene AssembleBSPObjects(
-    const BSP& bsp,
-    const std::unordered_map<BSPSurfaceIndex, BSPGeometry>& bsp_geometries,
+    const BSP& bsp, const BSPGeometries& bsp_geometries,
     const std::unordered_map<BSPTextureIndex, BSPMaterial>& bsp_materials,
-    const std::vector<Entity>& bsp_entities) {
+    const std::vector<Entity>& bsp_entities, const AssembleOptions& options) {
   Scene scene;
 
   // 1. Process Entities (Lights)
@@ -111,18 +150,21 @@ Scene AssembleBSPObjects(
       continue;
     }
     // TODO: Support multiple texture layers.
+    const Q3TextureLayer* albedo_layer = nullptr;
     for (const auto& layer : bsp_mat.texture_layers) {
       if (std::holds_alternative<Q3TCModNoOp>(layer.tcmod)) {
-        mat.albedo.file_path = layer.path;
+        albedo_layer = &layer;
       } else {
         // TODO: Implement tcmod. This links to the multi-texture support. We
         // will skip this for now.
       }
     }
-    if (mat.albedo.file_path.empty()) {
+    if (albedo_layer == nullptr || albedo_layer->path.empty()) {
       // Takes the first texture layer as albedo and ignore the TcMod.
-      mat.albedo.file_path = bsp_mat.texture_layers.front().path;
+      albedo_layer = &bsp_mat.texture_layers.front();
     }
+    mat.albedo.file_path = albedo_layer->path;
+    mat.albedo.alpha_blended = albedo_layer->blend_src == BlendFunc::SRC_ALPHA;
 
     // Emission
     mat.emission_intensity = bsp_mat.q3map_surfacelight;
@@ -176,39 +218,63 @@ Scene AssembleBSPObjects(
     }
   }
 
-  // 3. Process Geometries
-  for (const auto& [surface_idx, geo] : bsp_geometries) {
-    Geometry out_geo;
-    out_geo.material_id = geo.texture_index;
-    out_geo.transform = Eigen::Affine3f::Identity();
-
-    // Triangulate / Convert
-    if (std::holds_alternative<BSPPolygon>(geo.primitive)) {
-      const auto& poly = std::get<BSPPolygon>(geo.primitive);
-      BSPMesh mesh = Triangulate(poly);
-      ToGeometry(mesh, &out_geo);
-    } else if (std::holds_alternative<BSPMesh>(geo.primitive)) {
-      const auto& mesh = std::get<BSPMesh>(geo.primitive);
-      ToGeometry(mesh, &out_geo);
-    } else if (std::holds_alternative<BSPPatch>(geo.primitive)) {
-      const auto& patch = std::get<BSPPatch>(geo.primitive);
-      BSPMesh mesh = Triangulate(patch);
-      ToGeometry(mesh, &out_geo);
-    } else {
-      LOG(ERROR) << "Unknown primitive type: " << geo.primitive.index();
-      continue;
+  // 3. Process Geometries. Patch grids are planned and stitched together
+  // first, so that neighbouring patches meet without cracks whatever their
+  // tessellation density.
+  std::vector<BSPPatch> patches;
+  std::vector<int> patch_indices(bsp_geometries.size(), -1);
+  for (size_t i = 0; i < bsp_geometries.size(); ++i) {
+    if (bsp_geometries[i] &&
+        std::holds_alternative<BSPPatch>(bsp_geometries[i]->primitive)) {
+      patch_indices[i] = static_cast<int>(patches.size());
+      patches.push_back(std::get<BSPPatch>(bsp_geometries[i]->primitive));
+    }
+  }
+
+  std::vector<PatchGrid> patch_grids(patches.size());
+  ParallelFor(patches.size(), options.num_threads, [&](size_t p) {
+    patch_grids[p] = PlanPatchGrid(patches[p], options.patch_tessellation);
+  });
+  const std::vector<PatchSeam> seams = StitchPatchGrids(patches, patch_grids);
+  ParallelFor(patches.size(), options.num_threads, [&](size_t p) {
+    EvaluatePatchGrid(patches[p], &patch_grids[p]);
+  });
+  WeldPatchSeams(seams, patch_grids);
+
+  // Surfaces are then triangulated and transformed into their own slots in
+  // parallel, and merged in surface order.
+  std::vector<std::optional<Geometry>> converted(bsp_geometries.size());
+  ParallelFor(bsp_geometries.size(), options.num_threads, [&](size_t i) {
+    if (bsp_geometries[i]) {
+      PatchGrid* patch_grid =
+          patch_indices[i] >= 0 ? &patch_grids[patch_indices[i]] : nullptr;
+      converted[i] = ConvertGeometry(*bsp_geometries[i], patch_grid);
     }
+  });
 
-    scene.geometries.emplace(surface_idx, std::move(out_geo));
+  const std::span<const dmodel_t> models = GetLump<LumpType::Models>(bsp);
+  if (!models.empty()) {
+    scene.first_world_surface = models[0].first_surface;
+    scene.num_world_surfaces = models[0].num_surfaces;
+  }
+
+  scene.geometries.reserve(converted.size());
+  for (size_t i = 0; i < converted.size(); ++i) {
+    if (!converted[i]) {
+      continue;
+    }
+    const BSPSurfaceIndex surface_idx = static_cast<BSPSurfaceIndex>(i);
+    const BSPTextureIndex texture_index = converted[i]->material_id;
+    scene.geometries.emplace(surface_idx, std::move(*converted[i]));
 
     // 4. Check for Area Light (Emissive Material)
-    auto mat_it = scene.materials.find(geo.texture_index);
+    auto mat_it = scene.materials.find(texture_index);
     if (mat_it != scene.materials.end() &&
         mat_it->second.emission_intensity > 0.0f) {
       Light area_light;
       area_light.type = Light::Type::Area;
       area_light.intensity = mat_it->second.emission_intensity;
-      area_light.material_id = geo.texture_index;
+      area_light.material_id = texture_index;
       area_light.geometry_index = surface_idx;
       area_light.color =
           Eigen::Vector3f::Ones();  // Use material lightimage/color?
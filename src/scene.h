@@ -4,6 +4,7 @@
 #include <Eigen/Dense>  // IWYU pragma: keep
 #include <cstdint>
 #include <filesystem>
+#include <limits>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -12,12 +13,16 @@
 #include "bsp_entity.h"
 #include "bsp_geometry.h"
 #include "bsp_material.h"
+#include "triangulation.h"
 
 namespace ioq3_map {
 
 // --- Texture ---
 struct Texture {
   std::filesystem::path file_path;
+  // Whether the shader stage blends by the alpha of the texture
+  // (blendFunc GL_SRC_ALPHA ...), which is otherwise unused.
+  bool alpha_blended = false;
 };
 
 // --- Material ---
@@ -80,13 +85,32 @@ struct Scene {
   std::unordered_map<BSPTextureIndex, Material> materials;
   std::vector<Light> lights;
   std::optional<Sky> sky;
+
+  // The surfaces of the world, BSP model 0:
+  // [first_world_surface, first_world_surface + num_world_surfaces). Those of
+  // the other models belong to brush entities, e.g. doors and platforms, which
+  // move on their own. Every surface by default.
+  BSPSurfaceIndex first_world_surface = 0;
+  int num_world_surfaces = std::numeric_limits<int>::max();
+};
+
+// Whether the surface belongs to the world rather than to a brush entity.
+bool IsWorldSurface(const Scene& scene, BSPSurfaceIndex surface);
+
+struct AssembleOptions {
+  // Surfaces are triangulated on a pool of `num_threads` workers (see
+  // ResolveThreadCount). The scene does not depend on the number of threads.
+  int num_threads = 0;
+
+  PatchTessellation patch_tessellation;
 };
 
+// Converts the BSP objects into a glTF-ready scene.
 Scene AssembleBSPObjects(
-    const BSP& bsp,
-    const std::unordered_map<BSPSurfaceIndex, BSPGeometry>& bsp_geometries,
+    const BSP& bsp, const BSPGeometries& bsp_geometries,
     const std::unordered_map<BSPTextureIndex, BSPMaterial>& bsp_materials,
-    const std::vector<Entity>& bsp_entities);
+    const std::vector<Entity>& bsp_entities,
+    const AssembleOptions& options = {});
 
 }  // namespace ioq3_map
 
@@ -3,6 +3,9 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <span>
+#include <vector>
+
 #include "bsp_geometry.h"
 #include "shader_parser.h"
 
@@ -17,7 +20,7 @@ MATCHER_P(VectorNear, tol, "") {
 class SceneTest : public ::testing::Test {
  protected:
   BSP bsp_;
-  std::unordered_map<BSPSurfaceIndex, BSPGeometry> geometries_;
+  BSPGeometries geometries_;
   std::unordered_map<BSPTextureIndex, BSPMaterial> materials_;
   std::vector<Entity> entities_;
 };
@@ -38,10 +41,13 @@ TEST_F(SceneTest, AssembleBSPObjectsPlanarTransform) {
   vertex_t v2;
   v2.xyz = {0, 100, 0};
   v2.normal = {0, 0, 1};
-  poly.vertices = {v0, v1, v2};
-  poly.indices = {0, 1, 2};
+  // The geometry views into these, as it would into the BSP lumps.
+  std::vector<vertex_t> vertices = {v0, v1, v2};
+  std::vector<int> indices = {0, 1, 2};
+  poly.vertices = vertices;
+  poly.indices = indices;
   geo.primitive = poly;
-  geometries_[0] = geo;
+  geometries_.push_back(geo);
 
   // Setup Material
   BSPMaterial mat;
@@ -82,9 +88,27 @@ TEST_F(SceneTest, AssembleBSPObjectsPlanarTransform) {
   // Material Check
   ASSERT_EQ(scene.materials.size(), 1);
   EXPECT_EQ(scene.materials.at(0).name, "textures/base_wall/concrete");
+  EXPECT_FALSE(scene.materials.at(0).albedo.alpha_blended);
   EXPECT_EQ(out_geo.material_id, 0);
 }
 
+TEST_F(SceneTest, AssembleBSPObjectsMarksAlphaBlendedAlbedo) {
+  BSPMaterial mat;
+  mat.name = "textures/base_trim/grate";
+  mat.texture_layers.push_back(Q3TextureLayer{.path = "textures/base.tga"});
+  mat.texture_layers.push_back(
+      Q3TextureLayer{.path = "textures/grate.tga",
+                     .blend_src = BlendFunc::SRC_ALPHA,
+                     .blend_dst = BlendFunc::ONE_MINUS_SRC_ALPHA});
+  materials_[0] = mat;
+
+  Scene scene = AssembleBSPObjects(bsp_, geometries_, materials_, entities_);
+
+  ASSERT_EQ(scene.materials.size(), 1);
+  EXPECT_EQ(scene.materials.at(0).albedo.file_path, "textures/grate.tga");
+  EXPECT_TRUE(scene.materials.at(0).albedo.alpha_blended);
+}
+
 TEST_F(SceneTest, AssembleBSPObjectsExtractsSun) {
   BSPMaterial mat;
   mat.name = "textures/skies/sky_sun";
@@ -174,5 +198,34 @@ TEST_F(SceneTest, AssembleBSPObjectsExtractsEntities) {
   EXPECT_TRUE(found_spot);
 }
 
+TEST_F(SceneTest, AssembleBSPObjectsInParallel) {
+  // A row of 3x3 patches, each lifted by its index.
+  std::vector<vertex_t> control_points(9 * 64);
+  for (size_t i = 0; i < control_points.size(); ++i) {
+    control_points[i].xyz = Eigen::Vector3f(i % 3, (i / 3) % 3, i / 9);
+    control_points[i].normal = Eigen::Vector3f(0, 0, 1);
+  }
+  for (size_t i = 0; i < control_points.size() / 9; ++i) {
+    BSPGeometry geo;
+    geo.texture_index = 0;
+    geo.primitive = BSPPatch{
+        3, 3, std::span<const vertex_t>(control_points).subspan(i * 9, 9)};
+    geometries_.push_back(geo);
+  }
+
+  Scene serial = AssembleBSPObjects(bsp_, geometries_, materials_, entities_,
+                                    {.num_threads = 1});
+  Scene parallel = AssembleBSPObjects(bsp_, geometries_, materials_,
+                                      entities_, {.num_threads = 4});
+
+  ASSERT_EQ(parallel.geometries.size(), geometries_.size());
+  for (const auto& [index, geometry] : serial.geometries) {
+    const Geometry& other = parallel.geometries.at(index);
+    EXPECT_EQ(other.vertices, geometry.vertices);
+    EXPECT_EQ(other.indices, geometry.indices);
+    EXPECT_NEAR(other.vertices.front().y(), index * 0.0254f, 1e-5f);
+  }
+}
+
 }  // namespace
 }  // namespace ioq3_map
@@ -6,10 +6,8 @@
 #include <algorithm>
 #include <cctype>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
 #include <optional>
-#include <sstream>
 #include <string>
 
 #include "archives.h"
@@ -339,16 +337,16 @@ std::optional<Q3TextureLayer> ParseShaderStages(const VirtualFilesystem& vfs,
 }
 
 std::optional<std::filesystem::path> FindTexturePath(
-    const std::filesystem::path& path) {
+    const VirtualFilesystem& vfs, const std::filesystem::path& path) {
   std::filesystem::path candidate = path;
-  if (std::filesystem::exists(candidate)) {
+  if (vfs.Exists(candidate)) {
     return candidate;
   }
 
   // Try to find a valid extension
   for (const auto& ext : kTextureExtensions) {
     candidate.replace_extension(ext);
-    if (std::filesystem::exists(candidate)) {
+    if (vfs.Exists(candidate)) {
       return candidate;
     }
   }
@@ -356,7 +354,8 @@ std::optional<std::filesystem::path> FindTexturePath(
   return std::nullopt;
 }
 
-void PruneInvalidTextureLayers(Q3Shader* shader) {
+void PruneInvalidTextureLayers(const VirtualFilesystem& vfs,
+                               Q3Shader* shader) {
   for (auto it = shader->texture_layers.begin();
        it != shader->texture_layers.end();) {
     if (it->path.empty()) {
@@ -365,7 +364,7 @@ void PruneInvalidTextureLayers(Q3Shader* shader) {
       continue;
     }
 
-    auto found_path = FindTexturePath(it->path);
+    auto found_path = FindTexturePath(vfs, it->path);
     if (!found_path) {
       // DLOG(WARNING) << "Shader " << shader->name << " has missing texture "
       //               << it->path;
@@ -377,7 +376,7 @@ void PruneInvalidTextureLayers(Q3Shader* shader) {
   }
 
   if (shader->q3map_lightimage) {
-    auto found = FindTexturePath(*shader->q3map_lightimage);
+    auto found = FindTexturePath(vfs, *shader->q3map_lightimage);
     if (!found) {
       // DLOG(WARNING) << "Shader " << shader->name
       //               << " has missing q3map_lightimage "
@@ -393,42 +392,21 @@ void PruneInvalidTextureLayers(Q3Shader* shader) {
 
 std::vector<std::filesystem::path> ListQ3ShaderScripts(
     const VirtualFilesystem& vfs) {
-  std::filesystem::recursive_directory_iterator dir_it;
-  try {
-    dir_it = std::filesystem::recursive_directory_iterator(vfs.mount_point /
-                                                           kScriptFolder);
-  } catch (const std::filesystem::filesystem_error& e) {
-    LOG(ERROR) << "Failed to list shader scripts: " << e.what();
-    return {};
-  }
-
-  std::vector<std::filesystem::path> result;
-  for (const auto& entry : dir_it) {
-    if (entry.is_regular_file() &&
-        entry.path().extension() == kShaderExtension) {
-      result.push_back(entry.path());
-    }
-  }
-  std::sort(result.begin(), result.end());
-  return result;
+  return vfs.ListFiles(vfs.mount_point / kScriptFolder, kShaderExtension);
 }
 
 std::unordered_map<Q3ShaderName, Q3Shader> ParseShaderScript(
     const VirtualFilesystem& vfs,
     const std::filesystem::path& shader_script_path) {
-  std::ifstream file(shader_script_path);
-  if (!file.is_open()) {
+  std::optional<std::string> content = vfs.ReadFile(shader_script_path);
+  if (!content) {
     LOG(ERROR) << "Failed to open shader file: " << shader_script_path;
     return {};
   }
 
-  std::stringstream buffer;
-  buffer << file.rdbuf();
-  std::string content = buffer.str();
-
   std::unordered_map<Q3ShaderName, Q3Shader> result;
 
-  Tokenizer tokenizer(content);
+  Tokenizer tokenizer(*content);
   while (tokenizer.HasMore()) {
     // The first line should be the shader name.
     std::string shader_name = tokenizer.Next();
@@ -466,7 +444,7 @@ std::unordered_map<Q3ShaderName, Q3Shader> ParseShaderScript(
       }
     }
 
-    PruneInvalidTextureLayers(&shader);
+    PruneInvalidTextureLayers(vfs, &shader);
     result.insert_or_assign(shader.name, std::move(shader));
   }
 
@@ -494,7 +472,7 @@ std::unordered_map<Q3ShaderName, Q3Shader> ParseShaderScripts(
 // found, return std::nullopt.
 std::optional<Q3Shader> CreateDefaultShader(const Q3ShaderName& name,
                                             const VirtualFilesystem& vfs) {
-  auto texture_path = FindTexturePath(vfs.mount_point / name);
+  auto texture_path = FindTexturePath(vfs, vfs.mount_point / name);
   if (!texture_path) {
     LOG(WARNING) << "Could not find texture for shader " << name;
     return std::nullopt;
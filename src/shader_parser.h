@@ -111,11 +111,12 @@ struct Q3Shader {
 };
 
 // Lists all *.shader files within the /scripts folder in the VFS. It returns
-// the OS paths for every shader file found.
+// the paths, rooted at the VFS mount point, for every shader file found.
 std::vector<std::filesystem::path> ListQ3ShaderScripts(
     const VirtualFilesystem& vfs);
 
-// Parses the content of a shader script from a full OS path.
+// Parses the content of a shader script from a path rooted at the VFS mount
+// point.
 std::unordered_map<Q3ShaderName, Q3Shader> ParseShaderScript(
     const VirtualFilesystem& vfs,
     const std::filesystem::path& shader_script_path);
@@ -0,0 +1,27 @@
+#ifndef IOQ3_MAP_TEST_UTIL_H_
+#define IOQ3_MAP_TEST_UTIL_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace ioq3_map {
+
+// The triangles of a grid of `size` x `size` quads, whose (size + 1)^2
+// vertices are numbered row by row. Each quad is split along the diagonal
+// from its first vertex, row by row like a patch.
+inline std::vector<uint32_t> GridIndices(int size) {
+  std::vector<uint32_t> indices;
+  const uint32_t width = size + 1;
+  for (uint32_t y = 0; y < uint32_t(size); ++y) {
+    for (uint32_t x = 0; x < uint32_t(size); ++x) {
+      const uint32_t v0 = y * width + x;
+      indices.insert(indices.end(), {v0, v0 + 1, v0 + width + 1, v0,
+                                     v0 + width + 1, v0 + width});
+    }
+  }
+  return indices;
+}
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_TEST_UTIL_H_
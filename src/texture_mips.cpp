@@ -0,0 +1,137 @@
+#include "texture_mips.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <utility>
+
+namespace ioq3_map {
+
+namespace {
+
+// Premultiplied linear RGBA, 4 floats per texel.
+struct LinearImage {
+  int width = 0;
+  int height = 0;
+  std::vector<float> texels;
+};
+
+float SrgbToLinear(float value) {
+  return value <= 0.04045f ? value / 12.92f
+                           : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// The linear value of every 8-bit sRGB code.
+const std::array<float, 256>& SrgbDecodeTable() {
+  static const std::array<float, 256> table = [] {
+    std::array<float, 256> values;
+    for (int i = 0; i < 256; ++i) {
+      values[i] = SrgbToLinear(i / 255.0f);
+    }
+    return values;
+  }();
+  return table;
+}
+
+// The linear values halfway between consecutive sRGB codes: the code of a
+// linear value is the number of thresholds below it, which rounds to the
+// nearest code in sRGB space.
+const std::array<float, 255>& SrgbEncodeThresholds() {
+  static const std::array<float, 255> table = [] {
+    std::array<float, 255> values;
+    for (int i = 0; i < 255; ++i) {
+      values[i] = SrgbToLinear((i + 0.5f) / 255.0f);
+    }
+    return values;
+  }();
+  return table;
+}
+
+uint8_t LinearToSrgb(float value) {
+  const std::array<float, 255>& thresholds = SrgbEncodeThresholds();
+  return static_cast<uint8_t>(
+      std::upper_bound(thresholds.begin(), thresholds.end(), value) -
+      thresholds.begin());
+}
+
+uint8_t UnitToByte(float value) {
+  return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+LinearImage Linearize(const RgbaImage& image) {
+  const std::array<float, 256>& decode = SrgbDecodeTable();
+  LinearImage linear{image.width, image.height,
+                     std::vector<float>(image.pixels.size())};
+  for (size_t i = 0; i < image.pixels.size(); i += 4) {
+    const float alpha = image.pixels[i + 3] / 255.0f;
+    for (int c = 0; c < 3; ++c) {
+      linear.texels[i + c] = decode[image.pixels[i + c]] * alpha;
+    }
+    linear.texels[i + 3] = alpha;
+  }
+  return linear;
+}
+
+RgbaImage Quantize(const LinearImage& linear) {
+  RgbaImage image{linear.width, linear.height,
+                  std::vector<uint8_t>(linear.texels.size())};
+  for (size_t i = 0; i < linear.texels.size(); i += 4) {
+    const float alpha = linear.texels[i + 3];
+    for (int c = 0; c < 3; ++c) {
+      image.pixels[i + c] =
+          alpha > 0.0f ? LinearToSrgb(linear.texels[i + c] / alpha) : 0;
+    }
+    image.pixels[i + 3] = UnitToByte(alpha);
+  }
+  return image;
+}
+
+// Averages 2x2 texels. The rows are summed over contiguous floats, which the
+// compiler vectorizes.
+LinearImage Downsample(const LinearImage& source) {
+  LinearImage target;
+  target.width = std::max(source.width / 2, 1);
+  target.height = std::max(source.height / 2, 1);
+  target.texels.resize(size_t(target.width) * target.height * 4);
+
+  const size_t source_row = size_t(source.width) * 4;
+  const int dx = source.width > 1 ? 4 : 0;
+  std::vector<float> row(source_row);
+  for (int y = 0; y < target.height; ++y) {
+    const float* top = &source.texels[2 * y * source_row];
+    const float* bottom = source.height > 1 ? top + source_row : top;
+    for (size_t i = 0; i < source_row; ++i) {
+      row[i] = top[i] + bottom[i];
+    }
+    float* out = &target.texels[size_t(y) * target.width * 4];
+    for (int x = 0; x < target.width; ++x) {
+      const float* left = &row[size_t(x) * 8];
+      for (int c = 0; c < 4; ++c) {
+        out[x * 4 + c] = (left[c] + left[c + dx]) * 0.25f;
+      }
+    }
+  }
+  return target;
+}
+
+}  // namespace
+
+int MipLevelCount(int width, int height) {
+  return std::bit_width(static_cast<unsigned>(std::max({width, height, 1})));
+}
+
+std::vector<RgbaImage> GenerateMipChain(RgbaImage base) {
+  const int num_levels = MipLevelCount(base.width, base.height);
+  std::vector<RgbaImage> levels;
+  levels.reserve(num_levels);
+  LinearImage linear = Linearize(base);
+  levels.push_back(std::move(base));
+  for (int level = 1; level < num_levels; ++level) {
+    linear = Downsample(linear);
+    levels.push_back(Quantize(linear));
+  }
+  return levels;
+}
+
+}  // namespace ioq3_map
@@ -0,0 +1,29 @@
+#ifndef IOQ3_MAP_TEXTURE_MIPS_H_
+#define IOQ3_MAP_TEXTURE_MIPS_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace ioq3_map {
+
+// An 8-bit RGBA image in sRGB, row by row from the top, with straight alpha.
+struct RgbaImage {
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> pixels;
+};
+
+// The number of levels of a full mip chain, down to 1x1.
+int MipLevelCount(int width, int height);
+
+// Generates the full mip chain of `base`, base level first. Every level
+// halves the previous one, rounding down, with a 2x2 box filter in linear
+// space: the colors are decoded from sRGB and weighted by their alpha, so
+// that transparent texels do not bleed into their neighbours. The levels are
+// filtered from the previous level in floating point, and only rounded to
+// 8 bits once. The last row or column of an odd dimension is dropped.
+std::vector<RgbaImage> GenerateMipChain(RgbaImage base);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_TEXTURE_MIPS_H_
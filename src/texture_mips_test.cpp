@@ -0,0 +1,58 @@
+#include "texture_mips.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace ioq3_map {
+namespace {
+
+RgbaImage Fill(int width, int height, std::vector<uint8_t> texel) {
+  RgbaImage image{width, height, {}};
+  for (int i = 0; i < width * height; ++i) {
+    image.pixels.insert(image.pixels.end(), texel.begin(), texel.end());
+  }
+  return image;
+}
+
+TEST(TextureMipsTest, MipLevelCount) {
+  EXPECT_EQ(MipLevelCount(256, 64), 9);
+  EXPECT_EQ(MipLevelCount(5, 3), 3);
+  EXPECT_EQ(MipLevelCount(1, 1), 1);
+}
+
+TEST(TextureMipsTest, HalvesDownToOneTexel) {
+  const std::vector<RgbaImage> levels =
+      GenerateMipChain(Fill(8, 2, {10, 200, 30, 77}));
+  ASSERT_EQ(levels.size(), 4);
+  const int widths[] = {8, 4, 2, 1};
+  const int heights[] = {2, 1, 1, 1};
+  for (size_t i = 0; i < levels.size(); ++i) {
+    EXPECT_EQ(levels[i].width, widths[i]);
+    EXPECT_EQ(levels[i].height, heights[i]);
+    // A constant image stays constant.
+    EXPECT_EQ(levels[i].pixels, Fill(widths[i], heights[i], {10, 200, 30, 77})
+                                    .pixels);
+  }
+}
+
+TEST(TextureMipsTest, AveragesInLinearSpace) {
+  // One white texel out of four is a quarter of the light, which is 137 in
+  // sRGB rather than 64.
+  RgbaImage image = Fill(2, 2, {0, 0, 0, 255});
+  image.pixels[0] = image.pixels[1] = image.pixels[2] = 255;
+  const std::vector<RgbaImage> levels = GenerateMipChain(image);
+  ASSERT_EQ(levels.size(), 2);
+  EXPECT_EQ(levels[1].pixels, (std::vector<uint8_t>{137, 137, 137, 255}));
+}
+
+TEST(TextureMipsTest, TransparentTexelsDoNotBleed) {
+  const RgbaImage image{2, 1, {255, 0, 0, 255, 0, 255, 0, 0}};
+  const std::vector<RgbaImage> levels = GenerateMipChain(image);
+  ASSERT_EQ(levels.size(), 2);
+  EXPECT_EQ(levels[1].pixels, (std::vector<uint8_t>{255, 0, 0, 128}));
+}
+
+}  // namespace
+}  // namespace ioq3_map
@@ -1,149 +1,300 @@
 #include "triangulation.h"
 
-namespace ioq3_map {
+#include <Eigen/Dense>  // IWYU pragma: keep
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <utility>
 
-BSPMesh Triangulate(const BSPPolygon& polygon) {
-  BSPMesh mesh;
-  mesh.vertices = polygon.vertices;
+namespace ioq3_map {
 
+std::vector<int> Triangulate(const BSPPolygon& polygon) {
   // If explicit triangulation indices are provided (e.g. from BSP meshverts),
   // use them.
   if (!polygon.indices.empty()) {
-    mesh.indices = polygon.indices;
-    return mesh;
+    return std::vector<int>(polygon.indices.begin(), polygon.indices.end());
   }
 
+  std::vector<int> indices;
   const size_t num_verts = polygon.vertices.size();
   if (num_verts < 3) {
-    return mesh;
+    return indices;
   }
 
   // Create a triangle fan: (0, 1, 2), (0, 2, 3), ...
+  indices.reserve((num_verts - 2) * 3);
   for (size_t i = 1; i < num_verts - 1; ++i) {
-    mesh.indices.push_back(0);
-    mesh.indices.push_back(static_cast<int>(i));
-    mesh.indices.push_back(static_cast<int>(i + 1));
+    indices.push_back(0);
+    indices.push_back(static_cast<int>(i));
+    indices.push_back(static_cast<int>(i + 1));
   }
 
-  return mesh;
+  return indices;
 }
 
 namespace {
 
-// Interpolates between two vertices a and b by t (0.0 to 1.0).
-vertex_t Lerp(const vertex_t& a, const vertex_t& b, float t) {
-  vertex_t v;
-  v.xyz = a.xyz + (b.xyz - a.xyz) * t;
-  v.st = a.st + (b.st - a.st) * t;
-  v.lightmap = a.lightmap + (b.lightmap - a.lightmap) * t;
-  v.normal = (a.normal + (b.normal - a.normal) * t).normalized();
-  for (int i = 0; i < 4; ++i) {
-    v.color[i] =
-        static_cast<uint8_t>(a.color[i] + (b.color[i] - a.color[i]) * t);
+// The vertex attributes that are interpolated over a patch, in the order of
+// the rows of a PatchChannels matrix.
+constexpr int kXyzRow = 0;
+constexpr int kStRow = 3;
+constexpr int kLightmapRow = 5;
+constexpr int kNormalRow = 7;
+constexpr int kColorRow = 10;
+constexpr int kNumChannels = 14;
+
+// Adaptive subdivision stops at this many segments per sub-patch and
+// direction.
+constexpr int kMaxAdaptiveSegments = 16;
+
+// The 9 control points of a 3x3 sub-patch in SoA form: one column per
+// control point, in row-major order, and one row per channel.
+using PatchChannels = Eigen::Matrix<float, kNumChannels, 9>;
+
+// Samples the quadratic Bezier basis at the local parameters ts, one column
+// per parameter.
+Eigen::Matrix<float, 3, Eigen::Dynamic> SampleBasis(std::span<const float> ts) {
+  Eigen::Matrix<float, 3, Eigen::Dynamic> basis(3, ts.size());
+  for (size_t i = 0; i < ts.size(); ++i) {
+    const float t = ts[i];
+    basis(0, i) = (1.0f - t) * (1.0f - t);
+    basis(1, i) = 2.0f * (1.0f - t) * t;
+    basis(2, i) = t * t;
   }
-  return v;
+  return basis;
 }
 
-// Evaluates a quadratic Bezier curve at t using control points p0, p1, p2.
-vertex_t Bezier(const vertex_t& p0, const vertex_t& p1, const vertex_t& p2,
-                float t) {
-  float b0 = (1.0f - t) * (1.0f - t);
-  float b1 = 2.0f * (1.0f - t) * t;
-  float b2 = t * t;
+void StoreControlPoint(const vertex_t& v, int column, PatchChannels* out) {
+  out->block<3, 1>(kXyzRow, column) = v.xyz;
+  out->block<2, 1>(kStRow, column) = v.st;
+  out->block<2, 1>(kLightmapRow, column) = v.lightmap;
+  out->block<3, 1>(kNormalRow, column) = v.normal;
+  for (int i = 0; i < 4; ++i) {
+    (*out)(kColorRow + i, column) = v.color[i];
+  }
+}
 
+vertex_t LoadVertex(const Eigen::Matrix<float, kNumChannels, 1>& channels) {
   vertex_t v;
-  v.xyz = p0.xyz * b0 + p1.xyz * b1 + p2.xyz * b2;
-  v.st = p0.st * b0 + p1.st * b1 + p2.st * b2;
-  v.lightmap = p0.lightmap * b0 + p1.lightmap * b1 + p2.lightmap * b2;
+  v.xyz = channels.segment<3>(kXyzRow);
+  v.st = channels.segment<2>(kStRow);
+  v.lightmap = channels.segment<2>(kLightmapRow);
   // Normals shouldn't be linearly interpolated like this for a curved surface,
   // but it's a common approximation. Re-normalizing is crucial.
   // Ideally we would compute the tangent and bitangent derivatives.
-  v.normal = (p0.normal * b0 + p1.normal * b1 + p2.normal * b2).normalized();
-
+  v.normal = channels.segment<3>(kNormalRow).normalized();
+  // The weights are a partition of unity, so colors stay within [0, 255] and
+  // only need rounding.
   for (int i = 0; i < 4; ++i) {
-    v.color[i] = static_cast<uint8_t>(p0.color[i] * b0 + p1.color[i] * b1 +
-                                      p2.color[i] * b2);
+    v.color[i] = static_cast<uint8_t>(channels(kColorRow + i) + 0.5f);
   }
   return v;
 }
 
-}  // namespace
-
-BSPMesh Triangulate(const BSPPatch& patch, int subdivisions) {
-  BSPMesh mesh;
-
+bool IsValidPatch(const BSPPatch& patch) {
   // A patch of size WxH must be odd dimensions and >= 3.
   // It effectively consists of a grid of (W-1)/2 x (H-1)/2 sub-patches of 3x3
   // control points.
-  if (patch.width < 3 || patch.height < 3 || patch.width % 2 == 0 ||
-      patch.height % 2 == 0) {
-    return mesh;  // Invalid patch dimensions
+  return patch.width >= 3 && patch.height >= 3 && patch.width % 2 == 1 &&
+         patch.height % 2 == 1 &&
+         patch.control_points.size() >=
+             static_cast<size_t>(patch.width) * patch.height;
+}
+
+Eigen::Vector3f BezierPoint(const Eigen::Vector3f& p0,
+                            const Eigen::Vector3f& p1,
+                            const Eigen::Vector3f& p2, float t) {
+  return p0 * ((1.0f - t) * (1.0f - t)) + p1 * (2.0f * (1.0f - t) * t) +
+         p2 * (t * t);
+}
+
+// Distance of the curve point at the middle of [t0, t1] from the chord between
+// the curve points at t0 and t1. Like the engine, this uses the distance from
+// the line rather than from the chord's midpoint: it ignores texture warping,
+// but gives a lot less polygons.
+float ChordError(const Eigen::Vector3f& p0, const Eigen::Vector3f& p1,
+                 const Eigen::Vector3f& p2, float t0, float t1) {
+  const Eigen::Vector3f a = BezierPoint(p0, p1, p2, t0);
+  const Eigen::Vector3f b = BezierPoint(p0, p1, p2, t1);
+  const Eigen::Vector3f mid = BezierPoint(p0, p1, p2, 0.5f * (t0 + t1)) - a;
+  const Eigen::Vector3f chord = b - a;
+  const float chord_length = chord.norm();
+  if (chord_length < 1e-6f) {
+    return mid.norm();
+  }
+  return (mid - chord * (mid.dot(chord) / (chord_length * chord_length)))
+      .norm();
+}
+
+// Returns the number of segments, a power of two, for the `span`-th sub-patch
+// column (or row when `rows` is set) such that every curve of the span's
+// control rows (columns) is within `max_error` of its tessellation. The
+// curves of the surface are blends of those of the control points, so that
+// bounds the error of the surface as well.
+int AdaptiveSegments(const BSPPatch& patch, int span, bool rows,
+                     float max_error) {
+  const int num_curves = rows ? patch.width : patch.height;
+  auto control_point = [&](int curve, int k) -> const Eigen::Vector3f& {
+    const int x = rows ? curve : span * 2 + k;
+    const int y = rows ? span * 2 + k : curve;
+    return patch.control_points[y * patch.width + x].xyz;
+  };
+
+  int segments = 1;
+  for (; segments < kMaxAdaptiveSegments; segments *= 2) {
+    float error = 0.0f;
+    for (int curve = 0; curve < num_curves && error <= max_error; ++curve) {
+      for (int k = 0; k < segments; ++k) {
+        error = std::max(
+            error, ChordError(control_point(curve, 0), control_point(curve, 1),
+                              control_point(curve, 2),
+                              static_cast<float>(k) / segments,
+                              static_cast<float>(k + 1) / segments));
+      }
+    }
+    if (error <= max_error) {
+      break;
+    }
+  }
+  return segments;
+}
+
+// Plans the parameters of one direction of the grid: `num_spans` spans of
+// sub-patches, each split into segments.
+std::vector<float> PlanParameters(const BSPPatch& patch, int num_spans,
+                                  bool rows,
+                                  const PatchTessellation& tessellation) {
+  std::vector<float> params;
+  for (int span = 0; span < num_spans; ++span) {
+    const int segments =
+        tessellation.max_error > 0.0f
+            ? AdaptiveSegments(patch, span, rows, tessellation.max_error)
+            : tessellation.subdivisions;
+    for (int k = 0; k < segments; ++k) {
+      params.push_back(span + static_cast<float>(k) / segments);
+    }
+  }
+  params.push_back(static_cast<float>(num_spans));
+  return params;
+}
+
+// The local parameters within sub-patch `span` of the grid parameters, which
+// run from the span's first to last parameter (both integers).
+std::vector<float> LocalParameters(const std::vector<float>& params, int span) {
+  auto first = std::lower_bound(params.begin(), params.end(),
+                                static_cast<float>(span));
+  auto last = std::lower_bound(first, params.end(),
+                               static_cast<float>(span + 1));
+  std::vector<float> ts;
+  for (auto it = first; it <= last && it != params.end(); ++it) {
+    ts.push_back(*it - span);
+  }
+  return ts;
+}
+
+}  // namespace
+
+PatchGrid PlanPatchGrid(const BSPPatch& patch,
+                        const PatchTessellation& tessellation) {
+  PatchGrid grid;
+  if (!IsValidPatch(patch) ||
+      (tessellation.max_error <= 0.0f && tessellation.subdivisions < 1)) {
+    return grid;  // Invalid patch dimensions
   }
 
   const int sub_patches_x = (patch.width - 1) / 2;
   const int sub_patches_y = (patch.height - 1) / 2;
+  grid.columns =
+      PlanParameters(patch, sub_patches_x, /*rows=*/false, tessellation);
+  grid.rows = PlanParameters(patch, sub_patches_y, /*rows=*/true, tessellation);
+  return grid;
+}
 
-  // We will generate the entire grid of vertices first.
-  // The total grid size will be:
-  // Width:  sub_patches_x * subdivisions + 1
-  // Height: sub_patches_y * subdivisions + 1
+void EvaluatePatchGrid(const BSPPatch& patch, PatchGrid* grid) {
+  grid->vertices.clear();
+  if (!IsValidPatch(patch) || grid->columns.empty() || grid->rows.empty()) {
+    return;
+  }
 
-  const int grid_width = sub_patches_x * subdivisions + 1;
-  const int grid_height = sub_patches_y * subdivisions + 1;
+  const int sub_patches_x = (patch.width - 1) / 2;
+  const int sub_patches_y = (patch.height - 1) / 2;
+  const int grid_width = grid->width();
+  grid->vertices.resize(grid->columns.size() * grid->rows.size());
 
-  mesh.vertices.resize(grid_width * grid_height);
+  // The basis of each span, shared by its sub-patches.
+  std::vector<Eigen::Matrix<float, 3, Eigen::Dynamic>> basis_x;
+  std::vector<int> first_column;
+  for (int px = 0; px < sub_patches_x; ++px) {
+    basis_x.push_back(SampleBasis(LocalParameters(grid->columns, px)));
+    first_column.push_back(std::lower_bound(grid->columns.begin(),
+                                            grid->columns.end(),
+                                            static_cast<float>(px)) -
+                           grid->columns.begin());
+  }
 
+  PatchChannels control;
+  // The sub-patch blended along x, per control row, and then along y, per
+  // grid row.
+  Eigen::Matrix<float, kNumChannels, Eigen::Dynamic> along_x[3];
+  Eigen::Matrix<float, kNumChannels, Eigen::Dynamic> evaluated;
   for (int py = 0; py < sub_patches_y; ++py) {
+    const Eigen::Matrix<float, 3, Eigen::Dynamic> basis_y =
+        SampleBasis(LocalParameters(grid->rows, py));
+    const int first_row = std::lower_bound(grid->rows.begin(),
+                                           grid->rows.end(),
+                                           static_cast<float>(py)) -
+                          grid->rows.begin();
+
     for (int px = 0; px < sub_patches_x; ++px) {
       // Control points for this 3x3 sub-patch
       // The top-left corner of this sub-patch in the original control grid is
       // at (px * 2, py * 2).
       const int c_base_x = px * 2;
       const int c_base_y = py * 2;
-
-      // Fetch the 9 control points
-      const vertex_t* cp[3][3];
       for (int r = 0; r < 3; ++r) {
         for (int c = 0; c < 3; ++c) {
-          cp[r][c] = &patch.control_points[(c_base_y + r) * patch.width +
-                                           (c_base_x + c)];
+          StoreControlPoint(patch.control_points[(c_base_y + r) * patch.width +
+                                                 (c_base_x + c)],
+                            r * 3 + c, &control);
         }
       }
 
-      // Tessellate this sub-patch
-      for (int v_y = 0; v_y <= subdivisions; ++v_y) {
-        for (int v_x = 0; v_x <= subdivisions; ++v_x) {
-          // Local t coordinates (0.0 to 1.0)
-          float t_x = static_cast<float>(v_x) / subdivisions;
-          float t_y = static_cast<float>(v_y) / subdivisions;
-
-          // Interpolate horizontally first to get 3 vertical points
-          vertex_t temp[3];
-          for (int r = 0; r < 3; ++r) {
-            temp[r] = Bezier(*cp[r][0], *cp[r][1], *cp[r][2], t_x);
-          }
-
-          // Interpolate vertically to get final point
-          vertex_t final_vert = Bezier(temp[0], temp[1], temp[2], t_y);
-
-          // Calculate index in the global vertex grid
-          // Base offset for this sub-patch is (px * subdivisions, py *
-          // subdivisions)
-          int global_x = px * subdivisions + v_x;
-          int global_y = py * subdivisions + v_y;
+      // Tessellate this sub-patch, all channels at once: the control rows
+      // are blended along x, then the results along y.
+      for (int r = 0; r < 3; ++r) {
+        along_x[r].noalias() = control.middleCols<3>(r * 3) * basis_x[px];
+      }
 
+      for (int v_y = 0; v_y < basis_y.cols(); ++v_y) {
+        evaluated.noalias() = along_x[0] * basis_y(0, v_y) +
+                              along_x[1] * basis_y(1, v_y) +
+                              along_x[2] * basis_y(2, v_y);
+        for (int v_x = 0; v_x < evaluated.cols(); ++v_x) {
           // Handle overlaps: neighboring sub-patches share edge vertices.
-          // The calculation above is consistent; the 'last' vertex of patch N
-          // (v_x = subdivisions) lands on the same global coordinate as the
-          // 'first' vertex of patch N+1 (v_x = 0). We overwrite, which is fine
-          // (should be identical).
-          mesh.vertices[global_y * grid_width + global_x] = final_vert;
+          // The 'last' vertex of patch N lands on the same grid vertex as the
+          // 'first' vertex of patch N+1. We overwrite, which is fine (should
+          // be identical).
+          const int global_x = first_column[px] + v_x;
+          const int global_y = first_row + v_y;
+          grid->vertices[global_y * grid_width + global_x] =
+              LoadVertex(evaluated.col(v_x));
         }
       }
     }
   }
+}
+
+TriangleMesh Triangulate(PatchGrid grid) {
+  TriangleMesh mesh;
+  const int grid_width = grid.width();
+  const int grid_height = grid.height();
+  if (grid.vertices.size() != static_cast<size_t>(grid_width) * grid_height) {
+    return mesh;
+  }
+  mesh.vertices = std::move(grid.vertices);
 
   // Generate Indices (Grid triangulation)
+  mesh.indices.reserve((grid_width - 1) * (grid_height - 1) * 6);
   for (int y = 0; y < grid_height - 1; ++y) {
     for (int x = 0; x < grid_width - 1; ++x) {
       // Quad: (x, y), (x+1, y), (x+1, y+1), (x, y+1)
@@ -168,4 +319,15 @@ BSPMesh Triangulate(const BSPPatch& patch, int subdivisions) {
   return mesh;
 }
 
+TriangleMesh Triangulate(const BSPPatch& patch,
+                         const PatchTessellation& tessellation) {
+  PatchGrid grid = PlanPatchGrid(patch, tessellation);
+  EvaluatePatchGrid(patch, &grid);
+  return Triangulate(std::move(grid));
+}
+
+TriangleMesh Triangulate(const BSPPatch& patch, int subdivisions) {
+  return Triangulate(patch, PatchTessellation{.subdivisions = subdivisions});
+}
+
 }  // namespace ioq3_map
@@ -1,15 +1,67 @@
 #ifndef IOQ3_MAP_TRIANGULATION_H_
 #define IOQ3_MAP_TRIANGULATION_H_
 
+#include <vector>
+
 #include "bsp_geometry.h"
 
 namespace ioq3_map {
 
-// Triangulates a convex polygon into a triangle mesh using a triangle fan.
-BSPMesh Triangulate(const BSPPolygon& polygon);
+// A triangle mesh that owns its vertices, e.g. a tessellated patch.
+struct TriangleMesh {
+  std::vector<vertex_t> vertices;
+  std::vector<int> indices;
+};
+
+// Triangulates a convex polygon using a triangle fan. The indices refer to
+// polygon.vertices. The indices of the polygon, if any, are returned as is.
+std::vector<int> Triangulate(const BSPPolygon& polygon);
+
+// How finely patches are tessellated.
+struct PatchTessellation {
+  // Segments per 3x3 sub-patch and direction, when max_error is not set.
+  int subdivisions = 7;
+
+  // When positive, every column and row of sub-patches is subdivided
+  // adaptively, like the engine's tr_curve.c does: until each tessellated
+  // curve is within max_error world units of the true curve. Flat sub-patches
+  // become a single quad.
+  float max_error = 0.0f;
+};
+
+// A patch tessellated to a grid of vertices. Columns and rows are the patch
+// parameters of the grid lines: sub-patch i spans parameters [i, i + 1], so
+// columns run from 0 to (width - 1) / 2 over the patch. Since every column
+// and row runs across the whole patch, sub-patches sharing an edge are
+// sampled the same way on both sides.
+struct PatchGrid {
+  std::vector<float> columns;
+  std::vector<float> rows;
+
+  // height() x width() vertices, row-major. Empty until evaluated.
+  std::vector<vertex_t> vertices;
+
+  int width() const { return static_cast<int>(columns.size()); }
+  int height() const { return static_cast<int>(rows.size()); }
+};
+
+// Plans the columns and rows of a patch's grid, without evaluating it. The
+// grid is empty for invalid patches.
+PatchGrid PlanPatchGrid(const BSPPatch& patch,
+                        const PatchTessellation& tessellation);
+
+// Evaluates the vertices of a planned grid. The basis weights are sampled
+// once per column and row of sub-patches, and every 3x3 sub-patch is
+// evaluated with matrix products over all the vertex channels at once.
+void EvaluatePatchGrid(const BSPPatch& patch, PatchGrid* grid);
+
+// Triangulates an evaluated grid.
+TriangleMesh Triangulate(PatchGrid grid);
 
 // Triangulates a quadratic Bezier patch into a grid mesh.
-BSPMesh Triangulate(const BSPPatch& patch, int subdivisions = 7);
+TriangleMesh Triangulate(const BSPPatch& patch,
+                         const PatchTessellation& tessellation);
+TriangleMesh Triangulate(const BSPPatch& patch, int subdivisions = 7);
 
 }  // namespace ioq3_map
 
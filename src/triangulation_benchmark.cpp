@@ -0,0 +1,142 @@
+// Measures the patch tessellator against a per-vertex reference, which blends
+// whole vertex_t values through four quadratic Bezier evaluations per vertex.
+// The reference does not generate indices, so the speedup is a lower bound.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "bsp_geometry.h"
+#include "triangulation.h"
+
+DEFINE_int32(patch_size, 65,
+             "Width and height of the control point grid, must be odd");
+DEFINE_int32(subdivisions, 7, "Subdivisions per 3x3 sub-patch");
+DEFINE_int32(iterations, 20, "Number of tessellations to time");
+
+namespace ioq3_map {
+namespace {
+
+vertex_t Bezier(const vertex_t& p0, const vertex_t& p1, const vertex_t& p2,
+                float t) {
+  float b0 = (1.0f - t) * (1.0f - t);
+  float b1 = 2.0f * (1.0f - t) * t;
+  float b2 = t * t;
+
+  vertex_t v;
+  v.xyz = p0.xyz * b0 + p1.xyz * b1 + p2.xyz * b2;
+  v.st = p0.st * b0 + p1.st * b1 + p2.st * b2;
+  v.lightmap = p0.lightmap * b0 + p1.lightmap * b1 + p2.lightmap * b2;
+  v.normal = (p0.normal * b0 + p1.normal * b1 + p2.normal * b2).normalized();
+  for (int i = 0; i < 4; ++i) {
+    v.color[i] = static_cast<uint8_t>(p0.color[i] * b0 + p1.color[i] * b1 +
+                                      p2.color[i] * b2);
+  }
+  return v;
+}
+
+// The vertex grid of the reference tessellation, without indices.
+std::vector<vertex_t> ReferenceTessellate(const BSPPatch& patch,
+                                          int subdivisions) {
+  const int sub_patches_x = (patch.width - 1) / 2;
+  const int sub_patches_y = (patch.height - 1) / 2;
+  const int grid_width = sub_patches_x * subdivisions + 1;
+  const int grid_height = sub_patches_y * subdivisions + 1;
+
+  std::vector<vertex_t> vertices(grid_width * grid_height);
+  for (int py = 0; py < sub_patches_y; ++py) {
+    for (int px = 0; px < sub_patches_x; ++px) {
+      const vertex_t* cp[3][3];
+      for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+          cp[r][c] =
+              &patch.control_points[(py * 2 + r) * patch.width + (px * 2 + c)];
+        }
+      }
+
+      for (int v_y = 0; v_y <= subdivisions; ++v_y) {
+        for (int v_x = 0; v_x <= subdivisions; ++v_x) {
+          float t_x = static_cast<float>(v_x) / subdivisions;
+          float t_y = static_cast<float>(v_y) / subdivisions;
+          vertex_t temp[3];
+          for (int r = 0; r < 3; ++r) {
+            temp[r] = Bezier(*cp[r][0], *cp[r][1], *cp[r][2], t_x);
+          }
+          vertices[(py * subdivisions + v_y) * grid_width +
+                   (px * subdivisions + v_x)] =
+              Bezier(temp[0], temp[1], temp[2], t_y);
+        }
+      }
+    }
+  }
+  return vertices;
+}
+
+template <typename Fn>
+double TimeMilliseconds(int iterations, const Fn& fn) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    fn();
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+}  // namespace
+}  // namespace ioq3_map
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+  google::InitGoogleLogging(argv[0]);
+
+  using ioq3_map::vertex_t;
+
+  const int size = FLAGS_patch_size;
+  if (size < 3 || size % 2 == 0 || FLAGS_subdivisions < 1 ||
+      FLAGS_iterations < 1) {
+    LOG(ERROR) << "--patch_size must be odd and >= 3, --subdivisions and "
+                  "--iterations positive.";
+    return 1;
+  }
+
+  // A wavy surface, so that the normals and colors vary.
+  std::vector<vertex_t> control_points(size * size);
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      vertex_t& v = control_points[y * size + x];
+      v.xyz = Eigen::Vector3f(x * 16, y * 16, ((x + y) % 3) * 8);
+      v.st = Eigen::Vector2f(x / 4.0f, y / 4.0f);
+      v.lightmap = Eigen::Vector2f(x / float(size), y / float(size));
+      v.normal = Eigen::Vector3f(x % 2, y % 2, 1).normalized();
+      for (int c = 0; c < 4; ++c) {
+        v.color[c] = static_cast<uint8_t>((x * 7 + y * 13 + c) % 256);
+      }
+    }
+  }
+  const ioq3_map::BSPPatch patch{size, size, control_points};
+
+  size_t num_vertices = 0;
+  const double tessellator_ms = ioq3_map::TimeMilliseconds(
+      FLAGS_iterations, [&]() {
+        num_vertices =
+            ioq3_map::Triangulate(patch, FLAGS_subdivisions).vertices.size();
+      });
+  const double reference_ms = ioq3_map::TimeMilliseconds(
+      FLAGS_iterations, [&]() {
+        num_vertices =
+            ioq3_map::ReferenceTessellate(patch, FLAGS_subdivisions).size();
+      });
+
+  LOG(INFO) << size << "x" << size << " control points, "
+            << FLAGS_subdivisions << " subdivisions: " << num_vertices
+            << " vertices";
+  LOG(INFO) << "Per-vertex reference: " << reference_ms << " ms";
+  LOG(INFO) << "Basis table tessellator: " << tessellator_ms << " ms";
+  LOG(INFO) << "Speedup: " << reference_ms / tessellator_ms << "x";
+  return 0;
+}
@@ -2,88 +2,84 @@
 
 #include <gtest/gtest.h>
 
+#include <cmath>
+#include <vector>
+
 #include "bsp_geometry.h"
 
 namespace ioq3_map {
 namespace {
 
 TEST(TriangulationTest, TriangulateSquare) {
-  BSPPolygon poly;
   // Make a square: 4 vertices
   // 0 -- 1
   // |    |
   // 3 -- 2
-  poly.vertices.resize(4);
-  poly.vertices[0].xyz = {0, 0, 0};
-  poly.vertices[1].xyz = {1, 0, 0};
-  poly.vertices[2].xyz = {1, 1, 0};
-  poly.vertices[3].xyz = {0, 1, 0};
+  std::vector<vertex_t> vertices(4);
+  vertices[0].xyz = {0, 0, 0};
+  vertices[1].xyz = {1, 0, 0};
+  vertices[2].xyz = {1, 1, 0};
+  vertices[3].xyz = {0, 1, 0};
+  BSPPolygon poly{.vertices = vertices};
 
-  BSPMesh mesh = Triangulate(poly);
+  std::vector<int> indices = Triangulate(poly);
 
-  EXPECT_EQ(mesh.vertices.size(), 4);
   // Expect 2 triangles -> 6 indices
-  EXPECT_EQ(mesh.indices.size(), 6);
+  EXPECT_EQ(indices.size(), 6);
 
   // Triangle 1: 0, 1, 2
-  EXPECT_EQ(mesh.indices[0], 0);
-  EXPECT_EQ(mesh.indices[1], 1);
-  EXPECT_EQ(mesh.indices[2], 2);
+  EXPECT_EQ(indices[0], 0);
+  EXPECT_EQ(indices[1], 1);
+  EXPECT_EQ(indices[2], 2);
 
   // Triangle 2: 0, 2, 3
-  EXPECT_EQ(mesh.indices[3], 0);
-  EXPECT_EQ(mesh.indices[4], 2);
-  EXPECT_EQ(mesh.indices[5], 3);
+  EXPECT_EQ(indices[3], 0);
+  EXPECT_EQ(indices[4], 2);
+  EXPECT_EQ(indices[5], 3);
 }
 
 TEST(TriangulationTest, TriangulateTriangle) {
-  BSPPolygon poly;
-  poly.vertices.resize(3);
-  BSPMesh mesh = Triangulate(poly);
-
-  EXPECT_EQ(mesh.vertices.size(), 3);
-  EXPECT_EQ(mesh.indices.size(), 3);
-  EXPECT_EQ(mesh.indices[0], 0);
-  EXPECT_EQ(mesh.indices[1], 1);
-  EXPECT_EQ(mesh.indices[2], 2);
+  std::vector<vertex_t> vertices(3);
+  BSPPolygon poly{.vertices = vertices};
+  std::vector<int> indices = Triangulate(poly);
+
+  EXPECT_EQ(indices.size(), 3);
+  EXPECT_EQ(indices[0], 0);
+  EXPECT_EQ(indices[1], 1);
+  EXPECT_EQ(indices[2], 2);
 }
 
 TEST(TriangulationTest, TriangulateWithIndices) {
-  BSPPolygon poly;
-  poly.vertices.resize(4);
+  std::vector<vertex_t> vertices(4);
   // Square
-  poly.vertices[0].xyz = {0, 0, 0};
-  poly.vertices[1].xyz = {1, 0, 0};
-  poly.vertices[2].xyz = {1, 1, 0};
-  poly.vertices[3].xyz = {0, 1, 0};
+  vertices[0].xyz = {0, 0, 0};
+  vertices[1].xyz = {1, 0, 0};
+  vertices[2].xyz = {1, 1, 0};
+  vertices[3].xyz = {0, 1, 0};
 
   // Provide explicit indices (e.g. 0, 1, 2 only - just one triangle)
-  poly.indices = {0, 1, 2};
+  std::vector<int> explicit_indices = {0, 1, 2};
+  BSPPolygon poly{.vertices = vertices, .indices = explicit_indices};
 
-  BSPMesh mesh = Triangulate(poly);
+  std::vector<int> indices = Triangulate(poly);
 
-  EXPECT_EQ(mesh.vertices.size(), 4);
-  EXPECT_EQ(mesh.indices.size(), 3);
-  EXPECT_EQ(mesh.indices[0], 0);
-  EXPECT_EQ(mesh.indices[1], 1);
-  EXPECT_EQ(mesh.indices[2], 2);
+  EXPECT_EQ(indices.size(), 3);
+  EXPECT_EQ(indices[0], 0);
+  EXPECT_EQ(indices[1], 1);
+  EXPECT_EQ(indices[2], 2);
 }
 
 TEST(TriangulationTest, NotEnoughVertices) {
-  BSPPolygon poly;
-  poly.vertices.resize(2);
-  BSPMesh mesh = Triangulate(poly);
+  std::vector<vertex_t> vertices(2);
+  BSPPolygon poly{.vertices = vertices};
+  std::vector<int> indices = Triangulate(poly);
 
-  EXPECT_EQ(mesh.vertices.size(), 2);
-  EXPECT_EQ(mesh.indices.size(), 0);
+  EXPECT_EQ(indices.size(), 0);
 }
 
-// Helper to create a flat 3x3 patch on XY plane
-BSPPatch CreateFlatPatch3x3() {
-  BSPPatch patch;
-  patch.width = 3;
-  patch.height = 3;
-  patch.control_points.resize(9);
+// Helper to create the control points of a flat 3x3 patch on XY plane
+std::vector<vertex_t> CreateFlatControlPoints3x3() {
+  std::vector<vertex_t> control_points(9);
 
   // 0 1 2
   // 3 4 5
@@ -91,19 +87,20 @@ BSPPatch CreateFlatPatch3x3() {
   for (int y = 0; y < 3; ++y) {
     for (int x = 0; x < 3; ++x) {
       int idx = y * 3 + x;
-      patch.control_points[idx].xyz = Eigen::Vector3f(x, y, 0);
-      patch.control_points[idx].st = Eigen::Vector2f(x / 2.0f, y / 2.0f);
-      patch.control_points[idx].normal = Eigen::Vector3f(0, 0, 1);
+      control_points[idx].xyz = Eigen::Vector3f(x, y, 0);
+      control_points[idx].st = Eigen::Vector2f(x / 2.0f, y / 2.0f);
+      control_points[idx].normal = Eigen::Vector3f(0, 0, 1);
     }
   }
-  return patch;
+  return control_points;
 }
 
 TEST(TriangulationTest, TriangulatePatchFlat) {
-  BSPPatch patch = CreateFlatPatch3x3();
+  std::vector<vertex_t> control_points = CreateFlatControlPoints3x3();
+  BSPPatch patch{3, 3, control_points};
   // 2 subdivisions -> 3x3 grid of vertices per 3x3 control grid (since it's 1
   // sub-patch) Grid width = 1 * 2 + 1 = 3
-  BSPMesh mesh = Triangulate(patch, 2);
+  TriangleMesh mesh = Triangulate(patch, 2);
 
   int expected_grid_width = 3;
   int expected_grid_height = 3;
@@ -120,12 +117,13 @@ TEST(TriangulationTest, TriangulatePatchFlat) {
 }
 
 TEST(TriangulationTest, TriangulatePatchCurve) {
-  BSPPatch patch = CreateFlatPatch3x3();
+  std::vector<vertex_t> control_points = CreateFlatControlPoints3x3();
   // Lift the center point (index 4)
-  patch.control_points[4].xyz.z() = 2.0f;
+  control_points[4].xyz.z() = 2.0f;
+  BSPPatch patch{3, 3, control_points};
 
   // 2 subdivisions
-  BSPMesh mesh = Triangulate(patch, 2);
+  TriangleMesh mesh = Triangulate(patch, 2);
 
   // Midpoint of quadratic bezier p0(0), p1(2), p2(0) => 0.25*0 + 0.5*2 + 0.25*0
   // = 1.0 (Row interpolation) Then vertical interpolation of 0, 1, 0 => 0.5*1 =
@@ -135,28 +133,117 @@ TEST(TriangulationTest, TriangulatePatchCurve) {
 
 TEST(TriangulationTest, TriangulatePatchGrid) {
   // 5x3 patch (2 sub-patches wide, 1 high)
-  BSPPatch patch;
-  patch.width = 5;
-  patch.height = 3;
-  patch.control_points.resize(15);
+  std::vector<vertex_t> control_points(15);
   // Fill with dummy data
-  for (auto& v : patch.control_points) {
+  for (auto& v : control_points) {
     v.xyz = Eigen::Vector3f::Zero();
   }
+  BSPPatch patch{5, 3, control_points};
 
   // 2 subdivisions
   // Grid Width = 2 * 2 + 1 = 5
   // Grid Height = 1 * 2 + 1 = 3
-  BSPMesh mesh = Triangulate(patch, 2);
+  TriangleMesh mesh = Triangulate(patch, 2);
 
   EXPECT_EQ(mesh.vertices.size(), 15);
 }
 
+TEST(TriangulationTest, TriangulatePatchInterpolatesAllChannels) {
+  std::vector<vertex_t> control_points = CreateFlatControlPoints3x3();
+  for (int i = 0; i < 9; ++i) {
+    control_points[i].lightmap = Eigen::Vector2f(i, 2 * i);
+    control_points[i].normal = Eigen::Vector3f(i % 3, 1, 1);
+    for (int c = 0; c < 4; ++c) {
+      control_points[i].color[c] = static_cast<uint8_t>(i * 30);
+    }
+  }
+  BSPPatch patch{3, 3, control_points};
+
+  TriangleMesh mesh = Triangulate(patch, 4);
+  ASSERT_EQ(mesh.vertices.size(), 25);
+
+  // (t_x, t_y) = (0.25, 0.5): the weights are the outer product of the
+  // quadratic basis at each coordinate.
+  const float bx[3] = {0.5625f, 0.375f, 0.0625f};
+  const float by[3] = {0.25f, 0.5f, 0.25f};
+  Eigen::Vector2f lightmap = Eigen::Vector2f::Zero();
+  Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+  float color = 0;
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      const vertex_t& cp = control_points[r * 3 + c];
+      lightmap += cp.lightmap * by[r] * bx[c];
+      normal += cp.normal * by[r] * bx[c];
+      color += cp.color[0] * by[r] * bx[c];
+    }
+  }
+
+  const vertex_t& v = mesh.vertices[2 * 5 + 1];
+  EXPECT_FLOAT_EQ(v.xyz.x(), 0.5f);
+  EXPECT_FLOAT_EQ(v.xyz.y(), 1.0f);
+  EXPECT_NEAR(v.lightmap.x(), lightmap.x(), 1e-5);
+  EXPECT_NEAR(v.lightmap.y(), lightmap.y(), 1e-5);
+  EXPECT_TRUE(v.normal.isApprox(normal.normalized(), 1e-5f));
+  EXPECT_EQ(v.color[3], static_cast<uint8_t>(std::lround(color)));
+
+  // The corners are the corner control points.
+  EXPECT_EQ(mesh.vertices[24].color[0], control_points[8].color[0]);
+}
+
+TEST(TriangulationTest, AdaptiveFlatPatchIsASingleQuad) {
+  std::vector<vertex_t> control_points = CreateFlatControlPoints3x3();
+  BSPPatch patch{3, 3, control_points};
+
+  TriangleMesh mesh = Triangulate(patch, PatchTessellation{.max_error = 0.5f});
+
+  EXPECT_EQ(mesh.vertices.size(), 4);
+  EXPECT_EQ(mesh.indices.size(), 6);
+}
+
+TEST(TriangulationTest, AdaptiveCurveIsWithinError) {
+  // A 5x3 patch: a flat sub-patch next to one arched along x.
+  std::vector<vertex_t> control_points(15);
+  for (int y = 0; y < 3; ++y) {
+    for (int x = 0; x < 5; ++x) {
+      control_points[y * 5 + x].xyz = Eigen::Vector3f(x * 64, y * 64, 0);
+      control_points[y * 5 + x].normal = Eigen::Vector3f(0, 0, 1);
+    }
+    control_points[y * 5 + 3].xyz.z() = 128;
+  }
+  BSPPatch patch{5, 3, control_points};
+
+  constexpr float kMaxError = 1.0f;
+  PatchGrid grid =
+      PlanPatchGrid(patch, PatchTessellation{.max_error = kMaxError});
+  EvaluatePatchGrid(patch, &grid);
+
+  // The flat sub-patch keeps its corners, the arch is subdivided and the
+  // rows, flat along y, are not.
+  ASSERT_GE(grid.width(), 4);
+  EXPECT_FLOAT_EQ(grid.columns[0], 0.0f);
+  EXPECT_FLOAT_EQ(grid.columns[1], 1.0f);
+  EXPECT_FLOAT_EQ(grid.columns.back(), 2.0f);
+  EXPECT_EQ(grid.height(), 2);
+  ASSERT_EQ(grid.vertices.size(), grid.width() * grid.height());
+
+  // The true arch is (x, z)(t) = (128 + 128 * t, 256 * (1 - t) * t) for t in
+  // [0, 1]: check the middle of every segment against the chord.
+  for (int x = 1; x + 1 < grid.width(); ++x) {
+    const float t = 0.5f * (grid.columns[x] + grid.columns[x + 1]) - 1;
+    const Eigen::Vector3f curve(128 + 128 * t, 0, 256 * (1 - t) * t);
+    const Eigen::Vector3f a = grid.vertices[x].xyz;
+    const Eigen::Vector3f chord = grid.vertices[x + 1].xyz - a;
+    const float error = chord.normalized().cross(curve - a).norm();
+    EXPECT_LE(error, kMaxError) << x;
+    EXPECT_GT(error, kMaxError / 16) << "oversubdivided at " << x;
+  }
+}
+
 TEST(TriangulationTest, InvalidPatch) {
   BSPPatch patch;
   patch.width = 2;  // Even width invalid
   patch.height = 3;
-  BSPMesh mesh = Triangulate(patch);
+  TriangleMesh mesh = Triangulate(patch);
   EXPECT_TRUE(mesh.vertices.empty());
 
   patch.width = 3;
@@ -0,0 +1,132 @@
+#include "vertex_quantization.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ioq3_map {
+namespace {
+
+constexpr float kInt8Max = 127.0f;
+constexpr float kInt16Max = 32767.0f;
+constexpr float kUint16Max = 65535.0f;
+
+// Rounds to the nearest integer of [-limit, limit].
+float QuantizeSnorm(float value, float limit) {
+  return std::clamp(std::round(value * limit), -limit, limit);
+}
+
+void UpdateMaxError(float error, float* max_error) {
+  if (max_error != nullptr) {
+    *max_error = std::max(*max_error, error);
+  }
+}
+
+}  // namespace
+
+PositionQuantization PositionQuantization::FromBounds(
+    const Eigen::Vector3f& min, const Eigen::Vector3f& max) {
+  PositionQuantization quantization;
+  quantization.offset = (min + max) / 2;
+  quantization.scale = ((max - min) / 2).maxCoeff();
+  if (!(quantization.scale > 0.0f)) {
+    quantization.scale = 1.0f;
+  }
+  return quantization;
+}
+
+Eigen::Affine3f PositionQuantization::Dequantization() const {
+  return Eigen::Translation3f(offset) * Eigen::Scaling(scale / kInt16Max);
+}
+
+Eigen::Vector3f PositionQuantization::Quantize(
+    const Eigen::Vector3f& position) const {
+  const Eigen::Vector3f unit = (position - offset) / scale;
+  return Eigen::Vector3f(QuantizeSnorm(unit.x(), kInt16Max),
+                         QuantizeSnorm(unit.y(), kInt16Max),
+                         QuantizeSnorm(unit.z(), kInt16Max));
+}
+
+QuantizationError& QuantizationError::operator+=(
+    const QuantizationError& other) {
+  position = std::max(position, other.position);
+  normal = std::max(normal, other.normal);
+  texture_uv = std::max(texture_uv, other.texture_uv);
+  lightmap_uv = std::max(lightmap_uv, other.lightmap_uv);
+  return *this;
+}
+
+std::vector<int16_t> QuantizePositions(
+    std::span<const Eigen::Vector3f> positions,
+    const PositionQuantization& quantization, float* max_error) {
+  const Eigen::Affine3f dequantization = quantization.Dequantization();
+  std::vector<int16_t> encoded;
+  encoded.reserve(positions.size() * 4);
+  for (const Eigen::Vector3f& p : positions) {
+    const Eigen::Vector3f q = quantization.Quantize(p);
+    encoded.insert(encoded.end(), {static_cast<int16_t>(q.x()),
+                                   static_cast<int16_t>(q.y()),
+                                   static_cast<int16_t>(q.z()), 0});
+    UpdateMaxError((dequantization * q - p).cwiseAbs().maxCoeff(), max_error);
+  }
+  return encoded;
+}
+
+std::vector<int8_t> QuantizeNormals(std::span<const Eigen::Vector3f> normals,
+                                    float* max_error) {
+  std::vector<int8_t> encoded;
+  encoded.reserve(normals.size() * 4);
+  for (const Eigen::Vector3f& n : normals) {
+    const Eigen::Vector3f q(QuantizeSnorm(n.x(), kInt8Max),
+                            QuantizeSnorm(n.y(), kInt8Max),
+                            QuantizeSnorm(n.z(), kInt8Max));
+    encoded.insert(encoded.end(),
+                   {static_cast<int8_t>(q.x()), static_cast<int8_t>(q.y()),
+                    static_cast<int8_t>(q.z()), 0});
+    UpdateMaxError((q / kInt8Max - n).cwiseAbs().maxCoeff(), max_error);
+  }
+  return encoded;
+}
+
+std::vector<int16_t> QuantizeTextureUvs(std::span<const Eigen::Vector2f> uvs,
+                                        float scale, float* max_error) {
+  std::vector<int16_t> encoded;
+  encoded.reserve(uvs.size() * 2);
+  for (const Eigen::Vector2f& uv : uvs) {
+    const Eigen::Vector2f q(QuantizeSnorm(uv.x() / scale, kInt16Max),
+                            QuantizeSnorm(uv.y() / scale, kInt16Max));
+    encoded.insert(encoded.end(),
+                   {static_cast<int16_t>(q.x()), static_cast<int16_t>(q.y())});
+    UpdateMaxError((q * (scale / kInt16Max) - uv).cwiseAbs().maxCoeff(),
+                   max_error);
+  }
+  return encoded;
+}
+
+std::vector<uint16_t> QuantizeLightmapUvs(std::span<const Eigen::Vector2f> uvs,
+                                          float* max_error) {
+  std::vector<uint16_t> encoded;
+  encoded.reserve(uvs.size() * 2);
+  for (const Eigen::Vector2f& uv : uvs) {
+    const Eigen::Vector2f q(
+        std::clamp(std::round(uv.x() * kUint16Max), 0.0f, kUint16Max),
+        std::clamp(std::round(uv.y() * kUint16Max), 0.0f, kUint16Max));
+    encoded.insert(encoded.end(), {static_cast<uint16_t>(q.x()),
+                                   static_cast<uint16_t>(q.y())});
+    UpdateMaxError((q / kUint16Max - uv).cwiseAbs().maxCoeff(), max_error);
+  }
+  return encoded;
+}
+
+float TextureUvScale(std::span<const Eigen::Vector2f> uvs) {
+  float bound = 0.0f;
+  for (const Eigen::Vector2f& uv : uvs) {
+    bound = std::max(bound, uv.cwiseAbs().maxCoeff());
+  }
+  float scale = 1.0f;
+  while (scale < bound) {
+    scale *= 2.0f;
+  }
+  return scale;
+}
+
+}  // namespace ioq3_map
@@ -0,0 +1,69 @@
+#ifndef IOQ3_MAP_VERTEX_QUANTIZATION_H_
+#define IOQ3_MAP_VERTEX_QUANTIZATION_H_
+
+#include <Eigen/Dense>  // IWYU pragma: keep
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace ioq3_map {
+
+// Fixed-point encodings of the vertex attributes, as KHR_mesh_quantization
+// allows them. Every vertex is padded to 4 bytes, as glTF requires of vertex
+// attribute strides.
+
+// Maps the positions of a node into normalized int16 components:
+//   p = offset + scale * q / 32767.
+// The scale is uniform, so the dequantization is a node transform that does
+// not change normals.
+struct PositionQuantization {
+  Eigen::Vector3f offset = Eigen::Vector3f::Zero();
+  float scale = 1.0f;
+
+  // Covers the box from `min` to `max`.
+  static PositionQuantization FromBounds(const Eigen::Vector3f& min,
+                                         const Eigen::Vector3f& max);
+
+  // The transform from quantized to original positions.
+  Eigen::Affine3f Dequantization() const;
+
+  Eigen::Vector3f Quantize(const Eigen::Vector3f& position) const;
+};
+
+// The largest error of the attributes encoded so far, in the units of the
+// attributes: meters, unit normal components, and texture repeats.
+struct QuantizationError {
+  float position = 0.0f;
+  float normal = 0.0f;
+  float texture_uv = 0.0f;
+  float lightmap_uv = 0.0f;
+
+  QuantizationError& operator+=(const QuantizationError& other);
+};
+
+// 4 normalized int16 per vertex, the last one 0.
+std::vector<int16_t> QuantizePositions(
+    std::span<const Eigen::Vector3f> positions,
+    const PositionQuantization& quantization, float* max_error = nullptr);
+
+// 4 normalized int8 per vertex, the last one 0.
+std::vector<int8_t> QuantizeNormals(std::span<const Eigen::Vector3f> normals,
+                                    float* max_error = nullptr);
+
+// 2 normalized int16 per vertex, of uv / scale. `scale` bounds the absolute
+// coordinates and is applied back by KHR_texture_transform.
+std::vector<int16_t> QuantizeTextureUvs(std::span<const Eigen::Vector2f> uvs,
+                                        float scale,
+                                        float* max_error = nullptr);
+
+// 2 normalized uint16 per vertex. The coordinates must be in [0, 1].
+std::vector<uint16_t> QuantizeLightmapUvs(std::span<const Eigen::Vector2f> uvs,
+                                          float* max_error = nullptr);
+
+// The smallest power of two, at least 1, that bounds the absolute texture
+// coordinates.
+float TextureUvScale(std::span<const Eigen::Vector2f> uvs);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_VERTEX_QUANTIZATION_H_
@@ -0,0 +1,73 @@
+#include "vertex_quantization.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace ioq3_map {
+namespace {
+
+TEST(VertexQuantizationTest, QuantizePositions) {
+  const std::vector<Eigen::Vector3f> positions = {
+      Eigen::Vector3f(-1, 2, 3), Eigen::Vector3f(3, 4, 3),
+      Eigen::Vector3f(1, 3, 3.5f)};
+  const PositionQuantization quantization = PositionQuantization::FromBounds(
+      Eigen::Vector3f(-1, 2, 3), Eigen::Vector3f(3, 4, 3.5f));
+  EXPECT_EQ(quantization.offset, Eigen::Vector3f(1, 3, 3.25f));
+  EXPECT_EQ(quantization.scale, 2.0f);
+
+  float max_error = 0.0f;
+  const std::vector<int16_t> encoded =
+      QuantizePositions(positions, quantization, &max_error);
+  ASSERT_EQ(encoded.size(), 12);
+  // The longest axis spans the whole range, the others keep the scale.
+  EXPECT_EQ(encoded[0], -32767);
+  EXPECT_EQ(encoded[1], -16384);
+  EXPECT_EQ(encoded[3], 0);
+  EXPECT_EQ(encoded[4], 32767);
+  EXPECT_EQ(encoded[8], 0);
+  EXPECT_EQ(encoded[9], 0);
+
+  // The dequantization transform recovers the positions.
+  const Eigen::Affine3f dequantization = quantization.Dequantization();
+  for (size_t i = 0; i < positions.size(); ++i) {
+    const Eigen::Vector3f q(encoded[i * 4], encoded[i * 4 + 1],
+                            encoded[i * 4 + 2]);
+    EXPECT_LT((dequantization * q - positions[i]).norm(), 1e-4f);
+  }
+  EXPECT_GT(max_error, 0.0f);
+  EXPECT_LE(max_error, 2.0f / 32767);
+}
+
+TEST(VertexQuantizationTest, QuantizeNormals) {
+  float max_error = 0.0f;
+  const std::vector<int8_t> encoded = QuantizeNormals(
+      std::vector<Eigen::Vector3f>{Eigen::Vector3f(0, 0, -1),
+                                   Eigen::Vector3f(0.6f, 0.8f, 0)},
+      &max_error);
+  EXPECT_EQ(encoded, (std::vector<int8_t>{0, 0, -127, 0, 76, 102, 0, 0}));
+  EXPECT_LE(max_error, 0.5f / 127);
+}
+
+TEST(VertexQuantizationTest, QuantizeUvs) {
+  const std::vector<Eigen::Vector2f> uvs = {Eigen::Vector2f(-3, 0.5f),
+                                            Eigen::Vector2f(1, 0)};
+  EXPECT_EQ(TextureUvScale(uvs), 4.0f);
+  EXPECT_EQ(TextureUvScale(std::vector<Eigen::Vector2f>{}), 1.0f);
+
+  float texture_error = 0.0f;
+  EXPECT_EQ(QuantizeTextureUvs(uvs, 4.0f, &texture_error),
+            (std::vector<int16_t>{-24575, 4096, 8192, 0}));
+  EXPECT_LE(texture_error, 2.0f / 32767);
+
+  float lightmap_error = 0.0f;
+  EXPECT_EQ(QuantizeLightmapUvs(std::vector<Eigen::Vector2f>{
+                                    Eigen::Vector2f(0, 1),
+                                    Eigen::Vector2f(0.5f, 1.0001f)},
+                                &lightmap_error),
+            (std::vector<uint16_t>{0, 65535, 32768, 65535}));
+  EXPECT_LE(lightmap_error, 1e-4f + 1e-6f);
+}
+
+}  // namespace
+}  // namespace ioq3_map
@@ -0,0 +1,148 @@
+#include "vertex_welding.h"
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace ioq3_map {
+namespace {
+
+using CellKey = std::array<int64_t, 3>;
+
+struct CellKeyHash {
+  size_t operator()(const CellKey& key) const {
+    // Large primes, as in Teschner et al. 2003.
+    return static_cast<size_t>(static_cast<uint64_t>(key[0]) * 73856093u ^
+                               static_cast<uint64_t>(key[1]) * 19349663u ^
+                               static_cast<uint64_t>(key[2]) * 83492791u);
+  }
+};
+
+// The cell of a position. Without a position epsilon, only bit-identical
+// positions share a cell.
+CellKey Cell(const Eigen::Vector3f& p, float position_epsilon) {
+  if (position_epsilon <= 0.0f) {
+    return {std::bit_cast<int32_t>(p.x()), std::bit_cast<int32_t>(p.y()),
+            std::bit_cast<int32_t>(p.z())};
+  }
+  return {static_cast<int64_t>(std::floor(p.x() / position_epsilon)),
+          static_cast<int64_t>(std::floor(p.y() / position_epsilon)),
+          static_cast<int64_t>(std::floor(p.z() / position_epsilon))};
+}
+
+template <typename Vector>
+bool Near(const std::vector<Vector>& attribute, uint32_t a, uint32_t b,
+          float epsilon) {
+  return attribute.empty() ||
+         (attribute[a] - attribute[b]).cwiseAbs().maxCoeff() <= epsilon;
+}
+
+bool CanWeld(const Geometry& geo, const WeldOptions& options, uint32_t a,
+             uint32_t b) {
+  return Near(geo.vertices, a, b, options.position_epsilon) &&
+         Near(geo.normals, a, b, options.normal_epsilon) &&
+         Near(geo.texture_uvs, a, b, options.uv_epsilon) &&
+         Near(geo.lightmap_uvs, a, b, options.uv_epsilon);
+}
+
+// Keeps the attribute values of the kept vertices.
+template <typename Vector>
+void Compact(const std::vector<uint32_t>& kept,
+             std::vector<Vector>* attribute) {
+  if (attribute->empty()) {
+    return;
+  }
+  std::vector<Vector> compacted;
+  compacted.reserve(kept.size());
+  for (uint32_t v : kept) {
+    compacted.push_back((*attribute)[v]);
+  }
+  *attribute = std::move(compacted);
+}
+
+}  // namespace
+
+WeldStats& WeldStats::operator+=(const WeldStats& other) {
+  vertices_before += other.vertices_before;
+  vertices_after += other.vertices_after;
+  triangles_before += other.triangles_before;
+  triangles_after += other.triangles_after;
+  return *this;
+}
+
+WeldStats WeldVertices(const WeldOptions& options, Geometry* geometry,
+                       std::vector<bool>* kept_triangles) {
+  Geometry& geo = *geometry;
+  WeldStats stats;
+  stats.vertices_before = geo.vertices.size();
+  stats.triangles_before = geo.indices.size() / 3;
+
+  // Kept vertices by cell, and the kept vertex of every vertex.
+  std::unordered_map<CellKey, std::vector<uint32_t>, CellKeyHash> cells;
+  cells.reserve(geo.vertices.size());
+  std::vector<uint32_t> kept;
+  std::vector<uint32_t> remap(geo.vertices.size());
+  const int radius = options.position_epsilon > 0.0f ? 1 : 0;
+  for (uint32_t v = 0; v < geo.vertices.size(); ++v) {
+    const CellKey cell = Cell(geo.vertices[v], options.position_epsilon);
+
+    // The first welding candidate in the order the vertices were kept.
+    uint32_t match = UINT32_MAX;
+    for (int dx = -radius; dx <= radius; ++dx) {
+      for (int dy = -radius; dy <= radius; ++dy) {
+        for (int dz = -radius; dz <= radius; ++dz) {
+          auto it = cells.find({cell[0] + dx, cell[1] + dy, cell[2] + dz});
+          if (it == cells.end()) {
+            continue;
+          }
+          for (uint32_t k : it->second) {
+            if (remap[k] < match && CanWeld(geo, options, v, k)) {
+              match = remap[k];
+              break;
+            }
+          }
+        }
+      }
+    }
+
+    if (match == UINT32_MAX) {
+      match = static_cast<uint32_t>(kept.size());
+      kept.push_back(v);
+      cells[cell].push_back(v);
+    }
+    remap[v] = match;
+  }
+
+  Compact(kept, &geo.vertices);
+  Compact(kept, &geo.normals);
+  Compact(kept, &geo.texture_uvs);
+  Compact(kept, &geo.lightmap_uvs);
+
+  std::vector<uint32_t> indices;
+  indices.reserve(geo.indices.size());
+  if (kept_triangles != nullptr) {
+    kept_triangles->assign(geo.indices.size() / 3, false);
+  }
+  for (size_t i = 0; i + 2 < geo.indices.size(); i += 3) {
+    const uint32_t a = remap[geo.indices[i]];
+    const uint32_t b = remap[geo.indices[i + 1]];
+    const uint32_t c = remap[geo.indices[i + 2]];
+    if (a == b || b == c || c == a) {
+      continue;
+    }
+    indices.insert(indices.end(), {a, b, c});
+    if (kept_triangles != nullptr) {
+      (*kept_triangles)[i / 3] = true;
+    }
+  }
+  geo.indices = std::move(indices);
+
+  stats.vertices_after = geo.vertices.size();
+  stats.triangles_after = geo.indices.size() / 3;
+  return stats;
+}
+
+}  // namespace ioq3_map
@@ -0,0 +1,46 @@
+#ifndef IOQ3_MAP_VERTEX_WELDING_H_
+#define IOQ3_MAP_VERTEX_WELDING_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "scene.h"
+
+namespace ioq3_map {
+
+// How close two vertices must be to be welded. Every attribute of the two
+// vertices must be within its epsilon, per component. Positions are in scene
+// units, i.e. meters.
+struct WeldOptions {
+  float position_epsilon = 1e-4f;
+  float normal_epsilon = 1e-3f;
+  // Both texture and lightmap coordinates.
+  float uv_epsilon = 1e-4f;
+};
+
+struct WeldStats {
+  size_t vertices_before = 0;
+  size_t vertices_after = 0;
+  size_t triangles_before = 0;
+  size_t triangles_after = 0;
+
+  WeldStats& operator+=(const WeldStats& other);
+};
+
+// Merges the vertices of the geometry that are within the epsilons of each
+// other, e.g. the seams between the sub-patches of a tessellated patch or the
+// shared edges of planar faces, and remaps the indices. The first of a group
+// of welded vertices is kept, so the result does not depend on hashing.
+// Triangles that collapse are removed.
+//
+// Candidates are found through a spatial hash with cells of the position
+// epsilon, so only the neighbouring cells of a vertex are searched.
+//
+// If `kept_triangles` is set, it receives whether each triangle of the
+// original indices was kept.
+WeldStats WeldVertices(const WeldOptions& options, Geometry* geometry,
+                       std::vector<bool>* kept_triangles = nullptr);
+
+}  // namespace ioq3_map
+
+#endif  // IOQ3_MAP_VERTEX_WELDING_H_
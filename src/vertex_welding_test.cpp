@@ -0,0 +1,82 @@
+#include "vertex_welding.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "scene.h"
+
+namespace ioq3_map {
+namespace {
+
+// Two triangles of a quad that do not share their diagonal vertices.
+Geometry CreateUnweldedQuad() {
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(1, 1, 0), Eigen::Vector3f(0, 0, 0),
+                  Eigen::Vector3f(1, 1, 0), Eigen::Vector3f(0, 1, 0)};
+  geo.normals.assign(6, Eigen::Vector3f::UnitZ());
+  geo.texture_uvs = {Eigen::Vector2f(0, 0), Eigen::Vector2f(1, 0),
+                     Eigen::Vector2f(1, 1), Eigen::Vector2f(0, 0),
+                     Eigen::Vector2f(1, 1), Eigen::Vector2f(0, 1)};
+  geo.indices = {0, 1, 2, 3, 4, 5};
+  return geo;
+}
+
+TEST(VertexWeldingTest, WeldsDuplicateVertices) {
+  Geometry geo = CreateUnweldedQuad();
+  // Within the epsilon.
+  geo.vertices[4] += Eigen::Vector3f(1e-5f, 0, 0);
+
+  const WeldStats stats = WeldVertices(WeldOptions(), &geo);
+  EXPECT_EQ(stats.vertices_before, 6);
+  EXPECT_EQ(stats.vertices_after, 4);
+  EXPECT_EQ(stats.triangles_before, 2);
+  EXPECT_EQ(stats.triangles_after, 2);
+
+  // The first vertex of each group is kept, in order.
+  ASSERT_EQ(geo.vertices.size(), 4);
+  EXPECT_EQ(geo.vertices[2], Eigen::Vector3f(1, 1, 0));
+  EXPECT_EQ(geo.vertices[3], Eigen::Vector3f(0, 1, 0));
+  EXPECT_EQ(geo.normals.size(), 4);
+  EXPECT_EQ(geo.texture_uvs.size(), 4);
+  EXPECT_EQ(geo.indices, (std::vector<uint32_t>{0, 1, 2, 0, 2, 3}));
+}
+
+TEST(VertexWeldingTest, KeepsSeamsOfOtherAttributes) {
+  Geometry geo = CreateUnweldedQuad();
+  // A texture seam along the diagonal.
+  geo.texture_uvs[3] = Eigen::Vector2f(0.5f, 0.5f);
+  // A crease.
+  geo.normals[4] = Eigen::Vector3f::UnitX();
+
+  const WeldStats stats = WeldVertices(WeldOptions(), &geo);
+  EXPECT_EQ(stats.vertices_after, 6);
+  EXPECT_EQ(geo.indices, (std::vector<uint32_t>{0, 1, 2, 3, 4, 5}));
+}
+
+TEST(VertexWeldingTest, RemovesCollapsedTriangles) {
+  Geometry geo;
+  geo.vertices = {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 0, 0),
+                  Eigen::Vector3f(0, 1, 0), Eigen::Vector3f(1, 0, 5e-5f)};
+  geo.indices = {0, 1, 2, 0, 1, 3};
+
+  std::vector<bool> kept_triangles;
+  const WeldStats stats = WeldVertices(WeldOptions(), &geo, &kept_triangles);
+  EXPECT_EQ(stats.vertices_after, 3);
+  EXPECT_EQ(stats.triangles_after, 1);
+  EXPECT_EQ(geo.indices, (std::vector<uint32_t>{0, 1, 2}));
+  EXPECT_EQ(kept_triangles, (std::vector<bool>{true, false}));
+}
+
+TEST(VertexWeldingTest, ExactWeldingWithoutEpsilon) {
+  Geometry geo = CreateUnweldedQuad();
+  geo.vertices[4] += Eigen::Vector3f(1e-5f, 0, 0);
+
+  const WeldStats stats =
+      WeldVertices(WeldOptions{.position_epsilon = 0.0f}, &geo);
+  EXPECT_EQ(stats.vertices_after, 5);
+}
+
+}  // namespace
+}  // namespace ioq3_map